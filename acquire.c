@@ -0,0 +1,1603 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#define _GNU_SOURCE     // fallocate, vmsplice
+
+#include "acquire.h"
+#include "compress.h"
+#include "merkle.h"
+#include "zeropage.h"
+#include "uvm.h"
+#include "uvm_async.h"
+#include "throttle.h"
+#include "journal.h"
+#include "diskwrite.h"
+#include "common-utils.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Completions taken from the dump queue at a time
+#define ACQUIRE_REAP_BATCH 8
+
+// How often a writer out of slots checks whether the pipe reader caught up
+#define ACQUIRE_SPLICE_POLL_US 100
+
+typedef enum {
+    SLOT_FREE,        // may be handed to the copy thread
+    SLOT_COPYING,     // dump submitted, not yet published
+    SLOT_FULL,        // holds a copied chunk
+    SLOT_PROCESSING,  // claimed by a hashing/compression worker
+    SLOT_READY,       // processed and waiting to be written
+    SLOT_SPLICED,     // written with vmsplice, the pipe still holds the pages
+    SLOT_WRITING      // handed to the DiskWriter, not yet reaped
+} AcquireSlotState;
+
+typedef struct {
+    void              *buf;
+    unsigned long long gpuOffset;
+    NvLength           len;
+    NvU64              chunk;     // index of the chunk held by the slot
+    int                copied;    // all dumps into buf completed
+    NvLength           submitted; // bytes of the chunk submitted so far
+    unsigned int       parts;     // dumps into buf still in flight
+    int                failed;    // a dump into buf hit bad pages, and
+                                  // after bisection: buf holds filled ones
+    void              *out;       // compressed frame, when compressing
+    NvLength           outLen;
+    ImageIndexEntry    entry;     // how the chunk is stored, for images
+    NvU64              pipeEnd;   // bytes spliced up to the end of the chunk
+    unsigned int       writes;    // DiskWriter writes of the chunk not reaped
+    AcquireSlotState   state;
+} AcquireSlot;
+
+typedef struct {
+    const AcquireParams *params;
+    AcquireSlot         *slots;
+    unsigned int         depth;
+    NvU64                numChunks;
+    NvLength             outCapacity;
+
+    pthread_mutex_t      lock;
+    pthread_cond_t       cond;
+    RM_STATUS            copyStatus;
+    RM_STATUS            processStatus;
+    int                  copyDone;
+    int                  abort;
+    NvU64                chunksCopied;
+    NvU64                nextProcess;
+    NvLength             bytesCopied;
+    NvU64                copyNs;
+    NvU64                throttleNs;
+    NvU64                calls;
+    NvLength             maxCallBytes;
+    TokenBucket          bucket;
+    CallSizer            sizer;
+    NvU64                physRuns;     // 0 once any chunk's are unknown
+    NvU64                physRunsMax;
+    int                  physRunsUnknown;
+    NvU64                badPages;
+    NvU64                bisectCalls;
+    NvU64                hashNs;
+    NvU64                compressNs;
+} AcquireRing;
+
+NvU64 acquireNowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (NvU64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void acquireParamsInit(AcquireParams *params) {
+    memset(params, 0, sizeof(*params));
+    params->chunkBytes = ACQUIRE_DEFAULT_CHUNK_BYTES;
+    params->depth      = ACQUIRE_DEFAULT_DEPTH;
+    params->outFd      = -1;
+}
+
+//
+// Publishes chunks whose dumps completed, in chunk order, so chunksCopied and
+// bytesCopied always describe a prefix of the range.  Called with the ring
+// lock held.
+//
+static void acquirePublishLocked(AcquireRing *ring) {
+    for (;;) {
+        AcquireSlot *slot = &ring->slots[ring->chunksCopied % ring->depth];
+
+        if (slot->state != SLOT_COPYING || slot->chunk != ring->chunksCopied ||
+            !slot->copied)
+            break;
+
+        slot->state = SLOT_FULL;
+        ring->bytesCopied += slot->len;
+        ring->chunksCopied++;
+    }
+}
+
+// Sleeps until the bucket has the bytes of the next call.
+static void acquirePace(TokenBucket *bucket, NvLength bytes,
+                        NvU64 *throttleNs) {
+    NvU64 now = acquireNowNs();
+    NvU64 until = tokenBucketTake(bucket, bytes, now);
+    struct timespec ts;
+
+    if (until <= now)
+        return;
+
+    ts.tv_sec  = until / 1000000000ull;
+    ts.tv_nsec = until % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+    *throttleNs += until - now;
+}
+
+// Failures that are confined to the pages they happen on.
+static int acquireIsPageError(RM_STATUS rmStatus) {
+    return rmStatus == RM_ERR_ECC_ERROR || rmStatus == RM_ERR_INVALID_ADDRESS;
+}
+
+static void acquireBadPagesAdd(AcquireBadPages *badPages,
+                               unsigned long long gpuOffset, NvLength length,
+                               RM_STATUS status) {
+    AcquireBadRange *last = badPages->count ?
+                            &badPages->ranges[badPages->count - 1] : NULL;
+
+    if (last && last->status == status &&
+        last->gpuOffset + last->length == gpuOffset) {
+        last->length += length;
+        return;
+    }
+
+    if (badPages->count == badPages->capacity) {
+        badPages->capacity = badPages->capacity ? 2 * badPages->capacity : 16;
+        badPages->ranges   = nvrealloc(badPages->ranges, badPages->capacity *
+                                       sizeof(AcquireBadRange));
+    }
+    last = &badPages->ranges[badPages->count++];
+    last->gpuOffset = gpuOffset;
+    last->length    = length;
+    last->status    = status;
+}
+
+static int acquireBadRangeCompare(const void *a, const void *b) {
+    const AcquireBadRange *x = a, *y = b;
+
+    return x->gpuOffset < y->gpuOffset ? -1 : x->gpuOffset > y->gpuOffset;
+}
+
+// Chunks complete out of order, so their bad pages are sorted afterwards.
+static void acquireBadPagesSort(AcquireBadPages *badPages) {
+    unsigned int count = badPages->count, i;
+
+    qsort(badPages->ranges, count, sizeof(AcquireBadRange),
+          acquireBadRangeCompare);
+    badPages->count = 0;
+    for (i = 0; i < count; i++) {
+        AcquireBadRange r = badPages->ranges[i];
+        acquireBadPagesAdd(badPages, r.gpuOffset, r.length, r.status);
+    }
+}
+
+void acquireBadPagesFree(AcquireBadPages *badPages) {
+    nvfree(badPages->ranges);
+    memset(badPages, 0, sizeof(*badPages));
+}
+
+//
+// Dumps [gpuOffset, gpuOffset+len) into buf around the pages that fail with
+// a page error, halving the range until they are isolated.  failing says
+// the whole range is already known to fail, so only its halves are tried.
+// When the left half turns out clean the failure must be in the right one,
+// which saves its call too, so one bad page takes at most two calls per
+// halving.  Returns the first error that is not a page error.
+//
+static RM_STATUS acquireBisect(AcquireRing *ring, char *buf,
+                               unsigned long long gpuOffset, NvLength len,
+                               NvLength pageSize, int failing) {
+    const AcquireParams *params = ring->params;
+    RM_STATUS rmStatus;
+    NvLength half;
+    NvU64 badBefore, start;
+    NvLength i;
+
+    // A single page is always tried again, the failure may have passed.
+    if (!failing || len <= pageSize) {
+        acquirePace(&ring->bucket, len, &ring->throttleNs);
+        start = acquireNowNs();
+        rmStatus = UvmDumpGpuMemoryEx(params->gpuUuid, buf, gpuOffset, len,
+                                      params->blockBytes, 0);
+        ring->copyNs += acquireNowNs() - start;
+        ring->calls++;
+        ring->bisectCalls++;
+
+        if (rmStatus == RM_OK || !acquireIsPageError(rmStatus))
+            return rmStatus;
+
+        if (len <= pageSize) {
+            for (i = 0; i < len; i++)
+                buf[i] = ACQUIRE_BAD_PAGE_FILL[i % 8];
+            acquireBadPagesAdd(params->badPages, gpuOffset, len, rmStatus);
+            ring->badPages++;
+            return RM_OK;
+        }
+    }
+
+    half = (len / 2 + pageSize - 1) / pageSize * pageSize;
+    badBefore = ring->badPages;
+
+    rmStatus = acquireBisect(ring, buf, gpuOffset, half, pageSize, 0);
+    if (rmStatus != RM_OK)
+        return rmStatus;
+
+    return acquireBisect(ring, buf + half, gpuOffset + half, len - half,
+                         pageSize, ring->badPages == badBefore);
+}
+
+//
+// Keeps up to depth dumps queued on the GPU: every free slot gets the next
+// chunk submitted into it, and completions are reaped as they arrive.  Only
+// when nothing is in flight does the thread wait for the writer to free a
+// slot.
+//
+// A chunk is submitted as one dump unless a latency budget splits it into
+// calls sized by ring->sizer, which then go out one at a time.  Every call
+// is paced by ring->bucket.  With badPages set, chunks that hit bad pages
+// are bisected here once all their dumps are in.
+//
+static void *acquireCopyThread(void *arg) {
+    AcquireRing *ring = arg;
+    const AcquireParams *params = ring->params;
+    UvmDumpCompletion done[ACQUIRE_REAP_BATCH];
+    AcquireSlot *bisect[ACQUIRE_REAP_BATCH];
+    const NvLength pageSize = sysconf(_SC_PAGE_SIZE);
+    UvmDumpQueue *queue = NULL;
+    unsigned int inFlight = 0, numBisect, n, c;
+    NvU64 next = 0, start, callStart = 0;
+    NvLength callBytes = 0;
+    RM_STATUS rmStatus;
+
+    rmStatus = UvmDumpQueueCreate(NV_MIN(ring->depth,
+                                         UVM_DUMP_QUEUE_MAX_IN_FLIGHT),
+                                  &queue);
+
+    pthread_mutex_lock(&ring->lock);
+    if (rmStatus != RM_OK)
+        ring->copyStatus = rmStatus;
+
+    for (;;) {
+        AcquireSlot *slot = &ring->slots[next % ring->depth];
+        int stop = ring->abort || ring->copyStatus != RM_OK ||
+                   next == ring->numChunks;
+        int paced = params->maxCallNs && inFlight;
+        int partial = slot->state == SLOT_COPYING && slot->chunk == next;
+
+        if (!stop && !paced && (slot->state == SLOT_FREE || partial)) {
+            UvmDumpTicket ticket;
+            NvLength len;
+            void *buf;
+
+            if (!partial) {
+                NvLength offset = next * params->chunkBytes;
+
+                slot->gpuOffset = params->baseAddress + offset;
+                slot->len       = NV_MIN(params->chunkBytes,
+                                         params->sizeBytes - offset);
+                slot->chunk     = next;
+                slot->copied    = 0;
+                slot->submitted = 0;
+                slot->parts     = 0;
+                slot->failed    = 0;
+                slot->state     = SLOT_COPYING;
+            }
+            len = NV_MIN(ring->sizer.callBytes, slot->len - slot->submitted);
+            buf = (char *)slot->buf + slot->submitted;
+            pthread_mutex_unlock(&ring->lock);
+
+            if (!partial && !ring->physRunsUnknown) {
+                NvU64 runs = stagingPhysRuns(slot->buf, slot->len, 0);
+
+                ring->physRuns   += runs;
+                ring->physRunsMax = NV_MAX(ring->physRunsMax, runs);
+                ring->physRunsUnknown = runs == 0;
+            }
+
+            acquirePace(&ring->bucket, len, &ring->throttleNs);
+
+            start = acquireNowNs();
+            rmStatus = UvmDumpSubmit(queue, params->gpuUuid, buf,
+                                     slot->gpuOffset + slot->submitted, len,
+                                     params->blockBytes, 0,
+                                     (void *)(uintptr_t)next, &ticket);
+            ring->copyNs += acquireNowNs() - start;
+            callStart = start;
+            callBytes = len;
+
+            pthread_mutex_lock(&ring->lock);
+            if (rmStatus != RM_OK) {
+                if (!partial)
+                    slot->state = SLOT_FREE;
+                ring->copyStatus = rmStatus;
+            } else {
+                inFlight++;
+                slot->parts++;
+                slot->submitted += len;
+                ring->calls++;
+                ring->maxCallBytes = NV_MAX(ring->maxCallBytes, len);
+                if (slot->submitted == slot->len)
+                    next++;
+            }
+            continue;
+        }
+
+        if (inFlight) {
+            pthread_mutex_unlock(&ring->lock);
+
+            start = acquireNowNs();
+            n = UvmDumpReap(queue, done, ACQUIRE_REAP_BATCH, 1);
+            ring->copyNs += acquireNowNs() - start;
+
+            // Calls under a latency budget run alone, so this is their time.
+            if (params->maxCallNs)
+                callSizerUpdate(&ring->sizer, callBytes,
+                                acquireNowNs() - callStart);
+
+            pthread_mutex_lock(&ring->lock);
+            numBisect = 0;
+            for (c = 0; c < n; c++) {
+                NvU64 chunk = (NvU64)(uintptr_t)done[c].userData;
+                AcquireSlot *doneSlot = &ring->slots[chunk % ring->depth];
+
+                doneSlot->parts--;
+                if (done[c].status != RM_OK &&
+                    !(params->badPages && acquireIsPageError(done[c].status))) {
+                    if (ring->copyStatus == RM_OK)
+                        ring->copyStatus = done[c].status;
+                    continue;
+                }
+                if (done[c].status != RM_OK)
+                    doneSlot->failed = 1;
+                if (doneSlot->parts == 0 &&
+                    doneSlot->submitted == doneSlot->len) {
+                    if (doneSlot->failed)
+                        bisect[numBisect++] = doneSlot;
+                    else
+                        doneSlot->copied = 1;
+                }
+            }
+            inFlight -= n;
+
+            // The slots stay SLOT_COPYING, so nobody else touches them.
+            for (c = 0; c < numBisect; c++) {
+                AcquireSlot *badSlot = bisect[c];
+                NvU64 badBefore = ring->badPages;
+
+                if (ring->copyStatus != RM_OK)
+                    break;
+                pthread_mutex_unlock(&ring->lock);
+                rmStatus = acquireBisect(ring, badSlot->buf,
+                                         badSlot->gpuOffset, badSlot->len,
+                                         pageSize, 1);
+                pthread_mutex_lock(&ring->lock);
+                if (rmStatus != RM_OK && ring->copyStatus == RM_OK)
+                    ring->copyStatus = rmStatus;
+                badSlot->copied = rmStatus == RM_OK;
+                badSlot->failed = ring->badPages != badBefore;
+            }
+            acquirePublishLocked(ring);
+            pthread_cond_broadcast(&ring->cond);
+            continue;
+        }
+
+        if (stop)
+            break;
+
+        pthread_cond_wait(&ring->cond, &ring->lock);
+    }
+
+    //
+    // Chunks copied before a failure still go through the rest of the
+    // pipeline; everyone else stops once they reach chunksCopied.
+    //
+    ring->copyDone = 1;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+
+    UvmDumpQueueDestroy(queue);
+
+    return NULL;
+}
+
+// Waits for chunk i to reach state.  Returns 0 if it never will.
+static int acquireWaitChunk(AcquireRing *ring, NvU64 i,
+                            AcquireSlotState state) {
+    AcquireSlot *slot = &ring->slots[i % ring->depth];
+
+    while (!(slot->state == state && slot->chunk == i)) {
+        if (ring->abort || (ring->copyDone && i >= ring->chunksCopied))
+            return 0;
+        pthread_cond_wait(&ring->cond, &ring->lock);
+    }
+
+    return 1;
+}
+
+//
+// Hashes and/or compresses copied chunks.  Hashing always sees the raw chunk,
+// so the digests describe the image whether or not it is stored compressed.
+//
+static void *acquireProcessThread(void *arg) {
+    AcquireRing *ring = arg;
+    const AcquireParams *params = ring->params;
+    CompressContext *ctx = NULL;
+    int ok = 1;
+
+    if (params->compression != COMPRESS_NONE) {
+        ctx = compressContextCreate(params->compression, params->compressLevel);
+        ok = ctx != NULL;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+
+    if (!ok) {
+        nv_error_msg("Failed to create a %s context.\n",
+                     compressAlgorithmName(params->compression));
+        ring->processStatus = RM_ERR_NO_MEMORY;
+        ring->abort = 1;
+        pthread_cond_broadcast(&ring->cond);
+    }
+
+    // Workers claim chunks in order so the writer is never starved.
+    while (ok && ring->nextProcess < ring->numChunks) {
+        NvU64 i = ring->nextProcess++;
+        AcquireSlot *slot = &ring->slots[i % ring->depth];
+        NvU64 hashNs = 0, compressNs = 0, start;
+
+        if (!acquireWaitChunk(ring, i, SLOT_FULL))
+            break;
+
+        slot->state = SLOT_PROCESSING;
+        pthread_mutex_unlock(&ring->lock);
+
+        if (params->hash != HASH_NONE) {
+            start = acquireNowNs();
+            hashBuffer(params->hash, slot->buf, slot->len,
+                       merkleLeaf(params->merkle, i));
+            hashNs = acquireNowNs() - start;
+        }
+
+        if (params->image) {
+            ImageIndexEntry *e = &slot->entry;
+
+            start = acquireNowNs();
+            memset(e, 0, sizeof(*e));
+            e->kind   = imageChunkClassify(slot->buf, slot->len, &e->value);
+            e->crc    = hashCrc32c(0, slot->buf, slot->len);
+            e->length = slot->len;
+            hashNs += acquireNowNs() - start;
+        }
+
+        // Image chunks that are a repeated value need no compressing.
+        if (ctx && (!params->image ||
+                    slot->entry.kind == IMAGE_CHUNK_RAW)) {
+            start = acquireNowNs();
+            slot->outLen = compressChunk(ctx, slot->out, ring->outCapacity,
+                                         slot->buf, slot->len);
+            compressNs = acquireNowNs() - start;
+            ok = slot->outLen != 0;
+
+            // Images keep the raw bytes when compressing does not help.
+            if (ok && params->image && slot->outLen < slot->len) {
+                slot->entry.kind = params->compression == COMPRESS_ZSTD ?
+                                   IMAGE_CHUNK_ZSTD : IMAGE_CHUNK_LZ4;
+            }
+        }
+
+        pthread_mutex_lock(&ring->lock);
+        ring->hashNs     += hashNs;
+        ring->compressNs += compressNs;
+        if (!ok) {
+            ring->processStatus = RM_ERROR;
+            ring->abort = 1;
+        } else {
+            slot->state = SLOT_READY;
+        }
+        pthread_cond_broadcast(&ring->cond);
+    }
+
+    pthread_mutex_unlock(&ring->lock);
+    compressContextDestroy(ctx);
+
+    return NULL;
+}
+
+// Streams are written in order, so offset only matters for files.
+static int acquireWriteAll(const AcquireParams *params, const void *buf,
+                           NvLength len, unsigned long long offset) {
+    const char *p = buf;
+
+    while (len) {
+        ssize_t ret = params->stream ? write(params->outFd, p, len) :
+                                       pwrite(params->outFd, p, len, offset);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p      += ret;
+        len    -= ret;
+        offset += ret;
+    }
+
+    return 0;
+}
+
+//
+// Hands buf to the pipe outFd with vmsplice.  The pipe then refers to the
+// staging pages instead of a copy of them, so they must not be reused until
+// the reader has consumed them (see acquireReleaseSpliced).  A reader that
+// moves them on with splice() or tee() still holds them after that, which
+// is why params->splice is only an opt-in.
+//
+static int acquireSplice(int fd, const void *buf, NvLength len) {
+    struct iovec iov;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len  = len;
+    while (iov.iov_len) {
+        ssize_t ret = vmsplice(fd, &iov, 1, 0);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        iov.iov_base = (char *)iov.iov_base + ret;
+        iov.iov_len -= ret;
+    }
+
+    return 0;
+}
+
+//
+// Frees the spliced slots whose chunks the pipe reader has consumed, i.e.
+// the pipe holds no more than the bytes spliced after them.  With waitFor
+// set, polls until that slot is free as well.  Returns -1 if the pipe can
+// no longer be asked, in which case no slot is freed.
+//
+static int acquireReleaseSpliced(AcquireRing *ring, int fd, NvU64 spliced,
+                                 const AcquireSlot *waitFor) {
+    for (;;) {
+        int inPipe, released = 0, done;
+        unsigned int s;
+
+        if (ioctl(fd, FIONREAD, &inPipe)) {
+            nv_error_msg("Failed to query the output pipe: %s.\n",
+                         strerror(errno));
+            return -1;
+        }
+
+        pthread_mutex_lock(&ring->lock);
+        for (s = 0; s < ring->depth; s++) {
+            AcquireSlot *slot = &ring->slots[s];
+
+            if (slot->state == SLOT_SPLICED &&
+                slot->pipeEnd + inPipe <= spliced) {
+                slot->state = SLOT_FREE;
+                released = 1;
+            }
+        }
+        if (released)
+            pthread_cond_broadcast(&ring->cond);
+        done = !waitFor || waitFor->state != SLOT_SPLICED;
+        pthread_mutex_unlock(&ring->lock);
+
+        if (done)
+            return 0;
+        usleep(ACQUIRE_SPLICE_POLL_US);
+    }
+}
+
+//
+// Accounts for a chunk that reached the output and moves its slot to next:
+// free, or spliced while the pipe still holds it.  Chunks holding filled
+// bad pages stay out of the journal, so a resumed dump tries them again and
+// lists their bad pages anew.  Returns RM_ERROR if the journal could not be
+// updated.
+//
+static RM_STATUS acquireChunkWritten(AcquireRing *ring, AcquireStats *stats,
+                                     AcquireSlot *slot,
+                                     AcquireSlotState next) {
+    const AcquireParams *params = ring->params;
+    RM_STATUS rmStatus = RM_OK;
+
+    if (params->journal && !slot->failed &&
+        journalAppend(params->journal,
+                      (slot->gpuOffset - params->journal->header.baseAddress) /
+                      params->chunkBytes, slot->buf)) {
+        nv_error_msg("Failed to update the journal: %s.\n", strerror(errno));
+        rmStatus = RM_ERROR;
+    } else if (params->progress) {
+        __atomic_fetch_add(params->progress, slot->len, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    if (rmStatus != RM_OK) {
+        ring->abort = 1;
+    } else {
+        stats->bytesWritten += slot->len;
+        stats->chunks++;
+        slot->state = next;
+    }
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+
+    return rmStatus;
+}
+
+//
+// Reaps finished asynchronous writes and frees their slots.  Waits until
+// no more than maxInFlight writes are left and, with waitFor set, until
+// that slot's write has been reaped.
+//
+static RM_STATUS acquireReapWrites(AcquireRing *ring, AcquireStats *stats,
+                                   DiskWriter *writer,
+                                   const AcquireSlot *waitFor,
+                                   unsigned int maxInFlight) {
+    DiskWriteCompletion done[ACQUIRE_REAP_BATCH];
+    RM_STATUS rmStatus = RM_OK;
+    unsigned int n, c;
+
+    for (;;) {
+        int wait = diskWriterInFlight(writer) > maxInFlight ||
+                   (waitFor && waitFor->state == SLOT_WRITING);
+
+        n = diskWriterReap(writer, done, ACQUIRE_REAP_BATCH, wait);
+        for (c = 0; c < n; c++) {
+            AcquireSlot *slot = done[c].userData;
+
+            if (done[c].error) {
+                nv_error_msg("Failed to write output: %s.\n",
+                             strerror(done[c].error));
+                pthread_mutex_lock(&ring->lock);
+                ring->abort = 1;
+                pthread_cond_broadcast(&ring->cond);
+                pthread_mutex_unlock(&ring->lock);
+                rmStatus = RM_ERROR;
+                continue;
+            }
+            if (--slot->writes)
+                continue;
+            stats->bytesStored += slot->len;
+            if (acquireChunkWritten(ring, stats, slot, SLOT_FREE) != RM_OK)
+                rmStatus = RM_ERROR;
+        }
+
+        if (n == 0 || (!wait && n < ACQUIRE_REAP_BATCH))
+            break;
+    }
+
+    return rmStatus;
+}
+
+//
+// Preallocates the output range, switches outFd to O_DIRECT if the range is
+// aligned for it and the file system allows it, and creates the writer.
+// Sets *oDirectFlags to the flags to restore, or -1.
+//
+static RM_STATUS acquireDirectIoSetup(const AcquireParams *params,
+                                      unsigned int depth, NvLength pageSize,
+                                      AcquireStats *stats, int *oldFlags,
+                                      DiskWriter **writer) {
+    RM_STATUS rmStatus;
+    int flags;
+
+    *oldFlags = -1;
+
+    if (fallocate(params->outFd, 0, params->outOffset, params->sizeBytes) &&
+        errno != EOPNOTSUPP) {
+        nv_error_msg("Failed to preallocate the output: %s.\n",
+                     strerror(errno));
+        return RM_ERROR;
+    }
+
+    flags = fcntl(params->outFd, F_GETFL);
+    if (flags >= 0 && params->outOffset % pageSize == 0 &&
+        !fcntl(params->outFd, F_SETFL, flags | O_DIRECT)) {
+        *oldFlags = flags;
+        stats->directIo = 1;
+    }
+
+    rmStatus = diskWriterCreate(params->outFd,
+                                params->writeDepth ? params->writeDepth :
+                                NV_MAX(1, depth / 2),
+                                params->ioEngine, writer);
+    if (rmStatus != RM_OK) {
+        nv_error_msg("Failed to set up %s writes.\n",
+                     diskWriterEngineName(params->ioEngine));
+        return rmStatus;
+    }
+    stats->ioEngine = diskWriterEngine(*writer);
+
+    return RM_OK;
+}
+
+//
+// Hands a raw chunk at offset in the output to the writer: to outFd, or
+// to the segments it falls in, each through the lane of its target.  A
+// chunk counts as written once all of its writes are reaped.  Returns 0,
+// or -1 with errno set.
+//
+static int acquireSubmitWrite(const AcquireParams *params, DiskWriter *writer,
+                              AcquireSlot *slot, unsigned long long offset) {
+    const SegmentSet *segments = params->segments;
+    NvU64 inSegment;
+    NvLength done, len;
+    unsigned int i;
+
+    if (!segments) {
+        slot->writes = 1;
+        return diskWriterSubmit(writer, slot->buf, slot->len, offset, slot);
+    }
+
+    // Counted up front, so a chunk cut short by a failed submission is
+    // never taken for written.
+    i = segmentLocate(segments, offset, &inSegment);
+    slot->writes = segmentLocate(segments, offset + slot->len - 1,
+                                 &inSegment) - i + 1;
+
+    for (done = 0; done < slot->len; done += len, i++) {
+        segmentLocate(segments, offset + done, &inSegment);
+        len = NV_MIN(slot->len - done, segmentLength(segments, i) - inSegment);
+        if (diskWriterSubmitTo(writer, i % segments->targets,
+                               segments->fds[i], (char *)slot->buf + done,
+                               len, inSegment, slot))
+            return -1;
+    }
+
+    return 0;
+}
+
+//
+// Writes a raw chunk to its place in the output.  With params->sparse set,
+// runs of all-zero pages are skipped and left as holes, which read back as
+// zeros as long as the output was freshly sized with ftruncate.  Zero pages
+// are counted in *zeroPages and recorded in params->zeroMap.  Returns the
+// number of bytes written, or -1 on error.
+//
+static ssize_t acquireWriteRaw(const AcquireParams *params,
+                               const AcquireSlot *slot, NvLength pageSize,
+                               NvU64 *zeroPages) {
+    const char *buf = slot->buf;
+    NvLength chunkOffset = slot->gpuOffset - params->baseAddress;
+    NvU64 firstPage = chunkOffset / pageSize;
+    NvU64 pages = slot->len / pageSize, i;
+    NvLength runStart = 0, runLen = 0, written = 0;
+
+    if (!params->sparse) {
+        if (params->zeroMap) {
+            *zeroPages = zeroPageScan(buf, pages * pageSize, pageSize,
+                                      params->zeroMap, firstPage);
+        }
+        if (acquireWriteAll(params, buf, slot->len,
+                            params->outOffset + chunkOffset))
+            return -1;
+        return slot->len;
+    }
+
+    *zeroPages = 0;
+
+    // A trailing partial page is always written.
+    for (i = 0; i <= pages; i++) {
+        int zero = i < pages && zeroPageIsZero(buf + i * pageSize, pageSize);
+
+        if (i < pages && params->zeroMap) {
+            NvU64 bit = firstPage + i;
+            if (zero)
+                params->zeroMap[bit / 64] |= 1ull << (bit % 64);
+            else
+                params->zeroMap[bit / 64] &= ~(1ull << (bit % 64));
+        }
+
+        if (!zero) {
+            NvLength len = i < pages ? pageSize : slot->len - pages * pageSize;
+            if (runLen == 0)
+                runStart = i * pageSize;
+            runLen += len;
+            if (i < pages)
+                continue;
+        } else {
+            (*zeroPages)++;
+        }
+
+        if (runLen) {
+            if (acquireWriteAll(params, buf + runStart, runLen,
+                                params->outOffset + chunkOffset + runStart))
+                return -1;
+            written += runLen;
+            runLen = 0;
+        }
+    }
+
+    return written;
+}
+
+//
+// Has the driver write the range to outFd one chunk at a time, or in calls
+// sized for maxCallNs.  Returns
+// RM_ERR_NOT_SUPPORTED, having written nothing, if it cannot.
+//
+static RM_STATUS acquireDirect(const AcquireParams *params,
+                               AcquireStats *stats) {
+    RM_STATUS rmStatus = RM_OK;
+    NvLength done = 0;
+    TokenBucket bucket;
+    CallSizer sizer;
+
+    tokenBucketInit(&bucket, params->maxBytesPerSec, params->chunkBytes,
+                    acquireNowNs());
+    callSizerInit(&sizer, params->maxCallNs, sysconf(_SC_PAGE_SIZE),
+                  params->chunkBytes);
+
+    while (done < params->sizeBytes && rmStatus == RM_OK) {
+        NvLength len = NV_MIN(sizer.callBytes, params->sizeBytes - done);
+        NvLength written = 0;
+        NvU64 copyStart;
+
+        acquirePace(&bucket, len, &stats->throttleNs);
+        copyStart = acquireNowNs();
+
+        rmStatus = UvmDumpGpuMemoryToFd(params->gpuUuid, params->outFd,
+                                        params->outOffset + done,
+                                        params->baseAddress + done, len,
+                                        params->blockBytes, 0, &written);
+        stats->copyNs += acquireNowNs() - copyStart;
+        callSizerUpdate(&sizer, len, acquireNowNs() - copyStart);
+
+        if (rmStatus == RM_ERR_NOT_SUPPORTED && done == 0)
+            return rmStatus;
+
+        stats->calls++;
+        stats->maxCallBytes = NV_MAX(stats->maxCallBytes, len);
+
+        // A call that failed still wrote the bytes before the failure.
+        if (rmStatus != RM_OK)
+            len = NV_MIN(written, len);
+        stats->bytesCopied  += len;
+        stats->bytesWritten += len;
+        stats->bytesStored  += len;
+        if (params->progress)
+            __atomic_fetch_add(params->progress, len, __ATOMIC_RELAXED);
+        done += len;
+
+        //
+        // Calls under a latency budget need not line up with chunks, which
+        // count once they are whole, like on the staging path.
+        //
+        stats->chunks = done / params->chunkBytes +
+                        (done == params->sizeBytes &&
+                         done % params->chunkBytes != 0);
+    }
+
+    stats->direct = 1;
+    return rmStatus;
+}
+
+static RM_STATUS acquireChunks(const AcquireParams *params,
+                               AcquireStats *stats) {
+    const long pageSize = sysconf(_SC_PAGE_SIZE);
+    const int compress = params->compression != COMPRESS_NONE;
+    const int process = compress || params->hash != HASH_NONE ||
+                        params->image;
+    const AcquireSlotState writable = process ? SLOT_READY : SLOT_FULL;
+    AcquireRing ring;
+    AcquireStats localStats;
+    SeekTable table;
+    pthread_t copyThread;
+    pthread_t *workers = NULL;
+    unsigned int numWorkers = 0, w;
+    RM_STATUS rmStatus = RM_OK;
+    StagingBuffer staging;
+    unsigned long long outPos = params->outOffset;
+    NvU64 start = acquireNowNs();
+    NvU64 spliced = 0;
+    struct stat st;
+    int inPipe, splice = 0;
+    DiskWriter *writer = NULL;
+    int oldFlags = -1;
+    NvU64 i;
+    unsigned int s;
+
+    if (!stats)
+        stats = &localStats;
+    memset(stats, 0, sizeof(*stats));
+    memset(&table, 0, sizeof(table));
+
+    if (params->chunkBytes == 0 || params->chunkBytes % pageSize ||
+        params->depth == 0 || (params->outFd < 0 && !params->segments)) {
+        return RM_ERR_INVALID_ARGUMENT;
+    }
+
+    // The seek table stores frame sizes in 32 bits.
+    if (compress && compressBound(params->compression, params->compressLevel,
+                                  params->chunkBytes) > 0xFFFFFFFFull) {
+        return RM_ERR_INVALID_ARGUMENT;
+    }
+
+    if (params->hash != HASH_NONE && !params->merkle)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    // Compressed frames are appended, so there is nowhere to leave a hole.
+    if (params->sparse && compress)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    // Nor can a stream, which also cannot seek back to place a seek table.
+    if (params->stream && (params->sparse || compress || params->image))
+        return RM_ERR_INVALID_ARGUMENT;
+
+    // Image chunks are appended, and their index stores lengths in 32 bits.
+    if (params->image && (params->sparse ||
+                          params->chunkBytes > 0xFFFFFFFFull))
+        return RM_ERR_INVALID_ARGUMENT;
+
+    // Asynchronous O_DIRECT writes need whole raw chunks at fixed offsets.
+    if (params->directIo && (compress || params->sparse || params->stream ||
+                             params->image || params->directToFd))
+        return RM_ERR_INVALID_ARGUMENT;
+
+    // Segments take whole raw chunks, and must cover the range.
+    if (params->segments &&
+        (compress || params->sparse || params->stream || params->image ||
+         params->directToFd || params->directIo || params->journal ||
+         params->outOffset + params->sizeBytes >
+         params->segments->sizeBytes))
+        return RM_ERR_INVALID_ARGUMENT;
+
+    // The driver only ever writes the raw bytes, at their offset.
+    if (params->directToFd && (compress || params->hash != HASH_NONE ||
+                               params->sparse || params->zeroMap ||
+                               params->stream || params->image ||
+                               params->badPages))
+        return RM_ERR_INVALID_ARGUMENT;
+
+    if (params->directToFd && params->sizeBytes) {
+        rmStatus = acquireDirect(params, stats);
+        if (rmStatus != RM_ERR_NOT_SUPPORTED || stats->direct) {
+            stats->elapsedNs = acquireNowNs() - start;
+            return rmStatus;
+        }
+        rmStatus = RM_OK;
+    }
+
+    memset(&ring, 0, sizeof(ring));
+    ring.params    = params;
+    ring.numChunks = (params->sizeBytes + params->chunkBytes - 1) /
+                     params->chunkBytes;
+
+    if (params->hash != HASH_NONE) {
+        merkleInit(params->merkle, params->hash, params->chunkBytes,
+                   params->baseAddress, ring.numChunks);
+    }
+    if (params->image)
+        params->image->count = 0;
+
+    if (params->sizeBytes == 0)
+        return RM_OK;
+
+    // Never allocate more staging than the range actually needs.
+    ring.depth     = NV_MIN(params->depth, ring.numChunks);
+
+    //
+    // The staging ring is populated up front so the copy thread never takes a
+    // page fault and the kernel's get_user_pages finds every page present.
+    //
+    rmStatus = stagingAlloc((NvLength)ring.depth * params->chunkBytes,
+                            params->stagingPages, &staging);
+    if (rmStatus != RM_OK)
+        goto done;
+    stats->stagingPages = staging.pages;
+
+    if (compress) {
+        ring.outCapacity = compressBound(params->compression,
+                                         params->compressLevel,
+                                         params->chunkBytes);
+    }
+
+    ring.slots = nvalloc(ring.depth * sizeof(AcquireSlot));
+    for (s = 0; s < ring.depth; s++) {
+        ring.slots[s].buf   = (char *)staging.ptr +
+                              (NvLength)s * params->chunkBytes;
+        ring.slots[s].state = SLOT_FREE;
+        if (compress)
+            ring.slots[s].out = nvalloc(ring.outCapacity);
+    }
+
+    pthread_mutex_init(&ring.lock, NULL);
+    pthread_cond_init(&ring.cond, NULL);
+
+    tokenBucketInit(&ring.bucket, params->maxBytesPerSec, params->chunkBytes,
+                    acquireNowNs());
+    callSizerInit(&ring.sizer, params->maxCallNs, pageSize, params->chunkBytes);
+
+    //
+    // Streams into a pipe are spliced from the staging ring when asked to,
+    // which needs FIONREAD to tell when the reader is done with a chunk.  A
+    // pipe as large as a chunk keeps the reader from waiting on each
+    // vmsplice.
+    //
+    if (params->stream && params->splice && !params->zeroMap &&
+        !fstat(params->outFd, &st) &&
+        S_ISFIFO(st.st_mode) && !ioctl(params->outFd, FIONREAD, &inPipe)) {
+        splice = 1;
+        fcntl(params->outFd, F_SETPIPE_SZ,
+              (int)NV_MIN(params->chunkBytes, 0x40000000));
+        stats->spliced = 1;
+    }
+
+    if (params->directIo) {
+        rmStatus = acquireDirectIoSetup(params, ring.depth, pageSize, stats,
+                                        &oldFlags, &writer);
+        if (rmStatus != RM_OK)
+            goto destroy;
+    } else if (params->segments) {
+        //
+        // One thread per target.  No chunk takes more writes than the
+        // segments it touches, so the writer never runs out of room.
+        //
+        rmStatus = diskWriterCreateLanes(params->segments->targets,
+                                         ring.depth *
+                                         (params->chunkBytes /
+                                          params->segments->segmentBytes + 2),
+                                         &writer);
+        if (rmStatus != RM_OK) {
+            nv_error_msg("Failed to start the segment writers.\n");
+            goto destroy;
+        }
+    }
+
+    if (pthread_create(&copyThread, NULL, acquireCopyThread, &ring)) {
+        nv_error_msg("Failed to start the copy thread.\n");
+        rmStatus = RM_ERR_INSUFFICIENT_RESOURCES;
+        goto destroy;
+    }
+
+    if (process) {
+        //
+        // At most depth chunks are in flight, so more workers than that
+        // would only ever wait.
+        //
+        numWorkers = params->workerThreads ? params->workerThreads :
+                     (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+        numWorkers = NV_MAX(1, NV_MIN(numWorkers, ring.depth));
+        workers = nvalloc(numWorkers * sizeof(pthread_t));
+
+        for (w = 0; w < numWorkers; w++) {
+            if (pthread_create(&workers[w], NULL, acquireProcessThread,
+                               &ring)) {
+                nv_error_msg("Failed to start worker %u.\n", w);
+                break;
+            }
+        }
+
+        if (w == 0) {
+            rmStatus = RM_ERR_INSUFFICIENT_RESOURCES;
+            pthread_mutex_lock(&ring.lock);
+            ring.abort = 1;
+            pthread_cond_broadcast(&ring.cond);
+            pthread_mutex_unlock(&ring.lock);
+        }
+        numWorkers = w;
+    }
+
+    for (i = 0; i < ring.numChunks && rmStatus == RM_OK; i++) {
+        AcquireSlot *slot = &ring.slots[i % ring.depth];
+        NvU64 writeStart, zeroPages = 0;
+        int ready;
+
+        if (splice) {
+            writeStart = acquireNowNs();
+            if (acquireReleaseSpliced(&ring, params->outFd, spliced, slot))
+                rmStatus = RM_ERROR;
+            stats->writeNs += acquireNowNs() - writeStart;
+            if (rmStatus != RM_OK) {
+                pthread_mutex_lock(&ring.lock);
+                ring.abort = 1;
+                pthread_cond_broadcast(&ring.cond);
+                pthread_mutex_unlock(&ring.lock);
+                break;
+            }
+        }
+
+        // Frees the slot of this chunk if its previous one is still written.
+        if (writer) {
+            writeStart = acquireNowNs();
+            rmStatus = acquireReapWrites(&ring, stats, writer, slot,
+                                         diskWriterDepth(writer) - 1);
+            stats->writeNs += acquireNowNs() - writeStart;
+            if (rmStatus != RM_OK)
+                break;
+        }
+
+        pthread_mutex_lock(&ring.lock);
+        ready = acquireWaitChunk(&ring, i, writable);
+        pthread_mutex_unlock(&ring.lock);
+
+        if (!ready)
+            break;
+
+        //
+        // Raw chunks land at their offset within the range; compressed frames
+        // are appended back to back and located through the seek table.
+        //
+        writeStart = acquireNowNs();
+        if (params->image) {
+            ImageIndexEntry *e = &slot->entry;
+            const void *data = e->kind == IMAGE_CHUNK_RAW ? slot->buf :
+                               slot->out;
+
+            switch (e->kind) {
+                case IMAGE_CHUNK_RAW:  e->storedBytes = slot->len;    break;
+                case IMAGE_CHUNK_ZSTD:
+                case IMAGE_CHUNK_LZ4:  e->storedBytes = slot->outLen; break;
+                default:               e->storedBytes = 0;            break;
+            }
+            e->offset = outPos;
+
+            if (params->zeroMap) {
+                zeroPages = zeroPageScan(slot->buf, slot->len, pageSize,
+                                         params->zeroMap,
+                                         (slot->gpuOffset -
+                                          params->baseAddress) / pageSize);
+            }
+            if (acquireWriteAll(params, data, e->storedBytes, outPos)) {
+                rmStatus = RM_ERROR;
+            } else {
+                imageIndexAppend(params->image, e);
+                outPos += e->storedBytes;
+                stats->bytesStored += e->storedBytes;
+            }
+        } else if (compress) {
+            if (params->zeroMap) {
+                zeroPages = zeroPageScan(slot->buf, slot->len, pageSize,
+                                         params->zeroMap,
+                                         (slot->gpuOffset -
+                                          params->baseAddress) / pageSize);
+            }
+            if (acquireWriteAll(params, slot->out, slot->outLen,
+                                outPos)) {
+                rmStatus = RM_ERROR;
+            } else {
+                seekTableAppend(&table, slot->outLen, slot->len);
+                outPos += slot->outLen;
+                stats->bytesStored += slot->outLen;
+            }
+        } else if (writer) {
+            NvLength chunkOffset = slot->gpuOffset - params->baseAddress;
+
+            if (params->zeroMap) {
+                zeroPages = zeroPageScan(slot->buf, slot->len, pageSize,
+                                         params->zeroMap,
+                                         chunkOffset / pageSize);
+            }
+            stats->zeroPages += zeroPages;
+
+            // O_DIRECT cannot write the partial page at the very end.
+            if (oldFlags >= 0 && slot->len % pageSize) {
+                rmStatus = acquireReapWrites(&ring, stats, writer, NULL, 0);
+                fcntl(params->outFd, F_SETFL, oldFlags);
+                oldFlags = -1;
+                if (rmStatus == RM_OK &&
+                    acquireWriteAll(params, slot->buf, slot->len,
+                                    params->outOffset + chunkOffset)) {
+                    nv_error_msg("Failed to write output: %s.\n",
+                                 strerror(errno));
+                    rmStatus = RM_ERROR;
+                }
+                if (rmStatus == RM_OK) {
+                    stats->bytesStored += slot->len;
+                    rmStatus = acquireChunkWritten(&ring, stats, slot,
+                                                   SLOT_FREE);
+                }
+            } else {
+                pthread_mutex_lock(&ring.lock);
+                slot->state = SLOT_WRITING;
+                pthread_mutex_unlock(&ring.lock);
+
+                if (acquireSubmitWrite(params, writer, slot,
+                                       params->outOffset + chunkOffset)) {
+                    nv_error_msg("Failed to write output: %s.\n",
+                                 strerror(errno));
+                    rmStatus = RM_ERROR;
+                }
+            }
+            stats->writeNs += acquireNowNs() - writeStart;
+
+            if (rmStatus != RM_OK) {
+                pthread_mutex_lock(&ring.lock);
+                ring.abort = 1;
+                pthread_cond_broadcast(&ring.cond);
+                pthread_mutex_unlock(&ring.lock);
+            }
+            continue;
+        } else if (splice) {
+            if (acquireSplice(params->outFd, slot->buf, slot->len)) {
+                rmStatus = RM_ERROR;
+            } else {
+                spliced += slot->len;
+                slot->pipeEnd = spliced;
+                stats->bytesStored += slot->len;
+            }
+        } else {
+            ssize_t written = acquireWriteRaw(params, slot, pageSize,
+                                              &zeroPages);
+            if (written < 0)
+                rmStatus = RM_ERROR;
+            else
+                stats->bytesStored += written;
+        }
+        stats->writeNs += acquireNowNs() - writeStart;
+        stats->zeroPages += zeroPages;
+
+        if (rmStatus != RM_OK) {
+            nv_error_msg("Failed to write output: %s.\n", strerror(errno));
+            pthread_mutex_lock(&ring.lock);
+            ring.abort = 1;
+            pthread_cond_broadcast(&ring.cond);
+            pthread_mutex_unlock(&ring.lock);
+        } else {
+            rmStatus = acquireChunkWritten(&ring, stats, slot,
+                                           splice ? SLOT_SPLICED : SLOT_FREE);
+        }
+    }
+
+    // The staging ring must outlive the writes from it.
+    if (writer) {
+        RM_STATUS status = acquireReapWrites(&ring, stats, writer, NULL, 0);
+        if (rmStatus == RM_OK)
+            rmStatus = status;
+        diskWriterDestroy(writer);
+        writer = NULL;
+    }
+    if (oldFlags >= 0)
+        fcntl(params->outFd, F_SETFL, oldFlags);
+    oldFlags = -1;
+
+    pthread_join(copyThread, NULL);
+    for (w = 0; w < numWorkers; w++)
+        pthread_join(workers[w], NULL);
+
+    // Whatever reached the file is claimed, also after a failure.
+    if (params->journal && journalSync(params->journal) && rmStatus == RM_OK) {
+        nv_error_msg("Failed to update the journal: %s.\n", strerror(errno));
+        rmStatus = RM_ERROR;
+    }
+
+    //
+    // A partial dump still gets a seek table or image index covering the
+    // chunks it holds; an image also records why it is partial.
+    //
+    if (params->image && rmStatus == RM_OK) {
+        RM_STATUS status = ring.copyStatus != RM_OK ? ring.copyStatus :
+                                                      ring.processStatus;
+        NvLength indexBytes = imageIndexWrite(params->image, params->outFd,
+                                              outPos, status);
+        if (indexBytes == 0) {
+            nv_error_msg("Failed to write the image index: %s.\n",
+                         strerror(errno));
+            rmStatus = RM_ERROR;
+        }
+        stats->bytesStored += indexBytes;
+    } else if (compress && rmStatus == RM_OK) {
+        NvLength tableBytes = seekTableWrite(&table, params->outFd, outPos);
+        if (tableBytes == 0) {
+            nv_error_msg("Failed to write the seek table: %s.\n",
+                         strerror(errno));
+            rmStatus = RM_ERROR;
+        }
+        stats->bytesStored += tableBytes;
+    }
+
+    if (rmStatus == RM_OK)
+        rmStatus = ring.copyStatus;
+    if (rmStatus == RM_OK)
+        rmStatus = ring.processStatus;
+
+    // The tree only covers what reached the file.
+    if (params->hash != HASH_NONE) {
+        params->merkle->count     = stats->chunks;
+        params->merkle->sizeBytes = stats->bytesWritten;
+    }
+
+    stats->bytesCopied = ring.bytesCopied;
+    stats->copyNs      = ring.copyNs;
+    stats->throttleNs  = ring.throttleNs;
+    stats->calls       = ring.calls;
+    stats->maxCallBytes = ring.maxCallBytes;
+    if (!ring.physRunsUnknown) {
+        stats->physRuns    = ring.physRuns;
+        stats->physRunsMax = ring.physRunsMax;
+    }
+    stats->hashNs      = ring.hashNs;
+    stats->compressNs  = ring.compressNs;
+    stats->badPages    = ring.badPages;
+    stats->bisectCalls = ring.bisectCalls;
+    if (params->badPages)
+        acquireBadPagesSort(params->badPages);
+
+destroy:
+    // Only set here when setup failed before any write was submitted.
+    if (writer)
+        diskWriterDestroy(writer);
+    if (oldFlags >= 0)
+        fcntl(params->outFd, F_SETFL, oldFlags);
+    pthread_cond_destroy(&ring.cond);
+    pthread_mutex_destroy(&ring.lock);
+    for (s = 0; s < ring.depth; s++)
+        nvfree(ring.slots[s].out);
+    nvfree(ring.slots);
+    nvfree(workers);
+    seekTableFree(&table);
+    stagingFree(&staging);
+
+done:
+    stats->elapsedNs = acquireNowNs() - start;
+
+    return rmStatus;
+}
+
+static void acquireAddStats(AcquireStats *total, const AcquireStats *run) {
+    total->bytesCopied  += run->bytesCopied;
+    total->bytesWritten += run->bytesWritten;
+    total->bytesStored  += run->bytesStored;
+    total->zeroPages    += run->zeroPages;
+    total->chunks       += run->chunks;
+    total->copyNs       += run->copyNs;
+    total->hashNs       += run->hashNs;
+    total->compressNs   += run->compressNs;
+    total->writeNs      += run->writeNs;
+    total->throttleNs   += run->throttleNs;
+    total->calls        += run->calls;
+    total->maxCallBytes  = NV_MAX(total->maxCallBytes, run->maxCallBytes);
+    total->stagingPages  = run->stagingPages;
+    total->physRuns     += run->physRuns;
+    total->physRunsMax   = NV_MAX(total->physRunsMax, run->physRunsMax);
+    total->badPages     += run->badPages;
+    total->bisectCalls  += run->bisectCalls;
+    total->directIo      = run->directIo;
+    total->ioEngine      = run->ioEngine;
+}
+
+//
+// With a journal, only the runs of chunks it does not have are acquired,
+// and every chunk written is added to it.
+//
+RM_STATUS acquireRange(const AcquireParams *params, AcquireStats *stats) {
+    Journal *journal = params->journal;
+    const JournalHeader *h;
+    AcquireStats localStats, runStats;
+    RM_STATUS rmStatus = RM_OK;
+    NvU64 start = acquireNowNs();
+    NvU64 first, last, resumed = 0;
+
+    if (!journal)
+        return acquireChunks(params, stats);
+
+    if (!stats)
+        stats = &localStats;
+    memset(stats, 0, sizeof(*stats));
+
+    // Journals describe raw chunks at fixed offsets.
+    h = &journal->header;
+    if (params->compression != COMPRESS_NONE || params->image ||
+        params->stream || params->directToFd || params->zeroMap ||
+        h->baseAddress != params->baseAddress ||
+        h->sizeBytes != params->sizeBytes ||
+        h->chunkBytes != params->chunkBytes ||
+        h->outOffset != params->outOffset)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    for (first = 0; first < journal->numChunks; first++) {
+        if (journalChunkDone(journal, first)) {
+            resumed++;
+            if (params->progress)
+                __atomic_fetch_add(params->progress,
+                                   journalChunkLength(journal, first),
+                                   __ATOMIC_RELAXED);
+        }
+    }
+
+    // A tree over part of the dump would not be worth much.
+    if (resumed && params->hash != HASH_NONE)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    for (first = 0; first < journal->numChunks && rmStatus == RM_OK;
+         first = last) {
+        AcquireParams run = *params;
+        NvLength offset = first * params->chunkBytes;
+
+        if (journalChunkDone(journal, first)) {
+            last = first + 1;
+            continue;
+        }
+        for (last = first; last < journal->numChunks &&
+                           !journalChunkDone(journal, last); last++)
+            ;
+
+        run.baseAddress = params->baseAddress + offset;
+        run.outOffset   = params->outOffset + offset;
+        run.sizeBytes   = NV_MIN(last * params->chunkBytes,
+                                 params->sizeBytes) - offset;
+
+        // A sparse run relies on reading back zeros where it writes nothing.
+        if (resumed && params->sparse &&
+            fallocate(params->outFd, FALLOC_FL_PUNCH_HOLE |
+                      FALLOC_FL_KEEP_SIZE, run.outOffset, run.sizeBytes)) {
+            nv_error_msg("Failed to clear the output for a sparse resume: "
+                         "%s.\n", strerror(errno));
+            rmStatus = RM_ERROR;
+            break;
+        }
+
+        rmStatus = acquireChunks(&run, &runStats);
+        acquireAddStats(stats, &runStats);
+    }
+
+    stats->chunksResumed = resumed;
+    stats->elapsedNs     = acquireNowNs() - start;
+
+    return rmStatus;
+}
+
+typedef struct {
+    AcquireParams   *params;
+    AcquireStats    *stats;
+    RM_STATUS        status;
+    pthread_t        thread;
+
+    pthread_mutex_t *lock;
+    pthread_cond_t  *cond;
+    unsigned int    *finished;
+} AcquireWorker;
+
+static void *acquireWorkerThread(void *arg) {
+    AcquireWorker *worker = arg;
+
+    worker->status = acquireRange(worker->params, worker->stats);
+
+    pthread_mutex_lock(worker->lock);
+    (*worker->finished)++;
+    pthread_cond_signal(worker->cond);
+    pthread_mutex_unlock(worker->lock);
+
+    return NULL;
+}
+
+static void acquireReportProgress(const AcquireParams *params,
+                                  unsigned int count, NvU64 elapsedNs) {
+    char *line = nvasprintf("[%7.1fs]", elapsedNs / 1e9);
+    NvLength done = 0;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        NvLength bytes = __atomic_load_n(params[i].progress, __ATOMIC_RELAXED);
+        nv_append_sprintf(&line, " %s %5.1f%%",
+                          params[i].name ? params[i].name : "",
+                          params[i].sizeBytes ?
+                          100.0 * bytes / params[i].sizeBytes : 100.0);
+        done += bytes;
+    }
+    nv_append_sprintf(&line, " | %.2f GB/s",
+                      (done / (1024.0*1024*1024)) / (elapsedNs / 1e9));
+
+    nv_info_msg(NULL, "%s", line);
+    nvfree(line);
+}
+
+RM_STATUS acquireParallel(AcquireParams *params, unsigned int count,
+                          AcquireStats *stats, RM_STATUS *statuses,
+                          NvU64 reportIntervalNs) {
+    AcquireWorker *workers = nvalloc(count * sizeof(AcquireWorker));
+    AcquireStats *localStats = NULL;
+    NvLength *progress = nvalloc(count * sizeof(NvLength));
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_condattr_t attr;
+    pthread_cond_t cond;
+    unsigned int finished = 0, started = 0;
+    RM_STATUS rmStatus = RM_OK;
+    NvU64 start = acquireNowNs();
+    unsigned int i;
+
+    if (!stats)
+        stats = localStats = nvalloc(count * sizeof(AcquireStats));
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    for (i = 0; i < count; i++) {
+        if (!params[i].progress)
+            params[i].progress = &progress[i];
+
+        // Ranges whose worker never starts report this status.
+        workers[i].params   = &params[i];
+        workers[i].stats    = &stats[i];
+        workers[i].status   = RM_ERR_INSUFFICIENT_RESOURCES;
+        workers[i].lock     = &lock;
+        workers[i].cond     = &cond;
+        workers[i].finished = &finished;
+    }
+
+    for (i = 0; i < count; i++) {
+        workers[i].status = RM_OK;
+        if (pthread_create(&workers[i].thread, NULL, acquireWorkerThread,
+                           &workers[i])) {
+            nv_error_msg("Failed to start worker %u.\n", i);
+            workers[i].status = RM_ERR_INSUFFICIENT_RESOURCES;
+            break;
+        }
+        started++;
+    }
+
+    pthread_mutex_lock(&lock);
+    while (finished < started) {
+        if (reportIntervalNs) {
+            NvU64 deadline = acquireNowNs() + reportIntervalNs;
+            struct timespec ts = { deadline / 1000000000ull,
+                                   deadline % 1000000000ull };
+
+            if (pthread_cond_timedwait(&cond, &lock, &ts) == ETIMEDOUT) {
+                pthread_mutex_unlock(&lock);
+                acquireReportProgress(params, count, acquireNowNs() - start);
+                pthread_mutex_lock(&lock);
+            }
+        } else {
+            pthread_cond_wait(&cond, &lock);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    for (i = 0; i < count; i++) {
+        if (i < started)
+            pthread_join(workers[i].thread, NULL);
+        if (workers[i].status != RM_OK && rmStatus == RM_OK)
+            rmStatus = workers[i].status;
+        if (statuses)
+            statuses[i] = workers[i].status;
+        if (params[i].progress == &progress[i])
+            params[i].progress = NULL;
+    }
+
+    pthread_cond_destroy(&cond);
+    nvfree(localStats);
+    nvfree(progress);
+    nvfree(workers);
+
+    return rmStatus;
+}
@@ -0,0 +1,218 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _ACQUIRE_H_
+#define _ACQUIRE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+#include "compress.h"
+#include "hash.h"
+#include "merkle.h"
+#include "image.h"
+#include "staging.h"
+#include "journal.h"
+#include "diskwrite.h"
+#include "segment.h"
+
+#define ACQUIRE_DEFAULT_CHUNK_BYTES (8*1024*1024)
+#define ACQUIRE_DEFAULT_DEPTH       4
+
+// Repeated over pages that could not be read, see badPages
+#define ACQUIRE_BAD_PAGE_FILL       "BADPAGE!"
+
+typedef struct {
+    unsigned long long gpuOffset;
+    NvLength           length;
+    RM_STATUS          status;    // why the pages could not be read
+} AcquireBadRange;
+
+typedef struct {
+    AcquireBadRange *ranges;      // sorted, adjacent pages merged
+    unsigned int     count;
+    unsigned int     capacity;
+} AcquireBadPages;
+
+typedef struct {
+    UvmGpuUuid        *gpuUuid;
+    unsigned long long baseAddress;  // physical GPU offset of the first byte
+    NvLength           sizeBytes;    // total bytes to acquire
+    NvLength           chunkBytes;   // bytes per UvmDumpGpuMemory call
+    NvLength           blockBytes;   // driver copy block size, 0 = default
+    unsigned int       depth;        // number of staging buffers in the ring
+    int                outFd;        // file the chunks are written to
+    unsigned long long outOffset;    // file offset of the first byte
+    const char        *name;         // identifies the range in reports
+    NvLength          *progress;     // if set, advanced as chunks are written
+
+    CompressAlgorithm  compression;     // COMPRESS_NONE writes the raw bytes
+    int                compressLevel;
+    HashAlgorithm      hash;            // if set, chunk digests go to merkle
+    MerkleTree        *merkle;
+    unsigned int       workerThreads;   // hash/compress workers, 0 = one per CPU
+    int                sparse;          // leave zero pages as holes (raw only)
+    NvU64             *zeroMap;         // if set, one bit per page, 1 = zero
+    int                stream;          // outFd is a pipe or socket (raw only)
+    int                splice;          // vmsplice to pipes, see stream
+    ImageIndex        *image;           // if set, write image chunks (image.h)
+    int                directToFd;      // have the driver write outFd (raw only)
+    StagingPages       stagingPages;    // page size of the staging ring
+    NvU64              maxBytesPerSec;  // submission rate cap, 0 = none
+    NvU64              maxCallNs;       // latency budget of a call, 0 = none
+    Journal           *journal;         // if set, checkpoint chunks (raw only)
+    AcquireBadPages   *badPages;        // if set, skip unreadable pages
+    int                directIo;        // O_DIRECT async writes (raw only)
+    DiskWriterEngine   ioEngine;        // how, with directIo
+    unsigned int       writeDepth;      // writes in flight, 0 = depth/2
+    const SegmentSet  *segments;        // if set, write these (raw only)
+} AcquireParams;
+
+typedef struct {
+    NvLength bytesCopied;
+    NvLength bytesWritten;   // source bytes that reached the file
+    NvLength bytesStored;    // bytes actually written to the file
+    NvU64    zeroPages;      // counted when sparse or zeroMap is set
+    NvU64    chunks;
+    NvU64    copyNs;      // time spent submitting and waiting for dumps
+    NvU64    hashNs;      // summed over all workers
+    NvU64    compressNs;  // summed over all workers
+    NvU64    writeNs;     // time spent writing chunks out
+    NvU64    elapsedNs;   // wall clock for the whole range
+    NvU64    throttleNs;  // time spent waiting for maxBytesPerSec
+    NvU64    calls;       // driver calls, several per chunk under maxCallNs
+    NvLength maxCallBytes;
+    int      direct;      // written by the driver, see directToFd
+    int      spliced;     // handed to a pipe with vmsplice, see stream
+    StagingPages stagingPages;  // what the staging ring got
+    NvU64    physRuns;    // physically contiguous runs of all chunks, 0 if unknown
+    NvU64    physRunsMax; // most runs of one chunk
+    NvU64    chunksResumed; // already in the journal, not acquired again
+    NvU64    badPages;    // filled with ACQUIRE_BAD_PAGE_FILL
+    NvU64    bisectCalls; // driver calls spent isolating them
+    int      directIo;    // the output took O_DIRECT, see directIo
+    DiskWriterEngine ioEngine;  // what wrote it, with directIo
+} AcquireStats;
+
+void acquireParamsInit(AcquireParams *params);
+
+//
+// Acquires [baseAddress, baseAddress+sizeBytes) into outFd.
+//
+// The range is split into chunkBytes pieces.  A copy thread submits a dump of
+// each piece into the next free buffer of a ring of pre-faulted staging
+// buffers (see uvm_async.h), so up to depth dumps are queued on the GPU,
+// while the calling thread writes completed buffers to the file.  The GPU
+// copy and the disk I/O overlap and memory use is bounded by
+// depth*chunkBytes instead of the size of the dump.
+//
+// With compression enabled a pool of workers turns each copied chunk into an
+// independent frame, and the frames are appended in order starting at
+// outOffset followed by a seek table (see compress.h).  With hashing enabled
+// the same workers store each chunk's digest as a leaf of params->merkle,
+// which is (re)initialized by the call and ends up covering the chunks that
+// were written.
+//
+// With sparse set, all-zero pages of raw output are not written at all, so
+// the output range must already read as zeros (e.g. a file just sized with
+// ftruncate).  zeroMap, if set, must hold a bit for every page of the range.
+//
+// With stream set the chunks are written in order with write() and outOffset
+// is ignored, so outFd can be a pipe or a socket.  With splice also set a
+// pipe gets the staging pages themselves with vmsplice instead, and their
+// slots are reused once the pipe is drained.  That is only safe for readers
+// that copy the data out with read(): one that passes it on with splice()
+// or tee() drains the pipe while still referring to the pages, and would
+// see them overwritten by later chunks.
+//
+// With image set the chunks are stored as in an image file (see image.h):
+// zero and constant chunks are recognized, compression applies to each chunk
+// only where it helps, and every chunk gets a CRC-32C.  The chunks are
+// appended from outOffset, which must leave room for the header, followed by
+// the index and footer.  params->image is (re)initialized by the call.
+//
+// The staging ring is allocated with stagingPages (see staging.h) and each
+// chunk's buffer is resolved to physical runs, as the driver will pin it,
+// before its dump is submitted; physRuns/chunks is the average per chunk.
+//
+// With maxBytesPerSec set, dumps are submitted at that average rate, in
+// bursts of at most one chunk (see throttle.h).  With maxCallNs set each
+// chunk is copied in calls sized to take at most that long at the rate
+// the previous calls achieved, one call at a time, so other users of the
+// copy engine get in between.
+//
+// With journal set (see journal.h) the chunks the journal already holds are
+// skipped and every chunk written is recorded in it.  The journal must
+// describe this very range, chunk size and output offset.  Hashing cannot
+// be combined with skipping chunks.
+//
+// With badPages set, a chunk whose dump fails with an ECC error or an
+// invalid address is dumped again in halves, recursively, down to the
+// pages that keep failing, so a bad page costs about two calls per halving
+// of the chunk.  Those pages are filled with ACQUIRE_BAD_PAGE_FILL and added
+// to badPages with the status, and the dump goes on; the journal leaves
+// their chunks out.  Other errors still end the dump.
+//
+// With directIo set the output range is preallocated with fallocate and
+// switched to O_DIRECT (when outOffset is page aligned and the file system
+// supports it), and chunks are written asynchronously by a DiskWriter
+// (see diskwrite.h) with up to writeDepth writes in flight, so the writes
+// neither wait for each other nor pile up dirty pages.  A slot is reused
+// once its write has completed.  Raw, non-sparse files only.
+//
+// With segments set the output is the segment set (see segment.h) rather
+// than outFd: outOffset is the offset in the whole set, which must cover
+// the range, and each chunk is written by the thread of the target its
+// segment is on, so every target directory gets its own writer.  A chunk
+// that crosses segment boundaries is written in pieces.  Raw,
+// non-sparse output only; cannot be combined with a journal.
+//
+// With directToFd set the driver writes each chunk to outFd itself with
+// UvmDumpGpuMemoryToFd, so the bytes never pass through user memory and no
+// staging ring is allocated.  outFd must be a regular file.  If the backend
+// or driver has no such call the range is acquired through the staging ring
+// as usual; stats->direct tells which path was taken.
+//
+RM_STATUS acquireRange(const AcquireParams *params, AcquireStats *stats);
+
+//
+// Runs acquireRange for count independent ranges at once, one worker thread
+// each (e.g. one per GPU).  statuses and stats, if non-NULL, receive the
+// per-range results.  When reportIntervalNs is non-zero a progress line is
+// printed at that interval.  Returns RM_OK if every range succeeded, else the
+// first failure.
+//
+RM_STATUS acquireParallel(AcquireParams *params, unsigned int count,
+                          AcquireStats *stats, RM_STATUS *statuses,
+                          NvU64 reportIntervalNs);
+
+NvU64 acquireNowNs(void);
+
+void acquireBadPagesFree(AcquireBadPages *badPages);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
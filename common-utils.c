@@ -460,7 +460,7 @@ int nv_open(const char *pathname, int flags, mode_t mode)
  * on success.
  */
 
-int nv_get_file_length(const char *filename)
+off_t nv_get_file_length(const char *filename)
 {
     struct stat stat_buf;
     int ret;
@@ -483,12 +483,12 @@ int nv_get_file_length(const char *filename)
  * function only returns on success.
  */
 
-void nv_set_file_length(const char *filename, int fd, int len)
+void nv_set_file_length(const char *filename, int fd, off_t len)
 {
     if ((lseek(fd, len - 1, SEEK_SET) == -1) ||
         (write(fd, "", 1) == -1)) {
-        fprintf(stderr, "Unable to set file '%s' length %d (%s).\n",
-                filename, fd, strerror(errno));
+        fprintf(stderr, "Unable to set file '%s' length %lld (%s).\n",
+                filename, (long long)len, strerror(errno));
         exit(1);
     }
 } /* nv_set_file_length() */
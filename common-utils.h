@@ -65,8 +65,8 @@ char *nv_prepend_to_string_list(char *list, const char *item, const char *delim)
 char *fget_next_line(FILE *fp, int *eof);
 
 int nv_open(const char *pathname, int flags, mode_t mode);
-int nv_get_file_length(const char *filename);
-void nv_set_file_length(const char *filename, int fd, int len);
+off_t nv_get_file_length(const char *filename);
+void nv_set_file_length(const char *filename, int fd, off_t len);
 void *nv_mmap(const char *filename, size_t len, int prot, int flags, int fd);
 char *nv_basename(const char *path);
 
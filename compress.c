@@ -0,0 +1,313 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "compress.h"
+#include "common-utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <zstd.h>
+#include <lz4frame.h>
+
+#define ZSTD_FRAME_MAGIC 0xFD2FB528
+#define LZ4_FRAME_MAGIC  0x184D2204
+
+struct CompressContext {
+    CompressAlgorithm  algorithm;
+    int                level;
+    ZSTD_CCtx         *zstd;
+};
+
+static NvU32 getLe32(const NvU8 *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((NvU32)p[3] << 24);
+}
+
+static void putLe32(NvU8 *p, NvU32 v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+int compressParseSpec(const char *spec, CompressAlgorithm *algorithm,
+                      int *level) {
+    const char *colon = strchr(spec, ':');
+    size_t nameLen = colon ? (size_t)(colon - spec) : strlen(spec);
+    char *end;
+
+    if (nameLen == 4 && !strncmp(spec, "zstd", 4)) {
+        *algorithm = COMPRESS_ZSTD;
+        *level = 3;
+    } else if (nameLen == 3 && !strncmp(spec, "lz4", 3)) {
+        *algorithm = COMPRESS_LZ4;
+        *level = 0;
+    } else {
+        nv_error_msg("Unknown compression '%s'; use zstd[:LEVEL] or lz4[:LEVEL].\n",
+                     spec);
+        return -1;
+    }
+
+    if (colon) {
+        *level = strtol(colon + 1, &end, 0);
+        if (end == colon + 1 || *end != '\0') {
+            nv_error_msg("Invalid compression level '%s'.\n", colon + 1);
+            return -1;
+        }
+    }
+
+    if (*algorithm == COMPRESS_ZSTD &&
+        (*level < ZSTD_minCLevel() || *level > ZSTD_maxCLevel())) {
+        nv_error_msg("zstd levels range from %d to %d.\n",
+                     ZSTD_minCLevel(), ZSTD_maxCLevel());
+        return -1;
+    }
+
+    if (*algorithm == COMPRESS_LZ4 && (*level < 0 || *level > 12)) {
+        nv_error_msg("lz4 levels range from 0 to 12.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+const char *compressAlgorithmName(CompressAlgorithm algorithm) {
+    switch (algorithm) {
+        case COMPRESS_ZSTD: return "zstd";
+        case COMPRESS_LZ4:  return "lz4";
+        default:            return "none";
+    }
+}
+
+static void lz4Preferences(int level, NvLength srcSize,
+                           LZ4F_preferences_t *prefs) {
+    memset(prefs, 0, sizeof(*prefs));
+    prefs->frameInfo.blockSizeID = LZ4F_max4MB;
+    prefs->frameInfo.blockMode   = LZ4F_blockIndependent;
+    prefs->frameInfo.contentSize = srcSize;
+    prefs->compressionLevel      = level;
+}
+
+NvLength compressBound(CompressAlgorithm algorithm, int level, NvLength srcSize) {
+    LZ4F_preferences_t prefs;
+
+    switch (algorithm) {
+        case COMPRESS_ZSTD:
+            return ZSTD_compressBound(srcSize);
+        case COMPRESS_LZ4:
+            lz4Preferences(level, srcSize, &prefs);
+            return LZ4F_compressFrameBound(srcSize, &prefs);
+        default:
+            return srcSize;
+    }
+}
+
+CompressContext *compressContextCreate(CompressAlgorithm algorithm, int level) {
+    CompressContext *ctx = nvalloc(sizeof(*ctx));
+
+    ctx->algorithm = algorithm;
+    ctx->level     = level;
+
+    if (algorithm == COMPRESS_ZSTD) {
+        ctx->zstd = ZSTD_createCCtx();
+        if (!ctx->zstd) {
+            nvfree(ctx);
+            return NULL;
+        }
+    }
+
+    return ctx;
+}
+
+void compressContextDestroy(CompressContext *ctx) {
+    if (!ctx)
+        return;
+    if (ctx->zstd)
+        ZSTD_freeCCtx(ctx->zstd);
+    nvfree(ctx);
+}
+
+NvLength compressChunk(CompressContext *ctx, void *dst, NvLength dstCapacity,
+                       const void *src, NvLength srcSize) {
+    LZ4F_preferences_t prefs;
+    size_t ret;
+
+    switch (ctx->algorithm) {
+        case COMPRESS_ZSTD:
+            ret = ZSTD_compressCCtx(ctx->zstd, dst, dstCapacity, src, srcSize,
+                                    ctx->level);
+            if (ZSTD_isError(ret)) {
+                nv_error_msg("zstd compression failed: %s.\n",
+                             ZSTD_getErrorName(ret));
+                return 0;
+            }
+            return ret;
+
+        case COMPRESS_LZ4:
+            lz4Preferences(ctx->level, srcSize, &prefs);
+            ret = LZ4F_compressFrame(dst, dstCapacity, src, srcSize, &prefs);
+            if (LZ4F_isError(ret)) {
+                nv_error_msg("lz4 compression failed: %s.\n",
+                             LZ4F_getErrorName(ret));
+                return 0;
+            }
+            return ret;
+
+        default:
+            return 0;
+    }
+}
+
+NvLength decompressChunk(void *dst, NvLength dstCapacity,
+                         const void *src, NvLength srcSize) {
+    NvU32 magic;
+
+    if (srcSize < 4)
+        return 0;
+    magic = getLe32(src);
+
+    if (magic == ZSTD_FRAME_MAGIC) {
+        size_t ret = ZSTD_decompress(dst, dstCapacity, src, srcSize);
+        return ZSTD_isError(ret) ? 0 : ret;
+    }
+
+    if (magic == LZ4_FRAME_MAGIC) {
+        LZ4F_dctx *dctx;
+        NvLength produced = 0;
+        const char *in = src;
+        size_t ret;
+
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+            return 0;
+
+        do {
+            size_t dstSize = dstCapacity - produced;
+            size_t srcLeft = srcSize;
+
+            ret = LZ4F_decompress(dctx, (char *)dst + produced, &dstSize,
+                                  in, &srcLeft, NULL);
+            if (LZ4F_isError(ret)) {
+                produced = 0;
+                break;
+            }
+            produced += dstSize;
+            in       += srcLeft;
+            srcSize  -= srcLeft;
+        } while (ret != 0 && srcSize && produced < dstCapacity);
+
+        LZ4F_freeDecompressionContext(dctx);
+        return produced;
+    }
+
+    return 0;
+}
+
+void seekTableAppend(SeekTable *table, NvU32 compressedSize,
+                     NvU32 decompressedSize) {
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 64;
+        table->entries = nvrealloc(table->entries,
+                                   table->capacity * sizeof(SeekTableEntry));
+    }
+    table->entries[table->count].compressedSize   = compressedSize;
+    table->entries[table->count].decompressedSize = decompressedSize;
+    table->count++;
+}
+
+void seekTableFree(SeekTable *table) {
+    nvfree(table->entries);
+    memset(table, 0, sizeof(*table));
+}
+
+NvLength seekTableWrite(const SeekTable *table, int fd, NvU64 offset) {
+    NvLength size = 8 + (NvLength)table->count * 8 + SEEK_TABLE_FOOTER_SIZE;
+    NvU8 *buf = nvalloc(size);
+    NvU8 *p = buf;
+    NvLength done = 0;
+    NvU32 i;
+
+    putLe32(p, SEEK_TABLE_SKIPPABLE_MAGIC);               p += 4;
+    putLe32(p, size - 8);                                 p += 4;
+    for (i = 0; i < table->count; i++) {
+        putLe32(p, table->entries[i].compressedSize);     p += 4;
+        putLe32(p, table->entries[i].decompressedSize);   p += 4;
+    }
+    putLe32(p, table->count);                             p += 4;
+    *p++ = 0;
+    putLe32(p, SEEK_TABLE_SEEKABLE_MAGIC);
+
+    while (done < size) {
+        ssize_t ret = pwrite(fd, buf + done, size - done, offset + done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            nvfree(buf);
+            return 0;
+        }
+        done += ret;
+    }
+
+    nvfree(buf);
+    return size;
+}
+
+int seekTableRead(int fd, SeekTable *table) {
+    NvU8 footer[SEEK_TABLE_FOOTER_SIZE];
+    NvU8 *buf;
+    struct stat st;
+    NvU64 tableSize;
+    NvU32 count, i;
+
+    memset(table, 0, sizeof(*table));
+
+    if (fstat(fd, &st) || st.st_size < 8 + SEEK_TABLE_FOOTER_SIZE)
+        return -1;
+
+    if (pread(fd, footer, sizeof(footer), st.st_size - sizeof(footer)) !=
+        sizeof(footer))
+        return -1;
+
+    if (getLe32(footer + 5) != SEEK_TABLE_SEEKABLE_MAGIC || footer[4] != 0)
+        return -1;
+
+    count = getLe32(footer);
+    tableSize = 8 + (NvU64)count * 8 + SEEK_TABLE_FOOTER_SIZE;
+    if (tableSize > (NvU64)st.st_size)
+        return -1;
+
+    buf = nvalloc(tableSize);
+    if (pread(fd, buf, tableSize, st.st_size - tableSize) != (ssize_t)tableSize ||
+        getLe32(buf) != SEEK_TABLE_SKIPPABLE_MAGIC ||
+        getLe32(buf + 4) != tableSize - 8) {
+        nvfree(buf);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+        seekTableAppend(table, getLe32(buf + 8 + i * 8),
+                        getLe32(buf + 12 + i * 8));
+
+    nvfree(buf);
+    return 0;
+}
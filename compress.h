@@ -0,0 +1,125 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+
+typedef enum {
+    COMPRESS_NONE = 0,
+    COMPRESS_ZSTD,
+    COMPRESS_LZ4,
+} CompressAlgorithm;
+
+typedef struct CompressContext CompressContext;
+
+//
+// Parses "zstd", "zstd:LEVEL", "lz4" or "lz4:LEVEL".  Returns 0 on success,
+// -1 (after printing an error) otherwise.
+//
+int compressParseSpec(const char *spec, CompressAlgorithm *algorithm,
+                      int *level);
+
+const char *compressAlgorithmName(CompressAlgorithm algorithm);
+
+// Worst case compressed size of srcSize bytes.
+NvLength compressBound(CompressAlgorithm algorithm, int level, NvLength srcSize);
+
+//
+// A context holds the compressor state for one thread.  compressChunk turns
+// srcSize bytes into one self-contained zstd or lz4 frame and returns its
+// size, or 0 on failure.
+//
+CompressContext *compressContextCreate(CompressAlgorithm algorithm, int level);
+void compressContextDestroy(CompressContext *ctx);
+NvLength compressChunk(CompressContext *ctx, void *dst, NvLength dstCapacity,
+                       const void *src, NvLength srcSize);
+
+//
+// Decompresses one frame written by compressChunk (the algorithm is detected
+// from the frame magic).  Returns the decompressed size, or 0 on failure.
+//
+NvLength decompressChunk(void *dst, NvLength dstCapacity,
+                         const void *src, NvLength srcSize);
+
+/*
+ * Seekable stream layout
+ *
+ * A compressed dump is a sequence of independent frames, one per chunk,
+ * followed by a seek table in the format of the zstd seekable format
+ * (contrib/seekable_format in the zstd sources):
+ *
+ *   frame 0 | frame 1 | ... | frame N-1 | seek table
+ *
+ *   seek table = u32 0x184D2A5E        skippable frame magic
+ *                u32 N*8 + 9           frame content size
+ *                N * { u32 compressedSize, u32 decompressedSize }
+ *                u32 N                 number of frames
+ *                u8  0                 descriptor (no checksums)
+ *                u32 0x8F92EAB1        seekable magic
+ *
+ * All integers are little endian.  Both zstd and lz4 treat the seek table
+ * as a skippable frame, so the stream also decompresses with the stock
+ * zstd and lz4 tools.
+ */
+
+#define SEEK_TABLE_SKIPPABLE_MAGIC 0x184D2A5E
+#define SEEK_TABLE_SEEKABLE_MAGIC  0x8F92EAB1
+#define SEEK_TABLE_FOOTER_SIZE     9
+
+typedef struct {
+    NvU32 compressedSize;
+    NvU32 decompressedSize;
+} SeekTableEntry;
+
+typedef struct {
+    SeekTableEntry *entries;
+    NvU32           count;
+    NvU32           capacity;
+} SeekTable;
+
+void seekTableAppend(SeekTable *table, NvU32 compressedSize,
+                     NvU32 decompressedSize);
+void seekTableFree(SeekTable *table);
+
+//
+// Writes the seek table at offset.  Returns the number of bytes written, or 0
+// on failure.
+//
+NvLength seekTableWrite(const SeekTable *table, int fd, NvU64 offset);
+
+//
+// Reads the seek table from the end of the file.  Returns 0 on success, -1 if
+// the file does not end in a valid seek table.
+//
+int seekTableRead(int fd, SeekTable *table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,622 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#include "daemon.h"
+#include "gpulock.h"
+#include "uvm.h"
+#include "common-utils.h"
+#include "msg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Streamed jobs up to this size skip the pipeline and go out in one copy.
+#define DAEMON_DIRECT_BYTES (1024*1024)
+
+typedef struct {
+    const DaemonConfig *config;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    int                 listenFd;
+    int                 stopping;
+    int                *clients;     // open connections
+    unsigned int        numClients;
+    unsigned int        maxClients;
+    void              **buffers;     // idle DAEMON_DIRECT_BYTES staging buffers
+    unsigned int        numBuffers;
+} DaemonState;
+
+typedef struct {
+    DaemonState *state;
+    int          fd;
+} DaemonConnection;
+
+static int daemonReadAll(int fd, void *buf, NvLength len) {
+    char *p = buf;
+
+    while (len) {
+        ssize_t ret = recv(fd, p, len, 0);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        p   += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+static int daemonWriteAll(int fd, const void *buf, NvLength len) {
+    const char *p = buf;
+
+    while (len) {
+        ssize_t ret = send(fd, p, len, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        p   += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+static int daemonSendReply(int fd, RM_STATUS status, unsigned long long size,
+                           NvU64 start) {
+    DaemonReply reply;
+
+    reply.magic     = DAEMON_MAGIC;
+    reply.status    = status;
+    reply.size      = size;
+    reply.elapsedNs = start ? acquireNowNs() - start : 0;
+
+    return daemonWriteAll(fd, &reply, sizeof(reply));
+}
+
+//
+// Matches name like -g does: a prefix of the UUID without "GPU-", or the
+// full UUID.  An empty name selects the first GPU.
+//
+static const DaemonGpu *daemonFindGpu(const DaemonConfig *config,
+                                      const char *name) {
+    const DaemonGpu *found = NULL;
+    unsigned int i;
+
+    if (name[0] == '\0')
+        return config->numGpus ? &config->gpus[0] : NULL;
+
+    for (i = 0; i < config->numGpus; i++) {
+        const char *uuid = config->gpus[i].uuid;
+
+        if (strcmp(name, uuid) == 0)
+            return &config->gpus[i];
+        if (strncmp(name, uuid + 4, strlen(name)) == 0) {
+            if (found)
+                return NULL;
+            found = &config->gpus[i];
+        }
+    }
+
+    return found;
+}
+
+static RM_STATUS daemonCheckRange(const DaemonGpu *gpu,
+                                  unsigned long long offset,
+                                  unsigned long long size) {
+    const long pageSize = sysconf(_SC_PAGE_SIZE);
+
+    if (offset % pageSize || size % pageSize || size == 0)
+        return RM_ERR_INVALID_ARGUMENT;
+    if (offset > gpu->fbSize || size > gpu->fbSize - offset)
+        return RM_ERR_INVALID_ADDRESS;
+
+    return RM_OK;
+}
+
+//
+// Staging for direct copies is kept across jobs and connections.  Like the
+// acquire ring it is populated up front, so the copy never faults.
+//
+static void *daemonGetBuffer(DaemonState *state) {
+    void *buf = NULL;
+
+    pthread_mutex_lock(&state->lock);
+    if (state->numBuffers)
+        buf = state->buffers[--state->numBuffers];
+    pthread_mutex_unlock(&state->lock);
+
+    if (!buf) {
+        buf = mmap(NULL, DAEMON_DIRECT_BYTES, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+        if (buf == MAP_FAILED)
+            return NULL;
+    }
+
+    return buf;
+}
+
+static void daemonPutBuffer(DaemonState *state, void *buf) {
+    pthread_mutex_lock(&state->lock);
+    state->buffers = nvrealloc(state->buffers,
+                               (state->numBuffers + 1) * sizeof(void *));
+    state->buffers[state->numBuffers++] = buf;
+    pthread_mutex_unlock(&state->lock);
+}
+
+//
+// Sends the range back over the connection.  Returns -1 if the connection
+// can no longer be used.
+//
+static int daemonStream(DaemonConnection *conn, const DaemonGpu *gpu,
+                        const DaemonRequest *req, NvU64 start) {
+    AcquireParams params = conn->state->config->params;
+    RM_STATUS rmStatus;
+
+    if (req->size <= DAEMON_DIRECT_BYTES) {
+        void *buf = daemonGetBuffer(conn->state);
+        int ret;
+
+        if (!buf)
+            return daemonSendReply(conn->fd, RM_ERR_NO_MEMORY, 0, start);
+
+        rmStatus = UvmDumpGpuMemoryEx((UvmGpuUuid *)&gpu->uvmUuid, buf,
+                                      req->offset, req->size,
+                                      params.blockBytes, 0);
+        if (rmStatus != RM_OK) {
+            ret = daemonSendReply(conn->fd, rmStatus, 0, start);
+        } else if (daemonSendReply(conn->fd, RM_OK, req->size, 0) ||
+                   daemonWriteAll(conn->fd, buf, req->size)) {
+            ret = -1;
+        } else {
+            ret = daemonSendReply(conn->fd, RM_OK, req->size, start);
+        }
+
+        daemonPutBuffer(conn->state, buf);
+        return ret;
+    }
+
+    if (daemonSendReply(conn->fd, RM_OK, req->size, 0))
+        return -1;
+
+    params.gpuUuid     = (UvmGpuUuid *)&gpu->uvmUuid;
+    params.baseAddress = req->offset;
+    params.sizeBytes   = req->size;
+    params.outFd       = conn->fd;
+    params.outOffset   = 0;
+    params.stream      = 1;
+    params.compression = COMPRESS_NONE;
+    params.hash        = HASH_NONE;
+    params.sparse      = 0;
+    params.name        = gpu->uuid;
+
+    // The client is owed size bytes; all it can be told now is EOF.
+    rmStatus = acquireRange(&params, NULL);
+    if (rmStatus != RM_OK) {
+        nv_error_msg("%s: streaming 0x%llx-0x%llx failed (status 0x%x).\n",
+                     gpu->uuid, req->offset, req->offset + req->size,
+                     rmStatus);
+        return -1;
+    }
+
+    return daemonSendReply(conn->fd, RM_OK, req->size, start);
+}
+
+static int daemonWriteFile(DaemonConnection *conn, const DaemonGpu *gpu,
+                           const DaemonRequest *req, const char *path,
+                           NvU64 start) {
+    AcquireParams params = conn->state->config->params;
+    AcquireStats stats;
+    RM_STATUS rmStatus;
+    int fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        nv_error_msg("Failed to create %s: %s.\n", path, strerror(errno));
+        return daemonSendReply(conn->fd, RM_ERR_INVALID_PATH, 0, start);
+    }
+
+    params.gpuUuid     = (UvmGpuUuid *)&gpu->uvmUuid;
+    params.baseAddress = req->offset;
+    params.sizeBytes   = req->size;
+    params.outFd       = fd;
+    params.outOffset   = 0;
+    params.hash        = HASH_NONE;
+    params.name        = gpu->uuid;
+
+    memset(&stats, 0, sizeof(stats));
+    if (params.compression == COMPRESS_NONE && ftruncate(fd, req->size))
+        rmStatus = RM_ERROR;
+    else
+        rmStatus = acquireRange(&params, &stats);
+
+    if (fsync(fd) && rmStatus == RM_OK)
+        rmStatus = RM_ERROR;
+    close(fd);
+
+    return daemonSendReply(conn->fd, rmStatus, stats.bytesWritten, start);
+}
+
+static int daemonHandleDump(DaemonConnection *conn, DaemonRequest *req) {
+    NvU64 start = acquireNowNs();
+    const DaemonGpu *gpu;
+    RM_STATUS rmStatus = RM_OK;
+    GpuLock lock = { -1, 0, NULL };
+    char *path = NULL;
+    int ret;
+
+    if (!(req->flags & DAEMON_FLAG_STREAM)) {
+        if (req->pathLength == 0 || req->pathLength > DAEMON_MAX_PATH)
+            return -1;
+        path = nvalloc(req->pathLength + 1);
+        if (daemonReadAll(conn->fd, path, req->pathLength)) {
+            nvfree(path);
+            return -1;
+        }
+    }
+
+    req->gpu[DAEMON_GPU_BYTES - 1] = '\0';
+    gpu = daemonFindGpu(conn->state->config, req->gpu);
+    if (!gpu)
+        rmStatus = RM_ERR_INVALID_INDEX;
+    else
+        rmStatus = daemonCheckRange(gpu, req->offset, req->size);
+
+    // A job that can't get the GPU in time is answered with BUSY_RETRY.
+    if (rmStatus == RM_OK && conn->state->config->lockDir &&
+        gpuLockAcquire(conn->state->config->lockDir, gpu->uuid,
+                       conn->state->config->lockTimeoutNs, &lock))
+        rmStatus = RM_ERR_BUSY_RETRY;
+
+    if (rmStatus != RM_OK)
+        ret = daemonSendReply(conn->fd, rmStatus, 0, start);
+    else if (!path)
+        ret = daemonStream(conn, gpu, req, start);
+    else
+        ret = daemonWriteFile(conn, gpu, req, path, start);
+
+    gpuLockRelease(&lock);
+    nvfree(path);
+    return ret;
+}
+
+//
+// Stops accepting connections and makes every connection return once its
+// current job is done.  Called with state->lock held.
+//
+static void daemonStop(DaemonState *state) {
+    unsigned int i;
+
+    state->stopping = 1;
+    shutdown(state->listenFd, SHUT_RDWR);
+    for (i = 0; i < state->numClients; i++)
+        shutdown(state->clients[i], SHUT_RD);
+}
+
+static void *daemonConnectionThread(void *arg) {
+    DaemonConnection *conn = arg;
+    DaemonState *state = conn->state;
+    DaemonRequest req;
+    unsigned int i;
+
+    while (daemonReadAll(conn->fd, &req, sizeof(req)) == 0) {
+        if (req.magic != DAEMON_MAGIC || req.version != DAEMON_VERSION) {
+            daemonSendReply(conn->fd, RM_ERR_NOT_SUPPORTED, 0, 0);
+            break;
+        }
+
+        if (req.op == DAEMON_OP_DUMP) {
+            if (daemonHandleDump(conn, &req))
+                break;
+        } else if (req.op == DAEMON_OP_PING) {
+            if (daemonSendReply(conn->fd, RM_OK, 0, 0))
+                break;
+        } else if (req.op == DAEMON_OP_SHUTDOWN) {
+            daemonSendReply(conn->fd, RM_OK, 0, 0);
+            pthread_mutex_lock(&state->lock);
+            daemonStop(state);
+            pthread_mutex_unlock(&state->lock);
+            break;
+        } else if (daemonSendReply(conn->fd, RM_ERR_NOT_SUPPORTED, 0, 0)) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&state->lock);
+    for (i = 0; i < state->numClients; i++) {
+        if (state->clients[i] == conn->fd) {
+            state->clients[i] = state->clients[--state->numClients];
+            break;
+        }
+    }
+    close(conn->fd);
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->lock);
+
+    nvfree(conn);
+    return NULL;
+}
+
+static int daemonAddress(const char *socketPath, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr->sun_path)) {
+        nv_error_msg("Socket path %s is too long.\n", socketPath);
+        return -1;
+    }
+    strcpy(addr->sun_path, socketPath);
+    return 0;
+}
+
+//
+// Creates the listening socket, replacing a stale socket file left by a
+// daemon that is no longer running.  Only the owner may connect.
+//
+static int daemonListen(const char *socketPath) {
+    struct sockaddr_un addr;
+    struct stat st;
+    mode_t mask;
+    int fd, ret;
+
+    if (daemonAddress(socketPath, &addr))
+        return -1;
+
+    if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+        close(fd);
+        if (ret == 0) {
+            nv_error_msg("A daemon is already listening on %s.\n", socketPath);
+            return -1;
+        }
+        unlink(socketPath);
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        nv_error_msg("Failed to create a socket: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    mask = umask(0077);
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+
+    if (ret || listen(fd, 16)) {
+        nv_error_msg("Failed to listen on %s: %s.\n", socketPath,
+                     strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int daemonServe(const DaemonConfig *config) {
+    DaemonState state;
+    pthread_attr_t attr;
+
+    memset(&state, 0, sizeof(state));
+    state.config   = config;
+    state.listenFd = daemonListen(config->socketPath);
+    if (state.listenFd < 0)
+        return -1;
+
+    // Streamed jobs write to the socket, and a client may hang up at any time.
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cond, NULL);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while (1) {
+        DaemonConnection *conn;
+        pthread_t thread;
+        int fd = accept(state.listenFd, NULL, NULL);
+
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            pthread_mutex_lock(&state.lock);
+            if (!state.stopping) {
+                nv_error_msg("Failed to accept a connection: %s.\n",
+                             strerror(errno));
+                daemonStop(&state);
+            }
+            pthread_mutex_unlock(&state.lock);
+            break;
+        }
+
+        conn = nvalloc(sizeof(*conn));
+        conn->state = &state;
+        conn->fd    = fd;
+
+        pthread_mutex_lock(&state.lock);
+        if (state.numClients == state.maxClients) {
+            state.maxClients = state.maxClients ? state.maxClients * 2 : 16;
+            state.clients = nvrealloc(state.clients,
+                                      state.maxClients * sizeof(int));
+        }
+        state.clients[state.numClients++] = fd;
+        if (state.stopping)
+            shutdown(fd, SHUT_RD);
+
+        if (pthread_create(&thread, &attr, daemonConnectionThread, conn)) {
+            nv_error_msg("Failed to start a connection thread.\n");
+            state.numClients--;
+            close(fd);
+            nvfree(conn);
+        }
+        pthread_mutex_unlock(&state.lock);
+    }
+
+    // UVM may only be torn down once no job is using it.
+    pthread_mutex_lock(&state.lock);
+    while (state.numClients)
+        pthread_cond_wait(&state.cond, &state.lock);
+    pthread_mutex_unlock(&state.lock);
+
+    close(state.listenFd);
+    unlink(config->socketPath);
+    pthread_attr_destroy(&attr);
+    pthread_cond_destroy(&state.cond);
+    pthread_mutex_destroy(&state.lock);
+    nvfree(state.clients);
+    while (state.numBuffers)
+        munmap(state.buffers[--state.numBuffers], DAEMON_DIRECT_BYTES);
+    nvfree(state.buffers);
+
+    return 0;
+}
+
+int daemonConnect(const char *socketPath) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (daemonAddress(socketPath, &addr))
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        nv_error_msg("Cannot connect to %s: %s.\n", socketPath,
+                     strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int daemonRequest(int sock, DaemonOp op, NvU32 flags, const char *gpu,
+                         unsigned long long offset, NvLength size,
+                         const char *path) {
+    DaemonRequest req;
+
+    memset(&req, 0, sizeof(req));
+    req.magic      = DAEMON_MAGIC;
+    req.version    = DAEMON_VERSION;
+    req.op         = op;
+    req.flags      = flags;
+    req.pathLength = path ? strlen(path) : 0;
+    req.offset     = offset;
+    req.size       = size;
+    if (gpu) {
+        if (strlen(gpu) >= DAEMON_GPU_BYTES)
+            return -1;
+        strcpy(req.gpu, gpu);
+    }
+
+    if (daemonWriteAll(sock, &req, sizeof(req)))
+        return -1;
+    if (path && daemonWriteAll(sock, path, req.pathLength))
+        return -1;
+
+    return 0;
+}
+
+static RM_STATUS daemonReadReply(int sock, DaemonReply *reply) {
+    if (daemonReadAll(sock, reply, sizeof(*reply)) ||
+        reply->magic != DAEMON_MAGIC)
+        return RM_ERROR;
+
+    return reply->status;
+}
+
+RM_STATUS daemonDumpStream(int sock, const char *gpu,
+                           unsigned long long offset, NvLength size,
+                           int (*sink)(void *ctx, const void *buf,
+                                       NvLength len),
+                           void *ctx, DaemonReply *reply) {
+    DaemonReply localReply;
+    RM_STATUS rmStatus;
+    unsigned long long left;
+    void *buf;
+
+    if (!reply)
+        reply = &localReply;
+
+    if (daemonRequest(sock, DAEMON_OP_DUMP, DAEMON_FLAG_STREAM, gpu, offset,
+                      size, NULL))
+        return RM_ERROR;
+
+    rmStatus = daemonReadReply(sock, reply);
+    if (rmStatus != RM_OK)
+        return rmStatus;
+
+    buf = nvalloc(DAEMON_DIRECT_BYTES);
+    for (left = reply->size; left; ) {
+        NvLength len = NV_MIN(left, DAEMON_DIRECT_BYTES);
+
+        if (daemonReadAll(sock, buf, len) || sink(ctx, buf, len)) {
+            nvfree(buf);
+            return RM_ERROR;
+        }
+        left -= len;
+    }
+    nvfree(buf);
+
+    return daemonReadReply(sock, reply);
+}
+
+RM_STATUS daemonDumpToPath(int sock, const char *gpu,
+                           unsigned long long offset, NvLength size,
+                           const char *path, DaemonReply *reply) {
+    DaemonReply localReply;
+
+    if (strlen(path) == 0 || strlen(path) > DAEMON_MAX_PATH)
+        return RM_ERR_INVALID_PATH;
+
+    if (daemonRequest(sock, DAEMON_OP_DUMP, 0, gpu, offset, size, path))
+        return RM_ERROR;
+
+    return daemonReadReply(sock, reply ? reply : &localReply);
+}
+
+RM_STATUS daemonPing(int sock) {
+    DaemonReply reply;
+
+    if (daemonRequest(sock, DAEMON_OP_PING, 0, NULL, 0, 0, NULL))
+        return RM_ERROR;
+
+    return daemonReadReply(sock, &reply);
+}
+
+RM_STATUS daemonShutdown(int sock) {
+    DaemonReply reply;
+
+    if (daemonRequest(sock, DAEMON_OP_SHUTDOWN, 0, NULL, 0, 0, NULL))
+        return RM_ERROR;
+
+    return daemonReadReply(sock, &reply);
+}
@@ -0,0 +1,130 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+#include "acquire.h"
+
+/*******************************************************************************
+    Dump daemon
+
+    dump_fb --daemon initializes NVML and UVM once and then serves dump jobs
+    over a Unix socket, so a job only pays for the copy itself.
+
+    A client sends a DaemonRequest, followed by pathLength bytes of output
+    path for DAEMON_OP_DUMP without DAEMON_FLAG_STREAM.  Every request is
+    answered with a DaemonReply.  A streamed dump is answered with a reply
+    whose size is the number of bytes that follow, then the bytes, then a
+    second reply with the final status.  If the copy fails once bytes have
+    been sent the daemon closes the connection instead.  Several requests
+    may be sent over one connection.  All fields are in host byte order.
+*/
+
+#define DAEMON_MAGIC        0x44424644u   // "DFBD"
+#define DAEMON_VERSION      1
+#define DAEMON_GPU_BYTES    96            // partial UUID, as for -g
+#define DAEMON_MAX_PATH     4096
+
+typedef enum {
+    DAEMON_OP_PING     = 1,
+    DAEMON_OP_DUMP     = 2,
+    DAEMON_OP_SHUTDOWN = 3,
+} DaemonOp;
+
+// Send the bytes back over the socket instead of writing them to a path.
+#define DAEMON_FLAG_STREAM  0x1
+
+typedef struct {
+    NvU32              magic;
+    NvU16              version;
+    NvU16              op;
+    NvU32              flags;
+    NvU32              pathLength;
+    unsigned long long offset;
+    unsigned long long size;
+    char               gpu[DAEMON_GPU_BYTES];  // NUL terminated, "" = first
+} DaemonRequest;
+
+typedef struct {
+    NvU32              magic;
+    NvU32              status;     // RM_STATUS
+    unsigned long long size;       // bytes that follow, or bytes written
+    unsigned long long elapsedNs;  // time the daemon spent on the job
+} DaemonReply;
+
+typedef struct {
+    char       *uuid;      // full nvml UUID, "GPU-..."
+    UvmGpuUuid  uvmUuid;
+    NvLength    fbSize;
+} DaemonGpu;
+
+typedef struct {
+    const char   *socketPath;
+    DaemonGpu    *gpus;
+    unsigned int  numGpus;
+    AcquireParams params;  // chunking and compression of every job
+    const char   *lockDir;        // if set, lock the GPU for each job (gpulock.h)
+    NvU64         lockTimeoutNs;  // 0 waits forever
+} DaemonConfig;
+
+//
+// Serves requests on config->socketPath until a client sends
+// DAEMON_OP_SHUTDOWN.  UVM must already be initialized.  Each connection is
+// handled by its own thread.  Returns 0 after a clean shutdown, -1 if the
+// socket could not be set up.
+//
+int daemonServe(const DaemonConfig *config);
+
+// Returns a connected socket, or -1 after printing an error.
+int daemonConnect(const char *socketPath);
+
+//
+// Client side of DAEMON_OP_DUMP.  daemonDumpStream passes each part of the
+// range to sink as it arrives; sink returns non-zero to give up.
+// daemonDumpToPath has the daemon write the range to path, which is
+// resolved by the daemon.  Both return the status reported by the daemon, or
+// RM_ERROR if the connection failed, and fill reply if it is non-NULL.
+//
+RM_STATUS daemonDumpStream(int sock, const char *gpu,
+                           unsigned long long offset, NvLength size,
+                           int (*sink)(void *ctx, const void *buf,
+                                       NvLength len),
+                           void *ctx, DaemonReply *reply);
+
+RM_STATUS daemonDumpToPath(int sock, const char *gpu,
+                           unsigned long long offset, NvLength size,
+                           const char *path, DaemonReply *reply);
+
+RM_STATUS daemonPing(int sock);
+RM_STATUS daemonShutdown(int sock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
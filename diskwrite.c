@@ -0,0 +1,566 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#define _GNU_SOURCE     // pwritev
+
+#include "diskwrite.h"
+#include "common-utils.h"
+#include "msg.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int         fd;
+    const char *buf;
+    size_t      len;
+    off_t       offset;
+    void       *userData;
+    int         error;
+    int         next;       // link in the free, queued or completed list
+    struct iovec iov;       // read by io_uring until the write completes
+} DiskWrite;
+
+// The queue of writes served by one or more threads.
+typedef struct {
+    DiskWriter *writer;
+    int         queued;     // oldest write waiting for a thread
+    int         queuedTail;
+} DiskWriterLane;
+
+struct DiskWriter_tag {
+    DiskWriterEngine     engine;
+    int                  fd;
+    unsigned int         depth;
+    unsigned int         inFlight;
+    DiskWrite           *writes;        // depth entries
+    int                  freeList;      // -1 terminates every list
+
+    // DISK_WRITER_URING
+    int                  ringFd;
+    void                *sqRing;
+    void                *cqRing;
+    size_t               sqRingBytes;
+    size_t               cqRingBytes;
+    struct io_uring_sqe *sqes;
+    size_t               sqesBytes;
+    unsigned int        *sqHead;
+    unsigned int        *sqTail;
+    unsigned int        *sqMask;
+    unsigned int        *sqArray;
+    unsigned int        *cqHead;
+    unsigned int        *cqTail;
+    unsigned int        *cqMask;
+    struct io_uring_cqe *cqes;
+
+    // DISK_WRITER_THREADS
+    pthread_t           *threads;
+    unsigned int         numThreads;
+    DiskWriterLane      *lanes;
+    unsigned int         numLanes;
+    pthread_mutex_t      lock;
+    pthread_cond_t       cond;
+    int                  completed;
+    int                  stop;
+};
+
+static const char *g_diskWriterEngineNames[] = {
+    [DISK_WRITER_AUTO]    = "auto",
+    [DISK_WRITER_URING]   = "uring",
+    [DISK_WRITER_THREADS] = "threads",
+};
+
+int diskWriterParseEngine(const char *name, DiskWriterEngine *engine) {
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_LEN(g_diskWriterEngineNames); i++) {
+        if (!strcasecmp(name, g_diskWriterEngineNames[i])) {
+            *engine = (DiskWriterEngine)i;
+            return 0;
+        }
+    }
+
+    nv_error_msg("Unknown I/O engine '%s'; use auto, uring or threads.\n",
+                 name);
+    return -1;
+}
+
+const char *diskWriterEngineName(DiskWriterEngine engine) {
+    if ((unsigned int)engine < ARRAY_LEN(g_diskWriterEngineNames))
+        return g_diskWriterEngineNames[engine];
+    return "unknown";
+}
+
+// Returns 0, or the errno of the failure.
+static int diskWriteAll(int fd, const char *buf, size_t len, off_t offset) {
+    struct iovec iov;
+
+    while (len) {
+        ssize_t ret;
+
+        iov.iov_base = (void *)buf;
+        iov.iov_len  = len;
+        ret = pwritev(fd, &iov, 1, offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            return errno;
+        if (ret == 0)
+            return EIO;
+        buf    += ret;
+        len    -= ret;
+        offset += ret;
+    }
+
+    return 0;
+}
+
+static void diskWriterUringTeardown(DiskWriter *writer) {
+    if (writer->sqes && writer->sqes != MAP_FAILED)
+        munmap(writer->sqes, writer->sqesBytes);
+    if (writer->cqRing && writer->cqRing != MAP_FAILED &&
+        writer->cqRing != writer->sqRing)
+        munmap(writer->cqRing, writer->cqRingBytes);
+    if (writer->sqRing && writer->sqRing != MAP_FAILED)
+        munmap(writer->sqRing, writer->sqRingBytes);
+    if (writer->ringFd >= 0)
+        close(writer->ringFd);
+    writer->ringFd = -1;
+}
+
+static int diskWriterUringSetup(DiskWriter *writer) {
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    writer->ringFd = syscall(__NR_io_uring_setup, writer->depth, &p);
+    if (writer->ringFd < 0)
+        return -1;
+
+    writer->sqRingBytes = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    writer->cqRingBytes = p.cq_off.cqes +
+                          p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        writer->sqRingBytes = NV_MAX(writer->sqRingBytes, writer->cqRingBytes);
+        writer->cqRingBytes = writer->sqRingBytes;
+    }
+
+    writer->sqRing = mmap(NULL, writer->sqRingBytes, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, writer->ringFd,
+                          IORING_OFF_SQ_RING);
+    if (writer->sqRing == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        writer->cqRing = writer->sqRing;
+    } else {
+        writer->cqRing = mmap(NULL, writer->cqRingBytes,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, writer->ringFd,
+                              IORING_OFF_CQ_RING);
+        if (writer->cqRing == MAP_FAILED)
+            goto fail;
+    }
+
+    writer->sqesBytes = p.sq_entries * sizeof(struct io_uring_sqe);
+    writer->sqes = mmap(NULL, writer->sqesBytes, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, writer->ringFd,
+                        IORING_OFF_SQES);
+    if (writer->sqes == MAP_FAILED)
+        goto fail;
+
+    writer->sqHead  = (unsigned int *)((char *)writer->sqRing +
+                                       p.sq_off.head);
+    writer->sqTail  = (unsigned int *)((char *)writer->sqRing +
+                                       p.sq_off.tail);
+    writer->sqMask  = (unsigned int *)((char *)writer->sqRing +
+                                       p.sq_off.ring_mask);
+    writer->sqArray = (unsigned int *)((char *)writer->sqRing +
+                                       p.sq_off.array);
+    writer->cqHead  = (unsigned int *)((char *)writer->cqRing +
+                                       p.cq_off.head);
+    writer->cqTail  = (unsigned int *)((char *)writer->cqRing +
+                                       p.cq_off.tail);
+    writer->cqMask  = (unsigned int *)((char *)writer->cqRing +
+                                       p.cq_off.ring_mask);
+    writer->cqes    = (struct io_uring_cqe *)((char *)writer->cqRing +
+                                              p.cq_off.cqes);
+    return 0;
+
+fail:
+    diskWriterUringTeardown(writer);
+    return -1;
+}
+
+static void *diskWriterThread(void *arg) {
+    DiskWriterLane *lane = arg;
+    DiskWriter *writer = lane->writer;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        DiskWrite *w;
+        int id, error;
+
+        while (lane->queued < 0 && !writer->stop)
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        if (lane->queued < 0)
+            break;
+
+        id = lane->queued;
+        w  = &writer->writes[id];
+        lane->queued = w->next;
+        pthread_mutex_unlock(&writer->lock);
+
+        error = diskWriteAll(w->fd, w->buf, w->len, w->offset);
+
+        pthread_mutex_lock(&writer->lock);
+        w->error = error;
+        w->next  = writer->completed;
+        writer->completed = id;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+//
+// Starts numThreads threads over numLanes lanes: a pool of threads sharing
+// one lane, or one thread per lane.
+//
+static int diskWriterThreadsSetup(DiskWriter *writer, unsigned int numLanes,
+                                  unsigned int numThreads) {
+    unsigned int l, t;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    writer->completed = -1;
+    writer->numLanes  = numLanes;
+    writer->lanes     = nvalloc(numLanes * sizeof(DiskWriterLane));
+    writer->threads   = nvalloc(numThreads * sizeof(pthread_t));
+    for (l = 0; l < numLanes; l++) {
+        writer->lanes[l].writer = writer;
+        writer->lanes[l].queued = -1;
+    }
+
+    for (t = 0; t < numThreads; t++) {
+        if (pthread_create(&writer->threads[t], NULL, diskWriterThread,
+                           &writer->lanes[t % numLanes]))
+            break;
+    }
+    writer->numThreads = t;
+
+    // Every lane needs its thread.
+    return t >= numLanes ? 0 : -1;
+}
+
+static void diskWriterThreadsTeardown(DiskWriter *writer) {
+    unsigned int t;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    for (t = 0; t < writer->numThreads; t++)
+        pthread_join(writer->threads[t], NULL);
+    nvfree(writer->threads);
+    nvfree(writer->lanes);
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->lock);
+}
+
+static DiskWriter *diskWriterAlloc(int fd, unsigned int depth) {
+    DiskWriter *writer = nvalloc(sizeof(*writer));
+    unsigned int i;
+
+    writer->fd       = fd;
+    writer->depth    = depth;
+    writer->ringFd   = -1;
+    writer->writes   = nvalloc(depth * sizeof(DiskWrite));
+    writer->freeList = 0;
+    for (i = 0; i < depth; i++)
+        writer->writes[i].next = i + 1 < depth ? (int)(i + 1) : -1;
+
+    return writer;
+}
+
+RM_STATUS diskWriterCreate(int fd, unsigned int depth, DiskWriterEngine engine,
+                           DiskWriter **pWriter) {
+    DiskWriter *writer;
+
+    if (depth == 0 || fd < 0)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    writer = diskWriterAlloc(fd, depth);
+
+    if (engine != DISK_WRITER_THREADS && !diskWriterUringSetup(writer)) {
+        writer->engine = DISK_WRITER_URING;
+    } else if (engine == DISK_WRITER_URING) {
+        nvfree(writer->writes);
+        nvfree(writer);
+        return RM_ERR_NOT_SUPPORTED;
+    } else if (!diskWriterThreadsSetup(writer, 1, depth)) {
+        writer->engine = DISK_WRITER_THREADS;
+    } else {
+        diskWriterThreadsTeardown(writer);
+        nvfree(writer->writes);
+        nvfree(writer);
+        return RM_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    *pWriter = writer;
+    return RM_OK;
+}
+
+RM_STATUS diskWriterCreateLanes(unsigned int lanes, unsigned int depth,
+                                DiskWriter **pWriter) {
+    DiskWriter *writer;
+
+    if (depth == 0 || lanes == 0)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    writer = diskWriterAlloc(-1, depth);
+    writer->engine = DISK_WRITER_THREADS;
+
+    if (diskWriterThreadsSetup(writer, lanes, lanes)) {
+        diskWriterThreadsTeardown(writer);
+        nvfree(writer->writes);
+        nvfree(writer);
+        return RM_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    *pWriter = writer;
+    return RM_OK;
+}
+
+DiskWriterEngine diskWriterEngine(const DiskWriter *writer) {
+    return writer->engine;
+}
+
+unsigned int diskWriterInFlight(const DiskWriter *writer) {
+    return writer->inFlight;
+}
+
+unsigned int diskWriterDepth(const DiskWriter *writer) {
+    return writer->depth;
+}
+
+//
+// Writes go out as IORING_OP_WRITEV, which io_uring has had from the start
+// (Linux 5.1); IORING_OP_WRITE only came with 5.6.
+//
+// The kernel only reads the submission queue inside io_uring_enter, so when
+// that fails before taking the entry it is withdrawn again, and the write
+// was never issued.  An entry the kernel did take completes as usual.
+//
+static int diskWriterUringSubmit(DiskWriter *writer, int id) {
+    DiskWrite *w = &writer->writes[id];
+    unsigned int tail = *writer->sqTail;
+    unsigned int index = tail & *writer->sqMask;
+    struct io_uring_sqe *sqe = &writer->sqes[index];
+    int ret;
+
+    w->iov.iov_base = (void *)w->buf;
+    w->iov.iov_len  = w->len;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_WRITEV;
+    sqe->fd        = w->fd;
+    sqe->addr      = (unsigned long)&w->iov;
+    sqe->len       = 1;
+    sqe->off       = w->offset;
+    sqe->user_data = id;
+    writer->sqArray[index] = index;
+    __atomic_store_n(writer->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    do {
+        ret = syscall(__NR_io_uring_enter, writer->ringFd, 1, 0, 0, NULL, 0);
+    } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+    if (ret <= 0 && __atomic_load_n(writer->sqHead, __ATOMIC_ACQUIRE) == tail) {
+        __atomic_store_n(writer->sqTail, tail, __ATOMIC_RELEASE);
+        if (ret == 0)
+            errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+int diskWriterSubmit(DiskWriter *writer, const void *buf, size_t len,
+                     off_t offset, void *userData) {
+    return diskWriterSubmitTo(writer, 0, writer->fd, buf, len, offset,
+                              userData);
+}
+
+int diskWriterSubmitTo(DiskWriter *writer, unsigned int lane, int fd,
+                       const void *buf, size_t len, off_t offset,
+                       void *userData) {
+    DiskWrite *w;
+    int id = writer->freeList;
+
+    if (writer->engine == DISK_WRITER_THREADS && lane >= writer->numLanes) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (id < 0) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    // io_uring takes 32-bit lengths.
+    if (writer->engine == DISK_WRITER_URING && len > 0x7ffff000) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    w = &writer->writes[id];
+    writer->freeList = w->next;
+    w->fd       = fd;
+    w->buf      = buf;
+    w->len      = len;
+    w->offset   = offset;
+    w->userData = userData;
+    w->error    = 0;
+    w->next     = -1;
+
+    if (writer->engine == DISK_WRITER_URING) {
+        if (diskWriterUringSubmit(writer, id)) {
+            w->next = writer->freeList;
+            writer->freeList = id;
+            return -1;
+        }
+    } else {
+        DiskWriterLane *l = &writer->lanes[lane];
+
+        pthread_mutex_lock(&writer->lock);
+        if (l->queued < 0)
+            l->queued = id;
+        else
+            writer->writes[l->queuedTail].next = id;
+        l->queuedTail = id;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->lock);
+    }
+
+    writer->inFlight++;
+    return 0;
+}
+
+static void diskWriterComplete(DiskWriter *writer, int id,
+                               DiskWriteCompletion *completion) {
+    DiskWrite *w = &writer->writes[id];
+
+    completion->userData = w->userData;
+    completion->error    = w->error;
+    w->next = writer->freeList;
+    writer->freeList = id;
+    writer->inFlight--;
+}
+
+// A short write is finished synchronously.
+static unsigned int diskWriterUringReap(DiskWriter *writer,
+                                        DiskWriteCompletion *completions,
+                                        unsigned int max, int wait) {
+    unsigned int n = 0;
+
+    for (;;) {
+        unsigned int head = *writer->cqHead;
+        unsigned int tail = __atomic_load_n(writer->cqTail, __ATOMIC_ACQUIRE);
+
+        while (head != tail && n < max) {
+            const struct io_uring_cqe *cqe =
+                &writer->cqes[head & *writer->cqMask];
+            DiskWrite *w = &writer->writes[cqe->user_data];
+            int res = cqe->res;
+
+            if (res < 0)
+                w->error = -res;
+            else if ((size_t)res < w->len)
+                w->error = diskWriteAll(w->fd, w->buf + res,
+                                        w->len - res, w->offset + res);
+            diskWriterComplete(writer, cqe->user_data, &completions[n++]);
+            head++;
+        }
+        __atomic_store_n(writer->cqHead, head, __ATOMIC_RELEASE);
+
+        if (n || !wait || !writer->inFlight)
+            return n;
+
+        syscall(__NR_io_uring_enter, writer->ringFd, 0, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+}
+
+static unsigned int diskWriterThreadsReap(DiskWriter *writer,
+                                          DiskWriteCompletion *completions,
+                                          unsigned int max, int wait) {
+    unsigned int n = 0;
+
+    pthread_mutex_lock(&writer->lock);
+    while (wait && writer->completed < 0 && writer->inFlight)
+        pthread_cond_wait(&writer->cond, &writer->lock);
+
+    while (writer->completed >= 0 && n < max) {
+        int id = writer->completed;
+
+        writer->completed = writer->writes[id].next;
+        diskWriterComplete(writer, id, &completions[n++]);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return n;
+}
+
+unsigned int diskWriterReap(DiskWriter *writer,
+                            DiskWriteCompletion *completions,
+                            unsigned int max, int wait) {
+    if (writer->engine == DISK_WRITER_URING)
+        return diskWriterUringReap(writer, completions, max, wait);
+    return diskWriterThreadsReap(writer, completions, max, wait);
+}
+
+void diskWriterDestroy(DiskWriter *writer) {
+    DiskWriteCompletion completion;
+
+    if (!writer)
+        return;
+
+    while (writer->inFlight)
+        diskWriterReap(writer, &completion, 1, 1);
+
+    if (writer->engine == DISK_WRITER_URING)
+        diskWriterUringTeardown(writer);
+    else
+        diskWriterThreadsTeardown(writer);
+    nvfree(writer->writes);
+    nvfree(writer);
+}
@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _DISKWRITE_H_
+#define _DISKWRITE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+/*******************************************************************************
+    Asynchronous output writes
+
+    A DiskWriter keeps up to depth writes to one file in flight, so the
+    writer thread can hand over a chunk and go on with the next one instead
+    of waiting for the disk.  Together with O_DIRECT the writes bypass the
+    page cache, which keeps the dump from building up gigabytes of dirty
+    pages that the kernel later flushes in one burst.
+
+    DISK_WRITER_URING submits the writes to an io_uring, set up with the
+    raw system calls, as IORING_OP_WRITEV so that any kernel with io_uring
+    (5.1 and later) takes them.  DISK_WRITER_THREADS runs them on a pool of depth
+    threads with pwritev, for kernels without io_uring or where it is
+    disabled.  DISK_WRITER_AUTO tries io_uring first.
+
+    Buffers must stay untouched until their completion has been reaped.
+*/
+
+typedef enum {
+    DISK_WRITER_AUTO = 0,
+    DISK_WRITER_URING,
+    DISK_WRITER_THREADS,
+} DiskWriterEngine;
+
+typedef struct {
+    void *userData;
+    int   error;        // 0, or the errno of the failed write
+} DiskWriteCompletion;
+
+typedef struct DiskWriter_tag DiskWriter;
+
+// Parses "auto", "uring" or "threads".  Returns 0, or -1 after an error.
+int diskWriterParseEngine(const char *name, DiskWriterEngine *engine);
+const char *diskWriterEngineName(DiskWriterEngine engine);
+
+//
+// Creates a writer for fd with at most depth writes in flight.  Returns
+// RM_OK, RM_ERR_NOT_SUPPORTED if DISK_WRITER_URING was asked for and is not
+// available, or RM_ERR_INSUFFICIENT_RESOURCES.
+//
+RM_STATUS diskWriterCreate(int fd, unsigned int depth, DiskWriterEngine engine,
+                           DiskWriter **writer);
+
+//
+// Creates a DISK_WRITER_THREADS writer with one thread per lane, for output
+// spread over several disks: the writes of a lane are done in order by its
+// own thread, so each disk sees one sequential writer and a slow one only
+// holds up its own lane.  Writes are submitted with diskWriterSubmitTo.
+//
+RM_STATUS diskWriterCreateLanes(unsigned int lanes, unsigned int depth,
+                                DiskWriter **writer);
+
+// The engine the writer actually uses, never DISK_WRITER_AUTO.
+DiskWriterEngine diskWriterEngine(const DiskWriter *writer);
+
+// Writes in flight, submitted but not yet reaped, out of at most depth.
+unsigned int diskWriterInFlight(const DiskWriter *writer);
+unsigned int diskWriterDepth(const DiskWriter *writer);
+
+//
+// Queues a write of len bytes of buf at offset.  Partial writes are
+// finished before the completion is reported.  Returns 0, or -1 with errno
+// set (EBUSY when depth writes are already in flight).
+//
+int diskWriterSubmit(DiskWriter *writer, const void *buf, size_t len,
+                     off_t offset, void *userData);
+
+// Like diskWriterSubmit, but writes to fd, through lane of a writer with lanes.
+int diskWriterSubmitTo(DiskWriter *writer, unsigned int lane, int fd,
+                       const void *buf, size_t len, off_t offset,
+                       void *userData);
+
+//
+// Moves up to max completions into completions and returns how many.  With
+// wait set, blocks until at least one is available, unless nothing is in
+// flight.
+//
+unsigned int diskWriterReap(DiskWriter *writer,
+                            DiskWriteCompletion *completions,
+                            unsigned int max, int wait);
+
+// Waits for the writes in flight, drops their completions and frees writer.
+void diskWriterDestroy(DiskWriter *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -34,7 +34,18 @@
 //
 
 #include "dump_fb.h"
+#include "acquire.h"
+#include "compress.h"
+#include "hash.h"
+#include "merkle.h"
+#include "ranges.h"
+#include "daemon.h"
+#include "gpulock.h"
+#include "image.h"
+#include "journal.h"
+#include "segment.h"
 #include "uvm.h"
+#include "uvm_sim.h"
 #include "uvmtypes.h"
 #include "nvgetopt.h"
 #include "common-utils.h"
@@ -46,6 +57,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 char * RmErrorNumToString(RM_STATUS rmStatus) {
     switch (rmStatus) {
@@ -111,7 +123,12 @@ char * RmErrorNumToString(RM_STATUS rmStatus) {
 
 int getNumGpus() {
     unsigned int gpuCount = 0;
-    nvmlReturn_t nvmlStatus = nvmlDeviceGetCount(&gpuCount);
+    nvmlReturn_t nvmlStatus;
+
+    if (UvmSimIsEnabled())
+        return UvmSimGetConfig()->numGpus;
+
+    nvmlStatus = nvmlDeviceGetCount(&gpuCount);
     if (nvmlStatus != NVML_SUCCESS) {
         nv_error_msg("Could not get GPU count\n");
         return -1;
@@ -140,11 +157,34 @@ void nvmlUuidToUvmUuid(const char* nvmlUuid, UvmGpuUuid* uvmUuid) {
             (unsigned int*) &uvmUuid->uuid[15]);
 }
 
-const char* getRequestedUuid(const char* uuid) {
-    unsigned int gpuCount = 0;
-    unsigned int i;
-    nvmlReturn_t nvmlStatus;
+char* getGpuUuidByIndex(unsigned int index) {
     char devuuid[NVML_DEVICE_UUID_BUFFER_SIZE];
+    nvmlDevice_t device;
+    nvmlReturn_t nvmlStatus;
+
+    if (UvmSimIsEnabled()) {
+        UvmSimGetGpuUuidString(index, devuuid, sizeof(devuuid));
+        return strdup(devuuid);
+    }
+
+    nvmlStatus = nvmlDeviceGetHandleByIndex(index, &device);
+    if (nvmlStatus != NVML_SUCCESS)  {
+        printf("Could not retrieve device index %d\n", index);
+        return NULL;
+    }
+
+    nvmlStatus = nvmlDeviceGetUUID(device, devuuid, sizeof(devuuid));
+    if (nvmlStatus != NVML_SUCCESS) {
+        printf("Could not retrieve UUID for device index %d\n", index);
+        return NULL;
+    }
+
+    return strdup(devuuid);
+}
+
+const char* getRequestedUuid(const char* uuid) {
+    int gpuCount = 0;
+    int i;
     char *retuuid = NULL;
 
     gpuCount = getNumGpus();
@@ -155,27 +195,21 @@ const char* getRequestedUuid(const char* uuid) {
     }
 
     for (i = 0; i < gpuCount; i++) {
-        nvmlDevice_t device;
-        nvmlStatus = nvmlDeviceGetHandleByIndex(i, &device);
-
-        if (nvmlStatus != NVML_SUCCESS)  {
-            printf("Could not retrieve device index %d\n", i);
-            continue;
-        }
+        char *devuuid = getGpuUuidByIndex(i);
 
-        nvmlStatus = nvmlDeviceGetUUID(device, devuuid, sizeof(devuuid));
-        if (nvmlStatus != NVML_SUCCESS) {
-            printf("Could not retrieve UUID for device index %d\n", i);
+        if (!devuuid)
             continue;
-        }
 
         if (strncmp(uuid, &devuuid[4], strlen(uuid)) == 0) {
             if (retuuid) {
                 printf("Ambiguous UUID fragment\n");
                 free(retuuid);
+                free(devuuid);
                 return NULL;
             }
-            retuuid = strdup(devuuid);
+            retuuid = devuuid;
+        } else {
+            free(devuuid);
         }
     }
 
@@ -186,6 +220,10 @@ const char* getRequestedUuid(const char* uuid) {
 NvLength getFbSize(const char*uuid) {
     nvmlDevice_t device;
     nvmlMemory_t memory;
+
+    if (UvmSimIsEnabled())
+        return UvmSimGetConfig()->fbSize;
+
     if (NVML_SUCCESS != nvmlDeviceGetHandleByUUID(uuid, &device)) {
         nv_error_msg("Couldn't get device by UUID %s\n", uuid);
         return 0;
@@ -199,6 +237,40 @@ NvLength getFbSize(const char*uuid) {
     return memory.total;
 }
 
+enum {
+    SIMULATE_OPTION = 1024,
+    COMPRESS_OPTION,
+    WORKER_THREADS_OPTION,
+    HASH_OPTION,
+    VERIFY_OPTION,
+    SPARSE_OPTION,
+    RANGE_FILE_OPTION,
+    INDEXED_OPTION,
+    DAEMON_OPTION,
+    CONNECT_OPTION,
+    STOP_DAEMON_OPTION,
+    IMAGE_OPTION,
+    BLOCK_SIZE_OPTION,
+    LOCK_DIR_OPTION,
+    LOCK_TIMEOUT_OPTION,
+    NO_LOCK_OPTION,
+    DIRECT_TO_FD_OPTION,
+    STAGING_PAGES_OPTION,
+    MAX_BANDWIDTH_OPTION,
+    MAX_LATENCY_IMPACT_OPTION,
+    JOURNAL_OPTION,
+    RESUME_OPTION,
+    TOLERATE_ERRORS_OPTION,
+    FD_OPTION,
+    SPLICE_OPTION,
+    NO_SPLICE_OPTION,
+    DIRECT_IO_OPTION,
+    IO_ENGINE_OPTION,
+    WRITE_DEPTH_OPTION,
+    SEGMENT_DIRS_OPTION,
+    SEGMENT_SIZE_OPTION,
+};
+
 static const NVGetoptOption __options[] = {
 
     { "help",
@@ -213,6 +285,14 @@ static const NVGetoptOption __options[] = {
       "GPU-UUID",
       "The GPU UUID to extract data from.  To get the available UUIDs,\n"
       "use nvidia-smi -L (DO NOT include the \"GPU-\" prefix!).\n"
+      "A comma separated list of UUIDs dumps those GPUs in parallel.\n"
+    },
+
+    { "all-gpus",
+      'a',
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Dump every GPU in the system in parallel, one worker per GPU.\n"
     },
 
     // Both offset and size are marked as string arguments because nvgetopt
@@ -233,6 +313,34 @@ static const NVGetoptOption __options[] = {
       NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
       "SIZE-BYTES",
       "The number of bytes to extract. This must be a multiple of 4096.\n"
+      "If omitted, everything from the offset to the end of each GPU's\n"
+      "memory is extracted.\n"
+    },
+
+    { "ranges",
+      'r',
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "OFFSET:SIZE[,...]",
+      "Dump several ranges of GPU memory in one run instead of -o/-s.\n"
+      "Offsets and sizes must be multiples of 4096; sizes may end in K, M or\n"
+      "G.  Ranges are sorted and overlapping or adjacent ones merged.  Each\n"
+      "range goes to OUTPUT-FILE.0xOFFSET unless --indexed is given.\n"
+    },
+
+    { "range-file",
+      RANGE_FILE_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "FILE",
+      "Read OFFSET:SIZE ranges from FILE, one per line (# starts a comment).\n"
+      "May be combined with --ranges.\n"
+    },
+
+    { "indexed",
+      INDEXED_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Write all ranges of a GPU back to back into one file and list where\n"
+      "each one is in OUTPUT-FILE.index.\n"
     },
 
     { "file",
@@ -240,7 +348,319 @@ static const NVGetoptOption __options[] = {
       NVGETOPT_STRING_ARGUMENT |NVGETOPT_HELP_ALWAYS,
       "OUTPUT-FILE",
       "The file to write to.  To maintain forensic integrity, the file\n"
-      "must not currently exist.\n"
+      "must not currently exist.  When more than one GPU is dumped, each\n"
+      "GPU is written to OUTPUT-FILE.GPU-UUID.  \"-\" streams the dump to\n"
+      "standard output (see --fd), and messages go to standard error.\n"
+    },
+
+    { "fd",
+      FD_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "FD",
+      "Stream the dump, in order, to the already open file descriptor FD,\n"
+      "e.g. a pipe into a compressor or a socket, instead of a file.  Only\n"
+      "--depth chunks are ever held in memory, however large the dump.  One\n"
+      "GPU and one range only, and raw: cannot be combined with --compress,\n"
+      "--sparse, --image, --hash, --journal or --direct-to-fd.\n"
+    },
+
+    { "splice",
+      SPLICE_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Feed a stream into a pipe with vmsplice, handing over the staging\n"
+      "buffers themselves instead of copying them with write().  A buffer\n"
+      "is reused once the pipe is drained, so this is only safe when the\n"
+      "reader copies the data out with read(): a reader that passes it on\n"
+      "with splice() or tee(), as pv does into another pipe, gets later\n"
+      "chunks in place of earlier ones.\n"
+    },
+
+    { "no-splice",
+      NO_SPLICE_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Copy streams into pipes with write(), the default; undoes --splice.\n"
+    },
+
+    { "direct-io",
+      DIRECT_IO_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Preallocate OUTPUT-FILE and write it with O_DIRECT, several chunks\n"
+      "at a time, so a large dump does not fill the page cache with dirty\n"
+      "pages.  Only raw dumps: cannot be combined with --compress,\n"
+      "--sparse, --image, --direct-to-fd, --daemon or a stream.\n"
+    },
+
+    { "io-engine",
+      IO_ENGINE_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "ENGINE",
+      "How --direct-io submits its writes: uring (io_uring), threads (a\n"
+      "pool of pwrite threads) or auto, the default: io_uring when the\n"
+      "kernel has it, threads otherwise.\n"
+    },
+
+    { "write-depth",
+      WRITE_DEPTH_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "The most --direct-io writes in flight at once.  Defaults to half\n"
+      "of --depth.\n"
+    },
+
+    { "segment-dirs",
+      SEGMENT_DIRS_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "DIR[,DIR...]",
+      "Split the dump into numbered segments of --segment-size bytes that\n"
+      "go to the directories in turn, e.g. one per drive, each written by\n"
+      "its own thread.  OUTPUT-FILE then holds a manifest of the segments\n"
+      "(see segment.h), which --verify and the reader accept in place of\n"
+      "the dump.  Only raw dumps: cannot be combined with --compress,\n"
+      "--sparse, --image, --journal, --resume, --direct-to-fd,\n"
+      "--direct-io, --daemon, --connect or a stream.  Use a --depth of at\n"
+      "least two per directory to keep every drive busy.\n"
+    },
+
+    { "segment-size",
+      SEGMENT_SIZE_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Size of the --segment-dirs segments, a multiple of the page size.\n"
+      "Defaults to 1 GB.\n"
+    },
+
+    { "chunk-size",
+      'c',
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "CHUNK-BYTES",
+      "The number of bytes copied from the GPU per request.  Chunks are\n"
+      "staged in memory and written out while the next chunk is being\n"
+      "copied.  This must be a multiple of 4096 (default 8 MB).\n"
+    },
+
+    { "block-size",
+      BLOCK_SIZE_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "BLOCK-BYTES",
+      "The number of bytes the driver pins and copies at a time within each\n"
+      "chunk (default 128 KB).  This is a hint: the driver rounds it to a\n"
+      "multiple of 4096 between 4 KB and 16 MB, and drivers that predate\n"
+      "it ignore it.\n"
+    },
+
+    { "depth",
+      'd',
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "NUM-BUFFERS",
+      "The number of chunk-sized staging buffers kept in flight (default 4).\n"
+      "Up to this many chunk dumps are queued on the GPU at once.\n"
+    },
+
+    { "staging-pages",
+      STAGING_PAGES_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "TYPE",
+      "The pages the staging buffers are made of: 4k (default), hugetlb\n"
+      "(2 MB pages from /proc/sys/vm/nr_hugepages; fails if too few are\n"
+      "free), thp (transparent hugepages) or auto (hugetlb, else thp).\n"
+      "Hugepages let the driver copy each chunk in a few physically\n"
+      "contiguous runs instead of one copy per 4 KB page.\n"
+    },
+
+    { "max-bandwidth",
+      MAX_BANDWIDTH_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "BYTES-PER-SEC",
+      "Copy at most this many bytes per second from each GPU, leaving the\n"
+      "rest of the copy engine and PCIe bandwidth to the GPU's workload.\n"
+      "Dumps are paced by a token bucket holding one chunk.\n"
+    },
+
+    { "max-latency-impact",
+      MAX_LATENCY_IMPACT_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "USEC",
+      "Keep every driver call shorter than USEC microseconds, so work\n"
+      "queued behind a dump on the copy engine is delayed by at most that\n"
+      "much.  Chunks are split into calls sized from the rate the previous\n"
+      "calls achieved, and only one call is in flight at a time.\n"
+    },
+
+    { "simulate",
+      SIMULATE_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "SPEC",
+      "Dump from simulated GPUs instead of the driver; no GPU or root\n"
+      "privileges are needed.  SPEC is a comma separated list of key=value\n"
+      "pairs: gpus, size, file (image to serve), seed, zero and const\n"
+      "(percentage of zero and constant pages), region (pages of each\n"
+      "aligned region of this size are alike), latency-us, block-us (cost\n"
+      "of each --block-size block), run-us (cost of each physically\n"
+      "contiguous copy), bandwidth (bytes/s), setup-us (channel\n"
+      "setup cost), cache (0 pays setup-us on every call), fail-every\n"
+      "(fail every Nth call), fail-at and fail-len (fail calls touching\n"
+      "this range) and fail-status (ecc, invalid-address, busy, error or a\n"
+      "number).  -g defaults to the first simulated GPU.\n"
+    },
+
+    { "compress",
+      COMPRESS_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "ALGORITHM[:LEVEL]",
+      "Compress the dump as it is acquired.  ALGORITHM is zstd (default\n"
+      "level 3) or lz4 (levels 0-12, default 0).  Every chunk becomes an\n"
+      "independent frame and a seek table is appended, so the output is a\n"
+      "seekable stream that the stock zstd or lz4 tools can also expand.\n"
+      "Raising --depth above the number of compression threads keeps the\n"
+      "workers busy.\n"
+    },
+
+    { "sparse",
+      SPARSE_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Do not write pages that are entirely zero; they are left as holes\n"
+      "in a sparse output file, which saves disk space and writeback for\n"
+      "mostly empty memory.  The file still reads back as the full dump.\n"
+      "Cannot be combined with --compress.\n"
+    },
+
+    { "image",
+      IMAGE_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Write OUTPUT-FILE as an image: a header with the GPU, range, driver\n"
+      "version and time of the dump, then the chunks, each stored raw, as\n"
+      "a repeated value, or compressed when --compress is given and it\n"
+      "helps, and an index with a CRC-32C per chunk for random access.\n"
+      "See image.h for the layout.  Cannot be combined with --sparse or\n"
+      "--indexed.\n"
+    },
+
+    { "direct-to-fd",
+      DIRECT_TO_FD_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Have the driver write the dump to OUTPUT-FILE itself, through its\n"
+      "own bounce buffers, instead of copying it into user memory first.\n"
+      "Falls back to the usual path, with a warning, on drivers without\n"
+      "it.  Only raw dumps: cannot be combined with --compress, --sparse,\n"
+      "--image, --hash or --daemon.\n"
+    },
+
+    { "journal",
+      JOURNAL_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Record every chunk written, with its BLAKE3 digest, in\n"
+      "OUTPUT-FILE.journal, so the dump can be finished with --resume if it\n"
+      "is interrupted.  Only raw dumps: cannot be combined with --compress,\n"
+      "--image, --indexed, --direct-to-fd or --daemon.\n"
+    },
+
+    { "resume",
+      RESUME_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Finish the dump to OUTPUT-FILE recorded by --journal: the chunks in\n"
+      "OUTPUT-FILE.journal that still match the file are kept and only the\n"
+      "rest is acquired.  Give the same -g, -o, -s (or --ranges) as the\n"
+      "interrupted run; the chunk size is taken from the journal.  Cannot\n"
+      "be combined with --hash.\n"
+    },
+
+    { "tolerate-errors",
+      TOLERATE_ERRORS_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Do not give up on a chunk that fails with an ECC error or an invalid\n"
+      "address: dump it again in halves down to the pages that fail, fill\n"
+      "those with the text \"" ACQUIRE_BAD_PAGE_FILL "\" and list them, with\n"
+      "the reason, in OUTPUT-FILE.badpages.  Other errors still stop the\n"
+      "dump.  Cannot be combined with --direct-to-fd or --daemon.\n"
+    },
+
+    { "hash",
+      HASH_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "ALGORITHM",
+      "Hash every chunk as it is acquired with ALGORITHM (sha256 or\n"
+      "blake3) and write the chunk digests and the root of a Merkle tree\n"
+      "over them to OUTPUT-FILE.manifest.  Use --verify to check the dump\n"
+      "(or part of it) against the manifest later.\n"
+    },
+
+    { "worker-threads",
+      WORKER_THREADS_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "NUM-THREADS",
+      "The number of hashing/compression workers per GPU (default: one per\n"
+      "CPU, at most --depth).\n"
+    },
+
+    { "verify",
+      VERIFY_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "MANIFEST",
+      "Instead of dumping, check OUTPUT-FILE (raw or compressed) against\n"
+      "MANIFEST.  With -o and -s only the chunks overlapping that range of\n"
+      "GPU memory are rehashed.  No GPU or root privileges are needed.\n"
+    },
+
+    { "daemon",
+      DAEMON_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "SOCKET",
+      "Initialize once and then serve dump requests on the Unix socket\n"
+      "SOCKET until stopped with --stop-daemon.  Serves the GPUs given with\n"
+      "-g, or every GPU.  --chunk-size, --block-size, --depth, --compress\n"
+      "and --sparse apply to every request.\n"
+    },
+
+    { "connect",
+      CONNECT_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "SOCKET",
+      "Have the daemon listening on SOCKET dump -o/-s (or --ranges) of the\n"
+      "GPU matching -g (default: its first GPU) and write the bytes it\n"
+      "sends back to OUTPUT-FILE.  Needs no root privileges, only access to\n"
+      "SOCKET.\n"
+    },
+
+    { "stop-daemon",
+      STOP_DAEMON_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "With --connect, stop the daemon once its current requests are done.\n"
+    },
+
+    { "lock-dir",
+      LOCK_DIR_OPTION,
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "DIR",
+      "Directory of the per-GPU lock files (default " GPU_LOCK_DEFAULT_DIR ").\n"
+      "Each GPU is locked before it is dumped, so dumps of the same GPU from\n"
+      "several processes take turns in the order they asked, while different\n"
+      "GPUs are dumped at once.  The daemon locks the GPU for each request.\n"
+      "Simulated GPUs are only locked when this is given.\n"
+    },
+
+    { "lock-timeout",
+      LOCK_TIMEOUT_OPTION,
+      NVGETOPT_INTEGER_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "SECONDS",
+      "Give up if a GPU's lock is not granted within SECONDS (default: wait\n"
+      "as long as it takes).\n"
+    },
+
+    { "no-lock",
+      NO_LOCK_OPTION,
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Do not take the per-GPU lock files.\n"
     },
 
     { NULL, 0, 0, NULL, NULL },
@@ -261,156 +681,1381 @@ static void print_help(void) {
     nvgetopt_print_help(__options, 0, print_help_helper);
 }
 
-int main(int argc, char *argv[]) {
-    char              *file   = NULL;
-    unsigned long long offset = 0;
-    unsigned long long size   = 0;
-    nvmlReturn_t nvmlStatus;
-    const char * uuid = NULL;
-    const long PAGE_SIZE = sysconf(_SC_PAGE_SIZE);
-
-    UvmGpuUuid uvmUuid;
-    RM_STATUS rmStatus = RM_OK;
+typedef struct {
+    char         *uuid;      // full nvml UUID, "GPU-..."
+    char          label[16]; // short name for progress reports
+    UvmGpuUuid    uvmUuid;
+    DumpRange     range;
+    char         *file;
+    int           fd;        // -1 when the file belongs to another target
+    AcquireParams params;
+    AcquireStats  stats;
+    RM_STATUS     status;
+    MerkleTree    merkle;
+    char         *manifest;
+    NvLength      fbSize;
+    ImageIndex    image;
+    Journal       journal;   // used when params.journal is set
+    AcquireBadPages badPages;
+    SegmentSet    segments;  // used when params.segments is set
+} DumpTarget;
 
-    while (1) {
-        int c, intval;
-        char *strval  = NULL;
+//
+// Resolves the GPUs to dump, either every GPU or the comma separated list of
+// (partial) UUIDs given with -g.  Returns the number of targets, or -1.
+//
+static int selectGpus(const char *uuidList, int allGpus, DumpTarget **targets) {
+    DumpTarget *t = NULL;
+    int count = 0;
 
-        c = nvgetopt(argc,
-                     argv,
-                     __options,
-                     &strval, /* strval */
-                     NULL, /* boolval */
-                     &intval,
-                     NULL, /* doubleval */
-                     NULL); /* disable */
+    if (allGpus) {
+        int i, gpuCount = getNumGpus();
 
-        if (c == -1) break; 
+        if (gpuCount <= 0) {
+            nv_error_msg("No GPUs found.\n");
+            return -1;
+        }
 
-        switch (c)  {
-            case 'h':
-                print_help();
-                goto cleanup;
-                break;
-            case 'g':
-                uuid = strval;
-                break;
-            case 'o':
-                offset = strtoull(strval, NULL, 0);
-                if (offset % PAGE_SIZE)  {
-                    nv_error_msg("Offset must be a multiple of the system page size (%ld bytes).\n",
-                            PAGE_SIZE);
-                    goto cleanup;
-                }
-                break;
-            case 's':
-                size = strtoull(strval, NULL, 0);
-                if (size % PAGE_SIZE)  {
-                    nv_error_msg("Size must be a multiple of the system page size (%ld bytes).\n",
-                            PAGE_SIZE);
-                    goto cleanup;
-                }
-                if (size == 0) {
-                    nv_error_msg("A size greater than 0 needs to be specified.\n");
-                    goto cleanup;
-                }
-                break;
-            case 'f':
-                file = strval;
-                break;
-            default:
-                nv_error_msg("Invalid commandline, please run `%s --help` "
-                             "for usage information.\n", argv[0]);
-                goto cleanup;
+        t = nvalloc(gpuCount * sizeof(DumpTarget));
+        for (i = 0; i < gpuCount; i++) {
+            t[count].uuid = getGpuUuidByIndex(i);
+            if (t[count].uuid)
+                count++;
         }
+    } else {
+        char *list = nvstrdup(uuidList);
+        char *save = NULL;
+        char *item;
+
+        t = nvalloc((strlen(list) + 1) * sizeof(DumpTarget));
+        item = strtok_r(list, ",", &save);
+        do {
+            const char *full = getRequestedUuid(item ? item : "");
+            if (!full) {
+                nv_error_msg("Bad GPU UUID '%s'. Use nvidia-smi -L to see\n"
+                             "a list of UUIDs. Omit the \"GPU-\" portion for -g.\n",
+                             item ? item : "");
+                nvfree(list);
+                nvfree(t);
+                return -1;
+            }
+            t[count++].uuid = (char *)full;
+        } while (item && (item = strtok_r(NULL, ",", &save)));
+        nvfree(list);
     }
 
-    if (!uuid) {
-        nv_error_msg("Must provide a UUID using -g.  Use nvidia-smi -L to see\n"
-		     "a list of UUIDs.  Omit the \"GPU-\" portion for -g.\n");
-	goto cleanup;
-    }
+    *targets = t;
+    return count;
+}
 
-    if (!file) {
-        nv_error_msg("No output file specified.\n");
-        goto cleanup;
+//
+// OUTPUT-FILE, with the GPU UUID appended when several GPUs are dumped and
+// the range offset appended when several ranges go to separate files.
+//
+static char *targetFileName(const char *file, const DumpTarget *t,
+                            int multipleGpus, int splitRanges) {
+    char *name = multipleGpus ? nvasprintf("%s.%s", file, t->uuid) :
+                                nvstrdup(file);
+
+    if (splitRanges) {
+        char *split = nvasprintf("%s.0x%llx", name, t->range.offset);
+        nvfree(name);
+        name = split;
     }
 
-    if (getuid() != 0 && geteuid() != 0 ) {
-      nv_error_msg("Must be run with root privileges.  Try sudo ./dump_fb <args> instead.\n");
-      goto cleanup;
-    }
+    return name;
+}
 
-    if ((nvmlStatus = nvmlInit()) != NVML_SUCCESS) {
-        nv_error_msg("Cannot initialize NVML.\n");
-        goto cleanup;
-    }
+// The prefix of every report line about a target; empty for a single dump.
+static char *targetName(const DumpTarget *t, int multipleGpus,
+                        int multipleRanges) {
+    char *name = nvstrdup(multipleGpus ? t->uuid : "");
 
-    if ((rmStatus = UvmInitialize()) != RM_OK)  {
-        nv_error_msg("Cannot initialize UVM.\n");
-        nv_error_msg("UVM error: %s\n", RmErrorNumToString(rmStatus));
-        goto cleanup;
+    if (multipleRanges) {
+        nv_append_sprintf(&name, "%s0x%llx-0x%llx", multipleGpus ? " " : "",
+                          t->range.offset, t->range.offset + t->range.size);
     }
+    if (name[0])
+        nv_append_sprintf(&name, ": ");
 
-    uuid = getRequestedUuid(uuid);
+    return name;
+}
 
-    if (! uuid) {
-        nv_error_msg("Bad GPU UUID. Use nvidia-smi -L to see\n"
-		     "a list of UUIDs. Omit the \"GPU-\" portion for -g.\n");
-        goto cleanup;
-    }
-      
-    nvmlUuidToUvmUuid(uuid, &uvmUuid);
+static void getDriverVersion(char *version, unsigned int length) {
+    if (UvmSimIsEnabled())
+        snprintf(version, length, "simulated");
+    else if (nvmlSystemGetDriverVersion(version, length) != NVML_SUCCESS)
+        snprintf(version, length, "unknown");
+}
 
-    NvLength fbLength = getFbSize(uuid);
-    if (offset > fbLength || offset+size > fbLength)  {
-        nv_error_msg("0x%llx-0x%llx exceeds the size of GPU memory (0x%llx).\n",
-                offset, (offset+size), fbLength);
-        goto cleanup;
-    }
+static int writeImageHeader(DumpTarget *t) {
+    ImageHeader header;
 
-    if (! access(file, F_OK)) {
-        nv_error_msg("Refusing to overwrite file that already exists.\n");
-        goto cleanup;
-    }
+    imageHeaderInit(&header, t->range.offset, t->range.size,
+                    t->params.chunkBytes, t->params.compression,
+                    t->params.compressLevel);
+    header.fbSize = t->fbSize;
+    snprintf(header.gpuUuid, sizeof(header.gpuUuid), "%s", t->uuid);
+    getDriverVersion(header.driverVersion, sizeof(header.driverVersion));
 
-    int fd = open(file, O_CREAT | O_RDWR);
+    return imageHeaderWrite(&header, t->fd);
+}
 
-    if (fd < 0) {
+//
+// Reopens the output of an interrupted --journal run and loads the chunks
+// its journal still vouches for.
+//
+static int resumeTarget(DumpTarget *t, NvLength length) {
+    char *path = nvasprintf("%s.journal", t->file);
+    const JournalHeader *h = &t->journal.header;
+    struct stat st;
+    long long intact;
+    int ret = -1;
+
+    t->fd = open(t->file, O_RDWR);
+    if (t->fd < 0) {
         nv_error_msg("Failed to open output file.\n");
-        perror(file);
-        goto cleanup;
+        perror(t->file);
+        goto done;
+    }
+
+    if (journalOpen(&t->journal, path, t->fd))
+        goto done;
+    t->params.journal = &t->journal;
+
+    if (strcmp(h->gpuUuid, t->uuid) || h->baseAddress != t->range.offset ||
+        h->sizeBytes != t->range.size ||
+        h->outOffset != t->params.outOffset) {
+        nv_error_msg("%s is the journal of another dump (%s 0x%llx-0x%llx).\n",
+                     path, h->gpuUuid, (unsigned long long)h->baseAddress,
+                     (unsigned long long)(h->baseAddress + h->sizeBytes));
+        goto done;
     }
+    t->params.chunkBytes = h->chunkBytes;
 
-    if (ftruncate(fd, size)) {
+    // The file may not have been sized yet when the run died.
+    if (fstat(t->fd, &st) || (st.st_size < length && ftruncate(t->fd, length))) {
         nv_error_msg("Failed to size file\n");
-        perror(file);
-        goto cleanup;
+        perror(t->file);
+        goto done;
     }
 
-    void *ptr = mmap(NULL, size, 
-            PROT_READ|PROT_WRITE, 
-            MAP_SHARED, fd, 0);
+    intact = journalVerify(&t->journal);
+    if (intact < 0)
+        goto done;
 
-    if (ptr == MAP_FAILED)  {
-        nv_error_msg("Failed to mmap file: %d.\n", errno);
-        perror(file);
-        goto cleanup;
+    nv_info_msg(NULL, "Resuming %s: %lld of %llu chunks present.", t->file,
+                intact, (unsigned long long)t->journal.numChunks);
+    ret = 0;
+
+done:
+    nvfree(path);
+    return ret;
+}
+
+static int openTarget(DumpTarget *t, char *file, NvLength length,
+                      int journal, int resume, char *const *segmentDirs,
+                      int numSegmentDirs, NvLength segmentBytes) {
+    t->file = file;
+
+    if (resume)
+        return resumeTarget(t, length);
+
+    if (! access(t->file, F_OK)) {
+        nv_error_msg("Refusing to overwrite file that already exists: %s.\n",
+                     t->file);
+        return -1;
     }
 
-    if ((rmStatus = UvmDumpGpuMemory(&uvmUuid, ptr, offset, size)) != RM_OK)  {
-        nv_error_msg("UVM error: %s\n", RmErrorNumToString(rmStatus));
+    if (t->params.hash != HASH_NONE) {
+        t->manifest = nvasprintf("%s.manifest", t->file);
+        if (! access(t->manifest, F_OK)) {
+            nv_error_msg("Refusing to overwrite file that already exists: %s.\n",
+                         t->manifest);
+            return -1;
+        }
     }
 
-    munmap(ptr, size);
+    if (journal) {
+        char *path = nvasprintf("%s.journal", t->file);
+        int exists = !access(path, F_OK);
 
-cleanup:
-    if (fd >= 0) {
-        close(fd);
+        if (exists)
+            nv_error_msg("Refusing to overwrite file that already exists: "
+                         "%s.\n", path);
+        nvfree(path);
+        if (exists)
+            return -1;
     }
 
-    UvmDeinitialize();
+    t->fd = open(t->file, O_CREAT | O_EXCL | O_RDWR, 0644);
 
-    return rmStatus;
-}
+    if (t->fd < 0) {
+        nv_error_msg("Failed to open output file.\n");
+        perror(t->file);
+        return -1;
+    }
 
+    if (journal) {
+        char *path = nvasprintf("%s.journal", t->file);
+        int ret = journalCreate(&t->journal, path, t->uuid, t->range.offset,
+                                t->range.size, t->params.chunkBytes,
+                                t->params.outOffset, t->fd);
+
+        if (ret)
+            nv_error_msg("Failed to create %s: %s.\n", path, strerror(errno));
+        nvfree(path);
+        if (ret)
+            return -1;
+        t->params.journal = &t->journal;
+    }
+
+    // The file only lists the segments, which hold the dump.
+    if (numSegmentDirs > 0) {
+        if (segmentSetCreate(&t->segments, t->file, segmentDirs,
+                             numSegmentDirs, segmentBytes, length) ||
+            segmentManifestWrite(&t->segments, t->fd))
+            return -1;
+        t->params.segments = &t->segments;
+        return 0;
+    }
+
+    // Compressed output is appended, so its size is not known up front.
+    if (t->params.compression == COMPRESS_NONE && !t->params.image &&
+        ftruncate(t->fd, length)) {
+        nv_error_msg("Failed to size file\n");
+        perror(t->file);
+        return -1;
+    }
+
+    if (t->params.image && writeImageHeader(t)) {
+        nv_error_msg("Failed to write the image header.\n");
+        perror(t->file);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void reportTarget(const DumpTarget *t, const char *name) {
+    if (t->params.directToFd && !t->stats.direct && t->stats.bytesWritten) {
+        nv_warning_msg("%sThe driver cannot write to files directly; the "
+                       "dump went through user memory.", name);
+    }
+
+    nv_info_msg(NULL, "%sWrote %llu of %llu bytes in %.3f s (%.2f GB/s).",
+                name,
+                (unsigned long long)t->stats.bytesWritten,
+                (unsigned long long)t->params.sizeBytes,
+                t->stats.elapsedNs / 1e9,
+                (t->stats.bytesWritten / (1024.0*1024*1024)) /
+                (t->stats.elapsedNs / 1e9));
+
+    if (t->params.directIo && t->stats.bytesWritten) {
+        if (t->stats.directIo)
+            nv_info_msg(NULL, "%sWrote with O_DIRECT through %s.", name,
+                        diskWriterEngineName(t->stats.ioEngine));
+        else
+            nv_warning_msg("%sThe output offset is not page aligned; the "
+                           "dump went through the page cache.", name);
+    }
+
+    if (t->stats.badPages) {
+        nv_warning_msg("%s%llu unreadable pages were filled with \"%s\" "
+                       "(%llu calls to find them).", name,
+                       (unsigned long long)t->stats.badPages,
+                       ACQUIRE_BAD_PAGE_FILL,
+                       (unsigned long long)t->stats.bisectCalls);
+    }
+
+    if (t->stats.chunksResumed) {
+        nv_info_msg(NULL, "%s%llu chunks were already in the file.", name,
+                    (unsigned long long)t->stats.chunksResumed);
+    }
+
+    if (t->params.maxBytesPerSec || t->params.maxCallNs) {
+        nv_info_msg(NULL, "%sThrottled for %.3f s; %llu driver calls of up "
+                    "to %llu bytes.", name, t->stats.throttleNs / 1e9,
+                    (unsigned long long)t->stats.calls,
+                    (unsigned long long)t->stats.maxCallBytes);
+    }
+
+    if (t->stats.physRuns && t->stats.chunks) {
+        nv_info_msg(NULL, "%sStaging on %s pages: %.1f physical runs per "
+                    "chunk (at most %llu).", name,
+                    stagingPagesName(t->stats.stagingPages),
+                    (double)t->stats.physRuns / t->stats.chunks,
+                    (unsigned long long)t->stats.physRunsMax);
+    }
+
+    if (t->params.sparse && t->stats.bytesWritten) {
+        NvU64 pages = t->stats.bytesWritten / sysconf(_SC_PAGE_SIZE);
+
+        nv_info_msg(NULL, "%s%.1f%% zero pages skipped, stored %llu bytes.",
+                    name,
+                    pages ? 100.0 * t->stats.zeroPages / pages : 0.0,
+                    (unsigned long long)t->stats.bytesStored);
+    }
+
+    if (t->params.compression != COMPRESS_NONE && t->stats.bytesStored) {
+        nv_info_msg(NULL, "%s%s stored %llu bytes (%.1fx).",
+                    name,
+                    compressAlgorithmName(t->params.compression),
+                    (unsigned long long)t->stats.bytesStored,
+                    (double)t->stats.bytesWritten / t->stats.bytesStored);
+    }
+
+    if (t->params.image) {
+        NvU64 kinds[IMAGE_CHUNK_LZ4 + 1] = { 0 };
+        NvU64 i;
+
+        for (i = 0; i < t->image.count; i++)
+            kinds[t->image.entries[i].kind]++;
+        nv_info_msg(NULL, "%simage of %llu chunks: %llu raw, %llu zero, "
+                    "%llu constant, %llu compressed.", name,
+                    (unsigned long long)t->image.count,
+                    (unsigned long long)kinds[IMAGE_CHUNK_RAW],
+                    (unsigned long long)kinds[IMAGE_CHUNK_ZERO],
+                    (unsigned long long)kinds[IMAGE_CHUNK_CONSTANT],
+                    (unsigned long long)(kinds[IMAGE_CHUNK_ZSTD] +
+                                         kinds[IMAGE_CHUNK_LZ4]));
+    }
+}
+
+//
+// Lists the pages --tolerate-errors filled in the count targets sharing
+// t->file in OUTPUT-FILE.badpages, or removes a stale list if there are none.
+//
+static int writeBadPages(const DumpTarget *t, int count) {
+    char *path = nvasprintf("%s.badpages", t->file);
+    unsigned int bad = 0, i;
+    FILE *f = NULL;
+    int ret = -1, k;
+
+    for (k = 0; k < count; k++)
+        bad += t[k].badPages.count;
+    if (!bad) {
+        if (unlink(path) == 0 || errno == ENOENT)
+            ret = 0;
+        else
+            nv_error_msg("Failed to remove %s: %s.\n", path, strerror(errno));
+        goto done;
+    }
+
+    f = fopen(path, "w");
+    if (!f) {
+        nv_error_msg("Failed to create %s: %s.\n", path, strerror(errno));
+        goto done;
+    }
+
+    fprintf(f, "# %s: pages filled with \"%s\"\n", t->uuid,
+            ACQUIRE_BAD_PAGE_FILL);
+    fprintf(f, "# offset size reason\n");
+    for (k = 0; k < count; k++) {
+        for (i = 0; i < t[k].badPages.count; i++) {
+            const AcquireBadRange *r = &t[k].badPages.ranges[i];
+
+            fprintf(f, "0x%llx 0x%llx %s\n", r->gpuOffset,
+                    (unsigned long long)r->length,
+                    RmErrorNumToString(r->status));
+        }
+    }
+
+    if (fclose(f)) {
+        nv_error_msg("Failed to write %s: %s.\n", path, strerror(errno));
+        goto done;
+    }
+    ret = 0;
+
+done:
+    nvfree(path);
+    return ret;
+}
+
+//
+// Takes the lock of every selected GPU.  Locks are always taken in UUID
+// order, so two runs that share several GPUs cannot each hold one the other
+// is waiting for.
+//
+static int lockGpus(const DumpTarget *gpus, int numGpus, const char *lockDir,
+                    NvU64 timeoutNs, GpuLock *locks) {
+    int *order = nvalloc(numGpus * sizeof(int));
+    int i, j, ret = 0;
+
+    for (i = 0; i < numGpus; i++) {
+        locks[i].fd = -1;
+        for (j = i; j > 0 && strcmp(gpus[order[j - 1]].uuid, gpus[i].uuid) > 0;
+             j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    for (i = 0; i < numGpus && ret == 0; i++) {
+        const DumpTarget *gpu = &gpus[order[i]];
+
+        ret = gpuLockAcquire(lockDir, gpu->uuid, timeoutNs, &locks[order[i]]);
+        if (ret) {
+            if (errno == ETIMEDOUT)
+                nv_error_msg("Timed out waiting for the lock of %s.\n",
+                             gpu->uuid);
+            else
+                nv_error_msg("Failed to lock %s in %s: %s.\n", gpu->uuid,
+                             lockDir, strerror(errno));
+        }
+    }
+
+    nvfree(order);
+    return ret;
+}
+
+//
+// Runs range r of every GPU: directly for a single GPU, otherwise one worker
+// per GPU.  Targets are stored GPU by GPU, numRanges per GPU.
+//
+static RM_STATUS acquireTargets(DumpTarget *targets, int numGpus,
+                                int numRanges, int r) {
+    AcquireParams *params;
+    AcquireStats *stats;
+    RM_STATUS *statuses;
+    RM_STATUS rmStatus;
+    int g;
+
+    if (numGpus == 1) {
+        targets[r].status = acquireRange(&targets[r].params, &targets[r].stats);
+        return targets[r].status;
+    }
+
+    params   = nvalloc(numGpus * sizeof(AcquireParams));
+    stats    = nvalloc(numGpus * sizeof(AcquireStats));
+    statuses = nvalloc(numGpus * sizeof(RM_STATUS));
+
+    for (g = 0; g < numGpus; g++)
+        params[g] = targets[g * numRanges + r].params;
+
+    rmStatus = acquireParallel(params, numGpus, stats, statuses, 1000000000ull);
+
+    for (g = 0; g < numGpus; g++) {
+        targets[g * numRanges + r].stats  = stats[g];
+        targets[g * numRanges + r].status = statuses[g];
+    }
+    nvfree(statuses);
+    nvfree(stats);
+    nvfree(params);
+
+    return rmStatus;
+}
+
+//
+// Writes OUTPUT-FILE.index for an indexed multi-range dump: one line per
+// range with its GPU offset and size and where its bytes are in the file.
+//
+static int writeIndex(const DumpTarget *targets, int numRanges) {
+    char *path = nvasprintf("%s.index", targets[0].file);
+    FILE *fp = fopen(path, "wx");
+    int r, ret = 0;
+
+    if (!fp) {
+        nv_error_msg("Failed to create %s: %s.\n", path, strerror(errno));
+        nvfree(path);
+        return -1;
+    }
+
+    fprintf(fp, "# gpu-offset size file-offset stored-bytes status\n");
+    for (r = 0; r < numRanges; r++) {
+        const DumpTarget *t = &targets[r];
+        fprintf(fp, "0x%llx 0x%llx %llu %llu %s\n", t->range.offset,
+                (unsigned long long)t->range.size, t->params.outOffset,
+                (unsigned long long)t->stats.bytesStored,
+                t->status == RM_OK ? "ok" : RmErrorNumToString(t->status));
+    }
+
+    if (ferror(fp) || fclose(fp)) {
+        nv_error_msg("Failed to write %s.\n", path);
+        ret = -1;
+    }
+    nvfree(path);
+    return ret;
+}
+
+typedef struct {
+    int      fd;
+    NvLength written;
+} ConnectOutput;
+
+static int writeToFd(void *ctx, const void *buf, NvLength len) {
+    ConnectOutput *out = ctx;
+    const char *p = buf;
+
+    while (len) {
+        ssize_t ret = write(out->fd, p, len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        p            += ret;
+        len          -= ret;
+        out->written += ret;
+    }
+
+    return 0;
+}
+
+//
+// --connect: streams each range from the daemon into OUTPUT-FILE, or into
+// OUTPUT-FILE.0xOFFSET when there are several.
+//
+static RM_STATUS connectDump(const char *socketPath, const char *gpu,
+                             const RangeList *ranges, const char *file) {
+    RM_STATUS rmStatus = RM_OK;
+    unsigned int r;
+    int sock = daemonConnect(socketPath);
+
+    if (sock < 0)
+        return RM_ERROR;
+
+    for (r = 0; r < ranges->count && rmStatus == RM_OK; r++) {
+        const DumpRange *range = &ranges->ranges[r];
+        char *path = ranges->count > 1 ?
+                     nvasprintf("%s.0x%llx", file, range->offset) :
+                     nvstrdup(file);
+        NvU64 start = acquireNowNs();
+        DaemonReply reply;
+        ConnectOutput out;
+
+        out.written = 0;
+        out.fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (out.fd < 0) {
+            nv_error_msg("Failed to open output file.\n");
+            perror(path);
+            nvfree(path);
+            rmStatus = RM_ERROR;
+            break;
+        }
+
+        rmStatus = daemonDumpStream(sock, gpu, range->offset, range->size,
+                                    writeToFd, &out, &reply);
+        if (rmStatus == RM_OK && fsync(out.fd)) {
+            perror(path);
+            rmStatus = RM_ERROR;
+        }
+        close(out.fd);
+
+        if (rmStatus != RM_OK) {
+            nv_error_msg("0x%llx-0x%llx: %s\n", range->offset,
+                         range->offset + range->size,
+                         RmErrorNumToString(rmStatus));
+            // Keep whatever did arrive, as a failed local dump would.
+            if (out.written == 0)
+                unlink(path);
+        } else {
+            nv_info_msg(NULL, "%s: wrote %llu bytes in %.3f ms (%.3f ms in "
+                        "the daemon).", path,
+                        (unsigned long long)range->size,
+                        (acquireNowNs() - start) / 1e6,
+                        reply.elapsedNs / 1e6);
+        }
+        nvfree(path);
+    }
+
+    close(sock);
+    return rmStatus;
+}
+
+//
+// --daemon: serves the selected GPUs until a client stops the daemon.
+//
+static RM_STATUS serveDaemon(const char *socketPath, const char *uuidList,
+                             int allGpus, const AcquireParams *params,
+                             const char *lockDir, NvU64 lockTimeoutNs) {
+    DaemonConfig config;
+    DumpTarget *selected = NULL;
+    int count, i;
+    RM_STATUS rmStatus = RM_OK;
+
+    count = selectGpus(uuidList, allGpus, &selected);
+    if (count <= 0)
+        return RM_ERROR;
+
+    memset(&config, 0, sizeof(config));
+    config.socketPath = socketPath;
+    config.params     = *params;
+    config.lockDir    = lockDir;
+    config.lockTimeoutNs = lockTimeoutNs;
+    config.numGpus    = count;
+    config.gpus       = nvalloc(count * sizeof(DaemonGpu));
+
+    for (i = 0; i < count; i++) {
+        DaemonGpu *gpu = &config.gpus[i];
+
+        gpu->uuid   = selected[i].uuid;
+        gpu->fbSize = getFbSize(gpu->uuid);
+        nvmlUuidToUvmUuid(gpu->uuid, &gpu->uvmUuid);
+        nv_info_msg(NULL, "%s: %llu bytes of memory.", gpu->uuid,
+                    (unsigned long long)gpu->fbSize);
+    }
+
+    nv_info_msg(NULL, "Serving %d GPU(s) on %s.", count, socketPath);
+    if (daemonServe(&config))
+        rmStatus = RM_ERROR;
+
+    for (i = 0; i < count; i++)
+        nvfree(config.gpus[i].uuid);
+    nvfree(config.gpus);
+    nvfree(selected);
+
+    return rmStatus;
+}
+
+//
+// Checks file against a manifest written by --hash.  offset and size select
+// a range of GPU memory; size 0 checks everything in the manifest.
+//
+static RM_STATUS verifyDump(const char *manifest, const char *file,
+                            unsigned long long offset,
+                            unsigned long long size) {
+    MerkleTree tree;
+    RM_STATUS rmStatus = RM_ERROR;
+    NvU64 badChunk = 0;
+    NvU64 start = acquireNowNs();
+    int fd, ret;
+
+    if (manifestRead(manifest, &tree))
+        return RM_ERROR;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        nv_error_msg("Failed to open %s.\n", file);
+        perror(file);
+        goto done;
+    }
+
+    if (size == 0) {
+        offset = tree.baseAddress;
+        size   = tree.sizeBytes;
+    } else if (offset < tree.baseAddress) {
+        nv_error_msg("0x%llx is before the start of the dump (0x%llx).\n",
+                     offset, tree.baseAddress);
+        goto done;
+    }
+
+    ret = merkleVerify(&tree, fd, offset - tree.baseAddress, size, &badChunk);
+    if (ret == 0) {
+        nv_info_msg(NULL, "%s: 0x%llx-0x%llx matches (%s, %.3f s).", file,
+                    offset, offset + size, hashAlgorithmName(tree.algorithm),
+                    (acquireNowNs() - start) / 1e9);
+        rmStatus = RM_OK;
+    } else if (ret > 0) {
+        nv_error_msg("%s: chunk %llu (0x%llx) does not match the manifest.\n",
+                     file, (unsigned long long)badChunk,
+                     tree.baseAddress + badChunk * tree.chunkBytes);
+    }
+
+done:
+    if (fd >= 0)
+        close(fd);
+    merkleFree(&tree);
+    return rmStatus;
+}
+
+int main(int argc, char *argv[]) {
+    char              *file   = NULL;
+    unsigned long long offset = 0;
+    unsigned long long size   = 0;
+    nvmlReturn_t nvmlStatus;
+    const char * uuid = NULL;
+    const long PAGE_SIZE = sysconf(_SC_PAGE_SIZE);
+    int allGpus = 0;
+    int numGpus = 0, numRanges = 0, numTargets = 0;
+    int i, g, r;
+
+    DumpTarget *gpus = NULL;
+    DumpTarget *targets = NULL;
+    RangeList ranges;
+    int indexed = 0;
+    RM_STATUS rmStatus = RM_OK;
+    AcquireParams acquireParams;
+    UvmSimConfig simConfig;
+    int simulate = 0;
+    const char *verify = NULL;
+    const char *daemonSocket = NULL;
+    const char *connectSocket = NULL;
+    int stopDaemon = 0;
+    int image = 0;
+    int journal = 0;
+    int resume = 0;
+    int tolerateErrors = 0;
+    int streamFd = -1;
+    int stream;
+    char **segmentDirs = NULL;
+    int numSegmentDirs = 0;
+    NvLength segmentBytes = SEGMENT_DEFAULT_BYTES;
+    const char *lockDir = NULL;
+    NvU64 lockTimeoutNs = 0;
+    int noLock = 0;
+    GpuLock *locks = NULL;
+    NvU64 start;
+
+    acquireParamsInit(&acquireParams);
+    memset(&ranges, 0, sizeof(ranges));
+
+    while (1) {
+        int c, intval;
+        char *strval  = NULL;
+
+        c = nvgetopt(argc,
+                     argv,
+                     __options,
+                     &strval, /* strval */
+                     NULL, /* boolval */
+                     &intval,
+                     NULL, /* doubleval */
+                     NULL); /* disable */
+
+        if (c == -1) break; 
+
+        switch (c)  {
+            case 'h':
+                print_help();
+                goto cleanup;
+                break;
+            case 'g':
+                uuid = strval;
+                break;
+            case 'a':
+                allGpus = 1;
+                break;
+            case 'o':
+                offset = strtoull(strval, NULL, 0);
+                if (offset % PAGE_SIZE)  {
+                    nv_error_msg("Offset must be a multiple of the system page size (%ld bytes).\n",
+                            PAGE_SIZE);
+                    goto cleanup;
+                }
+                break;
+            case 's':
+                size = strtoull(strval, NULL, 0);
+                if (size % PAGE_SIZE)  {
+                    nv_error_msg("Size must be a multiple of the system page size (%ld bytes).\n",
+                            PAGE_SIZE);
+                    goto cleanup;
+                }
+                if (size == 0) {
+                    nv_error_msg("A size greater than 0 needs to be specified.\n");
+                    goto cleanup;
+                }
+                break;
+            case 'f':
+                file = strval;
+                break;
+            case 'c':
+                acquireParams.chunkBytes = strtoull(strval, NULL, 0);
+                if (acquireParams.chunkBytes == 0 ||
+                    acquireParams.chunkBytes % PAGE_SIZE) {
+                    nv_error_msg("Chunk size must be a non-zero multiple of the system page size (%ld bytes).\n",
+                            PAGE_SIZE);
+                    goto cleanup;
+                }
+                break;
+            case BLOCK_SIZE_OPTION:
+                acquireParams.blockBytes = strtoull(strval, NULL, 0);
+                if (acquireParams.blockBytes == 0 ||
+                    acquireParams.blockBytes % PAGE_SIZE) {
+                    nv_error_msg("Block size must be a non-zero multiple of the system page size (%ld bytes).\n",
+                            PAGE_SIZE);
+                    goto cleanup;
+                }
+                break;
+            case 'd':
+                if (intval <= 0) {
+                    nv_error_msg("Depth must be at least 1.\n");
+                    goto cleanup;
+                }
+                acquireParams.depth = intval;
+                break;
+            case SIMULATE_OPTION:
+                UvmSimConfigInit(&simConfig);
+                if (UvmSimParseSpec(strval, &simConfig))
+                    goto cleanup;
+                simulate = 1;
+                break;
+            case SPARSE_OPTION:
+                acquireParams.sparse = 1;
+                break;
+            case COMPRESS_OPTION:
+                if (compressParseSpec(strval, &acquireParams.compression,
+                                      &acquireParams.compressLevel))
+                    goto cleanup;
+                break;
+            case WORKER_THREADS_OPTION:
+                if (intval <= 0) {
+                    nv_error_msg("At least one worker thread is needed.\n");
+                    goto cleanup;
+                }
+                acquireParams.workerThreads = intval;
+                break;
+            case HASH_OPTION:
+                if (hashParseName(strval, &acquireParams.hash))
+                    goto cleanup;
+                break;
+            case VERIFY_OPTION:
+                verify = strval;
+                break;
+            case 'r':
+                if (rangeListParse(strval, &ranges))
+                    goto cleanup;
+                break;
+            case RANGE_FILE_OPTION:
+                if (rangeListReadFile(strval, &ranges))
+                    goto cleanup;
+                break;
+            case INDEXED_OPTION:
+                indexed = 1;
+                break;
+            case DAEMON_OPTION:
+                daemonSocket = strval;
+                break;
+            case CONNECT_OPTION:
+                connectSocket = strval;
+                break;
+            case STOP_DAEMON_OPTION:
+                stopDaemon = 1;
+                break;
+            case IMAGE_OPTION:
+                image = 1;
+                break;
+            case LOCK_DIR_OPTION:
+                lockDir = strval;
+                break;
+            case LOCK_TIMEOUT_OPTION:
+                if (intval <= 0) {
+                    nv_error_msg("The lock timeout must be at least 1 "
+                                 "second.\n");
+                    goto cleanup;
+                }
+                lockTimeoutNs = intval * 1000000000ull;
+                break;
+            case NO_LOCK_OPTION:
+                noLock = 1;
+                break;
+            case STAGING_PAGES_OPTION:
+                if (stagingParsePages(strval, &acquireParams.stagingPages))
+                    goto cleanup;
+                break;
+            case MAX_BANDWIDTH_OPTION:
+                acquireParams.maxBytesPerSec = strtoull(strval, NULL, 0);
+                if (acquireParams.maxBytesPerSec == 0) {
+                    nv_error_msg("Invalid bandwidth '%s'.\n", strval);
+                    goto cleanup;
+                }
+                break;
+            case MAX_LATENCY_IMPACT_OPTION:
+                if (intval <= 0) {
+                    nv_error_msg("The latency impact must be at least 1 "
+                                 "microsecond.\n");
+                    goto cleanup;
+                }
+                acquireParams.maxCallNs = intval * 1000ull;
+                break;
+            case DIRECT_TO_FD_OPTION:
+                acquireParams.directToFd = 1;
+                break;
+            case JOURNAL_OPTION:
+                journal = 1;
+                break;
+            case RESUME_OPTION:
+                resume = 1;
+                break;
+            case TOLERATE_ERRORS_OPTION:
+                tolerateErrors = 1;
+                break;
+            case FD_OPTION:
+                if (intval < 0) {
+                    nv_error_msg("Invalid file descriptor %d.\n", intval);
+                    goto cleanup;
+                }
+                streamFd = intval;
+                break;
+            case SPLICE_OPTION:
+                acquireParams.splice = 1;
+                break;
+            case NO_SPLICE_OPTION:
+                acquireParams.splice = 0;
+                break;
+            case DIRECT_IO_OPTION:
+                acquireParams.directIo = 1;
+                break;
+            case IO_ENGINE_OPTION:
+                if (diskWriterParseEngine(strval, &acquireParams.ioEngine))
+                    goto cleanup;
+                break;
+            case SEGMENT_DIRS_OPTION:
+                segmentDirsFree(segmentDirs, numSegmentDirs);
+                numSegmentDirs = segmentParseDirs(strval, &segmentDirs);
+                if (numSegmentDirs < 0) {
+                    numSegmentDirs = 0;
+                    goto cleanup;
+                }
+                break;
+            case SEGMENT_SIZE_OPTION:
+                segmentBytes = strtoull(strval, NULL, 0);
+                if (segmentBytes == 0 || segmentBytes % PAGE_SIZE) {
+                    nv_error_msg("The segment size must be a non-zero "
+                                 "multiple of the page size (%ld bytes).\n",
+                                 PAGE_SIZE);
+                    goto cleanup;
+                }
+                break;
+            case WRITE_DEPTH_OPTION:
+                if (intval <= 0) {
+                    nv_error_msg("The write depth must be at least 1.\n");
+                    goto cleanup;
+                }
+                acquireParams.writeDepth = intval;
+                break;
+            default:
+                nv_error_msg("Invalid commandline, please run `%s --help` "
+                             "for usage information.\n", argv[0]);
+                goto cleanup;
+        }
+    }
+
+    if (acquireParams.sparse && acquireParams.compression != COMPRESS_NONE) {
+        nv_error_msg("--sparse cannot be combined with --compress.\n");
+        goto cleanup;
+    }
+
+    if (image && (acquireParams.sparse || indexed)) {
+        nv_error_msg("--image cannot be combined with --sparse or "
+                     "--indexed.\n");
+        goto cleanup;
+    }
+
+    if (acquireParams.directToFd &&
+        (acquireParams.compression != COMPRESS_NONE || acquireParams.sparse ||
+         image || acquireParams.hash != HASH_NONE || daemonSocket)) {
+        nv_error_msg("--direct-to-fd cannot be combined with --compress, "
+                     "--sparse, --image, --hash or --daemon.\n");
+        goto cleanup;
+    }
+
+    if ((journal || resume) &&
+        (acquireParams.compression != COMPRESS_NONE || image || indexed ||
+         acquireParams.directToFd || daemonSocket || connectSocket)) {
+        nv_error_msg("--journal and --resume cannot be combined with "
+                     "--compress, --image, --indexed, --direct-to-fd, "
+                     "--daemon or --connect.\n");
+        goto cleanup;
+    }
+
+    if (tolerateErrors && (acquireParams.directToFd || daemonSocket)) {
+        nv_error_msg("--tolerate-errors cannot be combined with "
+                     "--direct-to-fd or --daemon.\n");
+        goto cleanup;
+    }
+
+    if (acquireParams.directIo &&
+        (acquireParams.compression != COMPRESS_NONE || acquireParams.sparse ||
+         image || acquireParams.directToFd || daemonSocket)) {
+        nv_error_msg("--direct-io cannot be combined with --compress, "
+                     "--sparse, --image, --direct-to-fd or --daemon.\n");
+        goto cleanup;
+    }
+
+    if (numSegmentDirs &&
+        (acquireParams.compression != COMPRESS_NONE || acquireParams.sparse ||
+         image || journal || resume || acquireParams.directToFd ||
+         acquireParams.directIo || daemonSocket || connectSocket)) {
+        nv_error_msg("--segment-dirs cannot be combined with --compress, "
+                     "--sparse, --image, --journal, --resume, --direct-to-fd, "
+                     "--direct-io, --daemon or --connect.\n");
+        goto cleanup;
+    }
+
+    if (resume && acquireParams.hash != HASH_NONE) {
+        nv_error_msg("--resume cannot be combined with --hash.\n");
+        goto cleanup;
+    }
+
+    if (streamFd >= 0 && file) {
+        nv_error_msg("--fd cannot be combined with -f.\n");
+        goto cleanup;
+    }
+
+    stream = streamFd >= 0 || (file && !strcmp(file, "-"));
+    if (stream &&
+        (acquireParams.compression != COMPRESS_NONE || acquireParams.sparse ||
+         image || indexed || acquireParams.hash != HASH_NONE || journal ||
+         resume || acquireParams.directToFd || acquireParams.directIo ||
+         numSegmentDirs || daemonSocket || verify || connectSocket ||
+         allGpus || (uuid && strchr(uuid, ',')))) {
+        nv_error_msg("Streams hold one range of one GPU, raw: they cannot be "
+                     "combined with --compress, --sparse, --image, --indexed, "
+                     "--hash, --journal, --resume, --direct-to-fd, "
+                     "--direct-io, --segment-dirs, --daemon, --verify, "
+                     "--connect or several GPUs or ranges.\n");
+        goto cleanup;
+    }
+
+    // Nothing else may go to standard output once it carries the dump.
+    if (stream && streamFd < 0) {
+        fflush(stdout);
+        streamFd = dup(STDOUT_FILENO);
+        if (streamFd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            nv_error_msg("Failed to redirect standard output: %s.\n",
+                         strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    if (ranges.count && (offset || size)) {
+        nv_error_msg("-o/-s cannot be combined with a range list.\n");
+        goto cleanup;
+    }
+
+    if (indexed && acquireParams.hash != HASH_NONE) {
+        nv_error_msg("--hash needs one file per range; it cannot be combined "
+                     "with --indexed.\n");
+        goto cleanup;
+    }
+
+    if (verify) {
+        if (!file) {
+            nv_error_msg("No dump file specified.\n");
+            goto cleanup;
+        }
+        return verifyDump(verify, file, offset, size);
+    }
+
+    if (stopDaemon && !connectSocket) {
+        nv_error_msg("--stop-daemon needs --connect.\n");
+        goto cleanup;
+    }
+
+    if (connectSocket) {
+        int sock;
+
+        if (stopDaemon) {
+            if ((sock = daemonConnect(connectSocket)) < 0)
+                return RM_ERROR;
+            rmStatus = daemonShutdown(sock);
+            close(sock);
+            goto cleanup;
+        }
+        if (!file) {
+            nv_error_msg("No output file specified.\n");
+            goto cleanup;
+        }
+        if (!ranges.count) {
+            if (!size) {
+                nv_error_msg("-s (or --ranges) is needed with --connect.\n");
+                goto cleanup;
+            }
+            rangeListAdd(&ranges, offset, size);
+        }
+        rangeListCoalesce(&ranges);
+        rmStatus = connectDump(connectSocket, uuid ? uuid : "", &ranges, file);
+        goto cleanup;
+    }
+
+    if (daemonSocket) {
+        if (acquireParams.hash != HASH_NONE || ranges.count || indexed ||
+            image) {
+            nv_error_msg("--hash, --ranges, --indexed and --image cannot be "
+                         "combined with --daemon.\n");
+            goto cleanup;
+        }
+        if (!uuid)
+            allGpus = 1;
+    }
+
+    if (!uuid && simulate)
+        uuid = "";
+
+    if (!uuid && !allGpus) {
+        nv_error_msg("Must provide a UUID using -g.  Use nvidia-smi -L to see\n"
+		     "a list of UUIDs.  Omit the \"GPU-\" portion for -g.\n");
+	goto cleanup;
+    }
+
+    if (!file && !daemonSocket && !stream) {
+        nv_error_msg("No output file specified.\n");
+        goto cleanup;
+    }
+
+    // Simulated GPUs are private to the process unless asked otherwise.
+    if (noLock)
+        lockDir = NULL;
+    else if (!lockDir && !simulate)
+        lockDir = GPU_LOCK_DEFAULT_DIR;
+
+    if (simulate) {
+        UvmSimEnable(&simConfig);
+    } else {
+        if (getuid() != 0 && geteuid() != 0 ) {
+          nv_error_msg("Must be run with root privileges.  Try sudo ./dump_fb <args> instead.\n");
+          goto cleanup;
+        }
+
+        if ((nvmlStatus = nvmlInit()) != NVML_SUCCESS) {
+            nv_error_msg("Cannot initialize NVML.\n");
+            goto cleanup;
+        }
+    }
+
+    if ((rmStatus = UvmInitialize()) != RM_OK)  {
+        nv_error_msg("Cannot initialize UVM.\n");
+        nv_error_msg("UVM error: %s\n", RmErrorNumToString(rmStatus));
+        goto cleanup;
+    }
+
+    if (daemonSocket) {
+        rmStatus = serveDaemon(daemonSocket, uuid, allGpus, &acquireParams,
+                               lockDir, lockTimeoutNs);
+        goto cleanup;
+    }
+
+    numGpus = selectGpus(uuid, allGpus, &gpus);
+    if (numGpus <= 0) {
+        numGpus = 0;
+        goto cleanup;
+    }
+
+    // Overlapping and adjacent ranges are dumped once.
+    rangeListCoalesce(&ranges);
+    numRanges  = ranges.count ? ranges.count : 1;
+    if (stream && numRanges > 1) {
+        nv_error_msg("A stream can only hold one range.\n");
+        goto cleanup;
+    }
+    numTargets = numGpus * numRanges;
+
+    targets = nvalloc(numTargets * sizeof(DumpTarget));
+    for (i = 0; i < numTargets; i++)
+        targets[i].fd = -1;
+
+    for (g = 0; g < numGpus; g++) {
+        unsigned long long fileOffset = 0;
+        UvmGpuUuid uvmUuid;
+        NvLength fbLength;
+
+        nvmlUuidToUvmUuid(gpus[g].uuid, &uvmUuid);
+
+        fbLength = getFbSize(gpus[g].uuid);
+        if (ranges.count) {
+            if (rangeListValidate(&ranges, fbLength, PAGE_SIZE, gpus[g].uuid))
+                goto cleanup;
+        } else if (offset > fbLength || offset+size > fbLength)  {
+            nv_error_msg("%s: 0x%llx-0x%llx exceeds the size of GPU memory (0x%llx).\n",
+                    gpus[g].uuid, offset, (offset+size),
+                    (unsigned long long)fbLength);
+            goto cleanup;
+        }
+
+        for (r = 0; r < numRanges; r++) {
+            DumpTarget *t = &targets[g * numRanges + r];
+
+            t->uuid    = nvstrdup(gpus[g].uuid);
+            t->uvmUuid = uvmUuid;
+            if (ranges.count) {
+                t->range = ranges.ranges[r];
+            } else {
+                t->range.offset = offset;
+                t->range.size   = size ? size : fbLength - offset;
+            }
+
+            t->params             = acquireParams;
+            t->params.gpuUuid     = &t->uvmUuid;
+            t->params.baseAddress = t->range.offset;
+            t->params.sizeBytes   = t->range.size;
+            t->params.name        = t->label;
+            t->params.merkle      = &t->merkle;
+            t->params.badPages    = tolerateErrors ? &t->badPages : NULL;
+            t->fbSize             = fbLength;
+            snprintf(t->label, sizeof(t->label), "GPU%d", g);
+
+            if (image) {
+                t->params.image     = &t->image;
+                t->params.outOffset = IMAGE_HEADER_SIZE;
+            }
+
+            // Indexed raw ranges are packed back to back.
+            if (indexed) {
+                t->params.outOffset = fileOffset;
+                fileOffset += t->range.size;
+            }
+        }
+    }
+
+    // Before the output files are touched, so a run that gives up leaves
+    // them alone.
+    if (lockDir) {
+        locks = nvalloc(numGpus * sizeof(GpuLock));
+        if (lockGpus(gpus, numGpus, lockDir, lockTimeoutNs, locks)) {
+            rmStatus = RM_ERR_BUSY_RETRY;
+            goto cleanup;
+        }
+    }
+
+    for (g = 0; g < numGpus; g++) {
+        DumpTarget *first = &targets[g * numRanges];
+        const DumpTarget *last = &targets[g * numRanges + numRanges - 1];
+
+        for (r = 0; r < numRanges; r++) {
+            DumpTarget *t = &targets[g * numRanges + r];
+
+            if (indexed && r > 0) {
+                t->file = nvstrdup(first->file);
+                t->params.outFd    = first->fd;
+                t->params.segments = first->params.segments;
+                continue;
+            }
+
+            if (stream) {
+                t->file = file ? nvstrdup("standard output") :
+                                 nvasprintf("fd %d", streamFd);
+                t->fd   = streamFd;
+                t->params.outFd  = streamFd;
+                t->params.stream = 1;
+                streamFd = -1;
+                continue;
+            }
+
+            if (openTarget(t, targetFileName(file, t, numGpus > 1,
+                                             !indexed && numRanges > 1),
+                           indexed ? last->params.outOffset + last->range.size :
+                                     t->range.size, journal, resume,
+                           segmentDirs, numSegmentDirs, segmentBytes))
+                goto cleanup;
+            t->params.outFd = t->fd;
+        }
+    }
+
+    start = acquireNowNs();
+
+    for (r = 0; r < numRanges; r++) {
+        RM_STATUS status;
+
+        // Compressed ranges are appended, each after the previous one.
+        if (indexed && r > 0 && acquireParams.compression != COMPRESS_NONE) {
+            for (g = 0; g < numGpus; g++) {
+                DumpTarget *t = &targets[g * numRanges + r];
+                t->params.outOffset = t[-1].params.outOffset +
+                                      t[-1].stats.bytesStored;
+            }
+        }
+
+        status = acquireTargets(targets, numGpus, numRanges, r);
+        if (rmStatus == RM_OK)
+            rmStatus = status;
+    }
+
+    for (i = 0; i < numTargets; i++) {
+        DumpTarget *t = &targets[i];
+        char *name = targetName(t, numGpus > 1, numRanges > 1);
+
+        if (t->status != RM_OK)  {
+            nv_error_msg("%sUVM error: %s\n", name[0] ? name : "",
+                         RmErrorNumToString(t->status));
+        }
+
+        reportTarget(t, name);
+
+        if (t->fd >= 0 && !t->params.stream && fsync(t->fd)) {
+            nv_error_msg("Failed to flush output file.\n");
+            perror(t->file);
+            if (rmStatus == RM_OK)
+                rmStatus = RM_ERROR;
+        }
+        if (t->segments.count && segmentSetSync(&t->segments) &&
+            rmStatus == RM_OK)
+            rmStatus = RM_ERROR;
+
+        // Indexed ranges share one list, written below.
+        if (t->params.badPages && !indexed && writeBadPages(t, 1) &&
+            rmStatus == RM_OK)
+            rmStatus = RM_ERROR;
+
+        // A partial dump still gets a manifest for the chunks it holds.
+        if (t->manifest && t->merkle.leaves) {
+            NvU8 root[HASH_DIGEST_SIZE];
+            char *hex = nvstrdup("");
+            int j;
+
+            if (manifestWrite(t->manifest, &t->merkle, t->uuid)) {
+                if (rmStatus == RM_OK)
+                    rmStatus = RM_ERROR;
+                nvfree(hex);
+                nvfree(name);
+                continue;
+            }
+
+            merkleRoot(&t->merkle, root);
+            for (j = 0; j < HASH_DIGEST_SIZE; j++)
+                nv_append_sprintf(&hex, "%02x", root[j]);
+            nv_info_msg(NULL, "%s%s root %s (%llu chunks, %s).", name,
+                        hashAlgorithmName(t->merkle.algorithm), hex,
+                        (unsigned long long)t->merkle.count, t->manifest);
+            nvfree(hex);
+        }
+        nvfree(name);
+    }
+
+    if (indexed && tolerateErrors) {
+        for (g = 0; g < numGpus; g++) {
+            if (writeBadPages(&targets[g * numRanges], numRanges) &&
+                rmStatus == RM_OK)
+                rmStatus = RM_ERROR;
+        }
+    }
+
+    if (indexed && numRanges > 1) {
+        for (g = 0; g < numGpus; g++) {
+            if (writeIndex(&targets[g * numRanges], numRanges) &&
+                rmStatus == RM_OK)
+                rmStatus = RM_ERROR;
+        }
+    }
+
+    if (numTargets > 1) {
+        NvU64 elapsed = acquireNowNs() - start;
+        NvLength total = 0;
+
+        for (i = 0; i < numTargets; i++)
+            total += targets[i].stats.bytesWritten;
+
+        nv_info_msg(NULL, "Wrote %llu bytes from %d range(s) on %d GPU(s) in "
+                    "%.3f s (%.2f GB/s).",
+                    (unsigned long long)total, numRanges, numGpus,
+                    elapsed / 1e9,
+                    (total / (1024.0*1024*1024)) / (elapsed / 1e9));
+    }
+
+cleanup:
+    for (i = 0; locks && i < numGpus; i++)
+        gpuLockRelease(&locks[i]);
+    nvfree(locks);
+    for (i = 0; i < numTargets; i++) {
+        if (targets[i].params.journal)
+            journalClose(&targets[i].journal);
+        segmentSetClose(&targets[i].segments);
+        if (targets[i].fd >= 0) {
+            close(targets[i].fd);
+        }
+        nvfree(targets[i].file);
+        nvfree(targets[i].uuid);
+        nvfree(targets[i].manifest);
+        acquireBadPagesFree(&targets[i].badPages);
+        merkleFree(&targets[i].merkle);
+        imageIndexFree(&targets[i].image);
+    }
+    nvfree(targets);
+    for (i = 0; i < numGpus; i++)
+        nvfree(gpus[i].uuid);
+    nvfree(gpus);
+    rangeListFree(&ranges);
+    segmentDirsFree(segmentDirs, numSegmentDirs);
+
+    UvmDeinitialize();
+
+    return rmStatus;
+}
@@ -35,6 +35,12 @@ int getNumGpus();
 
 void nvmlUuidToUvmUuid(const char* nvmlUuid, UvmGpuUuid* uvmUuid);
 
+//
+// Returns the nvml UUID ("GPU-...") of device index, or NULL.  The caller
+// frees the result.
+//
+char* getGpuUuidByIndex(unsigned int index);
+
 // 
 // Matches a partial UUID and returns the complete one.
 // Returns NULL if one isn't found or if the search string is ambiguous.
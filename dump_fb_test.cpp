@@ -38,14 +38,46 @@ extern "C" {
 #include "nvgetopt.h"
 }
 #include "dump_fb.h"
+#include "acquire.h"
+#include "compress.h"
+#include "hash.h"
+#include "merkle.h"
+#include "ranges.h"
+#include "daemon.h"
+#include "gpulock.h"
+#include "dump_model.h"
+#include "image.h"
+#include "reader.h"
+#include "zeropage.h"
+#include "staging.h"
+#include "throttle.h"
+#include "journal.h"
+#include "diskwrite.h"
+#include "segment.h"
 #include "uvm.h"
+#include "uvm_async.h"
+#include "uvm_ioctl.h"
+#include "uvm_sim.h"
 
 #include <nvml.h>
 
 #include <stdlib.h>
 #include <malloc.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <poll.h>
 #include <time.h>
+#include <ftw.h>
+#include <dirent.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
 
 static const NvU32 PAGE_SIZE = 4096;
 
@@ -365,66 +397,4404 @@ TEST_P(PerformanceTest, TestBandwidthLocked) {
     std::cout << (GetParam()/(1024.0*1024*1024))/(elapsed/1000000000.0) << "GB/s\n";
 }
 
+TEST_P(PerformanceTest, TestBlockSizes) {
+    for (NvLength block = 16*1024; block <= 16*1024*1024; block *= 4) {
+        timespec time1, time2;
+        clock_gettime(CLOCK_REALTIME, &time1);
+        ASSERT_EQ(UvmDumpGpuMemoryEx(&uvmUuid, ptr, 0, GetParam(), block, 0),
+                (RM_STATUS)RM_OK);
+        clock_gettime(CLOCK_REALTIME, &time2);
+
+        unsigned long elapsed = diff(time1, time2);
+        std::cout << block / 1024 << "K blocks: "
+                  << (GetParam()/(1024.0*1024*1024))/(elapsed/1000000000.0)
+                  << "GB/s\n";
+    }
+}
+
 INSTANTIATE_TEST_CASE_P(PerformanceTest, PerformanceTest,
         ::testing::Values(4096, 1024*1024, 64*1024*1024, 
             128*1024*1024, 1024*1024*1024));
 
 
-static const NVGetoptOption __options[] = {
+//
+// Tests below run against the simulated GPU backend and need neither a GPU
+// nor root.
+//
+class SimTest : public ::testing::Test {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        virtual void Configure(UvmSimConfig *config) { }
+        bool MatchesSim(const void *buf, unsigned long long gpuAddress,
+                        NvLength sizeBytes, unsigned int gpuIndex = 0);
 
-    { "help",
-      'h',
-      NVGETOPT_HELP_ALWAYS,
-      NULL,
-      "Print usage information for the command line options and exit." },
+        UvmSimConfig simConfig;
+        UvmGpuUuid uvmUuid;
+};
 
-    { "gpu",
-      'g',
-      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
-      "GPU-UUID",
-      "The GPU UUID to extract data from.  To get the available UUIDs "
-      "use nvidia-smi -L (note don't include the \"GPU-\" prefix"
-    },
+void SimTest::SetUp() {
+    UvmSimConfigInit(&simConfig);
+    simConfig.fbSize = 64*1024*1024;
+    Configure(&simConfig);
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+    UvmSimGetGpuUuid(0, &uvmUuid);
+}
 
-    { NULL, 0, 0, NULL, NULL },
-};
+void SimTest::TearDown() {
+    UvmDeinitialize();
+    UvmSimDisable();
+}
 
-int main(int argc, char** argv) {
-    ::testing::InitGoogleTest(&argc, argv);
+bool SimTest::MatchesSim(const void *buf, unsigned long long gpuAddress,
+                         NvLength sizeBytes, unsigned int gpuIndex) {
+    void *expected = malloc(sizeBytes);
+    bool match;
 
-    while (1)  {
-        int c, intval;
-        char *strval  = NULL;
+    UvmSimFill(gpuIndex, gpuAddress, expected, sizeBytes);
+    match = memcmp(buf, expected, sizeBytes) == 0;
+    free(expected);
+    return match;
+}
 
-        c = nvgetopt(argc,
-                     argv,
-                     __options,
-                     &strval, /* strval */
-                     NULL, /* boolval */
-                     &intval,
-                     NULL, /* doubleval */
-                     NULL); /* disable */
+TEST_F(SimTest, ParseSpec) {
+    UvmSimConfig config;
 
-        if (c == -1) break;
+    UvmSimConfigInit(&config);
+    ASSERT_EQ(UvmSimParseSpec("gpus=2,size=1G,zero=90,const=5,region=2M,"
+                              "latency-us=20,block-us=5,setup-us=500,cache=0,"
+                              "bandwidth=4G,fail-at=0x2000,fail-len=4K,"
+                              "fail-status=invalid-address", &config), 0);
+    EXPECT_EQ(config.numGpus, 2u);
+    EXPECT_EQ(config.fbSize, 1024ull*1024*1024);
+    EXPECT_EQ(config.zeroPercent, 90u);
+    EXPECT_EQ(config.regionSize, 2ull*1024*1024);
+    EXPECT_EQ(config.latencyNs, 20000ull);
+    EXPECT_EQ(config.blockNs, 5000ull);
+    EXPECT_EQ(config.setupNs, 500000ull);
+    EXPECT_EQ(config.cacheChannels, 0);
+    EXPECT_EQ(config.bytesPerSec, 4ull*1024*1024*1024);
+    EXPECT_EQ(config.failAddress, 0x2000ull);
+    EXPECT_EQ(config.failLength, 4096ull);
+    EXPECT_EQ(config.failStatus, (RM_STATUS)RM_ERR_INVALID_ADDRESS);
 
-        switch (c)  {
-            case 'g':
-                uuid = strval;
-                break;
-            default:
-                nv_error_msg("Invalid commandline, please run `%s --help` "
-                             "for usage information.\n", argv[0]);
-                return -1;
+    EXPECT_NE(UvmSimParseSpec("bogus=1", &config), 0);
+    EXPECT_NE(UvmSimParseSpec("size", &config), 0);
+    EXPECT_NE(UvmSimParseSpec("zero=80,const=30", &config), 0);
+}
+
+TEST_F(SimTest, MatchesFill) {
+    void* ptr = mmap(NULL, 16*PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+
+    ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 5*PAGE_SIZE, 16*PAGE_SIZE),
+            (RM_STATUS)RM_OK);
+    EXPECT_TRUE(MatchesSim(ptr, 5*PAGE_SIZE, 16*PAGE_SIZE));
+
+    munmap(ptr, 16*PAGE_SIZE);
+}
+
+TEST_F(SimTest, InvalidArguments) {
+    void* ptr = mmap(NULL, 2*PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    UvmGpuUuid badUuid;
+    ASSERT_NE(ptr, MAP_FAILED);
+
+    memset(&badUuid, 0xab, sizeof(badUuid));
+    EXPECT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, 0), (RM_STATUS)RM_OK);
+    EXPECT_NE(UvmDumpGpuMemory(&uvmUuid, NULL, 0, PAGE_SIZE), (RM_STATUS)RM_OK);
+    EXPECT_NE(UvmDumpGpuMemory(&uvmUuid, (char *)ptr + 1, 0, PAGE_SIZE),
+            (RM_STATUS)RM_OK);
+    EXPECT_NE(UvmDumpGpuMemory(&uvmUuid, ptr, 1, PAGE_SIZE), (RM_STATUS)RM_OK);
+    EXPECT_NE(UvmDumpGpuMemory(&badUuid, ptr, 0, PAGE_SIZE), (RM_STATUS)RM_OK);
+    EXPECT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, simConfig.fbSize - PAGE_SIZE,
+            2*PAGE_SIZE), (RM_STATUS)RM_ERR_INVALID_ADDRESS);
+
+    munmap(ptr, 2*PAGE_SIZE);
+}
+
+TEST_F(SimTest, GpusDiffer) {
+    char a[PAGE_SIZE], b[PAGE_SIZE];
+
+    // Make every page random data so the two GPUs cannot match by chance.
+    UvmDeinitialize();
+    simConfig.numGpus = 2;
+    simConfig.zeroPercent = simConfig.constPercent = 0;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    UvmSimFill(0, 0, a, PAGE_SIZE);
+    UvmSimFill(1, 0, b, PAGE_SIZE);
+    EXPECT_NE(memcmp(a, b, PAGE_SIZE), 0);
+}
+
+TEST_F(SimTest, ImageFile) {
+    char path[] = "/tmp/dump_fb_image.XXXXXX";
+    char buf[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+    char out[2*PAGE_SIZE];
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+
+    memset(buf, 0x5a, sizeof(buf));
+    ASSERT_EQ(write(fd, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    close(fd);
+
+    UvmDeinitialize();
+    simConfig.imageFile = path;
+    simConfig.fbSize = 0;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+    EXPECT_EQ(UvmSimGetConfig()->fbSize, (NvLength)PAGE_SIZE);
+
+    memset(buf, 0, sizeof(buf));
+    ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, buf, 0, PAGE_SIZE), (RM_STATUS)RM_OK);
+    EXPECT_EQ(buf[PAGE_SIZE-1], 0x5a);
+
+    // Past the end of the image reads as zero.
+    UvmSimFill(0, PAGE_SIZE/2, out, sizeof(out));
+    EXPECT_EQ(out[0], 0x5a);
+    EXPECT_EQ(out[sizeof(out)-1], 0);
+
+    unlink(path);
+}
+
+TEST_F(SimTest, FailureInjection) {
+    void* ptr = mmap(NULL, 4*PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    UvmSimStats stats;
+    ASSERT_NE(ptr, MAP_FAILED);
+
+    UvmDeinitialize();
+    simConfig.failEvery = 3;
+    simConfig.failAddress = 8*PAGE_SIZE;
+    simConfig.failLength = PAGE_SIZE;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    EXPECT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, PAGE_SIZE), (RM_STATUS)RM_OK);
+    EXPECT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 6*PAGE_SIZE, 4*PAGE_SIZE),
+            (RM_STATUS)RM_ERR_ECC_ERROR);
+    EXPECT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, PAGE_SIZE),
+            (RM_STATUS)RM_ERR_ECC_ERROR);
+    EXPECT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, PAGE_SIZE), (RM_STATUS)RM_OK);
+
+    UvmSimGetStats(&stats);
+    EXPECT_EQ(stats.calls, 4u);
+    EXPECT_EQ(stats.failures, 2u);
+    EXPECT_EQ(stats.bytes, 2ull*PAGE_SIZE);
+
+    munmap(ptr, 4*PAGE_SIZE);
+}
+
+TEST_F(SimTest, BandwidthCap) {
+    const NvLength size = 4*1024*1024;
+    void* ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+
+    UvmDeinitialize();
+    simConfig.bytesPerSec = 100*1024*1024;
+    simConfig.latencyNs = 1000000;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    // 4 MB at 100 MB/s plus 1 ms of latency is at least 41 ms.
+    NvU64 start = acquireNowNs();
+    ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, size), (RM_STATUS)RM_OK);
+    EXPECT_GE(acquireNowNs() - start, 41000000ull);
+
+    munmap(ptr, size);
+}
+
+TEST_F(SimTest, ChannelCache) {
+    void* ptr = mmap(NULL, PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    UvmSimStats stats;
+    ASSERT_NE(ptr, MAP_FAILED);
+
+    // Cached: one setup per GPU until UvmDeinitialize releases it
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, PAGE_SIZE), RM_OK);
+    UvmSimGetStats(&stats);
+    EXPECT_EQ(stats.setups, 1ull);
+
+    UvmDeinitialize();
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+    ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, PAGE_SIZE), RM_OK);
+    UvmSimGetStats(&stats);
+    EXPECT_EQ(stats.setups, 2ull);
+
+    UvmDeinitialize();
+    simConfig.cacheChannels = 0;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, PAGE_SIZE), RM_OK);
+    UvmSimGetStats(&stats);
+    EXPECT_EQ(stats.setups, 3ull);
+
+    munmap(ptr, PAGE_SIZE);
+}
+
+TEST_F(SimTest, BlockSizeHint) {
+    const NvLength size = 1024*1024;
+    const struct { NvLength hint, used; } cases[] = {
+        { 0,                 UVM_SIM_DEFAULT_BLOCK_SIZE },
+        { 256*1024,          256*1024 },
+        { 5000,              PAGE_SIZE },
+        { 1,                 PAGE_SIZE },
+        { 64ull*1024*1024,   UVM_SIM_MAX_BLOCK_SIZE },
+    };
+    void* ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    UvmSimStats stats, before;
+    ASSERT_NE(ptr, MAP_FAILED);
+
+    for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        UvmSimGetStats(&before);
+        ASSERT_EQ(UvmDumpGpuMemoryEx(&uvmUuid, ptr, 0, size,
+                                     cases[i].hint, 0), RM_OK);
+        UvmSimGetStats(&stats);
+        EXPECT_EQ(stats.lastBlockSize, cases[i].used) << cases[i].hint;
+        EXPECT_EQ(stats.blocks - before.blocks,
+                  (size + cases[i].used - 1) / cases[i].used);
+    }
+    EXPECT_TRUE(MatchesSim(ptr, 0, size));
+
+    EXPECT_EQ(UvmDumpGpuMemoryEx(&uvmUuid, ptr, 0, size, 0,
+                                 UVM_DUMP_FLAG_SERIAL |
+                                 UVM_DUMP_FLAG_NO_COALESCE), RM_OK);
+    EXPECT_EQ(UvmDumpGpuMemoryEx(&uvmUuid, ptr, 0, size, 0, 0x80),
+              RM_ERR_INVALID_ARGUMENT);
+
+    munmap(ptr, size);
+}
+
+TEST_F(SimTest, DumpVectored) {
+    const unsigned int count = 2500;
+    char *buf = (char *)mmap(NULL, count * PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    std::vector<UvmDumpRange> ranges(count);
+    UvmSimStats stats;
+    ASSERT_NE(buf, MAP_FAILED);
+
+    // Scattered pages, every tenth range empty
+    for (unsigned int i = 0; i < count; i++) {
+        ranges[i].gpuOffset = (i * 7919ull % count) * PAGE_SIZE;
+        ranges[i].pBuffer   = buf + i * PAGE_SIZE;
+        ranges[i].length    = i % 10 ? PAGE_SIZE : 0;
+    }
+    ASSERT_EQ(UvmDumpGpuMemoryV(&uvmUuid, &ranges[0], count, 0, 0), RM_OK);
+    for (unsigned int i = 0; i < count; i++) {
+        if (ranges[i].length) {
+            ASSERT_TRUE(MatchesSim(ranges[i].pBuffer, ranges[i].gpuOffset,
+                                   PAGE_SIZE)) << i;
         }
     }
 
-    if (!uuid) {
-        nv_error_msg("Must provide a UUID using -g.  Use nvidia-smi -L to see "
-		     "a list of UUIDs.  Omit the \"GPU-\" portion for -g.\n");
-        return -1;
+    // Batched by UVM_DUMP_MAX_RANGES, one channel setup for all of them
+    UvmSimGetStats(&stats);
+    EXPECT_EQ(stats.calls, (NvU64)(count + UVM_DUMP_MAX_RANGES - 1) /
+                           UVM_DUMP_MAX_RANGES);
+    EXPECT_EQ(stats.ranges, (NvU64)count);
+    EXPECT_EQ(stats.bytes, (NvLength)(count - count / 10) * PAGE_SIZE);
+    EXPECT_EQ(stats.setups, 1ull);
+
+    // One bad range fails its batch before anything is copied
+    memset(buf, 0x42, count * PAGE_SIZE);
+    ranges[5].pBuffer = buf + 5 * PAGE_SIZE + 8;
+    EXPECT_EQ(UvmDumpGpuMemoryV(&uvmUuid, &ranges[0], 10, 0, 0),
+              RM_ERR_INVALID_ARGUMENT);
+    EXPECT_EQ(buf[PAGE_SIZE], 0x42);
+
+    EXPECT_EQ(UvmDumpGpuMemoryV(&uvmUuid, NULL, 0, 0, 0), RM_OK);
+
+    munmap(buf, count * PAGE_SIZE);
+}
+
+TEST_F(SimTest, DumpVectoredFallback) {
+    const unsigned int count = 50;
+    char *buf = (char *)mmap(NULL, count * PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    std::vector<UvmDumpRange> ranges(count);
+    UvmSimStats stats;
+    ASSERT_NE(buf, MAP_FAILED);
+
+    // A backend without dumpGpuMemoryV gets one call per range
+    UvmBackend single = *UvmGetBackend();
+    single.dumpGpuMemoryV = NULL;
+    UvmSetBackend(&single);
+
+    for (unsigned int i = 0; i < count; i++) {
+        ranges[i].gpuOffset = (count - i) * 2ull * PAGE_SIZE;
+        ranges[i].pBuffer   = buf + i * PAGE_SIZE;
+        ranges[i].length    = PAGE_SIZE;
+    }
+    EXPECT_EQ(UvmDumpGpuMemoryV(&uvmUuid, &ranges[0], count, 0, 0), RM_OK);
+    for (unsigned int i = 0; i < count; i++)
+        EXPECT_TRUE(MatchesSim(ranges[i].pBuffer, ranges[i].gpuOffset,
+                               PAGE_SIZE)) << i;
+
+    UvmSimGetStats(&stats);
+    EXPECT_EQ(stats.calls, (NvU64)count);
+
+    UvmSimEnable(&simConfig);
+    munmap(buf, count * PAGE_SIZE);
+}
+
+//
+// Scattered 4K reads, one call per range and vectored.
+//
+TEST_F(SimTest, VectoredLatency) {
+    const unsigned int count = 1000;
+    char *buf = (char *)mmap(NULL, count * PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    std::vector<UvmDumpRange> ranges(count);
+    NvU64 start, single, vectored;
+    ASSERT_NE(buf, MAP_FAILED);
+
+    UvmDeinitialize();
+    simConfig.latencyNs = 20000;
+    simConfig.blockNs = 2000;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    for (unsigned int i = 0; i < count; i++) {
+        ranges[i].gpuOffset = (i * 7919ull % 16384) * PAGE_SIZE;
+        ranges[i].pBuffer   = buf + i * PAGE_SIZE;
+        ranges[i].length    = PAGE_SIZE;
+    }
+
+    start = acquireNowNs();
+    for (unsigned int i = 0; i < count; i++)
+        ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, ranges[i].pBuffer,
+                                   ranges[i].gpuOffset, PAGE_SIZE), RM_OK);
+    single = acquireNowNs() - start;
+
+    start = acquireNowNs();
+    ASSERT_EQ(UvmDumpGpuMemoryV(&uvmUuid, &ranges[0], count, 0, 0), RM_OK);
+    vectored = acquireNowNs() - start;
+
+    std::cout << count << " scattered 4K ranges, one call each: "
+              << single / 1000000.0 << "ms, vectored: "
+              << vectored / 1000000.0 << "ms\n";
+    EXPECT_LT(vectored * 5, single);
+
+    munmap(buf, count * PAGE_SIZE);
+}
+
+//
+// Per-call latency of 4K dumps, as in PerformanceTest.TestBandwidth, when the
+// channel manager is set up on every call and when it is cached.
+//
+TEST_F(SimTest, ChannelCacheLatency) {
+    const unsigned int count = 200;
+    void* ptr = mmap(NULL, PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    NvU64 perCall[2];
+    ASSERT_NE(ptr, MAP_FAILED);
+
+    for (int cache = 0; cache < 2; cache++) {
+        UvmDeinitialize();
+        simConfig.latencyNs = 10000;
+        simConfig.setupNs = 500000;
+        simConfig.cacheChannels = cache;
+        UvmSimEnable(&simConfig);
+        ASSERT_EQ(UvmInitialize(), RM_OK);
+
+        NvU64 start = acquireNowNs();
+        for (unsigned int i = 0; i < count; i++)
+            ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, i * PAGE_SIZE,
+                                       PAGE_SIZE), RM_OK);
+        perCall[cache] = (acquireNowNs() - start) / count;
+        std::cout << "4K dump, channel manager "
+                  << (cache ? "cached: " : "per call: ")
+                  << perCall[cache] / 1000.0 << "us\n";
+    }
+    EXPECT_LT(perCall[1] * 3, perCall[0]);
+
+    munmap(ptr, PAGE_SIZE);
+}
+
+static bool EventFdReadable(int fd) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+// Reaps until count completions were seen, in ticket order.
+static std::vector<UvmDumpCompletion> ReapAll(UvmDumpQueue *queue,
+                                              unsigned int count) {
+    std::vector<UvmDumpCompletion> done(count);
+    unsigned int n = 0;
+
+    while (n < count) {
+        unsigned int got = UvmDumpReap(queue, &done[n], count - n, 1);
+        if (got == 0)
+            break;
+        n += got;
+    }
+    done.resize(n);
+    return done;
+}
+
+TEST_F(SimTest, AsyncSubmitReap) {
+    const unsigned int depth = 4;
+    char *buf = (char *)mmap(NULL, depth * PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    UvmDumpQueue *queue;
+    UvmDumpTicket ticket;
+    UvmDumpCompletion extra;
+    struct epoll_event ev;
+    int ep;
+    ASSERT_NE(buf, MAP_FAILED);
+
+    UvmDeinitialize();
+    simConfig.latencyNs = 20000000;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    EXPECT_EQ(UvmDumpQueueCreate(0, &queue), RM_ERR_INVALID_ARGUMENT);
+    ASSERT_EQ(UvmDumpQueueCreate(depth, &queue), RM_OK);
+
+    // Submitting does not wait for the 20ms copies
+    NvU64 start = acquireNowNs();
+    for (unsigned int i = 0; i < depth; i++) {
+        ASSERT_EQ(UvmDumpSubmit(queue, &uvmUuid, buf + i * PAGE_SIZE,
+                                (i + 1) * 3ull * PAGE_SIZE, PAGE_SIZE, 0, 0,
+                                buf + i * PAGE_SIZE, &ticket), RM_OK);
+        EXPECT_EQ(ticket, (UvmDumpTicket)i + 1);
+    }
+    EXPECT_LT(acquireNowNs() - start, 10000000ull);
+    EXPECT_EQ(UvmDumpSubmit(queue, &uvmUuid, buf, 0, PAGE_SIZE, 0, 0, NULL,
+                            &ticket), RM_ERR_BUSY_RETRY);
+    EXPECT_EQ(UvmDumpQueueOutstanding(queue), depth);
+    EXPECT_EQ(UvmDumpReap(queue, &extra, 1, 0), 0u);
+    EXPECT_FALSE(EventFdReadable(UvmDumpQueueGetEventFd(queue)));
+
+    ep = epoll_create1(0);
+    ASSERT_GE(ep, 0);
+    ev.events = EPOLLIN;
+    ev.data.ptr = queue;
+    ASSERT_EQ(epoll_ctl(ep, EPOLL_CTL_ADD, UvmDumpQueueGetEventFd(queue), &ev),
+              0);
+    ASSERT_EQ(epoll_wait(ep, &ev, 1, 1000), 1);
+    EXPECT_EQ(ev.data.ptr, (void *)queue);
+    close(ep);
+
+    std::vector<UvmDumpCompletion> done = ReapAll(queue, depth);
+    ASSERT_EQ(done.size(), depth);
+    for (unsigned int i = 0; i < depth; i++) {
+        EXPECT_EQ(done[i].ticket, (UvmDumpTicket)i + 1);
+        EXPECT_EQ(done[i].status, RM_OK);
+        EXPECT_EQ(done[i].userData, (void *)(buf + i * PAGE_SIZE));
+        EXPECT_TRUE(MatchesSim(buf + i * PAGE_SIZE, (i + 1) * 3ull * PAGE_SIZE,
+                               PAGE_SIZE)) << i;
+    }
+    EXPECT_FALSE(EventFdReadable(UvmDumpQueueGetEventFd(queue)));
+    EXPECT_EQ(UvmDumpQueueOutstanding(queue), 0u);
+
+    // Nothing in flight, so a blocking reap returns at once
+    EXPECT_EQ(UvmDumpReap(queue, &extra, 1, 1), 0u);
+
+    UvmDumpQueueDestroy(queue);
+    munmap(buf, depth * PAGE_SIZE);
+}
+
+TEST_F(SimTest, AsyncStatusPerTicket) {
+    char *buf = (char *)mmap(NULL, 3 * PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    UvmDumpQueue *queue;
+    UvmDumpTicket tickets[3], ticket;
+    ASSERT_NE(buf, MAP_FAILED);
+
+    UvmDeinitialize();
+    simConfig.failAddress = 8*PAGE_SIZE;
+    simConfig.failLength = PAGE_SIZE;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    ASSERT_EQ(UvmDumpQueueCreate(3, &queue), RM_OK);
+
+    // Argument errors are returned by the submit and use no slot
+    EXPECT_EQ(UvmDumpSubmit(queue, &uvmUuid, buf + 1, 0, PAGE_SIZE, 0, 0,
+                            NULL, &ticket), RM_ERR_INVALID_ARGUMENT);
+
+    for (unsigned int i = 0; i < 3; i++) {
+        ASSERT_EQ(UvmDumpSubmit(queue, &uvmUuid, buf + i * PAGE_SIZE,
+                                (7 + i) * PAGE_SIZE, PAGE_SIZE, 0, 0,
+                                NULL, &tickets[i]), RM_OK);
+    }
+
+    std::vector<UvmDumpCompletion> done = ReapAll(queue, 3);
+    ASSERT_EQ(done.size(), 3u);
+    for (unsigned int i = 0; i < 3; i++) {
+        EXPECT_EQ(done[i].ticket, tickets[i]);
+        EXPECT_EQ(done[i].status, i == 1 ? (RM_STATUS)RM_ERR_ECC_ERROR :
+                                           (RM_STATUS)RM_OK) << i;
+    }
+    EXPECT_TRUE(MatchesSim(buf, 7 * PAGE_SIZE, PAGE_SIZE));
+    EXPECT_TRUE(MatchesSim(buf + 2 * PAGE_SIZE, 9 * PAGE_SIZE, PAGE_SIZE));
+
+    UvmDumpQueueDestroy(queue);
+    munmap(buf, 3 * PAGE_SIZE);
+}
+
+TEST_F(SimTest, AsyncWorkerFallback) {
+    const unsigned int count = 32, depth = 4;
+    char *buf = (char *)mmap(NULL, count * PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    UvmDumpQueue *queue;
+    UvmDumpTicket ticket;
+    unsigned int submitted = 0, reaped = 0;
+    ASSERT_NE(buf, MAP_FAILED);
+
+    // Like the ioctl backend, run synchronous dumps on the queue's workers
+    UvmBackend blocking = *UvmGetBackend();
+    blocking.dumpGpuMemoryAsync = NULL;
+    UvmSetBackend(&blocking);
+
+    ASSERT_EQ(UvmDumpQueueCreate(depth, &queue), RM_OK);
+    while (reaped < count) {
+        UvmDumpCompletion done[depth];
+        unsigned int n;
+
+        while (submitted < count &&
+               UvmDumpSubmit(queue, &uvmUuid, buf + submitted * PAGE_SIZE,
+                             submitted * 5ull * PAGE_SIZE, PAGE_SIZE, 0, 0,
+                             NULL, &ticket) == RM_OK)
+            submitted++;
+
+        EXPECT_LE(UvmDumpQueueOutstanding(queue), depth);
+        n = UvmDumpReap(queue, done, depth, 1);
+        ASSERT_GT(n, 0u);
+        for (unsigned int i = 0; i < n; i++)
+            EXPECT_EQ(done[i].status, RM_OK);
+        reaped += n;
     }
+    for (unsigned int i = 0; i < count; i++)
+        EXPECT_TRUE(MatchesSim(buf + i * PAGE_SIZE, i * 5ull * PAGE_SIZE,
+                               PAGE_SIZE)) << i;
+    UvmDumpQueueDestroy(queue);
+
+    UvmSimEnable(&simConfig);
+    munmap(buf, count * PAGE_SIZE);
+}
+
+//
+// One thread keeping two GPUs busy: blocking calls take turns, queued dumps
+// run on both copy engines at once.
+//
+TEST_F(SimTest, AsyncLatency) {
+    const unsigned int count = 32;
+    char *buf = (char *)mmap(NULL, count * PAGE_SIZE, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    UvmGpuUuid uuids[2];
+    UvmDumpQueue *queue;
+    UvmDumpTicket ticket;
+    NvU64 start, blocking, queued;
+    ASSERT_NE(buf, MAP_FAILED);
+
+    UvmDeinitialize();
+    simConfig.numGpus = 2;
+    simConfig.latencyNs = 1000000;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+    UvmSimGetGpuUuid(0, &uuids[0]);
+    UvmSimGetGpuUuid(1, &uuids[1]);
+
+    start = acquireNowNs();
+    for (unsigned int i = 0; i < count; i++)
+        ASSERT_EQ(UvmDumpGpuMemory(&uuids[i % 2], buf + i * PAGE_SIZE,
+                                   i * PAGE_SIZE, PAGE_SIZE), RM_OK);
+    blocking = acquireNowNs() - start;
+
+    ASSERT_EQ(UvmDumpQueueCreate(count, &queue), RM_OK);
+    start = acquireNowNs();
+    for (unsigned int i = 0; i < count; i++)
+        ASSERT_EQ(UvmDumpSubmit(queue, &uuids[i % 2], buf + i * PAGE_SIZE,
+                                i * PAGE_SIZE, PAGE_SIZE, 0, 0, NULL, &ticket),
+                  RM_OK);
+    EXPECT_EQ(ReapAll(queue, count).size(), count);
+    queued = acquireNowNs() - start;
+    UvmDumpQueueDestroy(queue);
+
+    for (unsigned int i = 0; i < count; i++)
+        EXPECT_TRUE(MatchesSim(buf + i * PAGE_SIZE, i * PAGE_SIZE, PAGE_SIZE,
+                               i % 2)) << i;
+
+    std::cout << count << " 4K dumps on 2 GPUs, blocking: "
+              << blocking / 1000000.0 << "ms, queued: "
+              << queued / 1000000.0 << "ms\n";
+    EXPECT_LT(queued * 3, blocking * 2);
+
+    munmap(buf, count * PAGE_SIZE);
+}
+
+TEST_F(SimTest, DumpToFd) {
+    char path[] = "/tmp/dump_fb_test.XXXXXX";
+    const NvLength size = 40*PAGE_SIZE;
+    NvLength written;
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    unlink(path);
+
+    EXPECT_EQ(UvmDumpGpuMemoryToFd(&uvmUuid, fd, 3*PAGE_SIZE, 8*PAGE_SIZE,
+                                   size, 16*PAGE_SIZE, 0, &written), RM_OK);
+    EXPECT_EQ(written, size);
 
-    if (getuid() != 0 && geteuid() != 0 ) {
+    void *ptr = mmap(NULL, 3*PAGE_SIZE + size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim((char *)ptr + 3*PAGE_SIZE, 8*PAGE_SIZE, size));
+    munmap(ptr, 3*PAGE_SIZE + size);
+
+    // Out of bounds and unaligned, like UvmDumpGpuMemory
+    EXPECT_EQ(UvmDumpGpuMemoryToFd(&uvmUuid, fd, 0, simConfig.fbSize,
+                                   PAGE_SIZE, 0, 0, &written),
+              RM_ERR_INVALID_ADDRESS);
+    EXPECT_EQ(UvmDumpGpuMemoryToFd(&uvmUuid, fd, 0, 1, PAGE_SIZE, 0, 0,
+                                   &written), RM_ERR_INVALID_ARGUMENT);
+    EXPECT_EQ(written, 0u);
+    close(fd);
+}
+
+// Only regular files open for writing can be written by the driver.
+TEST_F(SimTest, DumpToFdRejectsOtherFiles) {
+    int fds[2];
+    NvLength written;
+    ASSERT_EQ(pipe(fds), 0);
+
+    EXPECT_EQ(UvmDumpGpuMemoryToFd(&uvmUuid, fds[1], 0, 0, PAGE_SIZE, 0, 0,
+                                   &written), RM_ERR_INVALID_ARGUMENT);
+    close(fds[0]);
+    close(fds[1]);
+
+    int fd = open("/dev/null", O_RDONLY);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(UvmDumpGpuMemoryToFd(&uvmUuid, fd, 0, 0, PAGE_SIZE, 0, 0,
+                                   &written), RM_ERR_INVALID_ARGUMENT);
+    close(fd);
+
+    EXPECT_EQ(UvmDumpGpuMemoryToFd(&uvmUuid, -1, 0, 0, PAGE_SIZE, 0, 0,
+                                   &written), RM_ERR_INVALID_ARGUMENT);
+}
+
+class AcquireTest : public SimTest {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        char path[64];
+        int fd;
+        AcquireParams params;
+        AcquireBadPages badPages;
+};
+
+void AcquireTest::SetUp() {
+    SimTest::SetUp();
+    strcpy(path, "/tmp/dump_fb_test.XXXXXX");
+    fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+
+    acquireParamsInit(&params);
+    params.gpuUuid = &uvmUuid;
+    params.outFd   = fd;
+    memset(&badPages, 0, sizeof(badPages));
+}
+
+void AcquireTest::TearDown() {
+    acquireBadPagesFree(&badPages);
+    close(fd);
+    unlink(path);
+    SimTest::TearDown();
+}
+
+TEST_F(AcquireTest, MatchesSource) {
+    NvLength size = 5*1024*1024 + 3*PAGE_SIZE;
+    AcquireStats stats;
+
+    params.baseAddress = 64*PAGE_SIZE;
+    params.sizeBytes   = size;
+    params.chunkBytes  = 1024*1024;
+    params.depth       = 3;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.bytesWritten, size);
+    EXPECT_EQ(stats.chunks, 6u);
+
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim(ptr, params.baseAddress, size));
+    munmap(ptr, size);
+}
+
+TEST_F(AcquireTest, OutputOffset) {
+    char buf[PAGE_SIZE];
+
+    params.baseAddress = 16*PAGE_SIZE;
+    params.sizeBytes   = 4*PAGE_SIZE;
+    params.chunkBytes  = PAGE_SIZE;
+    params.outOffset   = 2*PAGE_SIZE;
+
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_OK);
+    ASSERT_EQ(pread(fd, buf, sizeof(buf), 2*PAGE_SIZE), (ssize_t)sizeof(buf));
+    EXPECT_TRUE(MatchesSim(buf, 16*PAGE_SIZE, PAGE_SIZE));
+}
+
+TEST_F(AcquireTest, ZeroLength) {
+    AcquireStats stats;
+
+    params.sizeBytes = 0;
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.chunks, 0u);
+}
+
+TEST_F(AcquireTest, InvalidChunkSize) {
+    params.sizeBytes  = PAGE_SIZE;
+    params.chunkBytes = PAGE_SIZE + 1;
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+}
+
+// Chunks copied before the failing one must still reach the file.
+TEST_F(AcquireTest, CopyFailure) {
+    AcquireStats stats;
+    char buf[PAGE_SIZE];
+
+    UvmDeinitialize();
+    simConfig.failAddress = 9*PAGE_SIZE;
+    simConfig.failLength  = PAGE_SIZE;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    params.sizeBytes  = 16*PAGE_SIZE;
+    params.chunkBytes = 4*PAGE_SIZE;
+    params.depth      = 2;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_ERR_ECC_ERROR);
+    EXPECT_EQ(stats.bytesWritten, 8ull*PAGE_SIZE);
+    ASSERT_EQ(pread(fd, buf, sizeof(buf), 7*PAGE_SIZE), (ssize_t)sizeof(buf));
+    EXPECT_TRUE(MatchesSim(buf, 7*PAGE_SIZE, PAGE_SIZE));
+}
+
+TEST_F(AcquireTest, WriteFailure) {
+    params.sizeBytes  = 4*PAGE_SIZE;
+    params.chunkBytes = PAGE_SIZE;
+    params.outFd      = open("/dev/null", O_RDONLY);
+
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERROR);
+    close(params.outFd);
+}
+
+TEST(CompressTest, ParseSpec) {
+    CompressAlgorithm algorithm;
+    int level;
+
+    ASSERT_EQ(compressParseSpec("zstd", &algorithm, &level), 0);
+    EXPECT_EQ(algorithm, COMPRESS_ZSTD);
+    EXPECT_EQ(level, 3);
+    ASSERT_EQ(compressParseSpec("lz4:9", &algorithm, &level), 0);
+    EXPECT_EQ(algorithm, COMPRESS_LZ4);
+    EXPECT_EQ(level, 9);
+
+    EXPECT_NE(compressParseSpec("gzip", &algorithm, &level), 0);
+    EXPECT_NE(compressParseSpec("zstd:", &algorithm, &level), 0);
+    EXPECT_NE(compressParseSpec("zstd:99", &algorithm, &level), 0);
+    EXPECT_NE(compressParseSpec("lz4:x", &algorithm, &level), 0);
+}
+
+class CompressedAcquireTest : public AcquireTest {
+    protected:
+        NvLength Expand(unsigned long long gpuAddress);
+};
+
+//
+// Walks the seek table of the compressed dump, checking every frame against
+// the simulated GPU.  Returns the number of bytes that decompressed.
+//
+NvLength CompressedAcquireTest::Expand(unsigned long long gpuAddress) {
+    SeekTable table;
+    NvLength done = 0;
+    off_t offset = 0;
+
+    if (seekTableRead(fd, &table))
+        return 0;
+
+    NvLength frameBytes = compressBound(params.compression,
+                                        params.compressLevel,
+                                        params.chunkBytes);
+    void *frame = malloc(frameBytes);
+    void *buf = malloc(params.chunkBytes);
+
+    for (NvU32 i = 0; i < table.count; i++) {
+        const SeekTableEntry *e = &table.entries[i];
+
+        if (e->compressedSize > frameBytes ||
+            pread(fd, frame, e->compressedSize, offset) !=
+                (ssize_t)e->compressedSize ||
+            decompressChunk(buf, params.chunkBytes, frame,
+                            e->compressedSize) != e->decompressedSize ||
+            !MatchesSim(buf, gpuAddress + done, e->decompressedSize))
+            break;
+
+        offset += e->compressedSize;
+        done   += e->decompressedSize;
+    }
+
+    free(buf);
+    free(frame);
+    seekTableFree(&table);
+    return done;
+}
+
+TEST_F(CompressedAcquireTest, RoundTrip) {
+    const char *specs[] = { "zstd", "zstd:1", "lz4", "lz4:9" };
+    NvLength size = 5*1024*1024 + 3*PAGE_SIZE;
+
+    for (unsigned int i = 0; i < sizeof(specs)/sizeof(specs[0]); i++) {
+        AcquireStats stats;
+        struct stat st;
+
+        SCOPED_TRACE(specs[i]);
+        ASSERT_EQ(ftruncate(fd, 0), 0);
+        ASSERT_EQ(compressParseSpec(specs[i], &params.compression,
+                                    &params.compressLevel), 0);
+        params.baseAddress     = 64*PAGE_SIZE;
+        params.sizeBytes       = size;
+        params.chunkBytes      = 1024*1024;
+        params.depth           = 4;
+        params.workerThreads   = 3;
+
+        ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+        EXPECT_EQ(stats.bytesWritten, size);
+        EXPECT_EQ(stats.chunks, 6u);
+        ASSERT_EQ(fstat(fd, &st), 0);
+        EXPECT_EQ((NvLength)st.st_size, stats.bytesStored);
+        EXPECT_LT(stats.bytesStored, size);
+        EXPECT_EQ(Expand(params.baseAddress), size);
+    }
+}
+
+// A failed copy still leaves a readable stream of the chunks before it.
+TEST_F(CompressedAcquireTest, CopyFailure) {
+    AcquireStats stats;
+
+    UvmDeinitialize();
+    simConfig.failAddress = 9*PAGE_SIZE;
+    simConfig.failLength  = PAGE_SIZE;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    params.sizeBytes   = 16*PAGE_SIZE;
+    params.chunkBytes  = 4*PAGE_SIZE;
+    params.depth       = 2;
+    params.compression = COMPRESS_LZ4;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_ERR_ECC_ERROR);
+    EXPECT_EQ(stats.bytesWritten, 8ull*PAGE_SIZE);
+    EXPECT_EQ(Expand(0), 8ull*PAGE_SIZE);
+}
+
+TEST_F(CompressedAcquireTest, WriteFailure) {
+    params.sizeBytes   = 4*PAGE_SIZE;
+    params.chunkBytes  = PAGE_SIZE;
+    params.compression = COMPRESS_ZSTD;
+    params.outFd       = open("/dev/null", O_RDONLY);
+
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERROR);
+    close(params.outFd);
+}
+
+static std::string toHex(const NvU8 *digest) {
+    char hex[2 * HASH_DIGEST_SIZE + 1];
+    for (int i = 0; i < HASH_DIGEST_SIZE; i++)
+        sprintf(hex + 2*i, "%02x", digest[i]);
+    return hex;
+}
+
+static std::string hashHex(HashAlgorithm algorithm, const void *data,
+                           NvLength len) {
+    NvU8 digest[HASH_DIGEST_SIZE];
+    hashBuffer(algorithm, data, len, digest);
+    return toHex(digest);
+}
+
+// Known answers, on both SHA-256 code paths.
+TEST(HashTest, KnownAnswers) {
+    std::vector<NvU8> data(100000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = i % 251;
+
+    for (int accelerated = 0; accelerated < 2; accelerated++) {
+        hashSetSha256Accelerated(accelerated);
+        SCOPED_TRACE(hashSha256Implementation());
+
+        EXPECT_EQ(hashHex(HASH_SHA256, "", 0),
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+        EXPECT_EQ(hashHex(HASH_SHA256, "abc", 3),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        EXPECT_EQ(hashHex(HASH_SHA256, &data[0], data.size()),
+            "cd2df694e424bc7968cc37f47751019e5ca0cd1bdf2e479ea537c3a1c32ee1aa");
+    }
+
+    EXPECT_EQ(hashHex(HASH_BLAKE3, "", 0),
+        "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262");
+    EXPECT_EQ(hashHex(HASH_BLAKE3, "abc", 3),
+        "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85");
+    EXPECT_EQ(hashHex(HASH_BLAKE3, &data[0], data.size()),
+        "d93c23eedaf165a7e0be908ba86f1a7a520d568d2d13cde787c8580c5c72cc54");
+}
+
+TEST(HashTest, Crc32c) {
+    std::vector<NvU8> data(100000);
+    NvU8 zeros[32] = { 0 };
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = i % 251;
+
+    for (int accelerated = 0; accelerated < 2; accelerated++) {
+        hashSetCrc32cAccelerated(accelerated);
+        SCOPED_TRACE(hashCrc32cImplementation());
+
+        EXPECT_EQ(hashCrc32c(0, "", 0), 0u);
+        EXPECT_EQ(hashCrc32c(0, "123456789", 9), 0xe3069283u);
+        EXPECT_EQ(hashCrc32c(0, zeros, sizeof(zeros)), 0x8a9136aau);
+        EXPECT_EQ(hashCrc32c(0, &data[0], data.size()), 0x7247f66bu);
+
+        // Unaligned starts and continuing from a previous CRC.
+        NvU32 crc = hashCrc32c(0, &data[0], 3);
+        crc = hashCrc32c(crc, &data[3], 50000 - 3);
+        EXPECT_EQ(hashCrc32c(crc, &data[50000], 50000), 0x7247f66bu);
+    }
+    hashSetCrc32cAccelerated(1);
+}
+
+TEST(HashTest, MerkleRoot) {
+    MerkleTree tree;
+    NvU8 node[1 + 2*HASH_DIGEST_SIZE];
+    NvU8 left[HASH_DIGEST_SIZE], root[HASH_DIGEST_SIZE];
+
+    merkleInit(&tree, HASH_SHA256, PAGE_SIZE, 0, 3);
+    for (int i = 0; i < 3; i++)
+        hashBuffer(HASH_SHA256, &i, sizeof(i), merkleLeaf(&tree, i));
+
+    // root = H(1 || H(1 || leaf0 || leaf1) || leaf2)
+    node[0] = 0x01;
+    memcpy(node + 1, merkleLeaf(&tree, 0), 2*HASH_DIGEST_SIZE);
+    hashBuffer(HASH_SHA256, node, sizeof(node), left);
+    memcpy(node + 1, left, HASH_DIGEST_SIZE);
+    memcpy(node + 1 + HASH_DIGEST_SIZE, merkleLeaf(&tree, 2), HASH_DIGEST_SIZE);
+    hashBuffer(HASH_SHA256, node, sizeof(node), left);
+
+    merkleRoot(&tree, root);
+    EXPECT_EQ(toHex(root), toHex(left));
+
+    tree.count = 1;
+    merkleRoot(&tree, root);
+    EXPECT_EQ(toHex(root), toHex(merkleLeaf(&tree, 0)));
+    merkleFree(&tree);
+}
+
+class HashedAcquireTest : public AcquireTest {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        char manifest[80];
+        MerkleTree merkle;
+};
+
+void HashedAcquireTest::SetUp() {
+    AcquireTest::SetUp();
+    snprintf(manifest, sizeof(manifest), "%s.manifest", path);
+    memset(&merkle, 0, sizeof(merkle));
+
+    params.baseAddress = 32*PAGE_SIZE;
+    params.sizeBytes   = 2*1024*1024 + 5*PAGE_SIZE;
+    params.chunkBytes  = 256*1024;
+    params.hash        = HASH_SHA256;
+    params.merkle      = &merkle;
+}
+
+void HashedAcquireTest::TearDown() {
+    merkleFree(&merkle);
+    unlink(manifest);
+    AcquireTest::TearDown();
+}
+
+// Leaves are the plain hashes of the chunks, whatever the output format.
+TEST_F(HashedAcquireTest, LeavesMatchSource) {
+    const char *specs[] = { "sha256", "blake3" };
+    std::vector<NvU8> chunk(params.chunkBytes);
+
+    for (unsigned int i = 0; i < 2; i++) {
+        SCOPED_TRACE(specs[i]);
+        ASSERT_EQ(ftruncate(fd, 0), 0);
+        ASSERT_EQ(hashParseName(specs[i], &params.hash), 0);
+        params.compression = i ? COMPRESS_ZSTD : COMPRESS_NONE;
+        merkleFree(&merkle);
+
+        ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_OK);
+        ASSERT_EQ(merkle.count, 9u);
+        EXPECT_EQ(merkle.sizeBytes, params.sizeBytes);
+
+        for (NvU64 c = 0; c < merkle.count; c++) {
+            NvLength len = std::min(params.chunkBytes,
+                                    params.sizeBytes - c*params.chunkBytes);
+            UvmSimFill(0, params.baseAddress + c*params.chunkBytes,
+                       &chunk[0], len);
+            EXPECT_EQ(hashHex(params.hash, &chunk[0], len),
+                      toHex(merkleLeaf(&merkle, c)));
+        }
+        EXPECT_EQ(merkleVerify(&merkle, fd, 0, params.sizeBytes, NULL), 0);
+    }
+}
+
+TEST_F(HashedAcquireTest, ManifestDetectsTampering) {
+    MerkleTree loaded;
+    NvU64 bad = 0;
+    char byte;
+
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_OK);
+    ASSERT_EQ(manifestWrite(manifest, &merkle, "GPU-test"), 0);
+    ASSERT_EQ(manifestRead(manifest, &loaded), 0);
+    EXPECT_EQ(loaded.count, merkle.count);
+    EXPECT_EQ(loaded.baseAddress, params.baseAddress);
+    EXPECT_EQ(merkleVerify(&loaded, fd, 0, loaded.sizeBytes, NULL), 0);
+
+    // Flip one byte in chunk 5; only ranges covering it notice.
+    NvLength where = 5*params.chunkBytes + 123;
+    ASSERT_EQ(pread(fd, &byte, 1, where), 1);
+    byte ^= 0x40;
+    ASSERT_EQ(pwrite(fd, &byte, 1, where), 1);
+
+    EXPECT_EQ(merkleVerify(&loaded, fd, 0, loaded.sizeBytes, &bad), 1);
+    EXPECT_EQ(bad, 5u);
+    EXPECT_EQ(merkleVerify(&loaded, fd, 0, 5*params.chunkBytes, NULL), 0);
+    EXPECT_EQ(merkleVerify(&loaded, fd, where, 1, NULL), 1);
+    merkleFree(&loaded);
+
+    // A manifest whose leaves were edited no longer matches its root.
+    FILE *fp = fopen(manifest, "r+");
+    ASSERT_TRUE(fp != NULL);
+    fseek(fp, -3, SEEK_END);
+    fputc('0' + (fgetc(fp) == '0'), fp);
+    fclose(fp);
+    EXPECT_NE(manifestRead(manifest, &loaded), 0);
+}
+
+// A failed copy leaves a tree over the chunks that were written.
+TEST_F(HashedAcquireTest, CopyFailure) {
+    UvmDeinitialize();
+    simConfig.failAddress = params.baseAddress + 3*params.chunkBytes;
+    simConfig.failLength  = PAGE_SIZE;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERR_ECC_ERROR);
+    EXPECT_EQ(merkle.count, 3u);
+    EXPECT_EQ(merkle.sizeBytes, 3*params.chunkBytes);
+    EXPECT_EQ(merkleVerify(&merkle, fd, 0, merkle.sizeBytes, NULL), 0);
+}
+
+static const ZeroScanImpl zeroScanImpls[] = {
+    ZERO_SCAN_SCALAR, ZERO_SCAN_SSE2, ZERO_SCAN_AVX2,
+};
+
+TEST(ZeroPageTest, Scan) {
+    const NvU64 pages = 130;
+    NvU8 *buf = (NvU8 *)calloc(pages, PAGE_SIZE);
+    NvU64 bitmap[3];
+
+    // One non-zero byte each at the start, the middle and the very end.
+    buf[3*PAGE_SIZE] = 1;
+    buf[64*PAGE_SIZE + 2000] = 0x80;
+    buf[130*PAGE_SIZE - 1] = 0xff;
+
+    for (unsigned int i = 0; i < 3; i++) {
+        if (zeroPageSetImplementation(zeroScanImpls[i]))
+            continue;
+        SCOPED_TRACE(zeroPageImplementation());
+
+        memset(bitmap, 0xa5, sizeof(bitmap));
+        EXPECT_EQ(zeroPageScan(buf, pages * PAGE_SIZE, PAGE_SIZE, bitmap, 0),
+                  pages - 3);
+        for (NvU64 p = 0; p < pages; p++) {
+            EXPECT_EQ(zeroPageBitmapTest(bitmap, p),
+                      p != 3 && p != 64 && p != 129) << "page " << p;
+        }
+        EXPECT_TRUE(zeroPageIsZero(buf, 3*PAGE_SIZE));
+        EXPECT_FALSE(zeroPageIsZero(buf + 64*PAGE_SIZE, PAGE_SIZE));
+    }
+
+    zeroPageSetImplementation(ZERO_SCAN_AUTO);
+    free(buf);
+}
+
+// Zero pages become holes but the file reads back exactly like the source.
+TEST_F(AcquireTest, Sparse) {
+    NvLength size = 8*1024*1024 + 3*PAGE_SIZE;
+    NvU64 pages = size / PAGE_SIZE;
+    std::vector<NvU64> zeroMap((pages + 63) / 64);
+    AcquireStats stats;
+    struct stat st;
+
+    ASSERT_EQ(ftruncate(fd, size), 0);
+    params.sizeBytes  = size;
+    params.chunkBytes = 1024*1024;
+    params.sparse     = 1;
+    params.zeroMap    = &zeroMap[0];
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.bytesWritten, size);
+
+    NvU8 *source = (NvU8 *)malloc(size);
+    NvU64 zero = 0;
+    UvmSimFill(0, 0, source, size);
+    for (NvU64 p = 0; p < pages; p++) {
+        bool isZero = zeroPageIsZero(source + p*PAGE_SIZE, PAGE_SIZE);
+        zero += isZero;
+        EXPECT_EQ(zeroPageBitmapTest(&zeroMap[0], p), isZero) << "page " << p;
+    }
+    free(source);
+
+    EXPECT_GT(zero, 0u);
+    EXPECT_EQ(stats.zeroPages, zero);
+    EXPECT_EQ(stats.bytesStored, size - zero * PAGE_SIZE);
+    ASSERT_EQ(fstat(fd, &st), 0);
+    EXPECT_LE((NvLength)st.st_blocks * 512, stats.bytesStored + PAGE_SIZE);
+
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim(ptr, 0, size));
+    munmap(ptr, size);
+}
+
+TEST_F(AcquireTest, SparseRejectsCompression) {
+    params.sizeBytes   = PAGE_SIZE;
+    params.sparse      = 1;
+    params.compression = COMPRESS_LZ4;
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+}
+
+TEST_F(AcquireTest, DirectToFd) {
+    NvLength size = 3*1024*1024 + 5*PAGE_SIZE;
+    NvLength progress = 0;
+    AcquireStats stats;
+    UvmSimStats simStats;
+
+    params.baseAddress = 32*PAGE_SIZE;
+    params.sizeBytes   = size;
+    params.chunkBytes  = 1024*1024;
+    params.outOffset   = PAGE_SIZE;
+    params.progress    = &progress;
+    params.directToFd  = 1;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_TRUE(stats.direct);
+    EXPECT_EQ(stats.bytesWritten, size);
+    EXPECT_EQ(stats.chunks, 4u);
+    EXPECT_EQ(progress, size);
+    UvmSimGetStats(&simStats);
+    EXPECT_EQ(simStats.calls, 4u);
+
+    void *ptr = mmap(NULL, PAGE_SIZE + size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim((char *)ptr + PAGE_SIZE, params.baseAddress, size));
+    munmap(ptr, PAGE_SIZE + size);
+}
+
+// Without the driver call the range goes through the staging ring.
+TEST_F(AcquireTest, DirectToFdFallback) {
+    NvLength size = 2*1024*1024;
+    AcquireStats stats;
+
+    UvmBackend noDirect = *UvmGetBackend();
+    noDirect.dumpGpuMemoryToFd = NULL;
+    UvmSetBackend(&noDirect);
+
+    params.sizeBytes  = size;
+    params.chunkBytes = 512*1024;
+    params.directToFd = 1;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_FALSE(stats.direct);
+    EXPECT_EQ(stats.bytesWritten, size);
+
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim(ptr, 0, size));
+    munmap(ptr, size);
+
+    UvmSimEnable(&simConfig);
+}
+
+TEST_F(AcquireTest, DirectToFdCopyFailure) {
+    AcquireStats stats;
+
+    UvmDeinitialize();
+    simConfig.failAddress = 9*PAGE_SIZE;
+    simConfig.failLength  = PAGE_SIZE;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    params.sizeBytes  = 16*PAGE_SIZE;
+    params.chunkBytes = 4*PAGE_SIZE;
+    params.directToFd = 1;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_ERR_ECC_ERROR);
+    EXPECT_EQ(stats.bytesWritten, 8ull*PAGE_SIZE);
+
+    params.directToFd  = 1;
+    params.compression = COMPRESS_LZ4;
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+}
+
+static UvmBackend g_simBackend;
+
+// Writes the first half of the range, then fails.
+static RM_STATUS HalfDumpToFd(UvmGpuUuid *pGpuUuid, int fd,
+                              unsigned long long fileOffset,
+                              unsigned long long baseAddress,
+                              NvLength sizeBytes, NvLength blockSizeHint,
+                              NvU32 flags, NvLength *pBytesWritten) {
+    RM_STATUS status = g_simBackend.dumpGpuMemoryToFd(pGpuUuid, fd,
+                                                      fileOffset, baseAddress,
+                                                      sizeBytes / 2,
+                                                      blockSizeHint, flags,
+                                                      pBytesWritten);
+    return status == RM_OK ? RM_ERR_ECC_ERROR : status;
+}
+
+// Calls split by a latency budget still count chunks, and partial writes.
+TEST_F(AcquireTest, DirectToFdMaxLatency) {
+    const NvLength size = 6*1024*1024 + 5*PAGE_SIZE;
+    AcquireStats stats;
+
+    UvmDeinitialize();
+    simConfig.latencyNs   = 50000;
+    simConfig.bytesPerSec = 1024*1024*1024;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    params.sizeBytes  = size;
+    params.chunkBytes = 2*1024*1024;
+    params.maxCallNs  = 500000;
+    params.directToFd = 1;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_TRUE(stats.direct);
+    EXPECT_EQ(stats.chunks, 4u);
+    EXPECT_GT(stats.calls, stats.chunks);
+    EXPECT_EQ(stats.bytesWritten, size);
+
+    g_simBackend = *UvmGetBackend();
+    UvmBackend half = g_simBackend;
+    half.dumpGpuMemoryToFd = HalfDumpToFd;
+    UvmSetBackend(&half);
+
+    params.maxCallNs = 0;
+    EXPECT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_ERR_ECC_ERROR);
+    EXPECT_EQ(stats.bytesWritten, 1024ull*1024);
+    EXPECT_EQ(stats.chunks, 0u);
+
+    UvmSimEnable(&simConfig);
+}
+
+TEST(StagingTest, ParsePages) {
+    StagingPages pages;
+
+    ASSERT_EQ(stagingParsePages("hugetlb", &pages), 0);
+    EXPECT_EQ(pages, STAGING_PAGES_HUGETLB);
+    ASSERT_EQ(stagingParsePages("4K", &pages), 0);
+    EXPECT_EQ(pages, STAGING_PAGES_4K);
+    EXPECT_STREQ(stagingPagesName(STAGING_PAGES_THP), "thp");
+    EXPECT_EQ(stagingParsePages("1g", &pages), -1);
+}
+
+// Free 2 MB pages in the hugetlbfs pool
+static NvU64 hugePagesFree(void) {
+    FILE *fp = fopen("/proc/meminfo", "r");
+    unsigned long long free = 0;
+    char line[128];
+
+    while (fp && fgets(line, sizeof(line), fp))
+        sscanf(line, "HugePages_Free: %llu", &free);
+    if (fp)
+        fclose(fp);
+    return free;
+}
+
+TEST(StagingTest, Alloc) {
+    const size_t size = 4*1024*1024 + PAGE_SIZE;
+    const size_t hugeBytes = 6*1024*1024;
+    StagingBuffer buf;
+
+    for (int p = STAGING_PAGES_4K; p <= STAGING_PAGES_AUTO; p++) {
+        if (p == STAGING_PAGES_HUGETLB &&
+            hugePagesFree() * STAGING_HUGE_PAGE_SIZE < hugeBytes) {
+            // An empty pool is an error, not a silent fallback.
+            EXPECT_EQ(stagingAlloc(size, STAGING_PAGES_HUGETLB, &buf),
+                      RM_ERR_NO_MEMORY);
+            continue;
+        }
+
+        ASSERT_EQ(stagingAlloc(size, (StagingPages)p, &buf), RM_OK) << p;
+        EXPECT_NE(buf.pages, STAGING_PAGES_AUTO);
+        EXPECT_GE(buf.mapBytes, size);
+        if (buf.pages != STAGING_PAGES_4K) {
+            EXPECT_EQ((uintptr_t)buf.ptr % STAGING_HUGE_PAGE_SIZE, 0u);
+        }
+        memset(buf.ptr, 0x5a, size);
+        stagingFree(&buf);
+    }
+}
+
+TEST(StagingTest, PhysRuns) {
+    const size_t size = 4*1024*1024;
+    StagingBuffer buf;
+
+    ASSERT_EQ(stagingAlloc(size, STAGING_PAGES_4K, &buf), RM_OK);
+    NvU64 runs = stagingPhysRuns(buf.ptr, size, 0);
+    if (runs == 0) {
+        std::cout << "Physical addresses are not readable, skipped\n";
+        stagingFree(&buf);
+        return;
+    }
+    EXPECT_LE(runs, size / PAGE_SIZE);
+
+    // Block boundaries split runs.
+    EXPECT_GE(stagingPhysRuns(buf.ptr, size, 128*1024), size / (128*1024));
+    EXPECT_EQ(stagingPhysRuns(buf.ptr, PAGE_SIZE, 0), 1u);
+    stagingFree(&buf);
+
+    ASSERT_EQ(stagingAlloc(size, STAGING_PAGES_AUTO, &buf), RM_OK);
+    runs = stagingPhysRuns(buf.ptr, size, 0);
+    std::cout << stagingPagesName(buf.pages) << " staging: " << runs
+              << " runs over " << size / PAGE_SIZE << " pages\n";
+    EXPECT_GE(runs, 1u);
+    stagingFree(&buf);
+}
+
+TEST_F(AcquireTest, HugePageStaging) {
+    NvLength size = 6*1024*1024;
+    AcquireStats stats;
+
+    params.sizeBytes    = size;
+    params.chunkBytes   = 2*1024*1024;
+    params.depth        = 2;
+    params.stagingPages = STAGING_PAGES_AUTO;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_NE(stats.stagingPages, STAGING_PAGES_AUTO);
+    EXPECT_EQ(stats.bytesWritten, size);
+    EXPECT_LE(stats.physRuns, size / PAGE_SIZE);
+    EXPECT_LE(stats.physRunsMax, params.chunkBytes / PAGE_SIZE);
+
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim(ptr, 0, size));
+    munmap(ptr, size);
+}
+
+TEST(ThrottleTest, TokenBucket) {
+    TokenBucket bucket;
+
+    tokenBucketInit(&bucket, 1000000, 100000, 0);
+    EXPECT_EQ(tokenBucketTake(&bucket, 100000, 0), 0u);
+    EXPECT_EQ(tokenBucketTake(&bucket, 100000, 0), 100000000u);
+    // The debt is paid at 100 ms, so 50000 more bytes take until 150 ms.
+    EXPECT_EQ(tokenBucketTake(&bucket, 50000, 100000000), 150000000u);
+
+    // Idle time only refills up to the burst.
+    EXPECT_EQ(tokenBucketTake(&bucket, 100000, 10000000000ull),
+              10000000000ull);
+    EXPECT_EQ(tokenBucketTake(&bucket, 1, 10000000000ull), 10000001000ull);
+
+    // No rate, no waiting
+    tokenBucketInit(&bucket, 0, 0, 0);
+    EXPECT_EQ(tokenBucketTake(&bucket, 1ull << 40, 5), 5u);
+}
+
+TEST(ThrottleTest, TokenBucketKeepsRate) {
+    const NvU64 rate = 3*1000*1000 + 7, chunk = 4096;
+    TokenBucket bucket;
+    NvU64 now = 0;
+
+    // Sending as soon as allowed never drifts from the rate, fractions
+    // of a byte included.
+    tokenBucketInit(&bucket, rate, chunk, 0);
+    for (unsigned int i = 0; i < 10000; i++)
+        now = tokenBucketTake(&bucket, chunk, now);
+
+    NvU64 expected = (unsigned __int128)(9999 * chunk) * 1000000000ull / rate;
+    EXPECT_GE(now, expected);
+    EXPECT_LE(now, expected + 1);
+}
+
+TEST(ThrottleTest, CallSizer) {
+    const NvU64 budgetNs = 1000000;
+    CallSizer sizer;
+
+    // Without a budget every call is a whole chunk.
+    callSizerInit(&sizer, 0, PAGE_SIZE, 8*1024*1024);
+    EXPECT_EQ(sizer.callBytes, 8u*1024*1024);
+
+    // A device doing 1 GB/s after 20 us of latency: sizes double up to just
+    // under the budget and stay there.
+    callSizerInit(&sizer, budgetNs, PAGE_SIZE, 8*1024*1024);
+    EXPECT_EQ(sizer.callBytes, (NvLength)PAGE_SIZE);
+    for (unsigned int i = 0; i < 20; i++) {
+        NvLength bytes = sizer.callBytes;
+        NvU64 ns = 20000 + bytes;
+
+        EXPECT_LE(ns, budgetNs) << i;
+        callSizerUpdate(&sizer, bytes, ns);
+        EXPECT_LE(sizer.callBytes, 2 * bytes);
+        EXPECT_EQ(sizer.callBytes % PAGE_SIZE, 0u);
+    }
+    EXPECT_GE(sizer.callBytes, 800u*1000);
+
+    // Slowing down shrinks the next call at once.
+    callSizerUpdate(&sizer, sizer.callBytes, 4 * budgetNs);
+    EXPECT_LE(sizer.callBytes, 250u*1000);
+    callSizerUpdate(&sizer, PAGE_SIZE, 100 * budgetNs);
+    EXPECT_EQ(sizer.callBytes, (NvLength)PAGE_SIZE);
+}
+
+TEST_F(AcquireTest, MaxBandwidth) {
+    const NvLength size = 4*1024*1024;
+    AcquireStats stats;
+    NvU64 start;
+
+    params.sizeBytes      = size;
+    params.chunkBytes     = 512*1024;
+    params.maxBytesPerSec = 16*1024*1024;
+
+    start = acquireNowNs();
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    // All but the first chunk wait for the bucket.
+    EXPECT_GE(acquireNowNs() - start, 218750000u);
+    EXPECT_GT(stats.throttleNs, 0u);
+    EXPECT_EQ(stats.calls, 8u);
+
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim(ptr, 0, size));
+    munmap(ptr, size);
+}
+
+TEST_F(AcquireTest, MaxLatencyImpact) {
+    const NvLength size = 8*1024*1024;
+    AcquireStats stats;
+    UvmSimStats simStats;
+
+    UvmDeinitialize();
+    simConfig.latencyNs   = 50000;
+    simConfig.bytesPerSec = 1024*1024*1024;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    params.sizeBytes  = size;
+    params.chunkBytes = 2*1024*1024;
+    params.depth      = 4;
+    params.maxCallNs  = 500000;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.chunks, 4u);
+    EXPECT_GT(stats.calls, stats.chunks);
+    // 500 us at 1 GB/s after 50 us of latency is 471859 bytes.
+    EXPECT_LE(stats.maxCallBytes, 471859u);
+    UvmSimGetStats(&simStats);
+    EXPECT_EQ(simStats.calls, stats.calls);
+
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim(ptr, 0, size));
+    munmap(ptr, size);
+}
+
+TEST(DiskWriterTest, ParseEngine) {
+    DiskWriterEngine engine;
+
+    ASSERT_EQ(diskWriterParseEngine("uring", &engine), 0);
+    EXPECT_EQ(engine, DISK_WRITER_URING);
+    ASSERT_EQ(diskWriterParseEngine("THREADS", &engine), 0);
+    EXPECT_EQ(engine, DISK_WRITER_THREADS);
+    EXPECT_EQ(diskWriterParseEngine("aio", &engine), -1);
+    EXPECT_STREQ(diskWriterEngineName(DISK_WRITER_AUTO), "auto");
+}
+
+TEST(DiskWriterTest, WritesInAnyOrder) {
+    const DiskWriterEngine engines[] = { DISK_WRITER_URING,
+                                         DISK_WRITER_THREADS };
+    const unsigned int depth = 3, count = 16;
+    const size_t len = 64*1024;
+    std::vector<char> data(count * len);
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (char)(i * 7 + i / 4096);
+
+    for (unsigned int e = 0; e < 2; e++) {
+        char path[] = "/tmp/dump_fb_test.XXXXXX";
+        int fd = mkstemp(path);
+        DiskWriter *writer;
+        DiskWriteCompletion done[4];
+        unsigned int next = 0, reaped = 0;
+        std::vector<char> back(data.size());
+        ASSERT_GE(fd, 0);
+
+        RM_STATUS status = diskWriterCreate(fd, depth, engines[e], &writer);
+        if (status == RM_ERR_NOT_SUPPORTED) {
+            std::cout << "io_uring is not available\n";
+            close(fd);
+            unlink(path);
+            continue;
+        }
+        ASSERT_EQ(status, (RM_STATUS)RM_OK);
+        EXPECT_EQ(diskWriterEngine(writer), engines[e]);
+
+        // Back to front, never more than depth at once.
+        while (reaped < count) {
+            while (next < count && diskWriterInFlight(writer) < depth) {
+                size_t off = (count - 1 - next) * len;
+                ASSERT_EQ(diskWriterSubmit(writer, &data[off], len, off,
+                                           (void *)(uintptr_t)next), 0);
+                next++;
+            }
+            if (next < count) {
+                EXPECT_EQ(diskWriterSubmit(writer, &data[0], len, 0, NULL), -1);
+                EXPECT_EQ(errno, EBUSY);
+            }
+            unsigned int n = diskWriterReap(writer, done, 4, 1);
+            ASSERT_GT(n, 0u);
+            for (unsigned int c = 0; c < n; c++)
+                EXPECT_EQ(done[c].error, 0);
+            reaped += n;
+        }
+        EXPECT_EQ(diskWriterReap(writer, done, 4, 1), 0u);
+        diskWriterDestroy(writer);
+
+        ASSERT_EQ(pread(fd, &back[0], back.size(), 0), (ssize_t)back.size());
+        EXPECT_TRUE(back == data) << diskWriterEngineName(engines[e]);
+        close(fd);
+        unlink(path);
+    }
+}
+
+// A write io_uring_enter never took is withdrawn, not left in the ring.
+TEST(DiskWriterTest, UringEnterFailure) {
+    char path[] = "/tmp/dump_fb_test.XXXXXX";
+    int fd = mkstemp(path), ringFd = -1, savedFd, nullFd;
+    char data[4096], back[4096];
+    DiskWriteCompletion done[2];
+    DiskWriter *writer;
+    DIR *dir;
+    struct dirent *de;
+    ASSERT_GE(fd, 0);
+
+    if (diskWriterCreate(fd, 2, DISK_WRITER_URING, &writer) != RM_OK) {
+        std::cout << "io_uring is not available\n";
+        close(fd);
+        unlink(path);
+        return;
+    }
+
+    // Swap the ring for a file that io_uring_enter rejects.
+    dir = opendir("/proc/self/fd");
+    ASSERT_TRUE(dir != NULL);
+    while ((de = readdir(dir))) {
+        std::string link = std::string("/proc/self/fd/") + de->d_name;
+        char target[64];
+        ssize_t n = readlink(link.c_str(), target, sizeof(target) - 1);
+
+        if (n <= 0)
+            continue;
+        target[n] = 0;
+        if (strstr(target, "io_uring"))
+            ringFd = atoi(de->d_name);
+    }
+    closedir(dir);
+    ASSERT_GE(ringFd, 0);
+    savedFd = dup(ringFd);
+    nullFd = open("/dev/null", O_WRONLY);
+    ASSERT_GE(savedFd, 0);
+    ASSERT_GE(nullFd, 0);
+    ASSERT_EQ(dup2(nullFd, ringFd), ringFd);
+    close(nullFd);
+
+    memset(data, 'x', sizeof(data));
+    EXPECT_EQ(diskWriterSubmit(writer, data, sizeof(data), 0, NULL), -1);
+    EXPECT_NE(errno, EBUSY);
+    EXPECT_EQ(diskWriterInFlight(writer), 0u);
+
+    // Once the ring works again only the new write is done.
+    ASSERT_EQ(dup2(savedFd, ringFd), ringFd);
+    close(savedFd);
+    memset(data, 'y', sizeof(data));
+    ASSERT_EQ(diskWriterSubmit(writer, data, sizeof(data), sizeof(data),
+                               (void *)1), 0);
+    ASSERT_EQ(diskWriterReap(writer, done, 2, 1), 1u);
+    EXPECT_EQ(done[0].userData, (void *)1);
+    EXPECT_EQ(done[0].error, 0);
+    EXPECT_EQ(diskWriterInFlight(writer), 0u);
+
+    diskWriterDestroy(writer);
+    ASSERT_EQ(pread(fd, back, sizeof(back), sizeof(data)),
+              (ssize_t)sizeof(back));
+    EXPECT_EQ(memcmp(back, data, sizeof(data)), 0);
+    EXPECT_EQ(pread(fd, back, sizeof(back), 0), (ssize_t)sizeof(back));
+    EXPECT_EQ(back[0], 0);
+    close(fd);
+    unlink(path);
+}
+
+// Writes through one lane are done in order, whatever the other lanes do.
+TEST(DiskWriterTest, Lanes) {
+    const unsigned int lanes = 2, writes = 4;
+    const size_t len = 64*1024;
+    std::vector<char> data(writes * len), back(len);
+    char paths[lanes][32];
+    int fds[lanes];
+    DiskWriter *writer;
+    DiskWriteCompletion done[8];
+    unsigned int reaped = 0;
+
+    for (unsigned int w = 0; w < writes; w++)
+        memset(&data[w * len], 'a' + w, len);
+    for (unsigned int l = 0; l < lanes; l++) {
+        strcpy(paths[l], "/tmp/dump_fb_test.XXXXXX");
+        fds[l] = mkstemp(paths[l]);
+        ASSERT_GE(fds[l], 0);
+    }
+
+    ASSERT_EQ(diskWriterCreateLanes(lanes, lanes * writes, &writer),
+              (RM_STATUS)RM_OK);
+    EXPECT_EQ(diskWriterEngine(writer), DISK_WRITER_THREADS);
+
+    // Every write of a lane goes to the same place, so the last one wins.
+    for (unsigned int w = 0; w < writes; w++) {
+        for (unsigned int l = 0; l < lanes; l++) {
+            ASSERT_EQ(diskWriterSubmitTo(writer, l, fds[l], &data[w * len],
+                                         len, 0, NULL), 0);
+        }
+    }
+    EXPECT_EQ(diskWriterSubmitTo(writer, lanes, fds[0], &data[0], len, 0,
+                                 NULL), -1);
+    EXPECT_EQ(errno, EINVAL);
+
+    while (reaped < lanes * writes) {
+        unsigned int n = diskWriterReap(writer, done, 8, 1);
+        ASSERT_GT(n, 0u);
+        for (unsigned int c = 0; c < n; c++)
+            EXPECT_EQ(done[c].error, 0);
+        reaped += n;
+    }
+    diskWriterDestroy(writer);
+
+    for (unsigned int l = 0; l < lanes; l++) {
+        ASSERT_EQ(pread(fds[l], &back[0], len, 0), (ssize_t)len);
+        EXPECT_TRUE(std::equal(back.begin(), back.end(),
+                               data.begin() + (writes - 1) * len));
+        close(fds[l]);
+        unlink(paths[l]);
+    }
+}
+
+TEST_F(AcquireTest, DirectIo) {
+    const DiskWriterEngine engines[] = { DISK_WRITER_AUTO,
+                                         DISK_WRITER_THREADS };
+    const NvLength size = 5*1024*1024 + 3*PAGE_SIZE + 512;
+    AcquireStats stats;
+
+    for (unsigned int e = 0; e < 2; e++) {
+        ASSERT_EQ(ftruncate(fd, 0), 0);
+        params.baseAddress = 64*PAGE_SIZE;
+        params.sizeBytes   = size;
+        params.chunkBytes  = 1024*1024;
+        params.depth       = 4;
+        params.directIo    = 1;
+        params.ioEngine    = engines[e];
+
+        ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+        EXPECT_EQ(stats.bytesWritten, size);
+        EXPECT_EQ(stats.bytesStored, size);
+        EXPECT_EQ(stats.chunks, 6u);
+        if (engines[e] == DISK_WRITER_THREADS) {
+            EXPECT_EQ(stats.ioEngine, DISK_WRITER_THREADS);
+        }
+
+        // O_DIRECT is gone again, or the tail could not have been written.
+        EXPECT_EQ(fcntl(fd, F_GETFL) & O_DIRECT, 0);
+
+        void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        ASSERT_NE(ptr, MAP_FAILED);
+        EXPECT_TRUE(MatchesSim(ptr, params.baseAddress, size));
+        munmap(ptr, size);
+    }
+
+    params.sparse = 1;
+    EXPECT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+}
+
+TEST_F(AcquireTest, DirectIoWriteFailure) {
+    params.sizeBytes  = 4*PAGE_SIZE;
+    params.chunkBytes = PAGE_SIZE;
+    params.directIo   = 1;
+    params.ioEngine   = DISK_WRITER_THREADS;
+    params.outFd      = open("/dev/null", O_RDONLY);
+
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERROR);
+    close(params.outFd);
+}
+
+struct PipeReader {
+    int         fd;
+    NvU64       pauseEvery;  // sleep briefly after this many bytes, 0 = never
+    bool        keep;
+    std::string data;
+    NvU64       bytes;
+};
+
+static void *ReadPipe(void *arg) {
+    PipeReader *reader = (PipeReader *)arg;
+    std::vector<char> buf(64*1024);
+    NvU64 sincePause = 0;
+    ssize_t ret;
+
+    reader->bytes = 0;
+    while ((ret = read(reader->fd, &buf[0], buf.size())) > 0) {
+        if (reader->keep)
+            reader->data.append(&buf[0], ret);
+        reader->bytes += ret;
+        sincePause += ret;
+        if (reader->pauseEvery && sincePause >= reader->pauseEvery) {
+            usleep(200);
+            sincePause = 0;
+        }
+    }
+    return NULL;
+}
+
+struct PipeMover {
+    int in, out;
+};
+
+// Passes a pipe on to another with splice(), as pv does between pipes.
+static void *SplicePipe(void *arg) {
+    PipeMover *mover = (PipeMover *)arg;
+
+    while (splice(mover->in, NULL, mover->out, NULL, 64*1024,
+                  SPLICE_F_MOVE) > 0)
+        ;
+    close(mover->out);
+    return NULL;
+}
+
+//
+// A reader slower than the dump must still see every chunk as it was copied,
+// also behind a stage that splices the pipe on, unless the stream was
+// spliced in (which is then only opt-in).
+//
+TEST_F(AcquireTest, StreamSplicesIntoPipe) {
+    const NvLength size = 8*1024*1024 + 3*PAGE_SIZE;
+    const struct { int splice, middle; } cases[] = { { 0, 0 }, { 1, 0 },
+                                                     { 0, 1 } };
+    PipeReader reader = { -1, 256*1024, true, std::string(), 0 };
+    AcquireStats stats;
+
+    for (unsigned int c = 0; c < ARRAY_LEN(cases); c++) {
+        PipeMover mover;
+        pthread_t thread, middle;
+        int fds[2], next[2];
+
+        ASSERT_EQ(pipe(fds), 0);
+        reader.fd = fds[0];
+        if (cases[c].middle) {
+            ASSERT_EQ(pipe(next), 0);
+            mover.in  = fds[0];
+            mover.out = next[1];
+            reader.fd = next[0];
+            ASSERT_EQ(pthread_create(&middle, NULL, SplicePipe, &mover), 0);
+        }
+        reader.data.clear();
+        ASSERT_EQ(pthread_create(&thread, NULL, ReadPipe, &reader), 0);
+
+        params.baseAddress = 32*PAGE_SIZE;
+        params.sizeBytes   = size;
+        params.chunkBytes  = 256*1024;
+        params.depth       = 2;
+        params.outFd       = fds[1];
+        params.stream      = 1;
+        params.splice      = cases[c].splice;
+
+        EXPECT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK) << c;
+        close(fds[1]);
+        if (cases[c].middle)
+            pthread_join(middle, NULL);
+        pthread_join(thread, NULL);
+        close(fds[0]);
+        if (cases[c].middle)
+            close(next[0]);
+
+        EXPECT_EQ(stats.spliced, cases[c].splice) << c;
+        ASSERT_EQ(reader.data.size(), size) << c;
+        EXPECT_TRUE(MatchesSim(reader.data.data(), params.baseAddress,
+                               size)) << c;
+    }
+}
+
+static bool IsBadPageFill(const char *buf, NvLength len) {
+    for (NvLength i = 0; i < len; i++) {
+        if (buf[i] != ACQUIRE_BAD_PAGE_FILL[i % 8])
+            return false;
+    }
+    return true;
+}
+
+TEST_F(AcquireTest, BadPagesAreBisected) {
+    const NvLength size = 64*PAGE_SIZE;
+    AcquireStats stats;
+    UvmSimStats simStats;
+
+    // Pages 15-17 straddle the first two chunks.
+    UvmDeinitialize();
+    simConfig.failAddress = 15*PAGE_SIZE;
+    simConfig.failLength  = 3*PAGE_SIZE;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    params.sizeBytes  = size;
+    params.chunkBytes = 16*PAGE_SIZE;
+    params.badPages   = &badPages;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.bytesWritten, size);
+    EXPECT_EQ(stats.badPages, 3u);
+    ASSERT_EQ(badPages.count, 1u);
+    EXPECT_EQ(badPages.ranges[0].gpuOffset, 15ull*PAGE_SIZE);
+    EXPECT_EQ(badPages.ranges[0].length, 3ull*PAGE_SIZE);
+    EXPECT_EQ(badPages.ranges[0].status, (RM_STATUS)RM_ERR_ECC_ERROR);
+    UvmSimGetStats(&simStats);
+    EXPECT_EQ(simStats.calls, stats.calls);
+
+    char *ptr = (char *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim(ptr, 0, 15*PAGE_SIZE));
+    EXPECT_TRUE(IsBadPageFill(ptr + 15*PAGE_SIZE, 3*PAGE_SIZE));
+    EXPECT_TRUE(MatchesSim(ptr + 18*PAGE_SIZE, 18*PAGE_SIZE, 46*PAGE_SIZE));
+    munmap(ptr, size);
+}
+
+// One bad page in a chunk of 2^k pages costs at most 2k+1 more calls.
+TEST_F(AcquireTest, BadPageBisectionIsLogarithmic) {
+    const NvLength pages = 1024;
+    AcquireStats stats;
+
+    params.sizeBytes  = pages*PAGE_SIZE;
+    params.chunkBytes = pages*PAGE_SIZE;
+    params.badPages   = &badPages;
+
+    for (NvLength bad = 0; bad < pages; bad += 173) {
+        UvmDeinitialize();
+        simConfig.failAddress = bad*PAGE_SIZE;
+        simConfig.failLength  = PAGE_SIZE;
+        UvmSimEnable(&simConfig);
+        ASSERT_EQ(UvmInitialize(), RM_OK);
+
+        ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK) << bad;
+        EXPECT_EQ(stats.badPages, 1u) << bad;
+        EXPECT_LE(stats.bisectCalls, 21u) << bad;
+        EXPECT_EQ(stats.calls, stats.bisectCalls + 1) << bad;
+        acquireBadPagesFree(&badPages);
+    }
+}
+
+TEST_F(AcquireTest, BadPagesOtherErrorsStop) {
+    UvmDeinitialize();
+    simConfig.failAddress = 5*PAGE_SIZE;
+    simConfig.failLength  = PAGE_SIZE;
+    simConfig.failStatus  = RM_ERR_BUSY_RETRY;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    params.sizeBytes  = 16*PAGE_SIZE;
+    params.chunkBytes = 4*PAGE_SIZE;
+    params.badPages   = &badPages;
+
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERR_BUSY_RETRY);
+    EXPECT_EQ(badPages.count, 0u);
+}
+
+class JournalTest : public AcquireTest {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        std::string journalPath;
+        Journal journal;
+};
+
+void JournalTest::SetUp() {
+    AcquireTest::SetUp();
+    journalPath = std::string(path) + ".journal";
+    memset(&journal, 0, sizeof(journal));
+    journal.fd  = -1;
+}
+
+void JournalTest::TearDown() {
+    journalClose(&journal);
+    unlink(journalPath.c_str());
+    AcquireTest::TearDown();
+}
+
+TEST_F(JournalTest, ReopenAndVerify) {
+    const NvLength size = 10*PAGE_SIZE + 512;
+    const NvLength chunk = 2*PAGE_SIZE;
+    const char torn[] = "JREC";
+    char garbage[PAGE_SIZE];
+    AcquireStats stats;
+
+    params.sizeBytes  = size;
+    params.chunkBytes = chunk;
+    ASSERT_EQ(journalCreate(&journal, journalPath.c_str(), "GPU-test", 0,
+                            size, chunk, 0, fd), 0);
+    params.journal = &journal;
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.chunks, 6u);
+    journalClose(&journal);
+
+    // A torn record at the end is dropped.
+    int jfd = open(journalPath.c_str(), O_WRONLY | O_APPEND);
+    ASSERT_GE(jfd, 0);
+    ASSERT_EQ(write(jfd, torn, sizeof(torn)), (ssize_t)sizeof(torn));
+    close(jfd);
+
+    ASSERT_EQ(journalOpen(&journal, journalPath.c_str(), fd), 0);
+    EXPECT_STREQ(journal.header.gpuUuid, "GPU-test");
+    EXPECT_EQ(journal.numChunks, 6u);
+    EXPECT_EQ(journalChunkLength(&journal, 5), 512u);
+    EXPECT_EQ(journalVerify(&journal), 6);
+
+    // Damaged and cut off chunks are forgotten.
+    memset(garbage, 0x5a, sizeof(garbage));
+    ASSERT_EQ(pwrite(fd, garbage, sizeof(garbage), 3*PAGE_SIZE),
+              (ssize_t)sizeof(garbage));
+    ASSERT_EQ(ftruncate(fd, 10*PAGE_SIZE), 0);
+    EXPECT_EQ(journalVerify(&journal), 4);
+    EXPECT_FALSE(journalChunkDone(&journal, 1));
+    EXPECT_FALSE(journalChunkDone(&journal, 5));
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.chunks, 2u);
+    EXPECT_EQ(stats.chunksResumed, 4u);
+    EXPECT_EQ(stats.bytesWritten, chunk + 512);
+
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim(ptr, 0, size));
+    munmap(ptr, size);
+
+    // The journal now vouches for everything.
+    journalClose(&journal);
+    ASSERT_EQ(journalOpen(&journal, journalPath.c_str(), fd), 0);
+    EXPECT_EQ(journalVerify(&journal), 6);
+}
+
+// Chunks with filled bad pages are left for a resumed dump to try again.
+TEST_F(JournalTest, BadPagesAreNotJournaled) {
+    const NvLength size = 16*PAGE_SIZE;
+    const NvLength chunk = 4*PAGE_SIZE;
+    AcquireStats stats;
+
+    UvmDeinitialize();
+    simConfig.failAddress = 5*PAGE_SIZE;
+    simConfig.failLength  = PAGE_SIZE;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    params.sizeBytes  = size;
+    params.chunkBytes = chunk;
+    params.badPages   = &badPages;
+    ASSERT_EQ(journalCreate(&journal, journalPath.c_str(), "GPU-test", 0,
+                            size, chunk, 0, fd), 0);
+    params.journal = &journal;
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.badPages, 1u);
+    journalClose(&journal);
+
+    ASSERT_EQ(journalOpen(&journal, journalPath.c_str(), fd), 0);
+    EXPECT_EQ(journalVerify(&journal), 3);
+    EXPECT_FALSE(journalChunkDone(&journal, 1));
+
+    // The page is still bad, so it is listed again.
+    acquireBadPagesFree(&badPages);
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.chunks, 1u);
+    EXPECT_EQ(stats.chunksResumed, 3u);
+    ASSERT_EQ(badPages.count, 1u);
+    EXPECT_EQ(badPages.ranges[0].gpuOffset, 5ull*PAGE_SIZE);
+}
+
+TEST_F(JournalTest, RejectsMismatch) {
+    params.sizeBytes  = 8*PAGE_SIZE;
+    params.chunkBytes = 2*PAGE_SIZE;
+    ASSERT_EQ(journalCreate(&journal, journalPath.c_str(), "GPU-test", 0,
+                            8*PAGE_SIZE, PAGE_SIZE, 0, fd), 0);
+    params.journal = &journal;
+    EXPECT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+
+    params.chunkBytes  = PAGE_SIZE;
+    params.compression = COMPRESS_ZSTD;
+    EXPECT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+
+    journalClose(&journal);
+    EXPECT_EQ(journalOpen(&journal, path, fd), -1);
+}
+
+// A dump killed part way and resumed must match one that never stopped.
+TEST_F(JournalTest, ResumeAfterKill) {
+    const NvLength size = 16*1024*1024;
+    const NvLength chunk = 64*1024;
+    const off_t batch = sizeof(JournalHeader) +
+                        JOURNAL_SYNC_RECORDS * sizeof(JournalRecord);
+    struct stat st;
+    AcquireStats stats;
+    int status;
+
+    UvmDeinitialize();
+    simConfig.bytesPerSec = 16*1024*1024;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    params.sizeBytes  = size;
+    params.chunkBytes = chunk;
+    ASSERT_EQ(journalCreate(&journal, journalPath.c_str(), "GPU-test", 0,
+                            size, chunk, 0, fd), 0);
+    params.journal = &journal;
+
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+        _exit(acquireRange(&params, NULL) != RM_OK);
+
+    do {
+        usleep(1000);
+        ASSERT_EQ(stat(journalPath.c_str(), &st), 0);
+    } while (st.st_size < batch);
+    kill(pid, SIGKILL);
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFSIGNALED(status));
+
+    journalClose(&journal);
+    ASSERT_EQ(journalOpen(&journal, journalPath.c_str(), fd), 0);
+    long long intact = journalVerify(&journal);
+    EXPECT_GE(intact, JOURNAL_SYNC_RECORDS);
+    EXPECT_LT(intact, (long long)(size / chunk));
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ((long long)stats.chunksResumed, intact);
+    EXPECT_EQ(stats.chunks + stats.chunksResumed, size / chunk);
+
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    EXPECT_TRUE(MatchesSim(ptr, 0, size));
+    munmap(ptr, size);
+}
+
+TEST(RangesTest, Parse) {
+    RangeList list;
+
+    memset(&list, 0, sizeof(list));
+    ASSERT_EQ(rangeListParse("0x1000:4K,2M:0x2000,1G:1G", &list), 0);
+    ASSERT_EQ(list.count, 3u);
+    EXPECT_EQ(list.ranges[0].offset, 0x1000ull);
+    EXPECT_EQ(list.ranges[0].size, 4096u);
+    EXPECT_EQ(list.ranges[1].offset, 2ull*1024*1024);
+    EXPECT_EQ(list.ranges[1].size, 0x2000u);
+    EXPECT_EQ(list.ranges[2].offset, 1ull << 30);
+    EXPECT_EQ(list.ranges[2].size, 1u << 30);
+
+    EXPECT_NE(rangeListParse("", &list), 0);
+    EXPECT_NE(rangeListParse("0x1000", &list), 0);
+    EXPECT_NE(rangeListParse("0x1000:", &list), 0);
+    EXPECT_NE(rangeListParse("0x1000:4K,", &list), 0);
+    EXPECT_NE(rangeListParse("4K:4X", &list), 0);
+    EXPECT_NE(rangeListParse("0xffffffffffff0000:1M", &list), 0);
+    rangeListFree(&list);
+}
+
+TEST(RangesTest, ReadFile) {
+    char path[] = "/tmp/dump_fb_ranges.XXXXXX";
+    const char text[] = "# triage list\n"
+                        "0x200000:1M\n"
+                        "\n"
+                        "  0x1000 4096\n";
+    int fd = mkstemp(path);
+    RangeList list;
+
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, text, sizeof(text) - 1), (ssize_t)sizeof(text) - 1);
+    close(fd);
+
+    memset(&list, 0, sizeof(list));
+    ASSERT_EQ(rangeListReadFile(path, &list), 0);
+    ASSERT_EQ(list.count, 2u);
+    EXPECT_EQ(list.ranges[0].offset, 0x200000ull);
+    EXPECT_EQ(list.ranges[0].size, 1024u*1024);
+    EXPECT_EQ(list.ranges[1].offset, 0x1000ull);
+    EXPECT_EQ(list.ranges[1].size, 4096u);
+    rangeListFree(&list);
+
+    unlink(path);
+    EXPECT_NE(rangeListReadFile(path, &list), 0);
+}
+
+// Ranges come out sorted, with overlapping and adjacent ones merged.
+TEST(RangesTest, Coalesce) {
+    RangeList list;
+
+    memset(&list, 0, sizeof(list));
+    rangeListAdd(&list, 0x10000, 0x1000);
+    rangeListAdd(&list, 0x0, 0x2000);
+    rangeListAdd(&list, 0x2000, 0x1000);
+    rangeListAdd(&list, 0x8000, 0x4000);
+    rangeListAdd(&list, 0x9000, 0x1000);
+    rangeListAdd(&list, 0xa000, 0x4000);
+    rangeListCoalesce(&list);
+
+    ASSERT_EQ(list.count, 3u);
+    EXPECT_EQ(list.ranges[0].offset, 0x0ull);
+    EXPECT_EQ(list.ranges[0].size, 0x3000u);
+    EXPECT_EQ(list.ranges[1].offset, 0x8000ull);
+    EXPECT_EQ(list.ranges[1].size, 0x6000u);
+    EXPECT_EQ(list.ranges[2].offset, 0x10000ull);
+    EXPECT_EQ(list.ranges[2].size, 0x1000u);
+    rangeListFree(&list);
+}
+
+TEST(RangesTest, Validate) {
+    RangeList list;
+
+    memset(&list, 0, sizeof(list));
+    rangeListAdd(&list, 0, PAGE_SIZE);
+    rangeListAdd(&list, 1024*1024 - PAGE_SIZE, PAGE_SIZE);
+    EXPECT_EQ(rangeListValidate(&list, 1024*1024, PAGE_SIZE, "test"), 0);
+    EXPECT_NE(rangeListValidate(&list, 1024*1024 - 1, PAGE_SIZE, "test"), 0);
+
+    list.ranges[1].offset += 512;
+    EXPECT_NE(rangeListValidate(&list, 1024*1024, PAGE_SIZE, "test"), 0);
+
+    list.ranges[1].offset -= 512;
+    list.ranges[1].size    = 0;
+    EXPECT_NE(rangeListValidate(&list, 1024*1024, PAGE_SIZE, "test"), 0);
+    rangeListFree(&list);
+}
+
+//
+// Runs a daemon serving two simulated GPUs on a background thread.
+//
+class DaemonTest : public SimTest {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        void Configure(UvmSimConfig *config) { config->numGpus = 2; }
+        static void *Serve(void *arg);
+        static int Append(void *ctx, const void *buf, NvLength len);
+
+        char dir[64];
+        std::string socketPath;
+        char uuids[2][DAEMON_GPU_BYTES];
+        DaemonGpu gpus[2];
+        DaemonConfig config;
+        pthread_t thread;
+        int serveResult;
+        int sock;
+};
+
+void *DaemonTest::Serve(void *arg) {
+    DaemonTest *test = (DaemonTest *)arg;
+    test->serveResult = daemonServe(&test->config);
+    return NULL;
+}
+
+int DaemonTest::Append(void *ctx, const void *buf, NvLength len) {
+    std::vector<char> *out = (std::vector<char> *)ctx;
+    out->insert(out->end(), (const char *)buf, (const char *)buf + len);
+    return 0;
+}
+
+void DaemonTest::SetUp() {
+    SimTest::SetUp();
+    strcpy(dir, "/tmp/dump_fb_daemon.XXXXXX");
+    ASSERT_NE(mkdtemp(dir), (char *)NULL);
+    socketPath = std::string(dir) + "/sock";
+
+    memset(&config, 0, sizeof(config));
+    for (unsigned int i = 0; i < 2; i++) {
+        snprintf(uuids[i], sizeof(uuids[i]),
+                 "GPU-53494d47-5055-0000-0000-%012x", i);
+        gpus[i].uuid   = uuids[i];
+        gpus[i].fbSize = simConfig.fbSize;
+        UvmSimGetGpuUuid(i, &gpus[i].uvmUuid);
+    }
+    config.socketPath = socketPath.c_str();
+    config.gpus       = gpus;
+    config.numGpus    = 2;
+    acquireParamsInit(&config.params);
+    config.params.chunkBytes = 1024*1024;
+
+    serveResult = -1;
+    ASSERT_EQ(pthread_create(&thread, NULL, Serve, this), 0);
+
+    // Wait for the daemon to start listening.
+    for (int tries = 0; tries < 1000; tries++) {
+        struct stat st;
+        if (stat(socketPath.c_str(), &st) == 0)
+            break;
+        usleep(1000);
+    }
+    sock = daemonConnect(socketPath.c_str());
+    ASSERT_GE(sock, 0);
+}
+
+void DaemonTest::TearDown() {
+    if (sock >= 0) {
+        EXPECT_EQ(daemonShutdown(sock), (RM_STATUS)RM_OK);
+        close(sock);
+        pthread_join(thread, NULL);
+        EXPECT_EQ(serveResult, 0);
+    }
+    EXPECT_EQ(access(socketPath.c_str(), F_OK), -1);
+    rmdir(dir);
+    SimTest::TearDown();
+}
+
+// Small requests are copied directly, larger ones go through the pipeline.
+TEST_F(DaemonTest, StreamMatchesSource) {
+    const NvLength sizes[] = { PAGE_SIZE, 1024*1024, 5*1024*1024 + 3*PAGE_SIZE };
+    DaemonReply reply;
+
+    ASSERT_EQ(daemonPing(sock), (RM_STATUS)RM_OK);
+
+    for (unsigned int i = 0; i < 3; i++) {
+        std::vector<char> data;
+        unsigned long long offset = (i + 1) * 16 * PAGE_SIZE;
+
+        ASSERT_EQ(daemonDumpStream(sock, "", offset, sizes[i], Append, &data,
+                                   &reply), (RM_STATUS)RM_OK);
+        ASSERT_EQ(data.size(), sizes[i]);
+        EXPECT_EQ(reply.size, sizes[i]);
+        EXPECT_TRUE(MatchesSim(&data[0], offset, sizes[i], 0));
+    }
+
+    // A partial UUID picks the GPU, as with -g; so does the full one.
+    std::vector<char> data;
+    ASSERT_EQ(daemonDumpStream(sock, "53494d47-5055-0000-0000-000000000001",
+                               0, 8*PAGE_SIZE, Append, &data, NULL),
+              (RM_STATUS)RM_OK);
+    ASSERT_EQ(data.size(), 8*PAGE_SIZE);
+    EXPECT_TRUE(MatchesSim(&data[0], 0, 8*PAGE_SIZE, 1));
+}
+
+TEST_F(DaemonTest, WritesToPath) {
+    std::string out = std::string(dir) + "/dump";
+    NvLength size = 3*1024*1024;
+    DaemonReply reply;
+    std::vector<char> data(size);
+
+    ASSERT_EQ(daemonDumpToPath(sock, uuids[1], PAGE_SIZE, size, out.c_str(),
+                               &reply), (RM_STATUS)RM_OK);
+    EXPECT_EQ(reply.size, size);
+
+    int fd = open(out.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(read(fd, &data[0], size), (ssize_t)size);
+    close(fd);
+    EXPECT_TRUE(MatchesSim(&data[0], PAGE_SIZE, size, 1));
+
+    // Existing files are never overwritten.
+    EXPECT_EQ(daemonDumpToPath(sock, "", 0, PAGE_SIZE, out.c_str(), NULL),
+              (RM_STATUS)RM_ERR_INVALID_PATH);
+    unlink(out.c_str());
+}
+
+// Bad requests are refused without dropping the connection.
+TEST_F(DaemonTest, RejectsBadRequests) {
+    std::vector<char> data;
+
+    EXPECT_EQ(daemonDumpStream(sock, "ffff", 0, PAGE_SIZE, Append, &data,
+                               NULL), (RM_STATUS)RM_ERR_INVALID_INDEX);
+    // Ambiguous: both simulated GPUs match.
+    EXPECT_EQ(daemonDumpStream(sock, "53494d47", 0, PAGE_SIZE, Append, &data,
+                               NULL), (RM_STATUS)RM_ERR_INVALID_INDEX);
+    EXPECT_EQ(daemonDumpStream(sock, "", 100, PAGE_SIZE, Append, &data, NULL),
+              (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+    EXPECT_EQ(daemonDumpStream(sock, "", 0, 0, Append, &data, NULL),
+              (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+    EXPECT_EQ(daemonDumpStream(sock, "", simConfig.fbSize - PAGE_SIZE,
+                               2*PAGE_SIZE, Append, &data, NULL),
+              (RM_STATUS)RM_ERR_INVALID_ADDRESS);
+    EXPECT_TRUE(data.empty());
+
+    EXPECT_EQ(daemonPing(sock), (RM_STATUS)RM_OK);
+}
+
+TEST_F(DaemonTest, ConcurrentClients) {
+    int other = daemonConnect(socketPath.c_str());
+    std::vector<char> a, b;
+
+    ASSERT_GE(other, 0);
+    ASSERT_EQ(daemonDumpStream(other, "", 0, 2*1024*1024, Append, &a, NULL),
+              (RM_STATUS)RM_OK);
+    ASSERT_EQ(daemonDumpStream(sock, "", 0, 2*1024*1024, Append, &b, NULL),
+              (RM_STATUS)RM_OK);
+    EXPECT_TRUE(a == b);
+    close(other);
+}
+
+// A copy failure after the header was sent can only be reported by hanging up.
+class DaemonFailureTest : public DaemonTest {
+    protected:
+        void Configure(UvmSimConfig *config) {
+            DaemonTest::Configure(config);
+            config->failAddress = 4*1024*1024;
+            config->failLength  = PAGE_SIZE;
+        }
+};
+
+TEST_F(DaemonFailureTest, StreamFailureClosesConnection) {
+    std::vector<char> data;
+
+    EXPECT_EQ(daemonDumpStream(sock, "", 0, 8*1024*1024, Append, &data, NULL),
+              (RM_STATUS)RM_ERROR);
+    EXPECT_LT(data.size(), 8u*1024*1024);
+    close(sock);
+
+    sock = daemonConnect(socketPath.c_str());
+    ASSERT_GE(sock, 0);
+    EXPECT_EQ(daemonDumpStream(sock, "", 4*1024*1024, PAGE_SIZE, Append, &data,
+                               NULL), (RM_STATUS)RM_ERR_ECC_ERROR);
+    EXPECT_EQ(daemonPing(sock), (RM_STATUS)RM_OK);
+}
+
+// First-byte latency of a small read once the daemon is warm.
+TEST_F(DaemonTest, SmallRequestLatency) {
+    const unsigned int count = 2000;
+    std::vector<char> data;
+    NvU64 start;
+
+    data.reserve(PAGE_SIZE);
+    start = acquireNowNs();
+    for (unsigned int i = 0; i < count; i++) {
+        data.clear();
+        ASSERT_EQ(daemonDumpStream(sock, "", i * PAGE_SIZE, PAGE_SIZE, Append,
+                                   &data, NULL), (RM_STATUS)RM_OK);
+    }
+    std::cout << "4K request, one connection: "
+              << (acquireNowNs() - start) / 1000.0 / count << "us\n";
+
+    start = acquireNowNs();
+    for (unsigned int i = 0; i < count / 10; i++) {
+        int fd = daemonConnect(socketPath.c_str());
+        ASSERT_GE(fd, 0);
+        data.clear();
+        ASSERT_EQ(daemonDumpStream(fd, "", i * PAGE_SIZE, PAGE_SIZE, Append,
+                                   &data, NULL), (RM_STATUS)RM_OK);
+        close(fd);
+    }
+    std::cout << "4K request, new connection: "
+              << (acquireNowNs() - start) / 1000.0 / (count / 10) << "us\n";
+}
+
+class GpuLockTest : public SimTest {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        void Configure(UvmSimConfig *config) { config->numGpus = 2; }
+        static void *Waiter(void *arg);
+
+        char dir[64];
+        char names[2][DAEMON_GPU_BYTES];
+};
+
+struct GpuLockWaiter {
+    const char   *dir;
+    const char   *name;
+    unsigned int *order;
+    unsigned int  position;
+    int           result;
+};
+
+void *GpuLockTest::Waiter(void *arg) {
+    GpuLockWaiter *w = (GpuLockWaiter *)arg;
+    GpuLock lock;
+
+    w->result = gpuLockAcquire(w->dir, w->name, 5000000000ull, &lock);
+    if (w->result == 0) {
+        w->position = __atomic_fetch_add(w->order, 1, __ATOMIC_SEQ_CST);
+        usleep(10000);
+        gpuLockRelease(&lock);
+    }
+    return NULL;
+}
+
+void GpuLockTest::SetUp() {
+    SimTest::SetUp();
+    strcpy(dir, "/tmp/dump_fb_lock.XXXXXX");
+    ASSERT_NE(mkdtemp(dir), (char *)NULL);
+    for (unsigned int i = 0; i < 2; i++)
+        UvmSimGetGpuUuidString(i, names[i], sizeof(names[i]));
+}
+
+static int RemoveEntry(const char *path, const struct stat *st, int flag,
+                       struct FTW *ftw) {
+    return remove(path);
+}
+
+void GpuLockTest::TearDown() {
+    nftw(dir, RemoveEntry, 8, FTW_DEPTH | FTW_PHYS);
+    SimTest::TearDown();
+}
+
+TEST_F(GpuLockTest, Fifo) {
+    GpuLock lock;
+    unsigned int order = 0;
+    GpuLockWaiter waiters[3];
+    pthread_t threads[3];
+
+    ASSERT_EQ(gpuLockAcquire(dir, names[0], 0, &lock), 0);
+
+    // Queue up in a known order behind the holder
+    for (unsigned int i = 0; i < 3; i++) {
+        waiters[i].dir = dir;
+        waiters[i].name = names[0];
+        waiters[i].order = &order;
+        waiters[i].result = -1;
+        ASSERT_EQ(pthread_create(&threads[i], NULL, Waiter, &waiters[i]), 0);
+        usleep(30000);
+    }
+    EXPECT_EQ(__atomic_load_n(&order, __ATOMIC_SEQ_CST), 0u);
+
+    gpuLockRelease(&lock);
+    for (unsigned int i = 0; i < 3; i++) {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ(waiters[i].result, 0);
+        EXPECT_EQ(waiters[i].position, i);
+    }
+}
+
+TEST_F(GpuLockTest, OtherGpuAndTimeout) {
+    GpuLock lock, other, late;
+    NvU64 start;
+
+    ASSERT_EQ(gpuLockAcquire(dir, names[0], 0, &lock), 0);
+
+    // Another GPU is not held up
+    start = acquireNowNs();
+    ASSERT_EQ(gpuLockAcquire(dir, names[1], 100000000ull, &other), 0);
+    EXPECT_LT(acquireNowNs() - start, 50000000ull);
+    gpuLockRelease(&other);
+
+    start = acquireNowNs();
+    EXPECT_EQ(gpuLockAcquire(dir, names[0], 100000000ull, &late), -1);
+    EXPECT_EQ(errno, ETIMEDOUT);
+    EXPECT_GE(acquireNowNs() - start, 100000000ull);
+    EXPECT_EQ(late.fd, -1);
+
+    // The abandoned ticket does not hold up the next one
+    gpuLockRelease(&lock);
+    start = acquireNowNs();
+    ASSERT_EQ(gpuLockAcquire(dir, names[0], 100000000ull, &late), 0);
+    EXPECT_LT(acquireNowNs() - start, 50000000ull);
+    gpuLockRelease(&late);
+
+    EXPECT_EQ(gpuLockAcquire(dir, "a/b", 0, &late), -1);
+    EXPECT_EQ(errno, EINVAL);
+}
+
+TEST_F(GpuLockTest, DeadHolder) {
+    GpuLock lock;
+    int status;
+    pid_t pid = fork();
+
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        // Exit while holding the lock
+        _exit(gpuLockAcquire(dir, names[0], 0, &lock) ? 1 : 0);
+    }
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    ASSERT_EQ(gpuLockAcquire(dir, names[0], 100000000ull, &lock), 0);
+    gpuLockRelease(&lock);
+}
+
+//
+// Processes dumping two simulated GPUs at once.  Dumps of one GPU must never
+// overlap, dumps of different GPUs should.
+//
+TEST_F(GpuLockTest, MultiProcessStress) {
+    const unsigned int procs = 8, rounds = 4;
+    const NvLength size = 1024*1024;
+    struct Hold { NvU64 start, end; };
+    Hold *holds = (Hold *)mmap(NULL, procs * rounds * sizeof(Hold),
+            PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    pid_t pids[procs];
+    bool overlapped = false;
+    ASSERT_NE(holds, MAP_FAILED);
+
+    UvmDeinitialize();
+    simConfig.latencyNs = 2000000;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    for (unsigned int p = 0; p < procs; p++) {
+        pids[p] = fork();
+        ASSERT_GE(pids[p], 0);
+        if (pids[p] == 0) {
+            unsigned int gpu = p % 2;
+            UvmGpuUuid uuid;
+            void *buf = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                             MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            int failed = buf == MAP_FAILED;
+
+            UvmSimGetGpuUuid(gpu, &uuid);
+            for (unsigned int r = 0; r < rounds && !failed; r++) {
+                Hold *hold = &holds[p * rounds + r];
+                unsigned long long offset = (p * rounds + r) * size;
+                GpuLock lock;
+
+                if (gpuLockAcquire(dir, names[gpu], 10000000000ull, &lock)) {
+                    failed = 1;
+                    break;
+                }
+                hold->start = acquireNowNs();
+                failed = UvmDumpGpuMemory(&uuid, buf, offset, size) != RM_OK ||
+                         !MatchesSim(buf, offset, size, gpu);
+                hold->end = acquireNowNs();
+                gpuLockRelease(&lock);
+            }
+            _exit(failed);
+        }
+    }
+
+    for (unsigned int p = 0; p < procs; p++) {
+        int status;
+        ASSERT_EQ(waitpid(pids[p], &status, 0), pids[p]);
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0) << p;
+    }
+
+    for (unsigned int a = 0; a < procs * rounds; a++) {
+        for (unsigned int b = a + 1; b < procs * rounds; b++) {
+            bool overlap = holds[a].start < holds[b].end &&
+                           holds[b].start < holds[a].end;
+            if ((a / rounds) % 2 == (b / rounds) % 2)
+                EXPECT_FALSE(overlap) << a << " " << b;
+            else
+                overlapped |= overlap;
+        }
+    }
+    EXPECT_TRUE(overlapped);
+
+    munmap(holds, procs * rounds * sizeof(Hold));
+}
+
+TEST_F(GpuLockTest, TicketDelayStress) {
+    const unsigned int procs = 6, rounds = 3;
+    struct Hold { NvU64 start, end; };
+    Hold *holds = (Hold *)mmap(NULL, procs * rounds * sizeof(Hold),
+            PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    pid_t pids[procs];
+    ASSERT_NE(holds, MAP_FAILED);
+
+    for (unsigned int p = 0; p < procs; p++) {
+        pids[p] = fork();
+        ASSERT_GE(pids[p], 0);
+        if (pids[p] == 0) {
+            struct timespec ts = { 0, 1000000 };
+
+            // Slow publishers must still keep the later tickets waiting
+            gpuLockSetTicketDelay(p % 2 ? 3000000 : 0);
+
+            for (unsigned int r = 0; r < rounds; r++) {
+                Hold *hold = &holds[p * rounds + r];
+                GpuLock lock;
+
+                if (gpuLockAcquire(dir, names[0], 10000000000ull, &lock))
+                    _exit(1);
+                hold->start = acquireNowNs();
+                nanosleep(&ts, NULL);
+                hold->end = acquireNowNs();
+                gpuLockRelease(&lock);
+            }
+            _exit(0);
+        }
+    }
+
+    for (unsigned int p = 0; p < procs; p++) {
+        int status;
+        ASSERT_EQ(waitpid(pids[p], &status, 0), pids[p]);
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0) << p;
+    }
+
+    for (unsigned int a = 0; a < procs * rounds; a++) {
+        for (unsigned int b = a + 1; b < procs * rounds; b++) {
+            EXPECT_FALSE(holds[a].start < holds[b].end &&
+                         holds[b].start < holds[a].end) << a << " " << b;
+        }
+    }
+
+    munmap(holds, procs * rounds * sizeof(Hold));
+}
+
+TEST(ImageTest, Classify) {
+    std::vector<NvU64> buf(4096 / 8, 0);
+    NvU64 value = 1;
+
+    EXPECT_EQ(imageChunkClassify(&buf[0], 4096, &value), IMAGE_CHUNK_ZERO);
+    EXPECT_EQ(value, 0u);
+
+    std::fill(buf.begin(), buf.end(), 0xdeadbeef00c0ffeeull);
+    EXPECT_EQ(imageChunkClassify(&buf[0], 4096, &value), IMAGE_CHUNK_CONSTANT);
+    EXPECT_EQ(value, 0xdeadbeef00c0ffeeull);
+
+    buf[511] ^= 1ull << 63;
+    EXPECT_EQ(imageChunkClassify(&buf[0], 4096, &value), IMAGE_CHUNK_RAW);
+    EXPECT_EQ(imageChunkClassify(&buf[0], 12, &value), IMAGE_CHUNK_RAW);
+}
+
+//
+// Images of a simulated GPU whose memory is made of 1 MB regions of zero,
+// constant and random pages, so whole chunks can be zero or constant.
+//
+class ImageAcquireTest : public AcquireTest {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        void Configure(UvmSimConfig *config) {
+            config->zeroPercent  = 40;
+            config->constPercent = 20;
+            config->regionSize   = 1024*1024;
+        }
+        RM_STATUS Acquire(unsigned long long base, NvLength size,
+                          CompressAlgorithm compression,
+                          NvLength chunkBytes = 1024*1024);
+        void CorruptByte(NvU64 offset);
+
+        ImageIndex index;
+        ImageFile image;
+};
+
+void ImageAcquireTest::SetUp() {
+    AcquireTest::SetUp();
+    memset(&index, 0, sizeof(index));
+    memset(&image, 0, sizeof(image));
+    image.fd = -1;
+}
+
+void ImageAcquireTest::TearDown() {
+    imageClose(&image);
+    imageIndexFree(&index);
+    AcquireTest::TearDown();
+}
+
+RM_STATUS ImageAcquireTest::Acquire(unsigned long long base, NvLength size,
+                                    CompressAlgorithm compression,
+                                    NvLength chunkBytes) {
+    ImageHeader header;
+
+    params.baseAddress = base;
+    params.sizeBytes   = size;
+    params.chunkBytes  = chunkBytes;
+    params.compression = compression;
+    params.outOffset   = IMAGE_HEADER_SIZE;
+    params.image       = &index;
+
+    imageHeaderInit(&header, base, size, params.chunkBytes, compression, 0);
+    header.fbSize = simConfig.fbSize;
+    strcpy(header.gpuUuid, "GPU-test");
+    EXPECT_EQ(imageHeaderWrite(&header, fd), 0);
+
+    return acquireRange(&params, NULL);
+}
+
+void ImageAcquireTest::CorruptByte(NvU64 offset) {
+    NvU8 byte;
+    ASSERT_EQ(pread(fd, &byte, 1, offset), 1);
+    byte ^= 0x10;
+    ASSERT_EQ(pwrite(fd, &byte, 1, offset), 1);
+}
+
+//
+// Chunks the size of a region are all zero, constant or random; twice that
+// they are mixed and compress.
+//
+TEST_F(ImageAcquireTest, RoundTrip) {
+    const CompressAlgorithm algorithms[] = { COMPRESS_NONE, COMPRESS_ZSTD };
+    NvLength size = 24*1024*1024 + 5*PAGE_SIZE;
+    unsigned long long base = 2*1024*1024;
+
+    for (unsigned int a = 0; a < 2; a++) {
+        NvLength chunkBytes = (a + 1) * 1024*1024;
+        NvU64 chunks = (size + chunkBytes - 1) / chunkBytes;
+
+        SCOPED_TRACE(compressAlgorithmName(algorithms[a]));
+        ASSERT_EQ(ftruncate(fd, 0), 0);
+        imageIndexFree(&index);
+        ASSERT_EQ(Acquire(base, size, algorithms[a], chunkBytes),
+                  (RM_STATUS)RM_OK);
+        ASSERT_EQ(imageOpenFd(fd, &image), 0);
+
+        EXPECT_EQ(image.header->baseAddress, base);
+        EXPECT_EQ(image.header->sizeBytes, size);
+        EXPECT_EQ(image.header->chunkBytes, chunkBytes);
+        EXPECT_EQ(image.header->fbSize, simConfig.fbSize);
+        EXPECT_STREQ(image.header->gpuUuid, "GPU-test");
+        EXPECT_EQ(image.count, chunks);
+        EXPECT_EQ(image.status, (RM_STATUS)RM_OK);
+
+        // Pattern chunks take no space.
+        NvU64 kinds[IMAGE_CHUNK_LZ4 + 1] = { 0 };
+        for (NvU64 i = 0; i < image.count; i++) {
+            kinds[image.index[i].kind]++;
+            if (image.index[i].kind == IMAGE_CHUNK_ZERO ||
+                image.index[i].kind == IMAGE_CHUNK_CONSTANT) {
+                EXPECT_EQ(image.index[i].storedBytes, 0u);
+            }
+        }
+        if (algorithms[a] == COMPRESS_NONE) {
+            EXPECT_GT(kinds[IMAGE_CHUNK_ZERO], 0u);
+            EXPECT_GT(kinds[IMAGE_CHUNK_CONSTANT], 0u);
+            EXPECT_GT(kinds[IMAGE_CHUNK_RAW], 0u);
+        } else {
+            EXPECT_GT(kinds[IMAGE_CHUNK_ZSTD], 0u);
+        }
+
+        std::vector<char> buf(chunkBytes);
+        for (NvU64 i = 0; i < image.count; i++) {
+            NvLength len = imageReadChunk(&image, i, &buf[0]);
+            ASSERT_EQ(len, std::min<NvLength>(chunkBytes,
+                                              size - i * chunkBytes));
+            EXPECT_TRUE(MatchesSim(&buf[0], base + i * chunkBytes, len))
+                << "chunk " << i;
+        }
+
+        // Reads at odd offsets that span chunks of different kinds.
+        std::vector<char> all(size);
+        ASSERT_EQ(imageRead(&image, base, size, &all[0]), 0);
+        EXPECT_TRUE(MatchesSim(&all[0], base, size));
+        for (NvU64 off = 3; off < size; off += 777777) {
+            NvLength len = std::min<NvLength>(size - off, 3*1024*1024 + 5);
+            ASSERT_EQ(imageRead(&image, base + off, len, &all[0]), 0);
+            EXPECT_TRUE(MatchesSim(&all[0], base + off, len)) << off;
+        }
+        EXPECT_NE(imageRead(&image, base - PAGE_SIZE, PAGE_SIZE, &buf[0]), 0);
+        EXPECT_NE(imageRead(&image, base + size - PAGE_SIZE, 2*PAGE_SIZE,
+                            &buf[0]), 0);
+        imageClose(&image);
+    }
+}
+
+TEST_F(ImageAcquireTest, DetectsCorruption) {
+    std::vector<char> buf(1024*1024);
+    NvU64 raw = ~0ull;
+
+    ASSERT_EQ(Acquire(0, 16*1024*1024, COMPRESS_NONE), (RM_STATUS)RM_OK);
+    for (NvU64 i = 0; i < index.count && raw == ~0ull; i++) {
+        if (index.entries[i].kind == IMAGE_CHUNK_RAW)
+            raw = i;
+    }
+    ASSERT_NE(raw, ~0ull);
+
+    // A flipped bit in a chunk is caught by its CRC.
+    CorruptByte(index.entries[raw].offset + 12345);
+    ASSERT_EQ(imageOpenFd(fd, &image), 0);
+    EXPECT_EQ(imageReadChunk(&image, raw, &buf[0]), 0u);
+    EXPECT_EQ(imageReadChunk(&image, raw == 0 ? 1 : 0, &buf[0]),
+              1024u*1024);
+    imageClose(&image);
+
+    // One in the index or the header makes the image unreadable.
+    struct stat st;
+    ASSERT_EQ(fstat(fd, &st), 0);
+    CorruptByte(st.st_size - IMAGE_FOOTER_SIZE - 20);
+    EXPECT_EQ(imageOpenFd(fd, &image), -1);
+    CorruptByte(st.st_size - IMAGE_FOOTER_SIZE - 20);
+    CorruptByte(40);
+    EXPECT_EQ(imageOpenFd(fd, &image), -1);
+    CorruptByte(40);
+    EXPECT_EQ(imageOpenFd(fd, &image), 0);
+    imageClose(&image);
+
+    // Anything else is simply not an image.
+    ASSERT_EQ(ftruncate(fd, 0), 0);
+    ASSERT_EQ(write(fd, "not an image", 12), 12);
+    EXPECT_EQ(imageOpenFd(fd, &image), 1);
+}
+
+// The chunks acquired before a copy failure are kept, and so is the failure.
+TEST_F(ImageAcquireTest, CopyFailure) {
+    std::vector<char> buf(1024*1024);
+
+    UvmDeinitialize();
+    UvmSimDisable();
+    simConfig.failAddress = 5*1024*1024 + PAGE_SIZE;
+    simConfig.failLength  = PAGE_SIZE;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    EXPECT_EQ(Acquire(0, 16*1024*1024, COMPRESS_LZ4),
+              (RM_STATUS)RM_ERR_ECC_ERROR);
+    ASSERT_EQ(imageOpenFd(fd, &image), 0);
+    EXPECT_EQ(image.count, 5u);
+    EXPECT_EQ(image.status, (RM_STATUS)RM_ERR_ECC_ERROR);
+    ASSERT_EQ(imageReadChunk(&image, 4, &buf[0]), 1024u*1024);
+    EXPECT_TRUE(MatchesSim(&buf[0], 4*1024*1024, 1024*1024));
+    EXPECT_NE(imageRead(&image, 5*1024*1024, PAGE_SIZE, &buf[0]), 0);
+}
+
+//
+// The same kind of memory dumped raw, sparse, as a seekable zstd stream and as
+// an lz4 image, and read back through a DumpReader.
+//
+class ReaderTest : public ImageAcquireTest {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        enum Format { RAW, SPARSE, SEEKABLE, IMAGE };
+        static const unsigned long long BASE = 3*1024*1024;
+        static const NvLength SIZE = 20*1024*1024 + 5*PAGE_SIZE;
+
+        void Write(Format format, NvLength chunkBytes = 1024*1024);
+        bool Matches(NvU64 offset, NvLength len);
+        static int CheckPage(void *ctx, NvU64 offset, const void *page,
+                             NvLength len);
+        static void *RandomReads(void *arg);
+
+        ReaderOptions options;
+        DumpReader *reader;
+        NvU64 nextPage;
+        bool pagesMatch;
+};
+
+const unsigned long long ReaderTest::BASE;
+const NvLength ReaderTest::SIZE;
+
+void ReaderTest::SetUp() {
+    ImageAcquireTest::SetUp();
+    readerOptionsInit(&options);
+    options.cacheBytes = 64*1024*1024;
+    options.readAhead  = 0;
+    reader = NULL;
+}
+
+void ReaderTest::TearDown() {
+    readerClose(reader);
+    ImageAcquireTest::TearDown();
+}
+
+void ReaderTest::Write(Format format, NvLength chunkBytes) {
+    readerClose(reader);
+    reader = NULL;
+    ASSERT_EQ(ftruncate(fd, 0), 0);
+
+    if (format == IMAGE) {
+        imageIndexFree(&index);
+        ASSERT_EQ(Acquire(BASE, SIZE, COMPRESS_LZ4, chunkBytes),
+                  (RM_STATUS)RM_OK);
+        return;
+    }
+
+    acquireParamsInit(&params);
+    params.gpuUuid     = &uvmUuid;
+    params.outFd       = fd;
+    params.baseAddress = BASE;
+    params.sizeBytes   = SIZE;
+    params.chunkBytes  = chunkBytes;
+    params.sparse      = format == SPARSE;
+    if (format == SEEKABLE)
+        params.compression = COMPRESS_ZSTD;
+    else
+        ASSERT_EQ(ftruncate(fd, SIZE), 0);
+    ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_OK);
+}
+
+bool ReaderTest::Matches(NvU64 offset, NvLength len) {
+    std::vector<char> buf(len + 1);
+
+    return readerRead(reader, offset, &buf[0], len) == 0 &&
+           MatchesSim(&buf[0], BASE + offset, len);
+}
+
+int ReaderTest::CheckPage(void *ctx, NvU64 offset, const void *page,
+                          NvLength len) {
+    ReaderTest *test = (ReaderTest *)ctx;
+
+    if (offset != test->nextPage || !test->MatchesSim(page, BASE + offset, len))
+        test->pagesMatch = false;
+    test->nextPage = offset + len;
+    return 0;
+}
+
+TEST_F(ReaderTest, Formats) {
+    const Format formats[] = { RAW, SPARSE, SEEKABLE, IMAGE };
+    const ReaderFormat expected[] = { READER_RAW, READER_RAW, READER_SEEKABLE,
+                                      READER_IMAGE };
+    std::vector<char> buf(PAGE_SIZE);
+
+    for (unsigned int f = 0; f < 4; f++) {
+        SCOPED_TRACE(f);
+        Write(formats[f]);
+        reader = readerOpen(path, &options);
+        ASSERT_TRUE(reader != NULL);
+
+        EXPECT_EQ(readerFormat(reader), expected[f]);
+        EXPECT_EQ(readerSize(reader), SIZE);
+        EXPECT_EQ(readerBaseAddress(reader),
+                  formats[f] == IMAGE ? BASE : 0ull);
+
+        EXPECT_TRUE(Matches(0, SIZE));
+        for (NvU64 off = 5; off < SIZE; off += 777777) {
+            EXPECT_TRUE(Matches(off, std::min<NvLength>(SIZE - off,
+                                                        2*1024*1024 + 3)))
+                << off;
+        }
+        EXPECT_TRUE(Matches(SIZE, 0));
+        EXPECT_NE(readerRead(reader, SIZE - 1, &buf[0], 2), 0);
+        EXPECT_NE(readerRead(reader, SIZE + 1, &buf[0], 0), 0);
+
+        // Whole pages, then pages that straddle chunks.
+        NvLength pageSizes[] = { PAGE_SIZE, 3000 };
+        for (unsigned int p = 0; p < 2; p++) {
+            nextPage   = 7;
+            pagesMatch = true;
+            EXPECT_EQ(readerForEachPage(reader, 7, SIZE - 7, pageSizes[p],
+                                        CheckPage, this), 0);
+            EXPECT_TRUE(pagesMatch);
+            EXPECT_EQ(nextPage, SIZE);
+        }
+    }
+}
+
+TEST_F(ReaderTest, Cache) {
+    ReaderStats stats;
+    NvU64 chunks = (SIZE + 1024*1024 - 1) / (1024*1024);
+
+    options.cacheBytes = 4*1024*1024;
+    options.shards     = 2;
+    Write(SEEKABLE);
+    reader = readerOpen(path, &options);
+    ASSERT_TRUE(reader != NULL);
+
+    EXPECT_TRUE(Matches(100, 200));
+    EXPECT_TRUE(Matches(5000, 200));
+    readerGetStats(reader, &stats);
+    EXPECT_EQ(stats.misses, 1u);
+    EXPECT_EQ(stats.hits, 1u);
+
+    // The whole dump does not fit, so reading it evicts and the first chunk
+    // has to be decoded again.
+    EXPECT_TRUE(Matches(0, SIZE));
+    EXPECT_TRUE(Matches(100, 200));
+    readerGetStats(reader, &stats);
+    EXPECT_EQ(stats.misses, chunks + 1);
+    EXPECT_GE(stats.evictions, chunks + 1 - 4);
+    EXPECT_EQ(stats.readAheads, 0u);
+}
+
+TEST_F(ReaderTest, ReadAhead) {
+    ReaderStats stats;
+    NvU64 chunks = (SIZE + 1024*1024 - 1) / (1024*1024);
+
+    options.readAhead = 4;
+    Write(SEEKABLE);
+    reader = readerOpen(path, &options);
+    ASSERT_TRUE(reader != NULL);
+
+    for (NvU64 off = 0; off < SIZE; off += PAGE_SIZE)
+        ASSERT_TRUE(Matches(off, PAGE_SIZE));
+
+    // Every chunk is decoded once, mostly ahead of the reads.
+    readerGetStats(reader, &stats);
+    EXPECT_EQ(stats.misses + stats.readAheads, chunks);
+    EXPECT_GT(stats.readAheads, 0u);
+    EXPECT_EQ(stats.evictions, 0u);
+}
+
+void *ReaderTest::RandomReads(void *arg) {
+    ReaderTest *test = (ReaderTest *)arg;
+    NvU64 seed = (uintptr_t)pthread_self();
+    bool ok = true;
+
+    for (int i = 0; i < 200 && ok; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        NvU64 off = (seed >> 20) % SIZE;
+        ok = test->Matches(off, std::min<NvLength>(SIZE - off, 70000));
+    }
+    return ok ? arg : NULL;
+}
+
+// Threads reading random ranges through a cache much smaller than the dump.
+TEST_F(ReaderTest, ConcurrentReads) {
+    const Format formats[] = { SEEKABLE, IMAGE };
+    pthread_t threads[4];
+
+    options.cacheBytes = 3*1024*1024;
+    options.shards     = 2;
+    options.readAhead  = 2;
+    for (unsigned int f = 0; f < 2; f++) {
+        Write(formats[f], 256*1024);
+        reader = readerOpen(path, &options);
+        ASSERT_TRUE(reader != NULL);
+
+        for (int t = 0; t < 4; t++)
+            ASSERT_EQ(pthread_create(&threads[t], NULL, RandomReads, this), 0);
+        for (int t = 0; t < 4; t++) {
+            void *ret;
+            pthread_join(threads[t], &ret);
+            EXPECT_TRUE(ret == this);
+        }
+    }
+}
+
+TEST_F(ReaderTest, Damaged) {
+    std::vector<char> buf(1024*1024);
+
+    // Chunks of two regions are mixed and compress.
+    Write(IMAGE, 2*1024*1024);
+    reader = readerOpen(path, &options);
+    ASSERT_TRUE(reader != NULL);
+    ASSERT_EQ(imageOpenFd(fd, &image), 0);
+    NvU64 i = 0;
+    while (i < image.count && image.index[i].kind != IMAGE_CHUNK_LZ4)
+        i++;
+    ASSERT_LT(i, image.count);
+    CorruptByte(image.index[i].offset + image.index[i].storedBytes / 2);
+    imageClose(&image);
+    EXPECT_NE(readerRead(reader, i * 2*1024*1024, &buf[0], PAGE_SIZE), 0);
+
+    // A seek table that claims more frames than the file holds.
+    Write(SEEKABLE);
+    struct stat st;
+    ASSERT_EQ(fstat(fd, &st), 0);
+    NvU8 frame[8] = { 0 };
+    ASSERT_EQ(pread(fd, frame, 8, st.st_size - 9 - 8), 8);
+    frame[1] ^= 0x40;
+    ASSERT_EQ(pwrite(fd, frame, 8, st.st_size - 9 - 8), 8);
+    reader = readerOpen(path, &options);
+    EXPECT_TRUE(reader == NULL);
+
+    EXPECT_TRUE(readerOpen("/nonexistent/dump", NULL) == NULL);
+}
+
+//
+// A dump split into segments over three directories, with chunks and pages
+// that straddle the segments, reads back as one dump: also after the
+// segments were gathered next to the manifest, but not once one is cut short.
+//
+TEST_F(ReaderTest, Segmented) {
+    const NvLength segmentBytes = 3*1024*1024 + 2*PAGE_SIZE;
+    char dir[] = "/tmp/dump_fb_segments.XXXXXX";
+    char *dirs[3];
+    SegmentSet segments;
+    AcquireStats stats;
+
+    ASSERT_NE(mkdtemp(dir), (char *)NULL);
+    std::string manifest = std::string(dir) + "/dump";
+    for (unsigned int t = 0; t < 3; t++) {
+        dirs[t] = nvasprintf("%s/%u", dir, t);
+        ASSERT_EQ(mkdir(dirs[t], 0755), 0);
+    }
+
+    // A set that cannot be created in full leaves nothing behind.
+    std::string taken = std::string(dirs[1]) + "/dump.seg00004";
+    int tfd = open(taken.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+    ASSERT_GE(tfd, 0);
+    close(tfd);
+    EXPECT_EQ(segmentSetCreate(&segments, manifest.c_str(), dirs, 3,
+                               segmentBytes, SIZE), -1);
+    for (unsigned int i = 0; i < 4; i++) {
+        char *created = nvasprintf("%s/dump.seg%05u", dirs[i % 3], i);
+        EXPECT_NE(access(created, F_OK), 0) << created;
+        nvfree(created);
+    }
+    EXPECT_EQ(unlink(taken.c_str()), 0);
+
+    ASSERT_EQ(segmentSetCreate(&segments, manifest.c_str(), dirs, 3,
+                               segmentBytes, SIZE), 0);
+    EXPECT_EQ(segments.count, 7u);
+    for (unsigned int i = 0; i < segments.count; i++) {
+        EXPECT_EQ(strncmp(segments.paths[i], dirs[i % 3], strlen(dirs[i % 3])),
+                  0);
+    }
+
+    acquireParamsInit(&params);
+    params.gpuUuid     = &uvmUuid;
+    params.outFd       = -1;
+    params.baseAddress = BASE;
+    params.sizeBytes   = SIZE;
+    params.chunkBytes  = 1024*1024;
+    params.depth       = 6;
+    params.segments    = &segments;
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.bytesWritten, SIZE);
+    EXPECT_EQ(stats.bytesStored, SIZE);
+
+    int mfd = open(manifest.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    ASSERT_GE(mfd, 0);
+    ASSERT_EQ(segmentManifestWrite(&segments, mfd), 0);
+    close(mfd);
+
+    for (unsigned int pass = 0; pass < 2; pass++) {
+        reader = readerOpen(manifest.c_str(), &options);
+        ASSERT_TRUE(reader != NULL);
+        EXPECT_EQ(readerFormat(reader), READER_SEGMENTED);
+        EXPECT_EQ(readerSize(reader), SIZE);
+        EXPECT_TRUE(Matches(0, SIZE));
+        EXPECT_TRUE(Matches(segmentBytes - 5, 10));
+
+        nextPage   = 0;
+        pagesMatch = true;
+        EXPECT_EQ(readerForEachPage(reader, 0, SIZE, 64*1024, CheckPage,
+                                    this), 0);
+        EXPECT_TRUE(pagesMatch);
+        EXPECT_EQ(nextPage, SIZE);
+        readerClose(reader);
+        reader = NULL;
+
+        for (unsigned int i = 0; pass == 0 && i < segments.count; i++) {
+            char *name = nv_basename(segments.paths[i]);
+            std::string moved = std::string(dir) + "/" + name;
+            ASSERT_EQ(rename(segments.paths[i], moved.c_str()), 0);
+            free(name);
+        }
+    }
+
+    std::string last = std::string(dir) + "/dump.seg00006";
+    ASSERT_EQ(truncate(last.c_str(), PAGE_SIZE), 0);
+    EXPECT_TRUE(readerOpen(manifest.c_str(), &options) == NULL);
+
+    // Segments only take raw chunks, and must cover the range.
+    params.sparse = 1;
+    EXPECT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+    params.sparse    = 0;
+    params.outOffset = PAGE_SIZE;
+    EXPECT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+
+    segmentSetClose(&segments);
+    for (unsigned int t = 0; t < 3; t++)
+        nvfree(dirs[t]);
+    nftw(dir, RemoveEntry, 8, FTW_DEPTH | FTW_PHYS);
+}
+
+//
+// Offsets past 4 GB: a sparse raw file and a seekable stream of 640 copies of
+// one compressed chunk, each with a marker near the end.
+//
+TEST_F(ReaderTest, LargeFile) {
+    const NvU64 size = 5ull*1024*1024*1024;
+    const NvLength chunkBytes = 8*1024*1024;
+    const char marker[] = "past 4 GB";
+    char buf[sizeof(marker)];
+
+    ASSERT_EQ(ftruncate(fd, size), 0);
+    ASSERT_EQ(pwrite(fd, marker, sizeof(marker), size - 100),
+              (ssize_t)sizeof(marker));
+    reader = readerOpen(path, &options);
+    ASSERT_TRUE(reader != NULL);
+    EXPECT_EQ(readerSize(reader), size);
+    ASSERT_EQ(readerRead(reader, size - 100, buf, sizeof(buf)), 0);
+    EXPECT_STREQ(buf, marker);
+    readerClose(reader);
+    reader = NULL;
+
+    std::vector<char> chunk(chunkBytes);
+    memcpy(&chunk[chunkBytes - 100], marker, sizeof(marker));
+    CompressContext *ctx = compressContextCreate(COMPRESS_ZSTD, 1);
+    std::vector<char> frame(compressBound(COMPRESS_ZSTD, 1, chunkBytes));
+    NvLength frameBytes = compressChunk(ctx, &frame[0], frame.size(),
+                                        &chunk[0], chunkBytes);
+    compressContextDestroy(ctx);
+    ASSERT_GT(frameBytes, 0u);
+
+    SeekTable table;
+    memset(&table, 0, sizeof(table));
+    ASSERT_EQ(ftruncate(fd, 0), 0);
+    for (NvU64 i = 0; i < size / chunkBytes; i++) {
+        ASSERT_EQ(pwrite(fd, &frame[0], frameBytes, i * frameBytes),
+                  (ssize_t)frameBytes);
+        seekTableAppend(&table, frameBytes, chunkBytes);
+    }
+    ASSERT_GT(seekTableWrite(&table, fd, size / chunkBytes * frameBytes), 0u);
+    seekTableFree(&table);
+
+    reader = readerOpen(path, &options);
+    ASSERT_TRUE(reader != NULL);
+    EXPECT_EQ(readerFormat(reader), READER_SEEKABLE);
+    EXPECT_EQ(readerSize(reader), size);
+    ASSERT_EQ(readerRead(reader, size - 100, buf, sizeof(buf)), 0);
+    EXPECT_STREQ(buf, marker);
+    ASSERT_EQ(readerRead(reader, size - chunkBytes - 100, buf, sizeof(buf)), 0);
+    EXPECT_STREQ(buf, marker);
+}
+
+//
+// Compares the original dump_fb path (one call into a MAP_SHARED mapping of
+// the whole output file) against the chunked pipeline, both against a
+// simulated GPU copying at 4 GB/s and both including the final fsync.
+//
+class AcquireBenchmark : public SimTest,
+                         public ::testing::WithParamInterface<NvLength> {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        static const NvLength DUMP_SIZE = 512*1024*1024;
+        void Configure(UvmSimConfig *config);
+        void UseRegions();
+        char path[64];
+        int fd;
+};
+
+void AcquireBenchmark::Configure(UvmSimConfig *config) {
+    config->fbSize = DUMP_SIZE;
+    config->bytesPerSec = 4ull*1024*1024*1024;
+}
+
+// Switches to memory made of 1 MB regions: 40% zero, 20% constant.
+void AcquireBenchmark::UseRegions() {
+    UvmDeinitialize();
+    simConfig.zeroPercent  = 40;
+    simConfig.constPercent = 20;
+    simConfig.regionSize   = 1024*1024;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+}
+
+void AcquireBenchmark::SetUp() {
+    SimTest::SetUp();
+    strcpy(path, "/tmp/dump_fb_bench.XXXXXX");
+    fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ftruncate(fd, DUMP_SIZE), 0);
+}
+
+void AcquireBenchmark::TearDown() {
+    close(fd);
+    unlink(path);
+    SimTest::TearDown();
+}
+
+static void reportBandwidth(const char *name, NvLength bytes, NvU64 ns) {
+    std::cout << name << ": " << ns/1000000.0 << "ms, "
+              << (bytes/(1024.0*1024*1024))/(ns/1000000000.0) << "GB/s\n";
+}
+
+TEST_F(AcquireBenchmark, SingleCall) {
+    NvU64 start = acquireNowNs();
+    void *ptr = mmap(NULL, DUMP_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, DUMP_SIZE), (RM_STATUS)RM_OK);
+    munmap(ptr, DUMP_SIZE);
+    ASSERT_EQ(fsync(fd), 0);
+    reportBandwidth("single call", DUMP_SIZE, acquireNowNs() - start);
+}
+
+TEST_P(AcquireBenchmark, Pipelined) {
+    AcquireParams params;
+    AcquireStats stats;
+    NvU64 start = acquireNowNs();
+
+    acquireParamsInit(&params);
+    params.gpuUuid    = &uvmUuid;
+    params.sizeBytes  = DUMP_SIZE;
+    params.chunkBytes = GetParam();
+    params.outFd      = fd;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    ASSERT_EQ(fsync(fd), 0);
+    std::cout << "chunk " << GetParam() << ", copy " << stats.copyNs/1000000.0
+              << "ms, write " << stats.writeNs/1000000.0 << "ms\n";
+    reportBandwidth("pipelined", DUMP_SIZE, acquireNowNs() - start);
+}
+
+INSTANTIATE_TEST_CASE_P(AcquireBenchmark, AcquireBenchmark,
+        ::testing::Values(1024*1024, 8*1024*1024, 32*1024*1024));
+
+//
+// End-to-end time and bytes on disk for a mostly empty 512 MB framebuffer
+// (85% zero pages, 10% constant, 5% random) copying at 4 GB/s: the original
+// single call into a mapping of the output file against the pipeline writing
+// raw, lz4 and zstd output.
+//
+class CompressBenchmark : public SimTest,
+                          public ::testing::WithParamInterface<const char *> {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        static const NvLength DUMP_SIZE = 512*1024*1024;
+        void Configure(UvmSimConfig *config);
+        void Report(const char *name, NvU64 ns);
+        char path[64];
+        int fd;
+};
+
+const NvLength CompressBenchmark::DUMP_SIZE;
+
+void CompressBenchmark::Configure(UvmSimConfig *config) {
+    config->fbSize = DUMP_SIZE;
+    config->zeroPercent = 85;
+    config->constPercent = 10;
+    config->bytesPerSec = 4ull*1024*1024*1024;
+}
+
+void CompressBenchmark::SetUp() {
+    SimTest::SetUp();
+    strcpy(path, "/tmp/dump_fb_bench.XXXXXX");
+    fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+}
+
+void CompressBenchmark::TearDown() {
+    close(fd);
+    unlink(path);
+    SimTest::TearDown();
+}
+
+void CompressBenchmark::Report(const char *name, NvU64 ns) {
+    struct stat st;
+
+    ASSERT_EQ(fstat(fd, &st), 0);
+    std::cout << name << ": " << ns/1000000.0 << "ms, "
+              << st.st_blocks*512/(1024*1024) << "MB written ("
+              << (double)DUMP_SIZE/(st.st_blocks*512) << "x)\n";
+}
+
+TEST_F(CompressBenchmark, RawMmap) {
+    NvU64 start = acquireNowNs();
+    ASSERT_EQ(ftruncate(fd, DUMP_SIZE), 0);
+    void *ptr = mmap(NULL, DUMP_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT_NE(ptr, MAP_FAILED);
+    ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, DUMP_SIZE), (RM_STATUS)RM_OK);
+    munmap(ptr, DUMP_SIZE);
+    ASSERT_EQ(fsync(fd), 0);
+    Report("raw mmap", acquireNowNs() - start);
+}
+
+TEST_P(CompressBenchmark, Pipelined) {
+    AcquireParams params;
+    AcquireStats stats;
+    NvU64 start = acquireNowNs();
+
+    acquireParamsInit(&params);
+    params.gpuUuid    = &uvmUuid;
+    params.sizeBytes  = DUMP_SIZE;
+    params.depth      = 16;
+    params.outFd      = fd;
+    if (strcmp(GetParam(), "raw"))
+        ASSERT_EQ(compressParseSpec(GetParam(), &params.compression,
+                                    &params.compressLevel), 0);
+    else
+        ASSERT_EQ(ftruncate(fd, DUMP_SIZE), 0);
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    ASSERT_EQ(fsync(fd), 0);
+    Report(GetParam(), acquireNowNs() - start);
+    std::cout << "copy " << stats.copyNs/1000000.0 << "ms, compress "
+              << stats.compressNs/1000000.0 << "ms (all workers), write "
+              << stats.writeNs/1000000.0 << "ms\n";
+}
+
+INSTANTIATE_TEST_CASE_P(CompressBenchmark, CompressBenchmark,
+        ::testing::Values("raw", "lz4", "lz4:9", "zstd:1", "zstd:3",
+                          "zstd:9"));
+
+//
+// Hashing throughput of each implementation over a 256 MB buffer, then the
+// pipeline dumping 512 MB at 4 GB/s with and without hashing.
+//
+class HashBenchmark : public AcquireBenchmark { };
+
+TEST_F(HashBenchmark, Throughput) {
+    const NvLength size = 256*1024*1024;
+    const NvLength chunk = ACQUIRE_DEFAULT_CHUNK_BYTES;
+    NvU8 *buf = (NvU8 *)malloc(size);
+    NvU8 digest[HASH_DIGEST_SIZE];
+    struct {
+        const char *name;
+        HashAlgorithm algorithm;
+        int accelerated;
+    } runs[] = {
+        { "sha256 sha-ni", HASH_SHA256, 1 },
+        { "sha256 scalar", HASH_SHA256, 0 },
+        { "blake3",        HASH_BLAKE3, 1 },
+    };
+
+    UvmSimFill(0, 0, buf, size);
+    for (unsigned int r = 0; r < sizeof(runs)/sizeof(runs[0]); r++) {
+        hashSetSha256Accelerated(runs[r].accelerated);
+        if (runs[r].accelerated && runs[r].algorithm == HASH_SHA256 &&
+            strcmp(hashSha256Implementation(), "sha-ni"))
+            continue;
+
+        NvU64 start = acquireNowNs();
+        for (NvLength off = 0; off < size; off += chunk)
+            hashBuffer(runs[r].algorithm, buf + off, chunk, digest);
+        reportBandwidth(runs[r].name, size, acquireNowNs() - start);
+    }
+    hashSetSha256Accelerated(1);
+    free(buf);
+}
+
+TEST_P(HashBenchmark, Pipelined) {
+    AcquireParams params;
+    AcquireStats stats;
+    MerkleTree merkle;
+    NvU64 start = acquireNowNs();
+
+    acquireParamsInit(&params);
+    params.gpuUuid    = &uvmUuid;
+    params.sizeBytes  = DUMP_SIZE;
+    params.chunkBytes = GetParam();
+    params.depth      = 8;
+    params.outFd      = fd;
+    params.hash       = HASH_SHA256;
+    params.merkle     = &merkle;
+
+    ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+    ASSERT_EQ(fsync(fd), 0);
+    std::cout << "chunk " << GetParam() << ", hash " << stats.hashNs/1000000.0
+              << "ms (all workers), " << merkle.count << " leaves\n";
+    reportBandwidth("pipelined sha256", DUMP_SIZE, acquireNowNs() - start);
+    merkleFree(&merkle);
+}
+
+INSTANTIATE_TEST_CASE_P(HashBenchmark, HashBenchmark,
+        ::testing::Values(1024*1024, 8*1024*1024));
+
+//
+// The zero page scanners over a synthetic 256 MB image (60% zero pages) and
+// an all-zero one, where every byte has to be read.
+//
+TEST_F(AcquireBenchmark, ZeroPageScan) {
+    const NvLength size = 256*1024*1024;
+    NvU8 *image = (NvU8 *)malloc(size);
+    NvU8 *zero = (NvU8 *)calloc(1, size);
+
+    UvmSimFill(0, 0, image, size);
+    memset(zero, 0, size);
+
+    for (unsigned int i = 0; i < 3; i++) {
+        if (zeroPageSetImplementation(zeroScanImpls[i]))
+            continue;
+
+        std::string name = zeroPageImplementation();
+        NvU64 start = acquireNowNs();
+        NvU64 pages = zeroPageScan(image, size, PAGE_SIZE, NULL, 0);
+        reportBandwidth((name + " image").c_str(), size, acquireNowNs() - start);
+
+        start = acquireNowNs();
+        EXPECT_EQ(zeroPageScan(zero, size, PAGE_SIZE, NULL, 0),
+                  size / PAGE_SIZE);
+        reportBandwidth((name + " all zero").c_str(), size,
+                        acquireNowNs() - start);
+        std::cout << 100.0 * pages / (size / PAGE_SIZE) << "% zero pages\n";
+    }
+
+    zeroPageSetImplementation(ZERO_SCAN_AUTO);
+    free(zero);
+    free(image);
+}
+
+//
+// 4 KB against hugepage staging when every physically contiguous copy the
+// driver pushes costs 1 us on top of the 4 GB/s copy engine.
+//
+TEST_F(AcquireBenchmark, StagingPages) {
+    const StagingPages kinds[] = { STAGING_PAGES_4K, STAGING_PAGES_AUTO };
+    NvU64 elapsed[2], copyNs[2], runs[2];
+
+    UvmDeinitialize();
+    simConfig.runNs = 1000;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    for (unsigned int k = 0; k < 2; k++) {
+        AcquireParams params;
+        AcquireStats stats;
+        UvmSimStats before, after;
+        NvU64 start = acquireNowNs();
+
+        acquireParamsInit(&params);
+        params.gpuUuid      = &uvmUuid;
+        params.sizeBytes    = DUMP_SIZE;
+        params.depth        = 4;
+        params.outFd        = fd;
+        params.stagingPages = kinds[k];
+
+        UvmSimGetStats(&before);
+        ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+        elapsed[k] = acquireNowNs() - start;
+        copyNs[k] = stats.copyNs;
+        UvmSimGetStats(&after);
+        runs[k] = after.runs - before.runs;
+
+        reportBandwidth(stagingPagesName(stats.stagingPages), DUMP_SIZE,
+                        elapsed[k]);
+        std::cout << (double)stats.physRuns / stats.chunks
+                  << " physical runs per chunk, " << runs[k]
+                  << " driver copies\n";
+    }
+
+    // Only when the kernel actually handed out hugepages
+    if (runs[1] * 4 < runs[0]) {
+        EXPECT_LT(copyNs[1], copyNs[0]);
+    }
+}
+
+static NvU64 peakRssBytes(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    NvU64 kb = 0;
+
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmHWM: %llu kB", &kb) == 1)
+            break;
+    }
+    if (f)
+        fclose(f);
+    return kb * 1024;
+}
+
+static void resetPeakRss(void) {
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+
+    if (f) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+struct DirtySampler {
+    volatile bool stop;
+    NvU64         base;
+    NvU64         peak;
+};
+
+static NvU64 dirtyBytes(void) {
+    FILE *f = fopen("/proc/meminfo", "r");
+    char line[256];
+    NvU64 kb = 0;
+
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Dirty: %llu kB", &kb) == 1)
+            break;
+    }
+    if (f)
+        fclose(f);
+    return kb * 1024;
+}
+
+static void *SampleDirty(void *arg) {
+    DirtySampler *sampler = (DirtySampler *)arg;
+
+    while (!sampler->stop) {
+        NvU64 dirty = dirtyBytes();
+        if (dirty > sampler->base)
+            sampler->peak = std::max(sampler->peak, dirty - sampler->base);
+        usleep(1000);
+    }
+    return NULL;
+}
+
+//
+// The whole dump through a shared mapping, through the page cache with
+// pwrite, and with O_DIRECT writes through io_uring and the thread pool,
+// each including the fsync.  Reports the throughput and how far the
+// system's dirty pages rose above where they started.
+//
+TEST_F(AcquireBenchmark, DirectIo) {
+    const char *names[] = { "mmap", "pwrite", "O_DIRECT uring",
+                            "O_DIRECT threads" };
+
+    for (unsigned int k = 0; k < 4; k++) {
+        DirtySampler sampler = { false, 0, 0 };
+        AcquireParams params;
+        AcquireStats stats;
+        pthread_t thread;
+        NvU64 start;
+
+        ASSERT_EQ(ftruncate(fd, 0), 0);
+        ASSERT_EQ(ftruncate(fd, DUMP_SIZE), 0);
+        sync();
+        sampler.base = dirtyBytes();
+        ASSERT_EQ(pthread_create(&thread, NULL, SampleDirty, &sampler), 0);
+
+        start = acquireNowNs();
+        if (k == 0) {
+            void *ptr = mmap(NULL, DUMP_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED,
+                             fd, 0);
+            ASSERT_NE(ptr, MAP_FAILED);
+            ASSERT_EQ(UvmDumpGpuMemory(&uvmUuid, ptr, 0, DUMP_SIZE),
+                      (RM_STATUS)RM_OK);
+            munmap(ptr, DUMP_SIZE);
+        } else {
+            acquireParamsInit(&params);
+            params.gpuUuid  = &uvmUuid;
+            params.sizeBytes = DUMP_SIZE;
+            params.depth    = 8;
+            params.outFd    = fd;
+            params.directIo = k > 1;
+            params.ioEngine = k == 2 ? DISK_WRITER_AUTO : DISK_WRITER_THREADS;
+            ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+        }
+        ASSERT_EQ(fsync(fd), 0);
+
+        sampler.stop = true;
+        pthread_join(thread, NULL);
+        reportBandwidth(names[k], DUMP_SIZE, acquireNowNs() - start);
+        std::cout << "dirty pages peaked " << sampler.peak / (1024*1024)
+                  << " MB above the start\n";
+    }
+}
+
+//
+// Streams a 4 GB dump into a pipe, spliced and copied, and checks that the
+// process never holds much more than the staging ring.
+//
+//
+// The same dump into segments spread over 1, 2 and 4 target directories,
+// each written by its own thread.  The targets are directories on tmpfs
+// (or /tmp without it); mount separate drives or loop devices there to
+// see the scaling of real disks.
+//
+TEST_F(AcquireBenchmark, SegmentTargets) {
+    const char *root = access("/dev/shm", W_OK) ? "/tmp" : "/dev/shm";
+
+    for (unsigned int targets = 1; targets <= 4; targets *= 2) {
+        std::string dir = std::string(root) + "/dump_fb_bench.XXXXXX";
+        std::vector<char *> dirs(targets);
+        SegmentSet segments;
+        AcquireParams params;
+        char name[32];
+
+        ASSERT_NE(mkdtemp(&dir[0]), (char *)NULL);
+        for (unsigned int t = 0; t < targets; t++) {
+            dirs[t] = nvasprintf("%s/%u", dir.c_str(), t);
+            ASSERT_EQ(mkdir(dirs[t], 0755), 0);
+        }
+
+        NvU64 start = acquireNowNs();
+        ASSERT_EQ(segmentSetCreate(&segments, "dump", &dirs[0], targets,
+                                   64*1024*1024, DUMP_SIZE), 0);
+        acquireParamsInit(&params);
+        params.gpuUuid   = &uvmUuid;
+        params.sizeBytes = DUMP_SIZE;
+        params.depth     = 4 * targets;
+        params.outFd     = -1;
+        params.segments  = &segments;
+        ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_OK);
+        ASSERT_EQ(segmentSetSync(&segments), 0);
+        snprintf(name, sizeof(name), "%u targets", targets);
+        reportBandwidth(name, DUMP_SIZE, acquireNowNs() - start);
+
+        segmentSetClose(&segments);
+        for (unsigned int t = 0; t < targets; t++)
+            nvfree(dirs[t]);
+        nftw(dir.c_str(), RemoveEntry, 8, FTW_DEPTH | FTW_PHYS);
+    }
+}
+
+TEST_F(AcquireBenchmark, StreamToPipe) {
+    const NvLength size = 4ull*1024*1024*1024;
+    const NvLength chunk = 8*1024*1024;
+    const unsigned int depth = 4;
+
+    UvmDeinitialize();
+    simConfig.fbSize      = size;
+    simConfig.bytesPerSec = 0;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    for (int splice = 0; splice < 2; splice++) {
+        PipeReader reader = { -1, 0, false, std::string(), 0 };
+        AcquireParams params;
+        AcquireStats stats;
+        pthread_t thread;
+        NvU64 start, before;
+        int fds[2];
+
+        ASSERT_EQ(pipe(fds), 0);
+        reader.fd = fds[0];
+        ASSERT_EQ(pthread_create(&thread, NULL, ReadPipe, &reader), 0);
+
+        acquireParamsInit(&params);
+        params.gpuUuid    = &uvmUuid;
+        params.sizeBytes  = size;
+        params.chunkBytes = chunk;
+        params.depth      = depth;
+        params.outFd      = fds[1];
+        params.stream     = 1;
+        params.splice     = splice;
+
+        resetPeakRss();
+        before = peakRssBytes();
+        start  = acquireNowNs();
+        EXPECT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+        close(fds[1]);
+        pthread_join(thread, NULL);
+        close(fds[0]);
+
+        reportBandwidth(splice ? "vmsplice" : "write", size,
+                        acquireNowNs() - start);
+        std::cout << "peak RSS grew by "
+                  << (peakRssBytes() - before) / (1024*1024) << " MB\n";
+        EXPECT_EQ(reader.bytes, size);
+        EXPECT_LT(peakRssBytes() - before, depth * chunk + 64*1024*1024);
+    }
+}
+
+//
+// End to end, sparse against writing every byte, including the fsync.  Zero
+// and data pages come in 2 MB regions, as in a real framebuffer.
+//
+TEST_F(AcquireBenchmark, Sparse) {
+    AcquireParams params;
+    AcquireStats stats;
+    struct stat st;
+
+    UvmDeinitialize();
+    simConfig.regionSize = 2*1024*1024;
+    UvmSimEnable(&simConfig);
+    ASSERT_EQ(UvmInitialize(), RM_OK);
+
+    for (int sparse = 0; sparse < 2; sparse++) {
+        ASSERT_EQ(ftruncate(fd, 0), 0);
+        ASSERT_EQ(ftruncate(fd, DUMP_SIZE), 0);
+
+        NvU64 start = acquireNowNs();
+        acquireParamsInit(&params);
+        params.gpuUuid   = &uvmUuid;
+        params.sizeBytes = DUMP_SIZE;
+        params.outFd     = fd;
+        params.sparse    = sparse;
+
+        ASSERT_EQ(acquireRange(&params, &stats), (RM_STATUS)RM_OK);
+        ASSERT_EQ(fsync(fd), 0);
+        NvU64 ns = acquireNowNs() - start;
+
+        ASSERT_EQ(fstat(fd, &st), 0);
+        std::cout << (sparse ? "sparse" : "dense") << ": " << ns/1000000.0
+                  << "ms, " << stats.bytesStored/(1024*1024) << "MB written, "
+                  << st.st_blocks*512/(1024*1024) << "MB allocated, "
+                  << stats.zeroPages << " zero pages skipped\n";
+    }
+}
+
+//
+// Latency of random 4K reads from a 512 MB dump made of 1 MB regions (40%
+// zero, 20% constant) kept as a raw file and as images with various chunk
+// sizes and compression.  The raw file is read with pread and the images with
+// imageRead, which has to decode a whole chunk for every compressed read.
+//
+TEST_F(AcquireBenchmark, ImageRandomRead) {
+    static const struct {
+        const char *name;
+        NvLength    chunkBytes;   // 0 for the raw file
+        const char *compress;
+    } formats[] = {
+        { "raw file",        0,                NULL   },
+        { "image",           8*1024*1024,      NULL   },
+        { "image lz4 8M",    8*1024*1024,      "lz4"  },
+        { "image lz4 1M",    1024*1024,        "lz4"  },
+        { "image lz4 256K",  256*1024,         "lz4"  },
+        { "image zstd 1M",   1024*1024,        "zstd" },
+    };
+    const unsigned int reads = 2000;
+    std::vector<NvU64> offsets(reads);
+    char buf[PAGE_SIZE];
+    NvU64 seed = 1;
+
+    UseRegions();
+
+    for (unsigned int i = 0; i < reads; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        offsets[i] = (seed >> 33) % (DUMP_SIZE / PAGE_SIZE) * PAGE_SIZE;
+    }
+
+    for (unsigned int f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        AcquireParams params;
+        ImageIndex index;
+        ImageFile image;
+        struct stat st;
+
+        memset(&index, 0, sizeof(index));
+        acquireParamsInit(&params);
+        params.gpuUuid   = &uvmUuid;
+        params.sizeBytes = DUMP_SIZE;
+        params.outFd     = fd;
+
+        ASSERT_EQ(ftruncate(fd, 0), 0);
+        if (formats[f].chunkBytes) {
+            ImageHeader header;
+
+            params.chunkBytes = formats[f].chunkBytes;
+            params.outOffset  = IMAGE_HEADER_SIZE;
+            params.image      = &index;
+            if (formats[f].compress) {
+                ASSERT_EQ(compressParseSpec(formats[f].compress,
+                                            &params.compression,
+                                            &params.compressLevel), 0);
+            }
+            imageHeaderInit(&header, 0, DUMP_SIZE, params.chunkBytes,
+                            params.compression, params.compressLevel);
+            ASSERT_EQ(imageHeaderWrite(&header, fd), 0);
+        } else {
+            ASSERT_EQ(ftruncate(fd, DUMP_SIZE), 0);
+        }
+        ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_OK);
+        imageIndexFree(&index);
+
+        if (formats[f].chunkBytes) {
+            ASSERT_EQ(imageOpenFd(fd, &image), 0);
+        }
+
+        NvU64 start = acquireNowNs();
+        for (unsigned int i = 0; i < reads; i++) {
+            if (formats[f].chunkBytes) {
+                ASSERT_EQ(imageRead(&image, offsets[i], PAGE_SIZE, buf), 0);
+            } else {
+                ASSERT_EQ(pread(fd, buf, PAGE_SIZE, offsets[i]),
+                          (ssize_t)PAGE_SIZE);
+            }
+        }
+        NvU64 ns = acquireNowNs() - start;
+
+        if (formats[f].chunkBytes)
+            imageClose(&image);
+        ASSERT_EQ(fstat(fd, &st), 0);
+        std::cout << formats[f].name << ": " << ns / 1000.0 / reads
+                  << "us per 4K read, " << st.st_blocks*512/(1024*1024)
+                  << "MB on disk\n";
+    }
+}
+
+//
+// Sequential and random reads through a DumpReader of the same 512 MB (1 MB
+// regions, 40% zero, 20% constant) stored raw, as a seekable zstd stream and
+// as an lz4 image, both in 1 MB chunks.  Sequential reads go 1 MB at a time
+// with and without read-ahead; random 4K reads go through a 64 MB cache, an
+// eighth of the dump.
+//
+TEST_F(AcquireBenchmark, ReaderAccess) {
+    static const struct {
+        const char       *name;
+        CompressAlgorithm compression;
+        int               image;
+    } formats[] = {
+        { "raw",           COMPRESS_NONE, 0 },
+        { "seekable zstd", COMPRESS_ZSTD, 0 },
+        { "image lz4",     COMPRESS_LZ4,  1 },
+    };
+    const unsigned int reads = 20000;
+    std::vector<char> buf(1024*1024);
+    ReaderOptions options;
+    ReaderStats stats;
+
+    UseRegions();
+
+    for (unsigned int f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        AcquireParams params;
+        ImageIndex index;
+        DumpReader *reader;
+
+        memset(&index, 0, sizeof(index));
+        acquireParamsInit(&params);
+        params.gpuUuid     = &uvmUuid;
+        params.sizeBytes   = DUMP_SIZE;
+        params.chunkBytes  = 1024*1024;
+        params.outFd       = fd;
+        params.compression = formats[f].compression;
+
+        ASSERT_EQ(ftruncate(fd, 0), 0);
+        if (formats[f].image) {
+            ImageHeader header;
+
+            params.outOffset = IMAGE_HEADER_SIZE;
+            params.image     = &index;
+            imageHeaderInit(&header, 0, DUMP_SIZE, params.chunkBytes,
+                            params.compression, 0);
+            ASSERT_EQ(imageHeaderWrite(&header, fd), 0);
+        }
+        ASSERT_EQ(acquireRange(&params, NULL), (RM_STATUS)RM_OK);
+        imageIndexFree(&index);
+
+        for (unsigned int readAhead = 0; readAhead <= 4; readAhead += 4) {
+            readerOptionsInit(&options);
+            options.readAhead = readAhead;
+            reader = readerOpen(path, &options);
+            ASSERT_TRUE(reader != NULL);
+
+            NvU64 start = acquireNowNs();
+            for (NvU64 off = 0; off < DUMP_SIZE; off += buf.size())
+                ASSERT_EQ(readerRead(reader, off, &buf[0], buf.size()), 0);
+            NvU64 ns = acquireNowNs() - start;
+
+            std::string name = std::string(formats[f].name) +
+                               ", sequential, read-ahead " +
+                               std::to_string(readAhead);
+            reportBandwidth(name.c_str(), DUMP_SIZE, ns);
+            readerClose(reader);
+        }
+
+        readerOptionsInit(&options);
+        options.cacheBytes = 64*1024*1024;
+        options.readAhead  = 0;
+        reader = readerOpen(path, &options);
+        ASSERT_TRUE(reader != NULL);
+
+        NvU64 seed = 1;
+        NvU64 start = acquireNowNs();
+        for (unsigned int i = 0; i < reads; i++) {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            NvU64 off = (seed >> 33) % (DUMP_SIZE / PAGE_SIZE) * PAGE_SIZE;
+            ASSERT_EQ(readerRead(reader, off, &buf[0], PAGE_SIZE), 0);
+        }
+        NvU64 ns = acquireNowNs() - start;
+
+        readerGetStats(reader, &stats);
+        std::cout << formats[f].name << ", random 4K: " << ns / 1000.0 / reads
+                  << "us per read, " << stats.hits << " hits, "
+                  << stats.misses << " misses\n";
+        readerClose(reader);
+    }
+}
+
+//
+// Four simulated GPUs, each with its own 1 GB/s copy engine.  Dumping them in
+// parallel should take about as long as dumping one.
+//
+class MultiGpuTest : public SimTest {
+    public:
+        void SetUp();
+        void TearDown();
+    protected:
+        static const unsigned int NUM_GPUS = 4;
+        static const NvLength DUMP_SIZE = 64*1024*1024;
+        void Configure(UvmSimConfig *config);
+        void Prepare(unsigned int count);
+
+        char paths[NUM_GPUS][64];
+        UvmGpuUuid uuids[NUM_GPUS];
+        AcquireParams params[NUM_GPUS];
+};
+
+const unsigned int MultiGpuTest::NUM_GPUS;
+const NvLength MultiGpuTest::DUMP_SIZE;
+
+void MultiGpuTest::Configure(UvmSimConfig *config) {
+    config->numGpus = NUM_GPUS;
+    config->fbSize = DUMP_SIZE;
+    config->bytesPerSec = 1024ull*1024*1024;
+}
+
+void MultiGpuTest::SetUp() {
+    SimTest::SetUp();
+    for (unsigned int i = 0; i < NUM_GPUS; i++) {
+        strcpy(paths[i], "/tmp/dump_fb_multi.XXXXXX");
+        int fd = mkstemp(paths[i]);
+        ASSERT_GE(fd, 0);
+
+        UvmSimGetGpuUuid(i, &uuids[i]);
+        acquireParamsInit(&params[i]);
+        params[i].gpuUuid   = &uuids[i];
+        params[i].sizeBytes = DUMP_SIZE;
+        params[i].outFd     = fd;
+    }
+}
+
+void MultiGpuTest::TearDown() {
+    for (unsigned int i = 0; i < NUM_GPUS; i++) {
+        close(params[i].outFd);
+        unlink(paths[i]);
+    }
+    SimTest::TearDown();
+}
+
+TEST_F(MultiGpuTest, ParallelMatchesSource) {
+    AcquireStats stats[NUM_GPUS];
+    RM_STATUS statuses[NUM_GPUS];
+
+    ASSERT_EQ(acquireParallel(params, NUM_GPUS, stats, statuses, 0),
+            (RM_STATUS)RM_OK);
+
+    for (unsigned int i = 0; i < NUM_GPUS; i++) {
+        EXPECT_EQ(statuses[i], (RM_STATUS)RM_OK);
+        EXPECT_EQ(stats[i].bytesWritten, DUMP_SIZE);
+        EXPECT_EQ(params[i].progress, (NvLength *)NULL);
+
+        void *ptr = mmap(NULL, DUMP_SIZE, PROT_READ, MAP_SHARED,
+                params[i].outFd, 0);
+        ASSERT_NE(ptr, MAP_FAILED);
+        EXPECT_TRUE(MatchesSim(ptr, 0, DUMP_SIZE, i));
+        munmap(ptr, DUMP_SIZE);
+    }
+}
+
+TEST_F(MultiGpuTest, OneGpuFails) {
+    RM_STATUS statuses[NUM_GPUS];
+    UvmGpuUuid bogus;
+    NvLength progress = 0;
+
+    memset(&bogus, 0, sizeof(bogus));
+    params[2].gpuUuid  = &bogus;
+    params[1].progress = &progress;
+
+    EXPECT_EQ(acquireParallel(params, NUM_GPUS, NULL, statuses, 0),
+            (RM_STATUS)RM_ERROR);
+    EXPECT_EQ(statuses[0], (RM_STATUS)RM_OK);
+    EXPECT_EQ(statuses[2], (RM_STATUS)RM_ERROR);
+    EXPECT_EQ(progress, DUMP_SIZE);
+}
+
+TEST_F(MultiGpuTest, ParallelVsSequential) {
+    NvU64 start, sequential, parallel;
+
+    start = acquireNowNs();
+    for (unsigned int i = 0; i < NUM_GPUS; i++)
+        ASSERT_EQ(acquireRange(&params[i], NULL), (RM_STATUS)RM_OK);
+    sequential = acquireNowNs() - start;
+
+    start = acquireNowNs();
+    ASSERT_EQ(acquireParallel(params, NUM_GPUS, NULL, NULL, 0),
+            (RM_STATUS)RM_OK);
+    parallel = acquireNowNs() - start;
+
+    std::cout << NUM_GPUS << " GPUs sequential: " << sequential/1000000.0
+              << "ms, parallel: " << parallel/1000000.0 << "ms\n";
+
+    // Each GPU needs 62.5 ms at 1 GB/s; allow generous slack for slow disks.
+    EXPECT_LT(parallel, sequential * 3 / 4);
+}
+
+//
+// The kernel dump loop, run through dump_model.c with mocked pinning and
+// pushbuffers.  CheckCopy follows the copies as they are pushed and checks
+// that together they cover every page of the buffer once, in order, each at
+// the physical address the page was pinned to.  CountUnpin counts how often
+// each page is unpinned and whether that happened before its copy was done.
+//
+class DumpModelTest : public ::testing::Test {
+    public:
+        void SetUp();
+    protected:
+        static void CheckCopy(void *ctx, unsigned long long gpuAddress,
+                              NvU64 physAddress, NvLength bytes);
+        static void CountUnpin(void *ctx, NvU64 bufferOffset, NvLength bytes,
+                               int copiesDone);
+        RM_STATUS Run(unsigned long long gpuAddress, NvLength sizeBytes);
+
+        DumpModelConfig config;
+        DumpModelStats stats;
+        unsigned long long base;
+        unsigned long long next;
+        bool copiesMatch;
+        std::vector<int> unpins;
+        bool unpinnedEarly;
+};
+
+void DumpModelTest::SetUp() {
+    dumpModelConfigInit(&config);
+    config.onCopy  = CheckCopy;
+    config.onUnpin = CountUnpin;
+    config.ctx     = this;
+}
+
+void DumpModelTest::CountUnpin(void *ctx, NvU64 bufferOffset, NvLength bytes,
+                               int copiesDone) {
+    DumpModelTest *test = (DumpModelTest *)ctx;
+
+    for (NvU64 page = bufferOffset / PAGE_SIZE;
+         page < (bufferOffset + bytes) / PAGE_SIZE; page++) {
+        if (page >= test->unpins.size())
+            test->unpins.resize(page + 1);
+        test->unpins[page]++;
+    }
+    if (!copiesDone)
+        test->unpinnedEarly = true;
+}
+
+void DumpModelTest::CheckCopy(void *ctx, unsigned long long gpuAddress,
+                              NvU64 physAddress, NvLength bytes) {
+    DumpModelTest *test = (DumpModelTest *)ctx;
+
+    if (gpuAddress != test->next || bytes == 0 || bytes % PAGE_SIZE)
+        test->copiesMatch = false;
+    for (NvLength off = 0; off < bytes; off += PAGE_SIZE) {
+        if (dumpModelPhysAddress(&test->config, gpuAddress - test->base + off)
+                != physAddress + off)
+            test->copiesMatch = false;
+    }
+    test->next = gpuAddress + bytes;
+}
+
+RM_STATUS DumpModelTest::Run(unsigned long long gpuAddress,
+                             NvLength sizeBytes) {
+    base          = gpuAddress;
+    next          = gpuAddress;
+    copiesMatch   = true;
+    unpinnedEarly = false;
+    unpins.clear();
+    return dumpModelRun(&config, gpuAddress, sizeBytes, &stats);
+}
+
+TEST_F(DumpModelTest, CopiesEveryPageOnce) {
+    const NvLength runs[] = { PAGE_SIZE, 3*PAGE_SIZE, 64*1024,
+                              2*1024*1024 };
+    const NvLength size = 8*1024*1024 + 3*PAGE_SIZE;
+
+    for (unsigned int r = 0; r < 4; r++) {
+        for (int coalesce = 0; coalesce < 2; coalesce++) {
+            SCOPED_TRACE(runs[r] * 2 + coalesce);
+            config.contiguousBytes = runs[r];
+            config.coalesce        = coalesce;
+            ASSERT_EQ(Run(0x10000, size), (RM_STATUS)RM_OK);
+            EXPECT_TRUE(copiesMatch);
+            EXPECT_EQ(next, 0x10000 + size);
+            EXPECT_EQ(stats.pinnedPages, size / PAGE_SIZE);
+        }
+    }
+}
+
+TEST_F(DumpModelTest, LaunchCounts) {
+    const NvLength size = 16*1024*1024;
+    const NvU64 blocks = size / config.blockBytes;
+
+    // Scattered pages need one copy each, coalesced or not.
+    ASSERT_EQ(Run(0, size), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.launches, size / PAGE_SIZE);
+    EXPECT_EQ(stats.maxLaunchBytes, (NvLength)PAGE_SIZE);
+    EXPECT_EQ(stats.pushbuffers, blocks);
+
+    // 64 KB runs: two copies per 128 KB block.
+    config.contiguousBytes = 64*1024;
+    ASSERT_EQ(Run(0, size), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.launches, 2 * blocks);
+
+    // Hugepages: a run never ends inside a block, so one copy per block.
+    config.contiguousBytes = 2*1024*1024;
+    ASSERT_EQ(Run(0, size), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.launches, blocks);
+    EXPECT_EQ(stats.maxLaunchBytes, config.blockBytes);
+
+    config.coalesce = 0;
+    ASSERT_EQ(Run(0, size), (RM_STATUS)RM_OK);
+    EXPECT_EQ(stats.launches, size / PAGE_SIZE);
+}
+
+// A block that needs more copies than a pushbuffer holds is split.
+TEST_F(DumpModelTest, FullPushbuffer) {
+    config.pushbufferBytes = 5 * config.launchBytes;
+    ASSERT_EQ(Run(0, 1024*1024), (RM_STATUS)RM_OK);
+    EXPECT_TRUE(copiesMatch);
+    EXPECT_EQ(stats.launches, 256u);
+    EXPECT_EQ(stats.pushbuffers, 8u * 7);   // 32 copies: 5+5+5+5+5+5+2
+
+    config.pushbufferBytes = config.launchBytes - 1;
+    EXPECT_EQ(Run(0, 1024*1024), (RM_STATUS)RM_ERROR);
+
+    EXPECT_EQ(Run(0x800, PAGE_SIZE), (RM_STATUS)RM_ERR_INVALID_ARGUMENT);
+}
+
+// However many blocks are in flight, and however the dump ends.
+TEST_F(DumpModelTest, UnpinsEveryPageOnce) {
+    const NvLength size = 4*1024*1024 + 5*PAGE_SIZE;
+    const NvU64 pages = size / PAGE_SIZE;
+
+    for (unsigned int depth = 1; depth <= DUMP_MODEL_MAX_DEPTH; depth++) {
+        SCOPED_TRACE(depth);
+        config.depth = depth;
+        ASSERT_EQ(Run(0, size), (RM_STATUS)RM_OK);
+        EXPECT_TRUE(copiesMatch);
+        EXPECT_FALSE(unpinnedEarly);
+        ASSERT_EQ(unpins.size(), pages);
+        EXPECT_EQ(std::count(unpins.begin(), unpins.end(), 1), (long)pages);
+        EXPECT_EQ(stats.unpinnedPages, pages);
+
+        // A failed submission leaves earlier blocks in flight; they are
+        // still waited for, and the failed block is unpinned too.
+        config.failSubmit = 5;
+        ASSERT_EQ(Run(0, size), (RM_STATUS)RM_ERROR);
+        EXPECT_FALSE(unpinnedEarly);
+        EXPECT_EQ(unpins.size(), 5 * config.blockBytes / PAGE_SIZE);
+        EXPECT_EQ(std::count(unpins.begin(), unpins.end(), 1),
+                  (long)unpins.size());
+        EXPECT_EQ(stats.unpinnedPages, stats.pinnedPages);
+        config.failSubmit = 0;
+    }
+
+    // A pushbuffer that fills mid block is waited for before it moves on.
+    config.pushbufferBytes = 5 * config.launchBytes;
+    ASSERT_EQ(Run(0, size), (RM_STATUS)RM_OK);
+    EXPECT_FALSE(unpinnedEarly);
+    EXPECT_EQ(std::count(unpins.begin(), unpins.end(), 1), (long)pages);
+}
+
+// Keeping a second block in flight hides the pinning behind the copies.
+TEST_F(DumpModelTest, Overlap) {
+    DumpModelStats sequential;
+
+    config.contiguousBytes = 2*1024*1024;
+    config.depth = 1;
+    ASSERT_EQ(Run(0, 64*1024*1024), (RM_STATUS)RM_OK);
+    sequential = stats;
+    config.depth = 2;
+    ASSERT_EQ(Run(0, 64*1024*1024), (RM_STATUS)RM_OK);
+
+    EXPECT_EQ(stats.launches, sequential.launches);
+    EXPECT_LT(stats.modelNs, sequential.modelNs * 3 / 4);
+}
+
+//
+// Copy engine launches and modelled bandwidth of a 16 GB dump into scattered,
+// 64 KB and hugepage backed buffers, with and without coalescing.
+//
+TEST(DumpModelBenchmark, Coalescing) {
+    const NvLength size = 16ull*1024*1024*1024;
+    const NvLength runs[] = { PAGE_SIZE, 64*1024, 2*1024*1024 };
+    DumpModelConfig config;
+    DumpModelStats stats;
+
+    dumpModelConfigInit(&config);
+    for (unsigned int r = 0; r < 3; r++) {
+        for (int coalesce = 0; coalesce < 2; coalesce++) {
+            config.contiguousBytes = runs[r];
+            config.coalesce        = coalesce;
+            ASSERT_EQ(dumpModelRun(&config, 0, size, &stats),
+                      (RM_STATUS)RM_OK);
+            std::cout << runs[r] / 1024 << "K runs, "
+                      << (coalesce ? "coalesced" : "per page") << ": "
+                      << stats.launches << " launches, "
+                      << (size / (1024.0*1024*1024)) /
+                         (stats.modelNs / 1000000000.0) << "GB/s\n";
+        }
+    }
+}
+
+//
+// Modelled bandwidth of a 16 GB dump with 1 to 4 blocks in flight, into
+// scattered and hugepage backed buffers.
+//
+TEST(DumpModelBenchmark, Depth) {
+    const NvLength size = 16ull*1024*1024*1024;
+    const NvLength runs[] = { PAGE_SIZE, 2*1024*1024 };
+    DumpModelConfig config;
+    DumpModelStats stats;
+
+    dumpModelConfigInit(&config);
+    for (unsigned int r = 0; r < 2; r++) {
+        for (unsigned int depth = 1; depth <= 4; depth *= 2) {
+            config.contiguousBytes = runs[r];
+            config.depth           = depth;
+            ASSERT_EQ(dumpModelRun(&config, 0, size, &stats),
+                      (RM_STATUS)RM_OK);
+            std::cout << runs[r] / 1024 << "K runs, depth " << depth << ": "
+                      << (size / (1024.0*1024*1024)) /
+                         (stats.modelNs / 1000000000.0) << "GB/s\n";
+        }
+    }
+}
+
+//
+// GB/s of the modelled copy loop for each block size a dump can ask for,
+// with contiguous and with scattered staging buffer pages.
+//
+TEST(DumpModelBenchmark, BlockSize) {
+    const NvLength size = 16ull*1024*1024*1024;
+    const NvLength runs[] = { PAGE_SIZE, 2*1024*1024 };
+    DumpModelConfig config;
+    DumpModelStats stats;
+
+    dumpModelConfigInit(&config);
+    for (unsigned int r = 0; r < 2; r++) {
+        for (NvLength block = 16*1024; block <= 16*1024*1024; block *= 4) {
+            config.contiguousBytes = runs[r];
+            config.blockBytes      = block;
+            ASSERT_EQ(dumpModelRun(&config, 0, size, &stats),
+                      (RM_STATUS)RM_OK);
+            std::cout << runs[r] / 1024 << "K runs, " << block / 1024
+                      << "K blocks: "
+                      << (size / (1024.0*1024*1024)) /
+                         (stats.modelNs / 1000000000.0) << "GB/s\n";
+        }
+    }
+}
+
+static const NVGetoptOption __options[] = {
+
+    { "help",
+      'h',
+      NVGETOPT_HELP_ALWAYS,
+      NULL,
+      "Print usage information for the command line options and exit." },
+
+    { "gpu",
+      'g',
+      NVGETOPT_STRING_ARGUMENT | NVGETOPT_HELP_ALWAYS,
+      "GPU-UUID",
+      "The GPU UUID to extract data from.  To get the available UUIDs "
+      "use nvidia-smi -L (note don't include the \"GPU-\" prefix"
+    },
+
+    { NULL, 0, 0, NULL, NULL },
+};
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+
+    while (1)  {
+        int c, intval;
+        char *strval  = NULL;
+
+        c = nvgetopt(argc,
+                     argv,
+                     __options,
+                     &strval, /* strval */
+                     NULL, /* boolval */
+                     &intval,
+                     NULL, /* doubleval */
+                     NULL); /* disable */
+
+        if (c == -1) break;
+
+        switch (c)  {
+            case 'g':
+                uuid = strval;
+                break;
+            default:
+                nv_error_msg("Invalid commandline, please run `%s --help` "
+                             "for usage information.\n", argv[0]);
+                return -1;
+        }
+    }
+
+    //
+    // Without a GPU only the tests that run against the simulated backend are
+    // run.
+    //
+    if (!uuid) {
+        std::string filter = ::testing::GTEST_FLAG(filter);
+        nv_info_msg(NULL, "No UUID given with -g; skipping tests that need a GPU.");
+        filter += (filter.find('-') == std::string::npos) ? "-" : ":";
+        filter += "DumpFbTest.*:PerformanceTest/*";
+        ::testing::GTEST_FLAG(filter) = filter;
+    } else if (getuid() != 0 && geteuid() != 0 ) {
       nv_error_msg("Must be run with root privileges.  Try sudo ./dump_fb_test <args> instead.\n");
       return -1;
     }
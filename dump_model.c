@@ -0,0 +1,283 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "dump_model.h"
+#include "common-utils.h"
+#include <string.h>
+
+#define PAGE_SIZE DUMP_MODEL_PAGE_SIZE
+
+// Where mock physical runs are placed from, going down.
+#define MODEL_PHYS_TOP 0x4000000000ull
+
+typedef struct
+{
+    const DumpModelConfig *config;
+    DumpModelStats        *stats;
+    NvU64                  nowNs;      // CPU side of the modelled clock
+    NvU64                  gpuFreeNs;  // when the copy engine goes idle
+    NvU64                  submits;
+} DumpModel;
+
+typedef struct
+{
+    NvLength used;                     // bytes of methods pushed
+    NvU64    gpuNs;                    // copy engine time of its copies
+} ModelPushbuffer;
+
+typedef struct
+{
+    NvU64    doneNs;
+} ModelTracker;
+
+// UvmDumpBlock
+typedef struct
+{
+    NvU64       *pages;
+    int          pinnedPages;
+    NvU64        bufferOffset;
+    NvBool       submitted;
+    ModelTracker tracker;
+} ModelBlock;
+
+void dumpModelConfigInit(DumpModelConfig *config)
+{
+    // Rough figures for a PCIe 3 GPU of the 343.13 era.
+    memset(config, 0, sizeof(*config));
+    config->blockBytes      = 128 * 1024;
+    config->pushbufferBytes = 64 * 4096;
+    config->launchBytes     = 64;
+    config->contiguousBytes = PAGE_SIZE;
+    config->coalesce        = 1;
+    config->depth           = 2;
+    config->pinNsPerPage    = 100;
+    config->unpinNsPerPage  = 50;
+    config->submitNs        = 2000;
+    config->launchNs        = 1000;
+    config->bytesPerSec     = 10ull * 1000 * 1000 * 1000;
+}
+
+NvU64 dumpModelPhysAddress(const DumpModelConfig *config, NvU64 bufferOffset)
+{
+    NvLength runBytes = NV_MAX(config->contiguousBytes, PAGE_SIZE);
+    NvU64 run = bufferOffset / runBytes;
+
+    // Runs go down from the top with a gap, so no two are adjacent.
+    return MODEL_PHYS_TOP - (run + 1) * 2 * runBytes +
+           bufferOffset % runBytes / PAGE_SIZE * PAGE_SIZE;
+}
+
+// _uvm_pin_user_pages: returns the number of pages pinned.
+static int modelPinUserPages(DumpModel *model, NvU64 bufferOffset,
+                             NvLength bytes, NvU64 **pages)
+{
+    NvU64 first = bufferOffset / PAGE_SIZE;
+    NvU64 last  = (bufferOffset + bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    int totalPages = last - first;
+    NvU64 *tempPages = nvalloc(totalPages * sizeof(NvU64));
+    int i;
+
+    for (i = 0; i < totalPages; i++)
+        tempPages[i] = dumpModelPhysAddress(model->config,
+                                            (first + i) * PAGE_SIZE);
+
+    model->nowNs += totalPages * model->config->pinNsPerPage;
+    model->stats->pinnedPages += totalPages;
+
+    *pages = tempPages;
+    return totalPages;
+}
+
+static void modelUnpinUserPages(DumpModel *model, ModelBlock *block,
+                                int copiesDone)
+{
+    const DumpModelConfig *config = model->config;
+
+    model->nowNs += block->pinnedPages * config->unpinNsPerPage;
+    model->stats->unpinnedPages += block->pinnedPages;
+    if (config->onUnpin)
+        config->onUnpin(config->ctx, block->bufferOffset,
+                        (NvLength)block->pinnedPages * PAGE_SIZE, copiesDone);
+
+    nvfree(block->pages);
+}
+
+static RM_STATUS modelGetPushbuffer(DumpModel *model, ModelPushbuffer *pb)
+{
+    memset(pb, 0, sizeof(*pb));
+    return RM_OK;
+}
+
+// UVM_PUSH_METHOD of ceOps.launchDma: fails when the pushbuffer is full.
+static NvBool modelPushLaunchDma(DumpModel *model, ModelPushbuffer *pb,
+                                 unsigned long long gpuAddress,
+                                 NvU64 physAddress, NvLength bytes)
+{
+    const DumpModelConfig *config = model->config;
+
+    if (pb->used + config->launchBytes > config->pushbufferBytes)
+        return NV_FALSE;
+
+    pb->used  += config->launchBytes;
+    pb->gpuNs += config->launchNs;
+    if (config->bytesPerSec)
+        pb->gpuNs += bytes * 1000000000ull / config->bytesPerSec;
+
+    model->stats->launches++;
+    model->stats->maxLaunchBytes = NV_MAX(model->stats->maxLaunchBytes,
+                                          bytes);
+    if (config->onCopy)
+        config->onCopy(config->ctx, gpuAddress, physAddress, bytes);
+
+    return NV_TRUE;
+}
+
+static RM_STATUS modelSubmitPushbuffer(DumpModel *model, ModelPushbuffer *pb,
+                                       ModelTracker *tracker)
+{
+    if (++model->submits == model->config->failSubmit)
+        return RM_ERROR;
+
+    model->nowNs += model->config->submitNs;
+    model->gpuFreeNs = NV_MAX(model->gpuFreeNs, model->nowNs) + pb->gpuNs;
+    tracker->doneNs = model->gpuFreeNs;
+    model->stats->pushbuffers++;
+    return RM_OK;
+}
+
+static void modelWaitForTracker(DumpModel *model, ModelTracker *tracker)
+{
+    model->nowNs = NV_MAX(model->nowNs, tracker->doneNs);
+}
+
+// _uvm_retire_dump_block
+static void modelRetireBlock(DumpModel *model, ModelBlock *block)
+{
+    if (!block->pages)
+        return;
+
+    if (block->submitted)
+        modelWaitForTracker(model, &block->tracker);
+
+    modelUnpinUserPages(model, block,
+                        block->tracker.doneNs <= model->nowNs);
+    block->pages = NULL;
+}
+
+RM_STATUS dumpModelRun(const DumpModelConfig *config,
+                       unsigned long long gpuAddress, NvLength sizeBytes,
+                       DumpModelStats *stats)
+{
+    RM_STATUS rmStatus = RM_OK;
+    DumpModel model;
+    ModelBlock blocks[DUMP_MODEL_MAX_DEPTH];
+    unsigned int depth = NV_MIN(NV_MAX(config->depth, 1),
+                                DUMP_MODEL_MAX_DEPTH);
+    unsigned int blockIndex = 0, b;
+    NvLength bytesRemaining = sizeBytes;
+    NvU64 bufferOffset = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    memset(&model, 0, sizeof(model));
+    memset(blocks, 0, sizeof(blocks));
+    model.config = config;
+    model.stats  = stats;
+
+    if (gpuAddress % PAGE_SIZE || config->blockBytes % PAGE_SIZE ||
+        config->blockBytes == 0)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    while (bytesRemaining)
+    {
+        ModelBlock *block = &blocks[blockIndex++ % depth];
+        ModelPushbuffer pushbuffer;
+        NvLength toCopy = NV_MIN(config->blockBytes, bytesRemaining);
+        int pinnedPages, pgnum, runPages;
+
+        modelRetireBlock(&model, block);
+
+        pinnedPages = modelPinUserPages(&model, bufferOffset, toCopy,
+                                        &block->pages);
+        block->pinnedPages  = pinnedPages;
+        block->bufferOffset = bufferOffset;
+        block->submitted    = NV_FALSE;
+        block->tracker.doneNs = 0;
+
+        rmStatus = modelGetPushbuffer(&model, &pushbuffer);
+        if (rmStatus != RM_OK)
+            goto done;
+
+        for (pgnum = 0; pgnum < pinnedPages; pgnum += runPages)
+        {
+            NvU64 physAddress = block->pages[pgnum];
+
+            // One copy for every run of physically contiguous pages
+            runPages = 1;
+            while (config->coalesce && pgnum + runPages < pinnedPages &&
+                   block->pages[pgnum + runPages] ==
+                       physAddress + (NvU64)runPages * PAGE_SIZE)
+                runPages++;
+
+            if (!modelPushLaunchDma(&model, &pushbuffer, gpuAddress,
+                                    physAddress,
+                                    (NvLength)runPages * PAGE_SIZE))
+            {
+                // Full: send what it holds and retry in a fresh one
+                if (pushbuffer.used == 0)
+                {
+                    rmStatus = RM_ERROR;
+                    goto done;
+                }
+
+                rmStatus = modelSubmitPushbuffer(&model, &pushbuffer,
+                                                 &block->tracker);
+                if (rmStatus == RM_OK)
+                {
+                    modelWaitForTracker(&model, &block->tracker);
+                    rmStatus = modelGetPushbuffer(&model, &pushbuffer);
+                }
+                if (rmStatus != RM_OK)
+                    goto done;
+                runPages = 0;
+                continue;
+            }
+
+            gpuAddress += (NvU64)runPages * PAGE_SIZE;
+        }
+
+        rmStatus = modelSubmitPushbuffer(&model, &pushbuffer, &block->tracker);
+        if (rmStatus != RM_OK)
+            goto done;
+        block->submitted = NV_TRUE;
+
+        bytesRemaining -= toCopy;
+        bufferOffset   += toCopy;
+    }
+
+ done:
+    for (b = 0; b < DUMP_MODEL_MAX_DEPTH; b++)
+        modelRetireBlock(&model, &blocks[b]);
+
+    stats->modelNs = model.nowNs;
+    return rmStatus;
+}
@@ -0,0 +1,117 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _DUMP_MODEL_H_
+#define _DUMP_MODEL_H_
+
+#include "uvmtypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*******************************************************************************
+    Model of the kernel dump loop
+
+    uvm_api_dump_gpu_memory in nvidia-343.13.patch cannot run without a GPU
+    and the patched driver.  dumpModelRun follows the same loop step by step,
+    with the pinning, pushbuffer and tracker calls replaced by mocks, so that
+    changes to the loop can be tested and the number of copy engine methods
+    and pushbuffers they cost can be measured on any machine.
+
+    The mock pins the user buffer as physically contiguous runs of
+    contiguousBytes (PAGE_SIZE for a fully scattered buffer, 2 MB for one
+    backed by hugepages), each run placed away from the previous one.  A
+    pushbuffer holds pushbufferBytes of methods and every launchDma takes
+    launchBytes of it, as UVM_PUSH_METHOD does.
+
+    Up to depth blocks are in flight, as in the kernel: a block is waited for
+    and unpinned only when its slot is reused or the dump ends.
+
+    Time is modelled, not measured: pinning and unpinning cost a fixed time
+    per page on the CPU, and every copy launchNs plus its size over
+    bytesPerSec on the copy engine, which works through submitted
+    pushbuffers in order while the CPU moves on.  The modelled duration
+    depends only on the configuration.
+*/
+
+#define DUMP_MODEL_PAGE_SIZE 4096
+#define DUMP_MODEL_MAX_DEPTH 8      // UVM_DUMP_MAX_DEPTH
+
+typedef struct
+{
+    NvLength     blockBytes;       // COPY_BLOCK_SIZE: bytes pinned at a time
+    NvLength     pushbufferBytes;  // UVM_PUSHBUFFER_RESERVATION_SIZE
+    NvLength     launchBytes;      // pushbuffer space of one launchDma
+    NvLength     contiguousBytes;  // physically contiguous run length
+    int          coalesce;         // one launchDma per contiguous run
+    unsigned int depth;            // uvm_dump_depth: blocks in flight
+
+    NvU64        pinNsPerPage;
+    NvU64        unpinNsPerPage;
+    NvU64        submitNs;         // cost of submitting a pushbuffer
+    NvU64        launchNs;         // fixed copy engine cost of a launchDma
+    NvU64        bytesPerSec;      // copy engine bandwidth
+    NvU64        failSubmit;       // fail the Nth submission, 0 = never
+
+    //
+    // If set, called for every launchDma in the order they are pushed, and
+    // for every block as it is unpinned, with copiesDone false if the copy
+    // engine could still be writing to it.
+    //
+    void       (*onCopy)(void *ctx, unsigned long long gpuAddress,
+                         NvU64 physAddress, NvLength bytes);
+    void       (*onUnpin)(void *ctx, NvU64 bufferOffset, NvLength bytes,
+                          int copiesDone);
+    void        *ctx;
+} DumpModelConfig;
+
+typedef struct
+{
+    NvU64        launches;         // launchDma methods pushed
+    NvU64        pushbuffers;      // pushbuffers submitted
+    NvU64        pinnedPages;
+    NvU64        unpinnedPages;
+    NvLength     maxLaunchBytes;
+    NvU64        modelNs;          // modelled duration of the call
+} DumpModelStats;
+
+void dumpModelConfigInit(DumpModelConfig *config);
+
+// Physical address the mock pins the page at bufferOffset of the buffer to.
+NvU64 dumpModelPhysAddress(const DumpModelConfig *config, NvU64 bufferOffset);
+
+//
+// Runs the loop for a dump of sizeBytes from gpuAddress into a page aligned
+// user buffer.  Returns RM_OK, RM_ERR_INVALID_ARGUMENT for unaligned input,
+// or RM_ERROR if a single copy does not fit in an empty pushbuffer or a
+// submission fails.
+//
+RM_STATUS dumpModelRun(const DumpModelConfig *config,
+                       unsigned long long gpuAddress, NvLength sizeBytes,
+                       DumpModelStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,237 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "gpulock.h"
+#include "acquire.h"
+#include "common-utils.h"
+#include "msg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// How often a waiter looks at the queue again
+#define GPU_LOCK_POLL_NS 2000000ull
+
+static int gpuLockMkdir(const char *path) {
+    if (mkdir(path, 0755) && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+static NvU64 g_gpuLockTicketDelayNs;
+
+void gpuLockSetTicketDelay(NvU64 delayNs) {
+    g_gpuLockTicketDelayNs = delayNs;
+}
+
+//
+// Takes the next ticket from the GPU's seq file and creates the locked
+// ticket file for it.  Both happen under the flock of the seq file, so no
+// waiter can draw a later ticket and scan the queue before this one shows.
+//
+static int gpuLockTakeTicket(const char *gpuDir, GpuLock *lock) {
+    char *path = nvstrcat(gpuDir, "/seq", NULL);
+    char *tmpPath = NULL;
+    unsigned long long next = 0;
+    int fd, ret = -1, err = 0;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    nvfree(path);
+    if (fd < 0)
+        return -1;
+
+    if (flock(fd, LOCK_EX)) {
+        err = errno;
+        goto done;
+    }
+    if (pread(fd, &next, sizeof(next), 0) != sizeof(next))
+        next = 0;
+    lock->ticket = ++next;
+    if (pwrite(fd, &next, sizeof(next), 0) != sizeof(next)) {
+        err = errno ? errno : EIO;
+        goto done;
+    }
+
+    if (g_gpuLockTicketDelayNs) {
+        struct timespec ts;
+
+        ts.tv_sec  = g_gpuLockTicketDelayNs / 1000000000ull;
+        ts.tv_nsec = g_gpuLockTicketDelayNs % 1000000000ull;
+        nanosleep(&ts, NULL);
+    }
+
+    //
+    // The ticket file is locked before it gets its name, so nobody can take
+    // it for one left behind by a dead process.
+    //
+    tmpPath = nvasprintf("%s/.new.%ld.%llu", gpuDir, (long)getpid(),
+                         lock->ticket);
+    lock->path = nvasprintf("%s/%020llu", gpuDir, lock->ticket);
+    lock->fd = open(tmpPath, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (lock->fd < 0 || flock(lock->fd, LOCK_EX) ||
+        rename(tmpPath, lock->path)) {
+        err = errno;
+        if (lock->fd >= 0)
+            unlink(tmpPath);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    nvfree(tmpPath);
+    close(fd);
+    errno = err;
+    return ret;
+}
+
+//
+// Returns 1 if path is a ticket file some process still holds, 0 if not
+// (removing it if it was left behind by a process that died).
+//
+static int gpuLockHeld(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int held;
+
+    if (fd < 0)
+        return 0;
+
+    held = flock(fd, LOCK_EX | LOCK_NB) != 0;
+    if (!held)
+        unlink(path);
+
+    close(fd);
+    return held;
+}
+
+// Counts the live tickets ahead of ticket; -1 if gpuDir can't be read.
+static int gpuLockAhead(const char *gpuDir, unsigned long long ticket) {
+    DIR *dir = opendir(gpuDir);
+    struct dirent *de;
+    int ahead = 0;
+
+    if (!dir)
+        return -1;
+
+    while ((de = readdir(dir))) {
+        unsigned long long other;
+        char *end, *path;
+
+        // Ticket files are all digits; unfinished ones start with '.'
+        if (de->d_name[0] < '0' || de->d_name[0] > '9')
+            continue;
+        other = strtoull(de->d_name, &end, 10);
+        if (*end || other >= ticket)
+            continue;
+
+        path = nvstrcat(gpuDir, "/", de->d_name, NULL);
+        if (gpuLockHeld(path))
+            ahead++;
+        nvfree(path);
+    }
+
+    closedir(dir);
+    return ahead;
+}
+
+int gpuLockAcquire(const char *dir, const char *name, NvU64 timeoutNs,
+                   GpuLock *lock) {
+    char *gpuDir;
+    NvU64 start = acquireNowNs();
+    int waiting = 0, err = 0;
+
+    lock->fd = -1;
+    lock->path = NULL;
+
+    if (!*name || strchr(name, '/')) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    gpuDir = nvstrcat(dir, "/", name, NULL);
+    if (gpuLockMkdir(dir) || gpuLockMkdir(gpuDir) ||
+        gpuLockTakeTicket(gpuDir, lock)) {
+        err = errno;
+        goto fail;
+    }
+
+    for (;;) {
+        int ahead = gpuLockAhead(gpuDir, lock->ticket);
+        struct timespec ts;
+
+        if (ahead < 0) {
+            err = errno;
+            unlink(lock->path);
+            goto fail;
+        }
+        if (ahead == 0)
+            break;
+
+        if (timeoutNs && acquireNowNs() - start >= timeoutNs) {
+            err = ETIMEDOUT;
+            unlink(lock->path);
+            goto fail;
+        }
+
+        if (!waiting) {
+            nv_info_msg(NULL, "Waiting for %s: %d dump(s) ahead.", name,
+                        ahead);
+            waiting = 1;
+        }
+
+        ts.tv_sec  = 0;
+        ts.tv_nsec = GPU_LOCK_POLL_NS;
+        nanosleep(&ts, NULL);
+    }
+
+    nvfree(gpuDir);
+    return 0;
+
+fail:
+    if (lock->fd >= 0)
+        close(lock->fd);
+    lock->fd = -1;
+    nvfree(lock->path);
+    lock->path = NULL;
+    nvfree(gpuDir);
+    errno = err;
+    return -1;
+}
+
+void gpuLockRelease(GpuLock *lock) {
+    if (lock->fd < 0)
+        return;
+
+    // Gone before it is unlocked, so the next waiter never sees it stale
+    unlink(lock->path);
+    close(lock->fd);
+    lock->fd = -1;
+    nvfree(lock->path);
+    lock->path = NULL;
+}
@@ -0,0 +1,72 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _GPULOCK_H_
+#define _GPULOCK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+
+/*******************************************************************************
+    Per-GPU lock files
+
+    dump_fb processes that dump the same GPU take turns through a lock in
+    DIR/GPU-UUID/.  Each waiter takes the next ticket from DIR/GPU-UUID/seq
+    and, still under the seq file's flock, creates a ticket file named after
+    it, holding an flock on it for as long as it waits or owns the GPU.  A waiter owns the GPU once no ticket
+    file with a lower number is still locked, so the GPU is handed out in the
+    order requests arrived.  Ticket files of processes that died are unlocked
+    by the kernel and removed by the next waiter that finds them.
+
+    The lock is advisory: it only orders dump_fb processes (and the daemon).
+    The patched driver serializes the copies of one GPU by itself.
+*/
+
+#define GPU_LOCK_DEFAULT_DIR "/run/dump_fb"
+
+typedef struct {
+    int                fd;       // locked ticket file, -1 when not held
+    unsigned long long ticket;
+    char              *path;
+} GpuLock;
+
+//
+// Waits for the lock of GPU name (e.g. a UUID string) under dir, creating
+// the directories if needed.  timeoutNs 0 waits forever.  Returns 0 once the
+// lock is held, or -1 with errno set (ETIMEDOUT if the timeout expired).
+//
+int gpuLockAcquire(const char *dir, const char *name, NvU64 timeoutNs,
+                   GpuLock *lock);
+
+void gpuLockRelease(GpuLock *lock);
+
+// Sleeps between drawing a ticket and publishing its file, for testing.
+void gpuLockSetTicketDelay(NvU64 delayNs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,525 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "hash.h"
+#include "common-utils.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HASH_HAVE_SHA_NI 1
+#endif
+
+static const NvU32 sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// SHA-256's initial hash value, which BLAKE3 also uses as its IV.
+static const NvU32 sha256Iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static NvU32 rotr32(NvU32 x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static NvU32 loadBe32(const NvU8 *p) {
+    return ((NvU32)p[0] << 24) | ((NvU32)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static NvU32 loadLe32(const NvU8 *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((NvU32)p[3] << 24);
+}
+
+static void storeLe32(NvU8 *p, NvU32 v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void sha256BlocksScalar(NvU32 state[8], const NvU8 *data,
+                               NvLength blocks) {
+    NvU32 w[64];
+    int i;
+
+    while (blocks--) {
+        NvU32 a = state[0], b = state[1], c = state[2], d = state[3];
+        NvU32 e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (i = 0; i < 16; i++)
+            w[i] = loadBe32(data + 4*i);
+        for (i = 16; i < 64; i++) {
+            NvU32 s0 = rotr32(w[i-15], 7) ^ rotr32(w[i-15], 18) ^ (w[i-15] >> 3);
+            NvU32 s1 = rotr32(w[i-2], 17) ^ rotr32(w[i-2], 19) ^ (w[i-2] >> 10);
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+
+#pragma GCC unroll 64
+        for (i = 0; i < 64; i++) {
+            NvU32 t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) +
+                       ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+            NvU32 t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) +
+                       ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        data += 64;
+    }
+}
+
+#ifdef HASH_HAVE_SHA_NI
+
+//
+// Four rounds per step with the SHA extensions.  The state is kept as the
+// ABEF/CDGH register pair the sha256rnds2 instruction works on, and the
+// message schedule lives in a four entry ring of 128 bit registers.
+//
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256BlocksShaNi(NvU32 state[8], const NvU8 *data,
+                              NvLength blocks) {
+    const __m128i shuffle = _mm_set_epi64x(0x0c0d0e0f08090a0bull,
+                                           0x0405060700010203ull);
+    __m128i state0, state1, tmp, msg, w[4];
+    int g;
+
+    tmp    = _mm_loadu_si128((const __m128i *)&state[0]);
+    state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+    tmp    = _mm_shuffle_epi32(tmp, 0xB1);              // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);           // EFGH
+    state0 = _mm_alignr_epi8(tmp, state1, 8);           // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);        // CDGH
+
+    while (blocks--) {
+        __m128i abef = state0, cdgh = state1;
+
+#pragma GCC unroll 16
+        for (g = 0; g < 16; g++) {
+            if (g < 4) {
+                w[g] = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i *)(data + 16*g)), shuffle);
+            } else {
+                tmp = _mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+                tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(g + 3) & 3],
+                                                         w[(g + 2) & 3], 4));
+                w[g & 3] = _mm_sha256msg2_epu32(tmp, w[(g + 3) & 3]);
+            }
+
+            msg = _mm_add_epi32(w[g & 3],
+                    _mm_loadu_si128((const __m128i *)&sha256K[4*g]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        data += 64;
+    }
+
+    tmp    = _mm_shuffle_epi32(state0, 0x1B);           // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);           // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);        // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);           // HGFE
+
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static int cpuHasShaNi(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+        !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+        return 0;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return 0;
+
+    return (ebx & bit_SHA) != 0;
+}
+
+#endif
+
+typedef void (*Sha256BlocksFunc)(NvU32 state[8], const NvU8 *data,
+                                 NvLength blocks);
+
+// Resolved on first use; every thread resolves it to the same value.
+static Sha256BlocksFunc sha256Blocks;
+
+static Sha256BlocksFunc getSha256Blocks(void) {
+    Sha256BlocksFunc func = __atomic_load_n(&sha256Blocks, __ATOMIC_RELAXED);
+
+    if (!func) {
+        func = sha256BlocksScalar;
+#ifdef HASH_HAVE_SHA_NI
+        if (cpuHasShaNi())
+            func = sha256BlocksShaNi;
+#endif
+        __atomic_store_n(&sha256Blocks, func, __ATOMIC_RELAXED);
+    }
+
+    return func;
+}
+
+void hashSetSha256Accelerated(int enable) {
+    __atomic_store_n(&sha256Blocks,
+                     enable ? NULL : sha256BlocksScalar, __ATOMIC_RELAXED);
+}
+
+const char *hashSha256Implementation(void) {
+    return getSha256Blocks() == sha256BlocksScalar ? "scalar" : "sha-ni";
+}
+
+static void sha256(const NvU8 *data, NvLength len, NvU8 *digest) {
+    Sha256BlocksFunc blocks = getSha256Blocks();
+    NvU32 state[8];
+    NvU8 tail[128];
+    NvLength full = len / 64, rest = len % 64, tailLen;
+    NvU64 bits = (NvU64)len * 8;
+    int i;
+
+    memcpy(state, sha256Iv, sizeof(state));
+    blocks(state, data, full);
+
+    // Padding: 0x80, zeros, then the message length in bits, big endian.
+    tailLen = rest < 56 ? 64 : 128;
+    memset(tail, 0, tailLen);
+    memcpy(tail, data + full * 64, rest);
+    tail[rest] = 0x80;
+    for (i = 0; i < 8; i++)
+        tail[tailLen - 1 - i] = bits >> (8 * i);
+    blocks(state, tail, tailLen / 64);
+
+    for (i = 0; i < 8; i++) {
+        digest[4*i]     = state[i] >> 24;
+        digest[4*i + 1] = state[i] >> 16;
+        digest[4*i + 2] = state[i] >> 8;
+        digest[4*i + 3] = state[i];
+    }
+}
+
+/*
+ * BLAKE3, following the portable reference implementation: the input is split
+ * into 1 KB chunks, each chunk is compressed 64 bytes at a time into a
+ * chaining value, and the chaining values are merged pairwise into a binary
+ * tree whose root is compressed once more with the ROOT flag.
+ */
+
+#define BLAKE3_BLOCK_LEN  64
+#define BLAKE3_CHUNK_LEN  1024
+#define BLAKE3_MAX_DEPTH  54
+
+enum {
+    BLAKE3_CHUNK_START = 1 << 0,
+    BLAKE3_CHUNK_END   = 1 << 1,
+    BLAKE3_PARENT      = 1 << 2,
+    BLAKE3_ROOT        = 1 << 3,
+};
+
+static const NvU8 blake3Schedule[7][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    {  2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8 },
+    {  3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1 },
+    { 10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6 },
+    { 12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4 },
+    {  9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7 },
+    { 11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13 },
+};
+
+#define BLAKE3_G(a, b, c, d, x, y)          \
+    do {                                    \
+        v[a] = v[a] + v[b] + (x);           \
+        v[d] = rotr32(v[d] ^ v[a], 16);     \
+        v[c] = v[c] + v[d];                 \
+        v[b] = rotr32(v[b] ^ v[c], 12);     \
+        v[a] = v[a] + v[b] + (y);           \
+        v[d] = rotr32(v[d] ^ v[a], 8);      \
+        v[c] = v[c] + v[d];                 \
+        v[b] = rotr32(v[b] ^ v[c], 7);      \
+    } while (0)
+
+static void blake3Compress(NvU32 cv[8], const NvU8 block[BLAKE3_BLOCK_LEN],
+                           NvU8 blockLen, NvU64 counter, NvU8 flags) {
+    NvU32 m[16], v[16];
+    int i, r;
+
+    for (i = 0; i < 16; i++)
+        m[i] = loadLe32(block + 4*i);
+
+    memcpy(v, cv, 8 * sizeof(NvU32));
+    memcpy(v + 8, sha256Iv, 4 * sizeof(NvU32));
+    v[12] = (NvU32)counter;
+    v[13] = (NvU32)(counter >> 32);
+    v[14] = blockLen;
+    v[15] = flags;
+
+#pragma GCC unroll 7
+    for (r = 0; r < 7; r++) {
+        const NvU8 *s = blake3Schedule[r];
+
+        BLAKE3_G(0, 4,  8, 12, m[s[0]],  m[s[1]]);
+        BLAKE3_G(1, 5,  9, 13, m[s[2]],  m[s[3]]);
+        BLAKE3_G(2, 6, 10, 14, m[s[4]],  m[s[5]]);
+        BLAKE3_G(3, 7, 11, 15, m[s[6]],  m[s[7]]);
+        BLAKE3_G(0, 5, 10, 15, m[s[8]],  m[s[9]]);
+        BLAKE3_G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        BLAKE3_G(2, 7,  8, 13, m[s[12]], m[s[13]]);
+        BLAKE3_G(3, 4,  9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (i = 0; i < 8; i++)
+        cv[i] = v[i] ^ v[i + 8];
+}
+
+//
+// Compresses every block of a chunk but the last into cv and leaves the last
+// (zero padded) block in block, since how it is compressed depends on whether
+// the chunk is the root.  Returns the flags and length of that block.
+//
+static NvU8 blake3Chunk(NvU32 cv[8], const NvU8 *data, NvLength len,
+                        NvU64 counter, NvU8 block[BLAKE3_BLOCK_LEN],
+                        NvU8 *blockLen) {
+    NvU8 flags = BLAKE3_CHUNK_START;
+
+    memcpy(cv, sha256Iv, 8 * sizeof(NvU32));
+
+    while (len > BLAKE3_BLOCK_LEN) {
+        blake3Compress(cv, data, BLAKE3_BLOCK_LEN, counter, flags);
+        data  += BLAKE3_BLOCK_LEN;
+        len   -= BLAKE3_BLOCK_LEN;
+        flags  = 0;
+    }
+
+    memset(block, 0, BLAKE3_BLOCK_LEN);
+    memcpy(block, data, len);
+    *blockLen = len;
+
+    return flags | BLAKE3_CHUNK_END;
+}
+
+static void blake3ParentBlock(NvU8 block[BLAKE3_BLOCK_LEN],
+                              const NvU32 left[8], const NvU32 right[8]) {
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        storeLe32(block + 4*i, left[i]);
+        storeLe32(block + 32 + 4*i, right[i]);
+    }
+}
+
+static void blake3(const NvU8 *data, NvLength len, NvU8 *digest) {
+    NvU32 stack[BLAKE3_MAX_DEPTH][8];
+    unsigned int depth = 0;
+    NvU64 numChunks = len ? (len + BLAKE3_CHUNK_LEN - 1) / BLAKE3_CHUNK_LEN : 1;
+    NvU64 chunk;
+    NvU32 cv[8];
+    NvU8 block[BLAKE3_BLOCK_LEN];
+    NvU8 blockLen, flags;
+    int i;
+
+    // Every chunk but the last is finished and merged into the stack.
+    for (chunk = 0; chunk + 1 < numChunks; chunk++) {
+        NvU64 total = chunk + 1;
+
+        flags = blake3Chunk(cv, data + chunk * BLAKE3_CHUNK_LEN,
+                            BLAKE3_CHUNK_LEN, chunk, block, &blockLen);
+        blake3Compress(cv, block, blockLen, chunk, flags);
+
+        // A complete subtree is merged for every trailing zero bit.
+        while (!(total & 1)) {
+            blake3ParentBlock(block, stack[--depth], cv);
+            memcpy(cv, sha256Iv, sizeof(cv));
+            blake3Compress(cv, block, BLAKE3_BLOCK_LEN, 0, BLAKE3_PARENT);
+            total >>= 1;
+        }
+        memcpy(stack[depth++], cv, sizeof(cv));
+    }
+
+    flags = blake3Chunk(cv, data + chunk * BLAKE3_CHUNK_LEN,
+                        len - chunk * BLAKE3_CHUNK_LEN, chunk, block, &blockLen);
+
+    // The last chunk is then folded into the stack from the right.
+    while (depth) {
+        NvU32 chunkCv[8];
+
+        blake3Compress(cv, block, blockLen, chunk, flags);
+        memcpy(chunkCv, cv, sizeof(cv));
+        blake3ParentBlock(block, stack[--depth], chunkCv);
+        memcpy(cv, sha256Iv, sizeof(cv));
+        blockLen = BLAKE3_BLOCK_LEN;
+        chunk    = 0;
+        flags    = BLAKE3_PARENT;
+    }
+
+    blake3Compress(cv, block, blockLen, chunk, flags | BLAKE3_ROOT);
+
+    for (i = 0; i < 8; i++)
+        storeLe32(digest + 4*i, cv[i]);
+}
+
+int hashParseName(const char *name, HashAlgorithm *algorithm) {
+    if (!strcmp(name, "sha256")) {
+        *algorithm = HASH_SHA256;
+    } else if (!strcmp(name, "blake3")) {
+        *algorithm = HASH_BLAKE3;
+    } else {
+        nv_error_msg("Unknown hash '%s'; use sha256 or blake3.\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+const char *hashAlgorithmName(HashAlgorithm algorithm) {
+    switch (algorithm) {
+        case HASH_SHA256: return "sha256";
+        case HASH_BLAKE3: return "blake3";
+        default:          return "none";
+    }
+}
+
+void hashBuffer(HashAlgorithm algorithm, const void *data, NvLength len,
+                NvU8 *digest) {
+    switch (algorithm) {
+        case HASH_SHA256:
+            sha256(data, len, digest);
+            break;
+        case HASH_BLAKE3:
+            blake3(data, len, digest);
+            break;
+        default:
+            memset(digest, 0, HASH_DIGEST_SIZE);
+            break;
+    }
+}
+
+typedef NvU32 (*Crc32cFunc)(NvU32 crc, const NvU8 *data, NvLength len);
+
+// Reflected CRC-32C polynomial.
+#define CRC32C_POLY 0x82F63B78
+
+static NvU32 crc32cTable[256];
+
+static NvU32 crc32cScalar(NvU32 crc, const NvU8 *data, NvLength len) {
+    while (len--)
+        crc = crc32cTable[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef __x86_64__
+
+__attribute__((target("sse4.2")))
+static NvU32 crc32cSse42(NvU32 crc, const NvU8 *data, NvLength len) {
+    NvU64 c = crc;
+
+    while (len && ((uintptr_t)data & 7)) {
+        c = _mm_crc32_u8(c, *data++);
+        len--;
+    }
+
+    #pragma GCC unroll 8
+    for (; len >= 8; data += 8, len -= 8) {
+        NvU64 v;
+        memcpy(&v, data, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+
+    while (len--)
+        c = _mm_crc32_u8(c, *data++);
+
+    return c;
+}
+
+static int cpuHasSse42(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+}
+
+#endif
+
+static Crc32cFunc crc32cFunc;
+
+//
+// Resolved on first use like getSha256Blocks.  Racing threads fill the table
+// with the same values before publishing the function.
+//
+static Crc32cFunc getCrc32c(void) {
+    Crc32cFunc func = __atomic_load_n(&crc32cFunc, __ATOMIC_ACQUIRE);
+
+    if (!func) {
+        unsigned int i, j;
+
+        for (i = 0; i < 256; i++) {
+            NvU32 c = i;
+            for (j = 0; j < 8; j++)
+                c = (c >> 1) ^ (c & 1 ? CRC32C_POLY : 0);
+            crc32cTable[i] = c;
+        }
+
+        func = crc32cScalar;
+#ifdef __x86_64__
+        if (cpuHasSse42())
+            func = crc32cSse42;
+#endif
+        __atomic_store_n(&crc32cFunc, func, __ATOMIC_RELEASE);
+    }
+
+    return func;
+}
+
+NvU32 hashCrc32c(NvU32 crc, const void *data, NvLength len) {
+    return ~getCrc32c()(~crc, data, len);
+}
+
+void hashSetCrc32cAccelerated(int enable) {
+    getCrc32c();
+    __atomic_store_n(&crc32cFunc, enable ? NULL : crc32cScalar,
+                     __ATOMIC_RELEASE);
+}
+
+const char *hashCrc32cImplementation(void) {
+    return getCrc32c() == crc32cScalar ? "scalar" : "sse4.2";
+}
@@ -0,0 +1,75 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+
+typedef enum {
+    HASH_NONE = 0,
+    HASH_SHA256,
+    HASH_BLAKE3,
+} HashAlgorithm;
+
+// Both supported algorithms produce 32 byte digests.
+#define HASH_DIGEST_SIZE 32
+
+//
+// Parses "sha256" or "blake3".  Returns 0 on success, -1 (after printing an
+// error) otherwise.
+//
+int hashParseName(const char *name, HashAlgorithm *algorithm);
+
+const char *hashAlgorithmName(HashAlgorithm algorithm);
+
+// Hashes len bytes of data into digest (HASH_DIGEST_SIZE bytes).
+void hashBuffer(HashAlgorithm algorithm, const void *data, NvLength len,
+                NvU8 *digest);
+
+//
+// SHA-256 uses the SHA extensions (SHA-NI) when the CPU has them and a
+// portable implementation otherwise.  hashSetSha256Accelerated(0) forces the
+// portable code, for testing and benchmarking.
+//
+const char *hashSha256Implementation(void);
+void hashSetSha256Accelerated(int enable);
+
+//
+// CRC-32C (Castagnoli) of len bytes, continuing from crc (0 to start), as
+// used for the per-chunk checksums of image files.  Uses the SSE4.2 crc32
+// instruction when available.
+//
+NvU32 hashCrc32c(NvU32 crc, const void *data, NvLength len);
+
+const char *hashCrc32cImplementation(void);
+void hashSetCrc32cAccelerated(int enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,389 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#include "image.h"
+#include "hash.h"
+#include "common-utils.h"
+#include "msg.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+void imageHeaderInit(ImageHeader *header, unsigned long long baseAddress,
+                     NvLength sizeBytes, NvLength chunkBytes,
+                     CompressAlgorithm compression, int compressLevel) {
+    struct timespec ts;
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+    header->version       = IMAGE_VERSION;
+    header->headerSize    = IMAGE_HEADER_SIZE;
+    header->baseAddress   = baseAddress;
+    header->sizeBytes     = sizeBytes;
+    header->chunkBytes    = chunkBytes;
+    header->pageSize      = sysconf(_SC_PAGE_SIZE);
+    header->compression   = compression;
+    header->compressLevel = compressLevel;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header->createdNs = (NvU64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+    if (gethostname(header->hostname, sizeof(header->hostname) - 1))
+        header->hostname[0] = '\0';
+}
+
+static NvU32 imageHeaderCrc(const ImageHeader *header) {
+    return hashCrc32c(0, header, offsetof(ImageHeader, headerCrc));
+}
+
+static int imageWriteAll(int fd, const void *buf, NvLength len, NvU64 offset) {
+    const char *p = buf;
+
+    while (len) {
+        ssize_t ret = pwrite(fd, p, len, offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        p      += ret;
+        len    -= ret;
+        offset += ret;
+    }
+
+    return 0;
+}
+
+int imageHeaderWrite(ImageHeader *header, int fd) {
+    NvU8 *buf = nvalloc(IMAGE_HEADER_SIZE);
+    int ret;
+
+    header->headerCrc = imageHeaderCrc(header);
+    memcpy(buf, header, sizeof(*header));
+    ret = imageWriteAll(fd, buf, IMAGE_HEADER_SIZE, 0);
+    nvfree(buf);
+
+    return ret;
+}
+
+ImageChunkKind imageChunkClassify(const void *buf, NvLength len,
+                                  NvU64 *value) {
+    const NvU8 *p = buf;
+
+    if (len < 8 || len % 8)
+        return IMAGE_CHUNK_RAW;
+
+    //
+    // The buffer repeats its first 8 bytes exactly when it equals itself
+    // shifted by 8 bytes, which memcmp checks at full memory speed.
+    //
+    if (memcmp(p, p + 8, len - 8))
+        return IMAGE_CHUNK_RAW;
+
+    memcpy(value, p, sizeof(*value));
+    return *value ? IMAGE_CHUNK_CONSTANT : IMAGE_CHUNK_ZERO;
+}
+
+const char *imageChunkKindName(ImageChunkKind kind) {
+    switch (kind) {
+        case IMAGE_CHUNK_RAW:      return "raw";
+        case IMAGE_CHUNK_ZERO:     return "zero";
+        case IMAGE_CHUNK_CONSTANT: return "constant";
+        case IMAGE_CHUNK_ZSTD:     return "zstd";
+        case IMAGE_CHUNK_LZ4:      return "lz4";
+        default:                   return "unknown";
+    }
+}
+
+void imageIndexAppend(ImageIndex *index, const ImageIndexEntry *entry) {
+    if (index->count == index->capacity) {
+        index->capacity = index->capacity ? index->capacity * 2 : 64;
+        index->entries = nvrealloc(index->entries,
+                                   index->capacity * sizeof(ImageIndexEntry));
+    }
+    index->entries[index->count++] = *entry;
+}
+
+void imageIndexFree(ImageIndex *index) {
+    nvfree(index->entries);
+    memset(index, 0, sizeof(*index));
+}
+
+NvLength imageIndexWrite(const ImageIndex *index, int fd, NvU64 offset,
+                         RM_STATUS status) {
+    NvLength indexBytes = index->count * sizeof(ImageIndexEntry);
+    NvLength size = indexBytes + IMAGE_FOOTER_SIZE;
+    NvU8 *buf = nvalloc(size);
+    ImageFooter footer;
+    int ret;
+
+    memset(&footer, 0, sizeof(footer));
+    memcpy(footer.magic, IMAGE_FOOTER_MAGIC, sizeof(footer.magic));
+    footer.indexOffset = offset;
+    footer.count       = index->count;
+    footer.status      = status;
+
+    memcpy(buf, index->entries, indexBytes);
+    memcpy(buf + indexBytes, &footer, sizeof(footer));
+    footer.indexCrc = hashCrc32c(0, buf, indexBytes +
+                                 offsetof(ImageFooter, indexCrc));
+    memcpy(buf + indexBytes, &footer, sizeof(footer));
+
+    ret = imageWriteAll(fd, buf, size, offset);
+    nvfree(buf);
+
+    return ret ? 0 : size;
+}
+
+// Checks everything imageReadChunk relies on, so reads never leave the map.
+static int imageCheck(ImageFile *image) {
+    const ImageHeader *header = image->header;
+    const ImageFooter *footer;
+    NvU64 maxChunks, i;
+
+    if (image->mapSize < IMAGE_HEADER_SIZE + IMAGE_FOOTER_SIZE ||
+        header->version != IMAGE_VERSION ||
+        header->headerSize != IMAGE_HEADER_SIZE ||
+        header->headerCrc != imageHeaderCrc(header) ||
+        header->chunkBytes == 0 || header->chunkBytes > 0xFFFFFFFFull)
+        return -1;
+
+    footer = (const ImageFooter *)(image->map + image->mapSize -
+                                   IMAGE_FOOTER_SIZE);
+    maxChunks = (header->sizeBytes + header->chunkBytes - 1) /
+                header->chunkBytes;
+    if (memcmp(footer->magic, IMAGE_FOOTER_MAGIC, sizeof(footer->magic)) ||
+        footer->count > maxChunks ||
+        footer->indexOffset < IMAGE_HEADER_SIZE ||
+        footer->indexOffset + footer->count * sizeof(ImageIndexEntry) !=
+            image->mapSize - IMAGE_FOOTER_SIZE)
+        return -1;
+
+    if (footer->indexCrc !=
+        hashCrc32c(0, image->map + footer->indexOffset,
+                   footer->count * sizeof(ImageIndexEntry) +
+                   offsetof(ImageFooter, indexCrc)))
+        return -1;
+
+    image->index  = (const ImageIndexEntry *)(image->map + footer->indexOffset);
+    image->count  = footer->count;
+    image->status = footer->status;
+
+    for (i = 0; i < image->count; i++) {
+        const ImageIndexEntry *e = &image->index[i];
+        NvLength expected = NV_MIN(header->chunkBytes,
+                                   header->sizeBytes - i * header->chunkBytes);
+
+        if (e->length != expected || e->kind > IMAGE_CHUNK_LZ4 ||
+            e->offset < IMAGE_HEADER_SIZE ||
+            e->offset + e->storedBytes > footer->indexOffset ||
+            (e->kind == IMAGE_CHUNK_RAW && e->storedBytes != e->length))
+            return -1;
+    }
+
+    return 0;
+}
+
+int imageOpenFd(int fd, ImageFile *image) {
+    char magic[8];
+    struct stat st;
+    void *map;
+
+    memset(image, 0, sizeof(*image));
+    image->fd = -1;
+
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+        memcmp(magic, IMAGE_MAGIC, sizeof(magic)))
+        return 1;
+
+    if (fstat(fd, &st)) {
+        nv_error_msg("Failed to read the image: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        nv_error_msg("Failed to map the image: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    image->map     = map;
+    image->mapSize = st.st_size;
+    image->header  = map;
+
+    if (imageCheck(image)) {
+        nv_error_msg("The image is damaged or was not completely written.\n");
+        munmap(map, st.st_size);
+        memset(image, 0, sizeof(*image));
+        image->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+int imageOpen(const char *path, ImageFile *image) {
+    int fd = open(path, O_RDONLY);
+    int ret;
+
+    if (fd < 0) {
+        nv_error_msg("Failed to open %s: %s.\n", path, strerror(errno));
+        return -1;
+    }
+
+    ret = imageOpenFd(fd, image);
+    if (ret)
+        close(fd);
+    else
+        image->fd = fd;
+
+    return ret;
+}
+
+void imageClose(ImageFile *image) {
+    if (image->map)
+        munmap((void *)image->map, image->mapSize);
+    if (image->fd >= 0)
+        close(image->fd);
+    memset(image, 0, sizeof(*image));
+    image->fd = -1;
+}
+
+// Fills len bytes with the repeated 8 byte pattern value.
+static void imageFillPattern(void *buf, NvLength len, NvU64 value) {
+    NvU8 *p = buf;
+    NvLength done;
+
+    if (value == 0) {
+        memset(buf, 0, len);
+        return;
+    }
+
+    memcpy(p, &value, NV_MIN(len, sizeof(value)));
+    for (done = sizeof(value); done < len; done *= 2)
+        memcpy(p + done, p, NV_MIN(done, len - done));
+}
+
+NvLength imageReadChunk(const ImageFile *image, NvU64 i, void *buf) {
+    const ImageIndexEntry *e;
+    const NvU8 *stored;
+
+    if (i >= image->count) {
+        nv_error_msg("Chunk %llu is not in the image.\n",
+                     (unsigned long long)i);
+        return 0;
+    }
+
+    e = &image->index[i];
+    stored = image->map + e->offset;
+
+    switch (e->kind) {
+        case IMAGE_CHUNK_RAW:
+            memcpy(buf, stored, e->length);
+            break;
+        case IMAGE_CHUNK_ZERO:
+        case IMAGE_CHUNK_CONSTANT:
+            imageFillPattern(buf, e->length, e->value);
+            break;
+        default:
+            if (decompressChunk(buf, image->header->chunkBytes, stored,
+                                e->storedBytes) != e->length) {
+                nv_error_msg("Chunk %llu does not decompress.\n",
+                             (unsigned long long)i);
+                return 0;
+            }
+            break;
+    }
+
+    if (hashCrc32c(0, buf, e->length) != e->crc) {
+        nv_error_msg("Chunk %llu does not match its checksum.\n",
+                     (unsigned long long)i);
+        return 0;
+    }
+
+    return e->length;
+}
+
+int imageRead(const ImageFile *image, unsigned long long offset,
+              NvLength size, void *buf) {
+    const ImageHeader *header = image->header;
+    NvLength chunkBytes = header->chunkBytes;
+    NvLength covered = NV_MIN(header->sizeBytes, image->count * chunkBytes);
+    NvU8 *out = buf;
+    void *scratch = NULL;
+    int ret = 0;
+
+    if (offset < header->baseAddress ||
+        offset - header->baseAddress > covered ||
+        size > covered - (offset - header->baseAddress)) {
+        nv_error_msg("0x%llx-0x%llx is not in the image.\n", offset,
+                     offset + size);
+        return -1;
+    }
+    offset -= header->baseAddress;
+
+    //
+    // Raw and pattern chunks are read in place.  Compressed chunks are
+    // decoded whole, which also checks their CRC.
+    //
+    while (size) {
+        NvU64 i = offset / chunkBytes;
+        NvLength within = offset % chunkBytes;
+        NvLength len = NV_MIN(size, chunkBytes - within);
+        const ImageIndexEntry *e = &image->index[i];
+
+        if (e->kind == IMAGE_CHUNK_RAW) {
+            memcpy(out, image->map + e->offset + within, len);
+        } else if (e->kind == IMAGE_CHUNK_ZERO) {
+            memset(out, 0, len);
+        } else if (e->kind == IMAGE_CHUNK_CONSTANT) {
+            NvU8 pattern[16];
+            NvU64 shifted;
+
+            // Start the pattern at the right byte of the repeated value.
+            memcpy(pattern, &e->value, 8);
+            memcpy(pattern + 8, &e->value, 8);
+            memcpy(&shifted, pattern + within % 8, 8);
+            imageFillPattern(out, len, shifted);
+        } else {
+            if (!scratch)
+                scratch = nvalloc(chunkBytes);
+            if (imageReadChunk(image, i, scratch) == 0) {
+                ret = -1;
+                break;
+            }
+            memcpy(out, (NvU8 *)scratch + within, len);
+        }
+
+        out    += len;
+        offset += len;
+        size   -= len;
+    }
+
+    nvfree(scratch);
+    return ret;
+}
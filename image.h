@@ -0,0 +1,184 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+#include "compress.h"
+
+/*
+ * GPU memory image files
+ *
+ * An image holds one acquired range of GPU memory together with how it was
+ * acquired, split into fixed size chunks that can each be found and checked
+ * without reading the rest of the file:
+ *
+ *   header | chunk 0 | chunk 1 | ... | chunk N-1 | index | footer
+ *
+ *   header = ImageHeader, zero padded to IMAGE_HEADER_SIZE bytes
+ *   chunk  = the stored bytes of the chunk: the raw bytes, one zstd or lz4
+ *            frame, or nothing for zero and constant chunks
+ *   index  = N * ImageIndexEntry, chunk i being entry i
+ *   footer = ImageFooter, the last IMAGE_FOOTER_SIZE bytes of the file
+ *
+ * Chunk i covers GPU memory baseAddress + i*chunkBytes onwards; only the last
+ * chunk may be shorter.  Every chunk carries the CRC-32C of its contents (not
+ * of its stored bytes), and the index and header carry their own.  An image
+ * of a dump that failed part way holds the chunks acquired before the
+ * failure, and the footer records the failure.
+ *
+ * All integers are little endian and the structures are stored as laid out
+ * below, so the index can be used in place from a mapping of the file.
+ */
+
+#define IMAGE_MAGIC         "DFBIMAGE"
+#define IMAGE_FOOTER_MAGIC  "DFBINDEX"
+#define IMAGE_VERSION       1
+#define IMAGE_HEADER_SIZE   4096
+
+typedef enum {
+    IMAGE_CHUNK_RAW      = 0,
+    IMAGE_CHUNK_ZERO     = 1,   // nothing stored
+    IMAGE_CHUNK_CONSTANT = 2,   // nothing stored; value repeated
+    IMAGE_CHUNK_ZSTD     = 3,
+    IMAGE_CHUNK_LZ4      = 4,
+} ImageChunkKind;
+
+typedef struct {
+    char     magic[8];          // IMAGE_MAGIC
+    NvU32    version;           // IMAGE_VERSION
+    NvU32    headerSize;        // IMAGE_HEADER_SIZE
+    NvU64    baseAddress;       // GPU offset of the first byte
+    NvU64    sizeBytes;         // bytes requested
+    NvU64    chunkBytes;
+    NvU64    fbSize;            // memory size of the GPU
+    NvU64    pageSize;
+    NvU64    createdNs;         // CLOCK_REALTIME when the acquisition started
+    char     gpuUuid[96];
+    char     driverVersion[80];
+    char     hostname[64];
+    NvU32    compression;       // CompressAlgorithm tried on every chunk
+    NvS32    compressLevel;
+    NvU32    reserved;
+    NvU32    headerCrc;         // CRC-32C of this struct up to headerCrc
+} ImageHeader;
+
+typedef struct {
+    NvU64    offset;            // file offset of the stored bytes
+    NvU64    value;             // CONSTANT: the repeated 8 byte pattern
+    NvU32    storedBytes;
+    NvU32    length;            // bytes of GPU memory in the chunk
+    NvU32    crc;               // CRC-32C of the chunk's contents
+    NvU32    kind;              // ImageChunkKind
+} ImageIndexEntry;
+
+typedef struct {
+    char     magic[8];          // IMAGE_FOOTER_MAGIC
+    NvU64    indexOffset;
+    NvU64    count;             // chunks in the image
+    NvU32    status;            // RM_STATUS of the acquisition
+    NvU32    indexCrc;          // CRC-32C of the index and this struct
+                                // up to indexCrc
+} ImageFooter;
+
+#define IMAGE_FOOTER_SIZE   sizeof(ImageFooter)
+
+// Fills in the fields every image has; the caller adds the GPU details.
+void imageHeaderInit(ImageHeader *header, unsigned long long baseAddress,
+                     NvLength sizeBytes, NvLength chunkBytes,
+                     CompressAlgorithm compression, int compressLevel);
+
+// Writes the header at the start of fd.  Returns 0 on success.
+int imageHeaderWrite(ImageHeader *header, int fd);
+
+//
+// Returns IMAGE_CHUNK_ZERO or IMAGE_CHUNK_CONSTANT (with the pattern in
+// *value) if len bytes of buf repeat one 8 byte value, else IMAGE_CHUNK_RAW.
+//
+ImageChunkKind imageChunkClassify(const void *buf, NvLength len,
+                                  NvU64 *value);
+
+const char *imageChunkKindName(ImageChunkKind kind);
+
+//
+// The index of an image being written.  imageIndexWrite writes the index and
+// footer at offset and returns the number of bytes written, or 0 on failure.
+//
+typedef struct {
+    ImageIndexEntry *entries;
+    NvU64            count;
+    NvU64            capacity;
+} ImageIndex;
+
+void imageIndexAppend(ImageIndex *index, const ImageIndexEntry *entry);
+void imageIndexFree(ImageIndex *index);
+NvLength imageIndexWrite(const ImageIndex *index, int fd, NvU64 offset,
+                         RM_STATUS status);
+
+//
+// An image opened for reading.  The whole file is mapped read-only, so
+// looking up a chunk is a constant time index access.
+//
+typedef struct {
+    int                    fd;
+    const NvU8            *map;
+    NvLength               mapSize;
+    const ImageHeader     *header;
+    const ImageIndexEntry *index;
+    NvU64                  count;
+    RM_STATUS              status;  // of the acquisition
+} ImageFile;
+
+//
+// Opens and checks the header, index and footer of an image.  Returns 0 on
+// success, 1 if fd is not an image at all, and -1 (after printing an error)
+// if it is a damaged one.  imageOpenFd does not take ownership of fd.
+//
+int imageOpen(const char *path, ImageFile *image);
+int imageOpenFd(int fd, ImageFile *image);
+void imageClose(ImageFile *image);
+
+//
+// Decodes chunk i into buf, which must hold header->chunkBytes bytes, and
+// checks it against its CRC.  Returns the chunk's length, or 0 (after
+// printing an error) if it is damaged.
+//
+NvLength imageReadChunk(const ImageFile *image, NvU64 i, void *buf);
+
+//
+// Reads size bytes of GPU memory starting at GPU offset offset.  Returns 0 on
+// success, -1 (after printing an error) if the range is not in the image or
+// a chunk it touches is damaged.
+//
+int imageRead(const ImageFile *image, unsigned long long offset,
+              NvLength size, void *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,285 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "journal.h"
+#include "acquire.h"
+#include "common-utils.h"
+#include "msg.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+static int journalWriteAll(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len) {
+        ssize_t ret = write(fd, p, len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        p   += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static int journalReadAll(int fd, void *buf, size_t len, off_t offset) {
+    char *p = buf;
+
+    while (len) {
+        ssize_t ret = pread(fd, p, len, offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret == 0)
+            errno = 0;
+        if (ret <= 0)
+            return -1;
+        p      += ret;
+        len    -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+static void journalSetup(Journal *journal, int fd, int outFd) {
+    const JournalHeader *h = &journal->header;
+
+    journal->fd        = fd;
+    journal->outFd     = outFd;
+    journal->numChunks = (h->sizeBytes + h->chunkBytes - 1) / h->chunkBytes;
+    journal->done      = nvalloc(((journal->numChunks + 63) / 64) *
+                                 sizeof(NvU64));
+    journal->digests   = nvalloc(journal->numChunks * HASH_DIGEST_SIZE);
+    journal->pending   = nvalloc(JOURNAL_SYNC_RECORDS * sizeof(JournalRecord));
+    journal->pendingCount = 0;
+    journal->lastSyncNs   = acquireNowNs();
+}
+
+static NvU32 journalHeaderCrc(const JournalHeader *h) {
+    return hashCrc32c(0, h, offsetof(JournalHeader, headerCrc));
+}
+
+static NvU32 journalRecordCrc(const JournalRecord *r) {
+    return hashCrc32c(0, r, offsetof(JournalRecord, crc));
+}
+
+int journalCreate(Journal *journal, const char *path, const char *gpuUuid,
+                  unsigned long long baseAddress, NvLength sizeBytes,
+                  NvLength chunkBytes, unsigned long long outOffset,
+                  int outFd) {
+    JournalHeader *h = &journal->header;
+    int fd;
+
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+    if (chunkBytes == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(h->magic, JOURNAL_MAGIC, sizeof(h->magic));
+    h->baseAddress = baseAddress;
+    h->sizeBytes   = sizeBytes;
+    h->chunkBytes  = chunkBytes;
+    h->outOffset   = outOffset;
+    strncpy(h->gpuUuid, gpuUuid, sizeof(h->gpuUuid) - 1);
+    h->headerCrc   = journalHeaderCrc(h);
+
+    fd = open(path, O_CREAT | O_EXCL | O_WRONLY | O_APPEND, 0644);
+    if (fd < 0)
+        return -1;
+
+    if (journalWriteAll(fd, h, sizeof(*h)) || fdatasync(fd)) {
+        int err = errno;
+        close(fd);
+        unlink(path);
+        errno = err;
+        return -1;
+    }
+
+    journalSetup(journal, fd, outFd);
+    return 0;
+}
+
+int journalOpen(Journal *journal, const char *path, int outFd) {
+    JournalHeader *h = &journal->header;
+    JournalRecord r;
+    off_t end = sizeof(*h);
+    int fd;
+
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+
+    fd = open(path, O_RDWR | O_APPEND);
+    if (fd < 0) {
+        nv_error_msg("Failed to open journal %s: %s.\n", path,
+                     strerror(errno));
+        return -1;
+    }
+
+    if (journalReadAll(fd, h, sizeof(*h), 0) ||
+        memcmp(h->magic, JOURNAL_MAGIC, sizeof(h->magic)) ||
+        h->headerCrc != journalHeaderCrc(h) || h->chunkBytes == 0) {
+        nv_error_msg("%s is not a dump journal.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    journalSetup(journal, fd, outFd);
+
+    // Records up to the first torn or corrupt one
+    while (!journalReadAll(fd, &r, sizeof(r), end)) {
+        if (r.magic != JOURNAL_RECORD_MAGIC || r.crc != journalRecordCrc(&r) ||
+            r.chunk >= journal->numChunks ||
+            r.length != journalChunkLength(journal, r.chunk))
+            break;
+
+        journal->done[r.chunk / 64] |= 1ull << (r.chunk % 64);
+        memcpy(journal->digests + r.chunk * HASH_DIGEST_SIZE, r.digest,
+               HASH_DIGEST_SIZE);
+        end += sizeof(r);
+    }
+
+    // New records go after the last good one.
+    if (ftruncate(fd, end)) {
+        nv_error_msg("Failed to truncate journal %s: %s.\n", path,
+                     strerror(errno));
+        journalClose(journal);
+        return -1;
+    }
+
+    return 0;
+}
+
+NvLength journalChunkLength(const Journal *journal, NvU64 chunk) {
+    const JournalHeader *h = &journal->header;
+    NvU64 offset = chunk * h->chunkBytes;
+
+    return NV_MIN(h->chunkBytes, h->sizeBytes - offset);
+}
+
+long long journalVerify(Journal *journal) {
+    const JournalHeader *h = &journal->header;
+    NvU8 digest[HASH_DIGEST_SIZE];
+    long long intact = 0;
+    void *buf = nvalloc(h->chunkBytes);
+    NvU64 i;
+
+    for (i = 0; i < journal->numChunks; i++) {
+        NvLength len = journalChunkLength(journal, i);
+
+        if (!journalChunkDone(journal, i))
+            continue;
+
+        if (journalReadAll(journal->outFd, buf, len,
+                           h->outOffset + i * h->chunkBytes)) {
+            if (errno) {
+                nv_error_msg("Failed to read the dump: %s.\n",
+                             strerror(errno));
+                nvfree(buf);
+                return -1;
+            }
+            memset(digest, 0, sizeof(digest));
+        } else {
+            hashBuffer(HASH_BLAKE3, buf, len, digest);
+        }
+
+        if (memcmp(digest, journal->digests + i * HASH_DIGEST_SIZE,
+                   HASH_DIGEST_SIZE))
+            journal->done[i / 64] &= ~(1ull << (i % 64));
+        else
+            intact++;
+    }
+
+    nvfree(buf);
+    return intact;
+}
+
+int journalSync(Journal *journal) {
+    unsigned int i;
+
+    if (journal->pendingCount == 0)
+        return 0;
+
+    // The chunks must be on disk before the journal says so.
+    if (fdatasync(journal->outFd) ||
+        journalWriteAll(journal->fd, journal->pending,
+                        journal->pendingCount * sizeof(JournalRecord)) ||
+        fdatasync(journal->fd))
+        return -1;
+
+    for (i = 0; i < journal->pendingCount; i++) {
+        NvU64 chunk = journal->pending[i].chunk;
+        journal->done[chunk / 64] |= 1ull << (chunk % 64);
+    }
+    journal->pendingCount = 0;
+    journal->lastSyncNs   = acquireNowNs();
+    return 0;
+}
+
+int journalAppend(Journal *journal, NvU64 chunk, const void *data) {
+    JournalRecord *r;
+
+    if (chunk >= journal->numChunks) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Left full by a failed sync
+    if (journal->pendingCount == JOURNAL_SYNC_RECORDS && journalSync(journal))
+        return -1;
+
+    r = &journal->pending[journal->pendingCount++];
+    memset(r, 0, sizeof(*r));
+    r->magic  = JOURNAL_RECORD_MAGIC;
+    r->length = journalChunkLength(journal, chunk);
+    r->chunk  = chunk;
+    hashBuffer(HASH_BLAKE3, data, r->length, r->digest);
+    r->crc    = journalRecordCrc(r);
+    memcpy(journal->digests + chunk * HASH_DIGEST_SIZE, r->digest,
+           HASH_DIGEST_SIZE);
+
+    if (journal->pendingCount == JOURNAL_SYNC_RECORDS ||
+        acquireNowNs() - journal->lastSyncNs >= JOURNAL_SYNC_NS)
+        return journalSync(journal);
+
+    return 0;
+}
+
+void journalClose(Journal *journal) {
+    if (journal->fd >= 0) {
+        journalSync(journal);
+        close(journal->fd);
+    }
+    journal->fd = -1;
+    nvfree(journal->done);
+    nvfree(journal->digests);
+    nvfree(journal->pending);
+    journal->done    = NULL;
+    journal->digests = NULL;
+    journal->pending = NULL;
+}
@@ -0,0 +1,140 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+#include "hash.h"
+
+/*
+ * Checkpoint journals
+ *
+ * A journal is a small append-only file next to a raw dump that records
+ * which chunks of the dump are known to be in the output file, so a dump
+ * that died part way can be resumed instead of started over:
+ *
+ *   header | record | record | ...
+ *
+ *   header = JournalHeader: the GPU, range and chunk size of the dump
+ *   record = JournalRecord: one written chunk and the BLAKE3 digest of its
+ *            contents
+ *
+ * Records are batched: they are kept in memory until JOURNAL_SYNC_RECORDS
+ * have piled up or JOURNAL_SYNC_NS have passed, and then the output file is
+ * synced before the records are appended and the journal is synced.  A
+ * record therefore never claims a chunk that is not on disk, and a crash
+ * loses at most the last batch, which is simply acquired again.  A torn
+ * record at the end of the file fails its CRC and is ignored.
+ *
+ * All integers are little endian, stored as laid out below.
+ */
+
+#define JOURNAL_MAGIC         "DFBJRNL1"
+#define JOURNAL_RECORD_MAGIC  0x4345524aU   // "JREC"
+#define JOURNAL_SYNC_RECORDS  64
+#define JOURNAL_SYNC_NS       1000000000ull
+
+typedef struct {
+    char     magic[8];          // JOURNAL_MAGIC
+    NvU64    baseAddress;       // GPU offset of the first byte
+    NvU64    sizeBytes;
+    NvU64    chunkBytes;
+    NvU64    outOffset;         // file offset of the first byte
+    char     gpuUuid[96];
+    NvU32    reserved;
+    NvU32    headerCrc;         // CRC-32C of this struct up to headerCrc
+} JournalHeader;
+
+typedef struct {
+    NvU32    magic;             // JOURNAL_RECORD_MAGIC
+    NvU32    length;            // bytes of the chunk
+    NvU64    chunk;             // index from baseAddress
+    NvU8     digest[HASH_DIGEST_SIZE];
+    NvU32    reserved;
+    NvU32    crc;               // CRC-32C of this struct up to crc
+} JournalRecord;
+
+typedef struct {
+    int            fd;
+    int            outFd;       // synced before records are appended
+    JournalHeader  header;
+    NvU64          numChunks;
+    NvU64         *done;        // one bit per chunk known to be written
+    NvU8          *digests;     // HASH_DIGEST_SIZE per chunk
+    JournalRecord *pending;     // not yet appended
+    unsigned int   pendingCount;
+    NvU64          lastSyncNs;
+} Journal;
+
+//
+// Creates the journal path (which must not exist) for a dump of sizeBytes
+// at baseAddress in chunkBytes chunks, written to outFd from outOffset.
+// Returns 0, or -1 with errno set.
+//
+int journalCreate(Journal *journal, const char *path, const char *gpuUuid,
+                  unsigned long long baseAddress, NvLength sizeBytes,
+                  NvLength chunkBytes, unsigned long long outOffset,
+                  int outFd);
+
+//
+// Opens an existing journal to resume the dump it describes, loading its
+// records.  Returns 0, or -1 after printing an error.
+//
+int journalOpen(Journal *journal, const char *path, int outFd);
+
+//
+// Rereads every chunk the journal claims from the output file and forgets
+// the ones whose contents no longer match.  Returns the number of chunks
+// that are intact, or -1 after printing an error.
+//
+long long journalVerify(Journal *journal);
+
+static __inline__ int journalChunkDone(const Journal *journal, NvU64 chunk) {
+    return (journal->done[chunk / 64] >> (chunk % 64)) & 1;
+}
+
+// Bytes of chunk (the last one may be short).
+NvLength journalChunkLength(const Journal *journal, NvU64 chunk);
+
+//
+// Records that chunk, with contents data, has been written to the output
+// file.  Syncs when the batch is full or old enough.  Returns 0, or -1 with
+// errno set.
+//
+int journalAppend(Journal *journal, NvU64 chunk, const void *data);
+
+// Appends everything pending now.  Returns 0, or -1 with errno set.
+int journalSync(Journal *journal);
+
+// Syncs and closes the journal.
+void journalClose(Journal *journal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,354 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "merkle.h"
+#include "compress.h"
+#include "image.h"
+#include "segment.h"
+#include "common-utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define MANIFEST_VERSION 1
+
+void merkleInit(MerkleTree *tree, HashAlgorithm algorithm, NvLength chunkBytes,
+                unsigned long long baseAddress, NvU64 count) {
+    memset(tree, 0, sizeof(*tree));
+    tree->algorithm   = algorithm;
+    tree->chunkBytes  = chunkBytes;
+    tree->baseAddress = baseAddress;
+    tree->count       = count;
+    tree->leaves      = nvalloc(count ? count * HASH_DIGEST_SIZE : 1);
+}
+
+void merkleFree(MerkleTree *tree) {
+    nvfree(tree->leaves);
+    memset(tree, 0, sizeof(*tree));
+}
+
+void merkleRoot(const MerkleTree *tree, NvU8 *root) {
+    NvU8 *level;
+    NvU8 node[1 + 2 * HASH_DIGEST_SIZE];
+    NvU64 n = tree->count, i;
+
+    if (n == 0) {
+        hashBuffer(tree->algorithm, "", 0, root);
+        return;
+    }
+
+    // Each level is reduced in place; an odd node out moves up as is.
+    level = nvalloc(n * HASH_DIGEST_SIZE);
+    memcpy(level, tree->leaves, n * HASH_DIGEST_SIZE);
+
+    while (n > 1) {
+        for (i = 0; i < n / 2; i++) {
+            node[0] = 0x01;
+            memcpy(node + 1, level + 2*i * HASH_DIGEST_SIZE,
+                   2 * HASH_DIGEST_SIZE);
+            hashBuffer(tree->algorithm, node, sizeof(node),
+                       level + i * HASH_DIGEST_SIZE);
+        }
+        if (n & 1) {
+            memmove(level + i * HASH_DIGEST_SIZE,
+                    level + (n - 1) * HASH_DIGEST_SIZE, HASH_DIGEST_SIZE);
+        }
+        n = (n + 1) / 2;
+    }
+
+    memcpy(root, level, HASH_DIGEST_SIZE);
+    nvfree(level);
+}
+
+static void digestToHex(const NvU8 *digest, char *hex) {
+    int i;
+
+    for (i = 0; i < HASH_DIGEST_SIZE; i++)
+        sprintf(hex + 2*i, "%02x", digest[i]);
+}
+
+static int hexToDigest(const char *hex, NvU8 *digest) {
+    int i;
+
+    if (strlen(hex) != 2 * HASH_DIGEST_SIZE)
+        return -1;
+
+    for (i = 0; i < HASH_DIGEST_SIZE; i++) {
+        unsigned int byte;
+        if (sscanf(hex + 2*i, "%2x", &byte) != 1)
+            return -1;
+        digest[i] = byte;
+    }
+
+    return 0;
+}
+
+int manifestWrite(const char *path, const MerkleTree *tree, const char *gpu) {
+    char hex[2 * HASH_DIGEST_SIZE + 1];
+    NvU8 root[HASH_DIGEST_SIZE];
+    FILE *fp;
+    NvU64 i;
+    int ret = 0;
+
+    fp = fopen(path, "wx");
+    if (!fp) {
+        nv_error_msg("Failed to create manifest %s: %s.\n", path,
+                     strerror(errno));
+        return -1;
+    }
+
+    merkleRoot(tree, root);
+    digestToHex(root, hex);
+
+    fprintf(fp, "dump_fb-manifest %d\n", MANIFEST_VERSION);
+    fprintf(fp, "gpu %s\n", gpu && gpu[0] ? gpu : "-");
+    fprintf(fp, "algorithm %s\n", hashAlgorithmName(tree->algorithm));
+    fprintf(fp, "offset 0x%llx\n", tree->baseAddress);
+    fprintf(fp, "size %llu\n", (unsigned long long)tree->sizeBytes);
+    fprintf(fp, "chunk-size %llu\n", (unsigned long long)tree->chunkBytes);
+    fprintf(fp, "root %s\n", hex);
+
+    for (i = 0; i < tree->count; i++) {
+        digestToHex(merkleLeaf(tree, i), hex);
+        fprintf(fp, "leaf %llu %s\n", (unsigned long long)i, hex);
+    }
+
+    if (ferror(fp))
+        ret = -1;
+    if (fclose(fp))
+        ret = -1;
+    if (ret)
+        nv_error_msg("Failed to write manifest %s.\n", path);
+
+    return ret;
+}
+
+int manifestRead(const char *path, MerkleTree *tree) {
+    char line[256], key[32], value[160];
+    NvU8 root[HASH_DIGEST_SIZE], computed[HASH_DIGEST_SIZE];
+    HashAlgorithm algorithm = HASH_NONE;
+    unsigned long long offset = 0, size = 0, chunk = 0, index;
+    int version = 0, haveRoot = 0;
+    NvU64 leaves = 0, capacity = 0;
+    FILE *fp;
+
+    memset(tree, 0, sizeof(*tree));
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        nv_error_msg("Failed to open manifest %s: %s.\n", path,
+                     strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "dump_fb-manifest %d", &version) == 1)
+            continue;
+
+        if (sscanf(line, "leaf %llu %159s", &index, value) == 2) {
+            if (!chunk || index != leaves)
+                goto bad;
+            if (leaves == capacity) {
+                capacity = capacity ? capacity * 2 : 1024;
+                tree->leaves = nvrealloc(tree->leaves,
+                                         capacity * HASH_DIGEST_SIZE);
+            }
+            if (hexToDigest(value, merkleLeaf(tree, leaves)))
+                goto bad;
+            leaves++;
+            continue;
+        }
+
+        if (sscanf(line, "%31s %159s", key, value) != 2)
+            goto bad;
+
+        if (!strcmp(key, "algorithm")) {
+            if (hashParseName(value, &algorithm))
+                goto bad;
+        } else if (!strcmp(key, "offset")) {
+            offset = strtoull(value, NULL, 0);
+        } else if (!strcmp(key, "size")) {
+            size = strtoull(value, NULL, 0);
+        } else if (!strcmp(key, "chunk-size")) {
+            chunk = strtoull(value, NULL, 0);
+        } else if (!strcmp(key, "root")) {
+            if (hexToDigest(value, root))
+                goto bad;
+            haveRoot = 1;
+        }
+    }
+
+    if (version != MANIFEST_VERSION || algorithm == HASH_NONE || !haveRoot ||
+        !chunk || leaves != (size + chunk - 1) / chunk)
+        goto bad;
+
+    fclose(fp);
+
+    tree->algorithm   = algorithm;
+    tree->chunkBytes  = chunk;
+    tree->baseAddress = offset;
+    tree->sizeBytes   = size;
+    tree->count       = leaves;
+
+    merkleRoot(tree, computed);
+    if (memcmp(root, computed, HASH_DIGEST_SIZE)) {
+        nv_error_msg("Manifest %s is corrupt: its leaves do not hash to its "
+                     "root.\n", path);
+        merkleFree(tree);
+        return -1;
+    }
+
+    return 0;
+
+bad:
+    nv_error_msg("Manifest %s is malformed.\n", path);
+    fclose(fp);
+    nvfree(tree->leaves);
+    memset(tree, 0, sizeof(*tree));
+    return -1;
+}
+
+int merkleVerify(const MerkleTree *tree, int fd, NvLength offset,
+                 NvLength size, NvU64 *badChunk) {
+    SeekTable table;
+    ImageFile image;
+    SegmentSet segments;
+    NvU64 first, last, i;
+    NvU64 frameOffset = 0;
+    NvU8 digest[HASH_DIGEST_SIZE];
+    void *buf = NULL, *frame = NULL;
+    NvLength frameCapacity = 0;
+    int compressed = 0, imaged, segmented = 0, ret = 0;
+
+    if (size == 0 || tree->count == 0)
+        return 0;
+
+    if (offset >= tree->sizeBytes || size > tree->sizeBytes - offset) {
+        nv_error_msg("Range 0x%llx-0x%llx is not covered by the manifest.\n",
+                     (unsigned long long)offset,
+                     (unsigned long long)(offset + size));
+        return -1;
+    }
+
+    first = offset / tree->chunkBytes;
+    last  = (offset + size - 1) / tree->chunkBytes;
+
+    //
+    // Images and compressed dumps store each chunk separately, so chunk i is
+    // image chunk i or frame i, and only the chunks in the range are read.
+    //
+    imaged = imageOpenFd(fd, &image);
+    if (imaged < 0)
+        return -1;
+    imaged = imaged == 0;
+    if (imaged && (image.header->chunkBytes != tree->chunkBytes ||
+                   image.count != tree->count)) {
+        nv_error_msg("The image has %llu chunks of %llu bytes but the "
+                     "manifest %llu of %llu.\n",
+                     (unsigned long long)image.count,
+                     (unsigned long long)image.header->chunkBytes,
+                     (unsigned long long)tree->count,
+                     (unsigned long long)tree->chunkBytes);
+        imageClose(&image);
+        return -1;
+    }
+
+    if (!imaged) {
+        segmented = segmentSetOpenFd(&segments, fd, NULL);
+        if (segmented < 0)
+            return -1;
+        segmented = segmented == 0;
+    }
+    if (!imaged && !segmented)
+        compressed = seekTableRead(fd, &table) == 0;
+    if (compressed) {
+        if (table.count != tree->count) {
+            nv_error_msg("The dump has %u frames but the manifest %llu "
+                         "chunks.\n", table.count,
+                         (unsigned long long)tree->count);
+            seekTableFree(&table);
+            return -1;
+        }
+        for (i = 0; i < first; i++)
+            frameOffset += table.entries[i].compressedSize;
+    }
+
+    buf = nvalloc(tree->chunkBytes);
+
+    for (i = first; i <= last && ret == 0; i++) {
+        NvLength len = NV_MIN(tree->chunkBytes,
+                              tree->sizeBytes - i * tree->chunkBytes);
+
+        if (imaged) {
+            if (imageReadChunk(&image, i, buf) != len) {
+                ret = -1;
+                break;
+            }
+        } else if (compressed) {
+            const SeekTableEntry *e = &table.entries[i];
+
+            if (e->compressedSize > frameCapacity) {
+                frameCapacity = e->compressedSize;
+                frame = nvrealloc(frame, frameCapacity);
+            }
+            if (e->decompressedSize != len ||
+                pread(fd, frame, e->compressedSize, frameOffset) !=
+                    (ssize_t)e->compressedSize ||
+                decompressChunk(buf, tree->chunkBytes, frame,
+                                e->compressedSize) != len) {
+                nv_error_msg("Failed to read chunk %llu.\n",
+                             (unsigned long long)i);
+                ret = -1;
+                break;
+            }
+            frameOffset += e->compressedSize;
+        } else if (segmented ?
+                   segmentRead(&segments, buf, len, i * tree->chunkBytes) :
+                   pread(fd, buf, len, i * tree->chunkBytes) !=
+                       (ssize_t)len) {
+            nv_error_msg("Failed to read chunk %llu.\n", (unsigned long long)i);
+            ret = -1;
+            break;
+        }
+
+        hashBuffer(tree->algorithm, buf, len, digest);
+        if (memcmp(digest, merkleLeaf(tree, i), HASH_DIGEST_SIZE)) {
+            if (badChunk)
+                *badChunk = i;
+            ret = 1;
+        }
+    }
+
+    if (compressed)
+        seekTableFree(&table);
+    if (imaged)
+        imageClose(&image);
+    if (segmented)
+        segmentSetClose(&segments);
+    nvfree(frame);
+    nvfree(buf);
+
+    return ret;
+}
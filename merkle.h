@@ -0,0 +1,102 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _MERKLE_H_
+#define _MERKLE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+#include "hash.h"
+
+/*
+ * Merkle tree over the chunks of a dump
+ *
+ * Leaf i is the plain hash of chunk i (chunkBytes of the image, the last
+ * chunk may be shorter), so a leaf can be checked with e.g.
+ *
+ *   dd if=IMAGE bs=CHUNK skip=i count=1 | sha256sum
+ *
+ * Interior nodes are H(0x01 || left || right).  A node without a sibling is
+ * carried up to the next level unchanged.  Leaves are always at least a page,
+ * so they can never be confused with a 65 byte interior node.
+ *
+ * The manifest is a text file:
+ *
+ *   dump_fb-manifest 1
+ *   gpu GPU-...
+ *   algorithm sha256
+ *   offset 0x0
+ *   size 1073741824
+ *   chunk-size 8388608
+ *   root <hex>
+ *   leaf 0 <hex>
+ *   ...
+ */
+
+typedef struct {
+    HashAlgorithm      algorithm;
+    NvLength           chunkBytes;
+    unsigned long long baseAddress;  // GPU offset of the first byte
+    NvLength           sizeBytes;    // bytes covered by the leaves
+    NvU64              count;
+    NvU8              *leaves;       // count * HASH_DIGEST_SIZE bytes
+} MerkleTree;
+
+// Allocates room for count leaves.
+void merkleInit(MerkleTree *tree, HashAlgorithm algorithm, NvLength chunkBytes,
+                unsigned long long baseAddress, NvU64 count);
+void merkleFree(MerkleTree *tree);
+
+static __inline__ NvU8 *merkleLeaf(const MerkleTree *tree, NvU64 i) {
+    return tree->leaves + i * HASH_DIGEST_SIZE;
+}
+
+void merkleRoot(const MerkleTree *tree, NvU8 *root);
+
+// Returns 0 on success, -1 (after printing an error) otherwise.
+int manifestWrite(const char *path, const MerkleTree *tree, const char *gpu);
+
+//
+// Reads a manifest and checks that its leaves hash to its root.  Returns 0 on
+// success, -1 (after printing an error) otherwise.
+//
+int manifestRead(const char *path, MerkleTree *tree);
+
+//
+// Rehashes the chunks of the image in fd that overlap [offset, offset+size)
+// (offsets within the image) and compares them with the tree.  fd may hold the
+// raw image, the manifest of its segments (segment.h), a compressed dump with
+// a seek table or an image file (image.h), whose chunks must match the
+// tree's.  Returns 0 if they match,
+// 1 if a chunk differs (its index is stored in badChunk) and -1 on error.
+//
+int merkleVerify(const MerkleTree *tree, int fd, NvLength offset,
+                 NvLength size, NvU64 *badChunk);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
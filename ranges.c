@@ -0,0 +1,192 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "ranges.h"
+#include "common-utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+void rangeListAdd(RangeList *list, unsigned long long offset, NvLength size) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->ranges = nvrealloc(list->ranges,
+                                 list->capacity * sizeof(DumpRange));
+    }
+    list->ranges[list->count].offset = offset;
+    list->ranges[list->count].size   = size;
+    list->count++;
+}
+
+void rangeListFree(RangeList *list) {
+    nvfree(list->ranges);
+    memset(list, 0, sizeof(*list));
+}
+
+static int rangeParseNumber(const char *str, char **end,
+                            unsigned long long *value) {
+    errno = 0;
+    *value = strtoull(str, end, 0);
+    if (*end == str || errno)
+        return -1;
+
+    switch (toupper(**end)) {
+        case 'G': *value <<= 10; /* fall through */
+        case 'M': *value <<= 10; /* fall through */
+        case 'K': *value <<= 10; (*end)++; break;
+    }
+
+    return 0;
+}
+
+//
+// Parses one OFFSET:SIZE or OFFSET SIZE pair and returns a pointer past it,
+// or NULL.
+//
+static const char *rangeParseOne(const char *str, RangeList *list) {
+    unsigned long long offset, size;
+    char *end;
+
+    if (rangeParseNumber(str, &end, &offset))
+        return NULL;
+    if (*end != ':' && !isspace(*end))
+        return NULL;
+    while (isspace(*end))
+        end++;
+    if (*end == ':')
+        end++;
+    if (rangeParseNumber(end, &end, &size) || size > ~0ull - offset)
+        return NULL;
+
+    rangeListAdd(list, offset, size);
+    return end;
+}
+
+int rangeListParse(const char *spec, RangeList *list) {
+    const char *p = spec;
+
+    do {
+        p = rangeParseOne(p, list);
+        if (!p || (*p && *p != ',')) {
+            nv_error_msg("Invalid range list '%s'; expected "
+                         "OFFSET:SIZE[,OFFSET:SIZE...].\n", spec);
+            return -1;
+        }
+    } while (*p++ == ',');
+
+    return 0;
+}
+
+int rangeListReadFile(const char *path, RangeList *list) {
+    char line[256];
+    unsigned int lineNo = 0;
+    FILE *fp = fopen(path, "r");
+
+    if (!fp) {
+        nv_error_msg("Failed to open range file %s: %s.\n", path,
+                     strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        const char *p = line;
+
+        lineNo++;
+        while (isspace(*p))
+            p++;
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        p = rangeParseOne(p, list);
+        while (p && isspace(*p))
+            p++;
+        if (!p || (*p && *p != '#')) {
+            nv_error_msg("%s:%u: expected OFFSET:SIZE.\n", path, lineNo);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static int rangeCompare(const void *a, const void *b) {
+    const DumpRange *x = a, *y = b;
+
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return x->size < y->size ? -1 : x->size > y->size;
+}
+
+void rangeListCoalesce(RangeList *list) {
+    unsigned int i, out = 0;
+
+    if (list->count == 0)
+        return;
+
+    qsort(list->ranges, list->count, sizeof(DumpRange), rangeCompare);
+
+    for (i = 1; i < list->count; i++) {
+        DumpRange *last = &list->ranges[out];
+        const DumpRange *r = &list->ranges[i];
+
+        if (r->offset <= last->offset + last->size) {
+            unsigned long long end = NV_MAX(last->offset + last->size,
+                                            r->offset + r->size);
+            last->size = end - last->offset;
+        } else {
+            list->ranges[++out] = *r;
+        }
+    }
+
+    list->count = out + 1;
+}
+
+int rangeListValidate(const RangeList *list, NvLength fbSize,
+                      NvLength pageSize, const char *gpu) {
+    unsigned int i;
+
+    for (i = 0; i < list->count; i++) {
+        const DumpRange *r = &list->ranges[i];
+
+        if (r->size == 0 || r->offset % pageSize || r->size % pageSize) {
+            nv_error_msg("Range 0x%llx:0x%llx must be non-empty and a "
+                         "multiple of the system page size (%llu bytes).\n",
+                         r->offset, (unsigned long long)r->size,
+                         (unsigned long long)pageSize);
+            return -1;
+        }
+
+        if (r->offset > fbSize || r->size > fbSize - r->offset) {
+            nv_error_msg("%s: 0x%llx-0x%llx exceeds the size of GPU memory "
+                         "(0x%llx).\n", gpu, r->offset, r->offset + r->size,
+                         (unsigned long long)fbSize);
+            return -1;
+        }
+    }
+
+    return 0;
+}
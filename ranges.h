@@ -0,0 +1,74 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _RANGES_H_
+#define _RANGES_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+
+typedef struct {
+    unsigned long long offset;
+    NvLength           size;
+} DumpRange;
+
+typedef struct {
+    DumpRange   *ranges;
+    unsigned int count;
+    unsigned int capacity;
+} RangeList;
+
+void rangeListAdd(RangeList *list, unsigned long long offset, NvLength size);
+void rangeListFree(RangeList *list);
+
+//
+// Parses a comma separated list of OFFSET:SIZE pairs.  Numbers may be hex
+// (0x...) and sizes may end in K, M or G.  Returns 0 on success, -1 (after
+// printing an error) otherwise.
+//
+int rangeListParse(const char *spec, RangeList *list);
+
+//
+// Reads OFFSET:SIZE (or OFFSET SIZE) pairs from a file, one per line.  Blank
+// lines and lines starting with # are ignored.
+//
+int rangeListReadFile(const char *path, RangeList *list);
+
+// Sorts the ranges and merges the ones that overlap or touch.
+void rangeListCoalesce(RangeList *list);
+
+//
+// Checks that every range is page aligned, non-empty and inside fbSize bytes
+// of GPU memory.  Returns 0 if so, -1 (after printing an error naming gpu)
+// otherwise.
+//
+int rangeListValidate(const RangeList *list, NvLength fbSize,
+                      NvLength pageSize, const char *gpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
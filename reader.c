@@ -0,0 +1,789 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "reader.h"
+#include "compress.h"
+#include "image.h"
+#include "segment.h"
+#include "msg.h"
+#include "common-utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define READER_DEFAULT_CACHE_BYTES (256*1024*1024)
+#define READER_DEFAULT_SHARDS      16
+#define READER_DEFAULT_READ_AHEAD  4
+
+//
+// A decoded chunk.  Entries being decoded are already in the hash chains so
+// that a second reader of the chunk waits for it instead of decoding it
+// again; they join the LRU list once loaded.  Entries with references are
+// never evicted.
+//
+typedef struct ReaderEntry {
+    NvU64               chunk;
+    NvU8               *data;
+    NvLength            len;
+    unsigned int        refs;
+    int                 loading;
+    struct ReaderEntry *hashNext;
+    struct ReaderEntry *lruPrev;     // towards the most recently used
+    struct ReaderEntry *lruNext;
+} ReaderEntry;
+
+typedef struct {
+    pthread_mutex_t  lock;
+    pthread_cond_t   loaded;
+    ReaderEntry    **buckets;
+    unsigned int     numBuckets;     // a power of two
+    ReaderEntry     *lruHead;
+    ReaderEntry     *lruTail;
+    NvU8            *spare;          // buffer of the last evicted entry
+    NvLength         bytes;
+    NvLength         capacity;
+    NvU64            hits;
+    NvU64            misses;
+    NvU64            readAheads;
+    NvU64            evictions;
+} ReaderShard;
+
+struct DumpReader {
+    ReaderFormat     format;
+    int              fd;
+    const NvU8      *map;            // the whole file, for raw and seekable
+    NvLength         mapSize;
+    ImageFile        image;
+    SeekTable        table;
+    SegmentSet       segments;
+    const NvU8     **segmentMaps;    // one mapping per segment
+    NvU64            size;
+    NvU64            baseAddress;
+
+    NvU64            numChunks;      // 0 for raw dumps, which are not cached
+    NvLength         chunkBytes;     // images: every chunk but the last
+    NvLength         maxChunkBytes;
+    NvU64           *chunkStart;     // seekable: numChunks+1 dump offsets
+    NvU64           *frameOffset;    // seekable: file offset of each frame
+
+    ReaderShard     *shards;
+    unsigned int     numShards;
+
+    unsigned int     readAhead;
+    NvU64            lastChunk;      // last chunk a read touched
+    NvU64            aheadUntil;     // last chunk queued for read-ahead
+    NvU64           *queue;
+    unsigned int     queueSize;
+    unsigned int     queueHead;
+    unsigned int     queueCount;
+    int              stopping;
+    pthread_mutex_t  queueLock;
+    pthread_cond_t   queueCond;
+    pthread_t       *threads;
+    unsigned int     numThreads;
+};
+
+void readerOptionsInit(ReaderOptions *options) {
+    memset(options, 0, sizeof(*options));
+    options->cacheBytes       = READER_DEFAULT_CACHE_BYTES;
+    options->shards           = READER_DEFAULT_SHARDS;
+    options->readAhead        = READER_DEFAULT_READ_AHEAD;
+    options->readAheadThreads = 2;
+}
+
+const char *readerFormatName(ReaderFormat format) {
+    switch (format) {
+        case READER_RAW:      return "raw";
+        case READER_SEEKABLE: return "seekable";
+        case READER_IMAGE:    return "image";
+        case READER_SEGMENTED: return "segmented";
+    }
+    return "unknown";
+}
+
+ReaderFormat readerFormat(const DumpReader *reader) {
+    return reader->format;
+}
+
+NvU64 readerSize(const DumpReader *reader) {
+    return reader->size;
+}
+
+NvU64 readerBaseAddress(const DumpReader *reader) {
+    return reader->baseAddress;
+}
+
+static NvU64 readerFindChunk(const DumpReader *reader, NvU64 offset) {
+    NvU64 lo = 0, hi = reader->numChunks - 1;
+
+    if (reader->format == READER_IMAGE)
+        return offset / reader->chunkBytes;
+
+    // Largest i with chunkStart[i] <= offset.
+    while (lo < hi) {
+        NvU64 mid = lo + (hi - lo + 1) / 2;
+        if (reader->chunkStart[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+static NvU64 readerChunkStart(const DumpReader *reader, NvU64 i) {
+    if (reader->format == READER_IMAGE)
+        return i * reader->chunkBytes;
+    return reader->chunkStart[i];
+}
+
+static NvLength readerChunkLength(const DumpReader *reader, NvU64 i) {
+    if (reader->format == READER_IMAGE)
+        return reader->image.index[i].length;
+    return reader->table.entries[i].decompressedSize;
+}
+
+// Raw image chunks are read in place; everything else goes through the cache.
+static int readerChunkCached(const DumpReader *reader, NvU64 i) {
+    return reader->format != READER_IMAGE ||
+           reader->image.index[i].kind != IMAGE_CHUNK_RAW;
+}
+
+static int readerDecode(DumpReader *reader, NvU64 i, void *buf) {
+    NvLength len = readerChunkLength(reader, i);
+
+    if (reader->format == READER_IMAGE)
+        return imageReadChunk(&reader->image, i, buf) == len ? 0 : -1;
+
+    if (decompressChunk(buf, len, reader->map + reader->frameOffset[i],
+                        reader->table.entries[i].compressedSize) != len) {
+        nv_error_msg("Failed to decompress chunk %llu.\n",
+                     (unsigned long long)i);
+        return -1;
+    }
+    return 0;
+}
+
+static ReaderEntry **readerBucket(const DumpReader *reader, ReaderShard *shard,
+                                  NvU64 i) {
+    return &shard->buckets[(i / reader->numShards) & (shard->numBuckets - 1)];
+}
+
+static ReaderEntry *readerShardFind(const DumpReader *reader,
+                                    ReaderShard *shard, NvU64 i) {
+    ReaderEntry *entry = *readerBucket(reader, shard, i);
+
+    while (entry && entry->chunk != i)
+        entry = entry->hashNext;
+    return entry;
+}
+
+static void readerShardUnhash(const DumpReader *reader, ReaderShard *shard,
+                              ReaderEntry *entry) {
+    ReaderEntry **link = readerBucket(reader, shard, entry->chunk);
+
+    while (*link != entry)
+        link = &(*link)->hashNext;
+    *link = entry->hashNext;
+}
+
+static void readerLruUnlink(ReaderShard *shard, ReaderEntry *entry) {
+    if (entry->lruPrev)
+        entry->lruPrev->lruNext = entry->lruNext;
+    else
+        shard->lruHead = entry->lruNext;
+    if (entry->lruNext)
+        entry->lruNext->lruPrev = entry->lruPrev;
+    else
+        shard->lruTail = entry->lruPrev;
+}
+
+static void readerLruPush(ReaderShard *shard, ReaderEntry *entry) {
+    entry->lruPrev = NULL;
+    entry->lruNext = shard->lruHead;
+    if (shard->lruHead)
+        shard->lruHead->lruPrev = entry;
+    else
+        shard->lruTail = entry;
+    shard->lruHead = entry;
+}
+
+static void readerFreeEntry(ReaderEntry *entry) {
+    free(entry->data);
+    nvfree(entry);
+}
+
+//
+// Misses reuse the buffer of the last evicted entry rather than fault in a
+// fresh one each time.
+//
+static NvU8 *readerGetBuffer(const DumpReader *reader, ReaderShard *shard) {
+    NvU8 *buf = shard->spare;
+
+    shard->spare = NULL;
+    return buf ? buf : malloc(reader->maxChunkBytes);
+}
+
+static void readerPutBuffer(ReaderShard *shard, NvU8 *buf) {
+    if (shard->spare)
+        free(buf);
+    else
+        shard->spare = buf;
+}
+
+// Drops the least recently used unreferenced entries while over capacity.
+static void readerShardEvict(const DumpReader *reader, ReaderShard *shard) {
+    ReaderEntry *entry = shard->lruTail;
+
+    while (entry && shard->bytes > shard->capacity) {
+        ReaderEntry *prev = entry->lruPrev;
+
+        if (entry->refs == 0) {
+            readerLruUnlink(shard, entry);
+            readerShardUnhash(reader, shard, entry);
+            shard->bytes -= entry->len;
+            shard->evictions++;
+            readerPutBuffer(shard, entry->data);
+            nvfree(entry);
+        }
+        entry = prev;
+    }
+}
+
+//
+// Returns chunk i with a reference held, decoding it if it is not cached, or
+// NULL if it cannot be decoded.  Read-ahead (prefetch set) only decodes
+// chunks nobody has and returns NULL otherwise.
+//
+static ReaderEntry *readerAcquire(DumpReader *reader, NvU64 i, int prefetch) {
+    ReaderShard *shard = &reader->shards[i % reader->numShards];
+    ReaderEntry *entry, **bucket;
+    int failed;
+
+    pthread_mutex_lock(&shard->lock);
+    while ((entry = readerShardFind(reader, shard, i)) != NULL) {
+        if (prefetch) {
+            pthread_mutex_unlock(&shard->lock);
+            return NULL;
+        }
+        if (!entry->loading) {
+            entry->refs++;
+            readerLruUnlink(shard, entry);
+            readerLruPush(shard, entry);
+            shard->hits++;
+            pthread_mutex_unlock(&shard->lock);
+            return entry;
+        }
+        pthread_cond_wait(&shard->loaded, &shard->lock);
+    }
+
+    entry = nvalloc(sizeof(*entry));
+    entry->chunk   = i;
+    entry->refs    = 1;
+    entry->loading = 1;
+    bucket = readerBucket(reader, shard, i);
+    entry->hashNext = *bucket;
+    *bucket = entry;
+    if (prefetch)
+        shard->readAheads++;
+    else
+        shard->misses++;
+    // Images decode into a buffer of a whole chunk even for the last one.
+    entry->data = readerGetBuffer(reader, shard);
+    pthread_mutex_unlock(&shard->lock);
+
+    failed = !entry->data || readerDecode(reader, i, entry->data);
+
+    pthread_mutex_lock(&shard->lock);
+    entry->loading = 0;
+    if (failed) {
+        readerShardUnhash(reader, shard, entry);
+    } else {
+        entry->len = readerChunkLength(reader, i);
+        readerLruPush(shard, entry);
+        shard->bytes += entry->len;
+        readerShardEvict(reader, shard);
+    }
+    pthread_cond_broadcast(&shard->loaded);
+    pthread_mutex_unlock(&shard->lock);
+
+    if (failed) {
+        readerFreeEntry(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+static void readerRelease(DumpReader *reader, ReaderEntry *entry) {
+    ReaderShard *shard;
+
+    if (!entry)
+        return;
+
+    shard = &reader->shards[entry->chunk % reader->numShards];
+    pthread_mutex_lock(&shard->lock);
+    if (--entry->refs == 0)
+        readerShardEvict(reader, shard);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static void *readerAheadThread(void *arg) {
+    DumpReader *reader = arg;
+
+    pthread_mutex_lock(&reader->queueLock);
+    while (!reader->stopping) {
+        NvU64 i;
+
+        if (reader->queueCount == 0) {
+            pthread_cond_wait(&reader->queueCond, &reader->queueLock);
+            continue;
+        }
+        i = reader->queue[reader->queueHead];
+        reader->queueHead = (reader->queueHead + 1) % reader->queueSize;
+        reader->queueCount--;
+        pthread_mutex_unlock(&reader->queueLock);
+
+        readerRelease(reader, readerAcquire(reader, i, 1));
+
+        pthread_mutex_lock(&reader->queueLock);
+    }
+    pthread_mutex_unlock(&reader->queueLock);
+
+    return NULL;
+}
+
+//
+// Queues the chunks after i for read-ahead when reads have just moved from
+// chunk i-1 to chunk i.  Reads within a chunk and random reads only cost an
+// atomic exchange.
+//
+static void readerNoteAccess(DumpReader *reader, NvU64 i) {
+    NvU64 prev, from, to, c;
+
+    if (reader->numThreads == 0)
+        return;
+
+    prev = __atomic_exchange_n(&reader->lastChunk, i, __ATOMIC_RELAXED);
+    if (prev + 1 != i)
+        return;
+
+    to = NV_MIN(i + reader->readAhead, reader->numChunks - 1);
+
+    pthread_mutex_lock(&reader->queueLock);
+    from = i + 1;
+    if (reader->aheadUntil >= from && reader->aheadUntil <= to)
+        from = reader->aheadUntil + 1;
+
+    for (c = from; c <= to && reader->queueCount < reader->queueSize; c++) {
+        if (!readerChunkCached(reader, c))
+            continue;
+        reader->queue[(reader->queueHead + reader->queueCount) %
+                      reader->queueSize] = c;
+        reader->queueCount++;
+    }
+    if (c > from) {
+        reader->aheadUntil = c - 1;
+        pthread_cond_signal(&reader->queueCond);
+    }
+    pthread_mutex_unlock(&reader->queueLock);
+}
+
+//
+// Returns a pointer to the byte at offset, which must be in the dump, and in
+// *avail how many bytes follow it in the same chunk (or mapping).  *entry is
+// set to the cache entry to release afterwards, if any.
+//
+static const NvU8 *readerLocate(DumpReader *reader, NvU64 offset,
+                                NvLength *avail, ReaderEntry **entry) {
+    NvU64 i, start;
+
+    *entry = NULL;
+
+    if (reader->format == READER_RAW) {
+        *avail = reader->size - offset;
+        return reader->map + offset;
+    }
+
+    if (reader->format == READER_SEGMENTED) {
+        NvU64 inSegment;
+        unsigned int s = segmentLocate(&reader->segments, offset, &inSegment);
+
+        *avail = segmentLength(&reader->segments, s) - inSegment;
+        return reader->segmentMaps[s] + inSegment;
+    }
+
+    i = readerFindChunk(reader, offset);
+    start = readerChunkStart(reader, i);
+    *avail = start + readerChunkLength(reader, i) - offset;
+    readerNoteAccess(reader, i);
+
+    if (!readerChunkCached(reader, i))
+        return reader->image.map + reader->image.index[i].offset +
+               (offset - start);
+
+    *entry = readerAcquire(reader, i, 0);
+    if (!*entry)
+        return NULL;
+    return (*entry)->data + (offset - start);
+}
+
+static int readerCheckRange(const DumpReader *reader, NvU64 offset,
+                            NvLength len) {
+    if (offset > reader->size || len > reader->size - offset) {
+        nv_error_msg("0x%llx-0x%llx is not in the dump.\n",
+                     (unsigned long long)offset,
+                     (unsigned long long)(offset + len));
+        return -1;
+    }
+    return 0;
+}
+
+int readerRead(DumpReader *reader, NvU64 offset, void *buf, NvLength len) {
+    NvU8 *out = buf;
+
+    if (readerCheckRange(reader, offset, len))
+        return -1;
+
+    while (len) {
+        ReaderEntry *entry;
+        NvLength avail;
+        const NvU8 *p = readerLocate(reader, offset, &avail, &entry);
+
+        if (!p)
+            return -1;
+
+        avail = NV_MIN(avail, len);
+        memcpy(out, p, avail);
+        readerRelease(reader, entry);
+
+        out    += avail;
+        offset += avail;
+        len    -= avail;
+    }
+
+    return 0;
+}
+
+int readerForEachPage(DumpReader *reader, NvU64 offset, NvLength len,
+                      NvLength pageSize, ReaderPageFunc func, void *ctx) {
+    NvU8 *bounce = NULL;
+    int ret = 0;
+
+    if (pageSize == 0 || readerCheckRange(reader, offset, len))
+        return -1;
+
+    while (len && ret == 0) {
+        ReaderEntry *entry;
+        NvLength avail, n;
+        const NvU8 *p = readerLocate(reader, offset, &avail, &entry);
+
+        if (!p) {
+            ret = -1;
+            break;
+        }
+
+        // Pages within the chunk are passed in place.
+        while (len && ret == 0 && (n = NV_MIN(pageSize, len)) <= avail) {
+            ret = func(ctx, offset, p, n);
+            p      += n;
+            avail  -= n;
+            offset += n;
+            len    -= n;
+        }
+        readerRelease(reader, entry);
+
+        // A page that straddles two chunks is put together in a copy.
+        if (len && ret == 0 && avail) {
+            n = NV_MIN(pageSize, len);
+            if (!bounce)
+                bounce = nvalloc(pageSize);
+            if (readerRead(reader, offset, bounce, n))
+                ret = -1;
+            else
+                ret = func(ctx, offset, bounce, n);
+            offset += n;
+            len    -= n;
+        }
+    }
+
+    nvfree(bounce);
+    return ret;
+}
+
+void readerGetStats(DumpReader *reader, ReaderStats *stats) {
+    unsigned int s;
+
+    memset(stats, 0, sizeof(*stats));
+    for (s = 0; s < reader->numShards; s++) {
+        ReaderShard *shard = &reader->shards[s];
+
+        pthread_mutex_lock(&shard->lock);
+        stats->hits       += shard->hits;
+        stats->misses     += shard->misses;
+        stats->readAheads += shard->readAheads;
+        stats->evictions  += shard->evictions;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+// Works out where each frame of a seekable dump starts, in the file and in
+// the dump.
+static int readerIndexFrames(DumpReader *reader) {
+    NvU64 fileOffset = 0;
+    NvU32 i;
+
+    reader->numChunks   = reader->table.count;
+    reader->chunkStart  = nvalloc((reader->numChunks + 1) * sizeof(NvU64));
+    reader->frameOffset = nvalloc((reader->numChunks + 1) * sizeof(NvU64));
+
+    for (i = 0; i < reader->table.count; i++) {
+        const SeekTableEntry *e = &reader->table.entries[i];
+
+        if (e->decompressedSize == 0)
+            return -1;
+        reader->frameOffset[i]    = fileOffset;
+        reader->chunkStart[i + 1] = reader->chunkStart[i] +
+                                    e->decompressedSize;
+        reader->maxChunkBytes = NV_MAX(reader->maxChunkBytes,
+                                       e->decompressedSize);
+        fileOffset += e->compressedSize;
+    }
+    reader->size = reader->chunkStart[reader->numChunks];
+
+    return fileOffset <= reader->mapSize ? 0 : -1;
+}
+
+static void readerInitCache(DumpReader *reader, const ReaderOptions *options) {
+    NvU64 perShard;
+    unsigned int s, buckets;
+
+    // Every shard must be able to hold at least one chunk.
+    reader->numShards = NV_MAX(options->shards, 1);
+    reader->numShards = NV_MIN(reader->numShards,
+                               NV_MAX(options->cacheBytes /
+                                      reader->maxChunkBytes, 1));
+    perShard = options->cacheBytes / reader->numShards;
+
+    for (buckets = 16; buckets < 2 * perShard / reader->maxChunkBytes;
+         buckets *= 2)
+        ;
+
+    reader->shards = nvalloc(reader->numShards * sizeof(ReaderShard));
+    for (s = 0; s < reader->numShards; s++) {
+        ReaderShard *shard = &reader->shards[s];
+
+        pthread_mutex_init(&shard->lock, NULL);
+        pthread_cond_init(&shard->loaded, NULL);
+        shard->numBuckets = buckets;
+        shard->buckets    = nvalloc(buckets * sizeof(ReaderEntry *));
+        shard->capacity   = perShard;
+    }
+}
+
+static void readerStartReadAhead(DumpReader *reader,
+                                 const ReaderOptions *options) {
+    unsigned int t;
+
+    reader->readAhead  = options->readAhead;
+    reader->queueSize  = NV_MAX(4 * options->readAhead, 16);
+    reader->queue      = nvalloc(reader->queueSize * sizeof(NvU64));
+    reader->threads    = nvalloc(options->readAheadThreads *
+                                 sizeof(pthread_t));
+
+    for (t = 0; t < options->readAheadThreads; t++) {
+        if (pthread_create(&reader->threads[t], NULL, readerAheadThread,
+                           reader))
+            break;
+        reader->numThreads++;
+    }
+}
+
+// Maps every segment of a segmented dump, which is then read in place.
+static int readerMapSegments(DumpReader *reader) {
+    const SegmentSet *set = &reader->segments;
+    unsigned int s;
+
+    reader->segmentMaps = nvalloc(set->count * sizeof(NvU8 *));
+    for (s = 0; s < set->count; s++) {
+        void *map = mmap(NULL, segmentLength(set, s), PROT_READ, MAP_SHARED,
+                         set->fds[s], 0);
+        if (map == MAP_FAILED) {
+            nv_error_msg("Failed to map %s: %s.\n", set->paths[s],
+                         strerror(errno));
+            return -1;
+        }
+        reader->segmentMaps[s] = map;
+    }
+
+    reader->format = READER_SEGMENTED;
+    reader->size   = set->sizeBytes;
+    return 0;
+}
+
+DumpReader *readerOpen(const char *path, const ReaderOptions *options) {
+    ReaderOptions defaults;
+    DumpReader *reader;
+    struct stat st;
+    int ret;
+
+    if (!options) {
+        readerOptionsInit(&defaults);
+        options = &defaults;
+    }
+
+    reader = nvalloc(sizeof(*reader));
+    reader->image.fd  = -1;
+    reader->lastChunk = ~0ull;
+    pthread_mutex_init(&reader->queueLock, NULL);
+    pthread_cond_init(&reader->queueCond, NULL);
+
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0) {
+        nv_error_msg("Failed to open %s: %s.\n", path, strerror(errno));
+        goto fail;
+    }
+
+    ret = imageOpenFd(reader->fd, &reader->image);
+    if (ret < 0)
+        goto fail;
+
+    if (ret == 0) {
+        const ImageFile *image = &reader->image;
+
+        reader->format        = READER_IMAGE;
+        reader->baseAddress   = image->header->baseAddress;
+        reader->chunkBytes    = image->header->chunkBytes;
+        reader->maxChunkBytes = reader->chunkBytes;
+        reader->numChunks     = image->count;
+        if (image->count)
+            reader->size = (image->count - 1) * reader->chunkBytes +
+                           image->index[image->count - 1].length;
+    } else if ((ret = segmentSetOpenFd(&reader->segments, reader->fd,
+                                       path)) <= 0) {
+        if (ret < 0 || readerMapSegments(reader))
+            goto fail;
+    } else {
+        if (fstat(reader->fd, &st)) {
+            nv_error_msg("Failed to stat %s: %s.\n", path, strerror(errno));
+            goto fail;
+        }
+        if ((NvU64)st.st_size > SIZE_MAX) {
+            nv_error_msg("%s is too large to map.\n", path);
+            goto fail;
+        }
+
+        reader->mapSize = st.st_size;
+        if (reader->mapSize) {
+            void *map = mmap(NULL, reader->mapSize, PROT_READ, MAP_SHARED,
+                             reader->fd, 0);
+            if (map == MAP_FAILED) {
+                nv_error_msg("Failed to map %s: %s.\n", path,
+                             strerror(errno));
+                goto fail;
+            }
+            reader->map = map;
+        }
+
+        if (seekTableRead(reader->fd, &reader->table) == 0) {
+            reader->format = READER_SEEKABLE;
+            if (readerIndexFrames(reader)) {
+                nv_error_msg("The seek table of %s does not match its "
+                             "frames.\n", path);
+                goto fail;
+            }
+        } else {
+            reader->format = READER_RAW;
+            reader->size   = reader->mapSize;
+        }
+    }
+
+    if (reader->numChunks) {
+        readerInitCache(reader, options);
+        if (options->readAhead && options->readAheadThreads)
+            readerStartReadAhead(reader, options);
+    }
+
+    return reader;
+
+fail:
+    readerClose(reader);
+    return NULL;
+}
+
+void readerClose(DumpReader *reader) {
+    unsigned int s, t;
+
+    if (!reader)
+        return;
+
+    pthread_mutex_lock(&reader->queueLock);
+    reader->stopping = 1;
+    pthread_cond_broadcast(&reader->queueCond);
+    pthread_mutex_unlock(&reader->queueLock);
+    for (t = 0; t < reader->numThreads; t++)
+        pthread_join(reader->threads[t], NULL);
+
+    for (s = 0; s < reader->numShards; s++) {
+        ReaderShard *shard = &reader->shards[s];
+        ReaderEntry *entry = shard->lruHead;
+
+        while (entry) {
+            ReaderEntry *next = entry->lruNext;
+            readerFreeEntry(entry);
+            entry = next;
+        }
+        free(shard->spare);
+        nvfree(shard->buckets);
+        pthread_cond_destroy(&shard->loaded);
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    pthread_cond_destroy(&reader->queueCond);
+    pthread_mutex_destroy(&reader->queueLock);
+
+    if (reader->map)
+        munmap((void *)reader->map, reader->mapSize);
+    for (s = 0; reader->segmentMaps && s < reader->segments.count; s++) {
+        if (reader->segmentMaps[s])
+            munmap((void *)reader->segmentMaps[s],
+                   segmentLength(&reader->segments, s));
+    }
+    nvfree(reader->segmentMaps);
+    segmentSetClose(&reader->segments);
+    imageClose(&reader->image);
+    if (reader->fd >= 0)
+        close(reader->fd);
+
+    seekTableFree(&reader->table);
+    nvfree(reader->chunkStart);
+    nvfree(reader->frameOffset);
+    nvfree(reader->queue);
+    nvfree(reader->threads);
+    nvfree(reader->shards);
+    nvfree(reader);
+}
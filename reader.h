@@ -0,0 +1,120 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _READER_H_
+#define _READER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+
+/*
+ * Random access to dump files
+ *
+ * A reader opens any dump dump_fb writes: a raw (or sparse) copy of memory,
+ * a seekable zstd/lz4 stream (see compress.h), an image (see image.h) or
+ * the manifest of a segmented dump (see segment.h), and serves reads at any
+ * offset without decompressing the whole file.  Offsets are relative to the
+ * first byte of the dump; a segmented dump reads as its segments put back
+ * together.
+ *
+ * Raw dumps, segments and the raw chunks of images are mapped and read in
+ * place.
+ * Other chunks are decoded (and image chunks checked against their CRC) into
+ * a cache of ReaderOptions.cacheBytes, split into shards with their own lock
+ * and LRU list so that threads reading different chunks do not contend.
+ * When reads move forward through the dump, background threads decode the
+ * next readAhead chunks before they are asked for.
+ *
+ * A reader may be used from several threads at once.
+ */
+
+typedef enum {
+    READER_RAW = 0,
+    READER_SEEKABLE,
+    READER_IMAGE,
+    READER_SEGMENTED,
+} ReaderFormat;
+
+typedef struct {
+    NvLength     cacheBytes;      // decoded chunks kept in memory
+    unsigned int shards;          // independently locked parts of the cache
+    unsigned int readAhead;       // chunks decoded ahead, 0 to disable
+    unsigned int readAheadThreads;
+} ReaderOptions;
+
+typedef struct {
+    NvU64 hits;
+    NvU64 misses;          // chunks decoded for a read
+    NvU64 readAheads;      // chunks decoded by the read-ahead threads
+    NvU64 evictions;
+} ReaderStats;
+
+typedef struct DumpReader DumpReader;
+
+void readerOptionsInit(ReaderOptions *options);
+
+//
+// Opens path, detecting its format.  options may be NULL for the defaults.
+// Returns NULL (after printing an error) if the file cannot be read or is a
+// damaged image or seek table.
+//
+DumpReader *readerOpen(const char *path, const ReaderOptions *options);
+void readerClose(DumpReader *reader);
+
+ReaderFormat readerFormat(const DumpReader *reader);
+const char *readerFormatName(ReaderFormat format);
+
+// Bytes of memory in the dump.
+NvU64 readerSize(const DumpReader *reader);
+
+// GPU offset of the first byte, when the file records it (images), else 0.
+NvU64 readerBaseAddress(const DumpReader *reader);
+
+//
+// Copies len bytes at offset into buf.  Returns 0 on success, -1 (after
+// printing an error) if the range is outside the dump or a chunk it touches
+// is damaged.
+//
+int readerRead(DumpReader *reader, NvU64 offset, void *buf, NvLength len);
+
+//
+// Calls func for each pageSize piece of [offset, offset+len), in order and
+// without copying when the bytes are mapped or cached.  The last piece may be
+// shorter.  Stops early and returns func's value if it is non-zero; returns
+// -1 if a chunk cannot be read.
+//
+typedef int (*ReaderPageFunc)(void *ctx, NvU64 offset, const void *page,
+                              NvLength len);
+
+int readerForEachPage(DumpReader *reader, NvU64 offset, NvLength len,
+                      NvLength pageSize, ReaderPageFunc func, void *ctx);
+
+void readerGetStats(DumpReader *reader, ReaderStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
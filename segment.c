@@ -0,0 +1,362 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "segment.h"
+#include "common-utils.h"
+#include "msg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define SEGMENT_MANIFEST_MAGIC "dump_fb-segments "
+
+int segmentParseDirs(const char *list, char ***dirs) {
+    const char *p = list;
+    int count = 0;
+
+    *dirs = NULL;
+
+    do {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+
+        if (len == 0) {
+            nv_error_msg("Invalid directory list '%s'; expected "
+                         "DIR[,DIR...].\n", list);
+            segmentDirsFree(*dirs, count);
+            *dirs = NULL;
+            return -1;
+        }
+
+        *dirs = nvrealloc(*dirs, (count + 1) * sizeof(char *));
+        (*dirs)[count] = nvalloc(len + 1);
+        memcpy((*dirs)[count], p, len);
+        count++;
+        p += len;
+    } while (*p++ == ',');
+
+    return count;
+}
+
+void segmentDirsFree(char **dirs, int count) {
+    int i;
+
+    for (i = 0; i < count; i++)
+        nvfree(dirs[i]);
+    nvfree(dirs);
+}
+
+static void segmentSetAlloc(SegmentSet *set, unsigned int count) {
+    unsigned int i;
+
+    set->count = count;
+    set->paths = nvalloc(count * sizeof(char *));
+    set->fds   = nvalloc(count * sizeof(int));
+    for (i = 0; i < count; i++)
+        set->fds[i] = -1;
+}
+
+int segmentSetCreate(SegmentSet *set, const char *file, char *const *dirs,
+                     unsigned int targets, NvLength segmentBytes,
+                     NvU64 sizeBytes) {
+    char **absDirs;
+    char *base;
+    unsigned int i, t;
+    int ret = 0;
+
+    memset(set, 0, sizeof(*set));
+    if (targets == 0 || segmentBytes == 0 || sizeBytes == 0)
+        return -1;
+
+    set->sizeBytes    = sizeBytes;
+    set->segmentBytes = segmentBytes;
+    set->targets      = targets;
+
+    // The manifest may be read from anywhere.
+    absDirs = nvalloc(targets * sizeof(char *));
+    for (t = 0; t < targets; t++) {
+        absDirs[t] = realpath(dirs[t], NULL);
+        if (!absDirs[t]) {
+            nv_error_msg("Cannot use segment directory %s: %s.\n", dirs[t],
+                         strerror(errno));
+            ret = -1;
+            goto done;
+        }
+    }
+
+    base = nv_basename(file);
+    segmentSetAlloc(set, (unsigned int)((sizeBytes + segmentBytes - 1) /
+                                        segmentBytes));
+
+    for (i = 0; i < set->count; i++) {
+        set->paths[i] = nvasprintf("%s/%s.seg%05u", absDirs[i % targets],
+                                   base, i);
+        set->fds[i] = open(set->paths[i], O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (set->fds[i] < 0) {
+            if (errno == EEXIST)
+                nv_error_msg("Refusing to overwrite file that already "
+                             "exists: %s.\n", set->paths[i]);
+            else
+                nv_error_msg("Failed to create %s: %s.\n", set->paths[i],
+                             strerror(errno));
+            ret = -1;
+            break;
+        }
+        if (ftruncate(set->fds[i], segmentLength(set, i))) {
+            nv_error_msg("Failed to size %s: %s.\n", set->paths[i],
+                         strerror(errno));
+            ret = -1;
+            break;
+        }
+    }
+    free(base);
+
+done:
+    for (t = 0; t < targets; t++)
+        free(absDirs[t]);
+    nvfree(absDirs);
+
+    // Only the segments opened here were created here.
+    for (i = 0; ret && i < set->count; i++) {
+        if (set->fds[i] >= 0)
+            unlink(set->paths[i]);
+    }
+    if (ret)
+        segmentSetClose(set);
+
+    return ret;
+}
+
+int segmentManifestWrite(const SegmentSet *set, int fd) {
+    char *text = nvasprintf(SEGMENT_MANIFEST_MAGIC "%d\n",
+                            SEGMENT_MANIFEST_VERSION);
+    const char *p;
+    size_t len;
+    unsigned int i;
+    int ret = 0;
+
+    nv_append_sprintf(&text, "size %llu\n",
+                      (unsigned long long)set->sizeBytes);
+    nv_append_sprintf(&text, "segment-size %llu\n",
+                      (unsigned long long)set->segmentBytes);
+    nv_append_sprintf(&text, "targets %u\n", set->targets);
+    for (i = 0; i < set->count; i++)
+        nv_append_sprintf(&text, "segment %u %s\n", i, set->paths[i]);
+
+    p   = text;
+    len = strlen(text);
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            nv_error_msg("Failed to write the segment manifest: %s.\n",
+                         strerror(n < 0 ? errno : EIO));
+            ret = -1;
+            break;
+        }
+        p   += n;
+        len -= n;
+    }
+    nvfree(text);
+
+    return ret;
+}
+
+//
+// Opens segment i at its recorded path or, failing that, under the same
+// name next to the manifest.
+//
+static int segmentOpenOne(SegmentSet *set, unsigned int i,
+                          const char *manifest) {
+    struct stat st;
+
+    set->fds[i] = open(set->paths[i], O_RDONLY);
+    if (set->fds[i] < 0 && errno == ENOENT && manifest) {
+        const char *slash = strrchr(manifest, '/');
+        char *name = nv_basename(set->paths[i]);
+        char *moved = slash ? nvasprintf("%.*s/%s", (int)(slash - manifest),
+                                         manifest, name) : nvstrdup(name);
+
+        set->fds[i] = open(moved, O_RDONLY);
+        if (set->fds[i] >= 0) {
+            nvfree(set->paths[i]);
+            set->paths[i] = moved;
+        } else {
+            nvfree(moved);
+        }
+        free(name);
+    }
+
+    if (set->fds[i] < 0) {
+        nv_error_msg("Failed to open segment %s: %s.\n", set->paths[i],
+                     strerror(errno));
+        return -1;
+    }
+
+    if (fstat(set->fds[i], &st) || (NvU64)st.st_size < segmentLength(set, i)) {
+        nv_error_msg("Segment %s is shorter than the manifest says.\n",
+                     set->paths[i]);
+        return -1;
+    }
+
+    return 0;
+}
+
+int segmentSetOpenFd(SegmentSet *set, int fd, const char *path) {
+    char magic[sizeof(SEGMENT_MANIFEST_MAGIC) - 1];
+    unsigned long long size = 0, segmentBytes = 0;
+    unsigned int targets = 0, index, next = 0, i;
+    int version = 0, offset;
+    char *text = NULL, *line, *end;
+    struct stat st;
+
+    memset(set, 0, sizeof(*set));
+
+    if (pread(fd, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic) ||
+        memcmp(magic, SEGMENT_MANIFEST_MAGIC, sizeof(magic)))
+        return 1;
+
+    // Even a manifest of thousands of segments is a few hundred kilobytes.
+    if (fstat(fd, &st) || st.st_size > 64*1024*1024)
+        goto bad;
+    text = nvalloc(st.st_size + 1);
+    if (pread(fd, text, st.st_size, 0) != st.st_size)
+        goto bad;
+
+    for (line = text; *line; line = end) {
+        end = strchr(line, '\n');
+        if (!end)
+            goto bad;
+        *end++ = '\0';
+
+        if (sscanf(line, SEGMENT_MANIFEST_MAGIC "%d", &version) == 1)
+            continue;
+        if (sscanf(line, "size %llu", &size) == 1 ||
+            sscanf(line, "segment-size %llu", &segmentBytes) == 1 ||
+            sscanf(line, "targets %u", &targets) == 1)
+            continue;
+
+        if (sscanf(line, "segment %u %n", &index, &offset) != 1 ||
+            !line[offset])
+            goto bad;
+
+        // The layout has to be known before the first segment.
+        if (!set->paths) {
+            if (version != SEGMENT_MANIFEST_VERSION || !size ||
+                !segmentBytes || !targets ||
+                (size + segmentBytes - 1) / segmentBytes > UINT_MAX)
+                goto bad;
+            set->sizeBytes    = size;
+            set->segmentBytes = segmentBytes;
+            set->targets      = targets;
+            segmentSetAlloc(set, (unsigned int)((size + segmentBytes - 1) /
+                                                segmentBytes));
+        }
+        if (index != next || index >= set->count)
+            goto bad;
+        set->paths[next++] = nvstrdup(line + offset);
+    }
+
+    if (!set->paths || next != set->count)
+        goto bad;
+    nvfree(text);
+
+    for (i = 0; i < set->count; i++) {
+        if (segmentOpenOne(set, i, path)) {
+            segmentSetClose(set);
+            return -1;
+        }
+    }
+
+    return 0;
+
+bad:
+    nv_error_msg("Segment manifest %s is malformed.\n",
+                 path ? path : "of the dump");
+    nvfree(text);
+    segmentSetClose(set);
+    return -1;
+}
+
+int segmentRead(const SegmentSet *set, void *buf, NvLength len,
+                NvU64 offset) {
+    char *p = buf;
+
+    if (offset > set->sizeBytes || len > set->sizeBytes - offset) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (len) {
+        NvU64 inSegment;
+        unsigned int i = segmentLocate(set, offset, &inSegment);
+        size_t n = NV_MIN(len, segmentLength(set, i) - inSegment);
+        ssize_t ret = pread(set->fds[i], p, n, inSegment);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            if (ret == 0)
+                errno = EIO;
+            return -1;
+        }
+        p      += ret;
+        offset += ret;
+        len    -= ret;
+    }
+
+    return 0;
+}
+
+int segmentSetSync(const SegmentSet *set) {
+    unsigned int i;
+
+    for (i = 0; i < set->count; i++) {
+        if (set->fds[i] >= 0 && fsync(set->fds[i])) {
+            nv_error_msg("Failed to flush %s: %s.\n", set->paths[i],
+                         strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void segmentSetClose(SegmentSet *set) {
+    unsigned int i;
+
+    for (i = 0; i < set->count; i++) {
+        if (set->fds[i] >= 0)
+            close(set->fds[i]);
+        nvfree(set->paths[i]);
+    }
+    nvfree(set->paths);
+    nvfree(set->fds);
+    memset(set, 0, sizeof(*set));
+}
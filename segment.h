@@ -0,0 +1,123 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _SEGMENT_H_
+#define _SEGMENT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+
+/*
+ * Segmented output
+ *
+ * A dump too fast for one disk can be split into segments of segmentBytes
+ * (the last one may be shorter) that rotate over several target
+ * directories, typically one per drive: segment i is NAME.segNNNNN in
+ * directory i % targets.  The file dump_fb was asked to write then holds a
+ * text manifest of the segments instead of the dump:
+ *
+ *   dump_fb-segments 1
+ *   size 4294967296
+ *   segment-size 1073741824
+ *   targets 2
+ *   segment 0 /mnt/nvme0/capture.seg00000
+ *   segment 1 /mnt/nvme1/capture.seg00001
+ *   ...
+ *
+ * The segments hold the bytes of the dump at their offsets, so the dump is
+ * their concatenation.  The reader (see reader.h) opens a manifest as one
+ * logical dump.  A segment that is no longer at its path is looked for next
+ * to the manifest, so the segments can be collected in one place.
+ */
+
+#define SEGMENT_MANIFEST_VERSION 1
+#define SEGMENT_DEFAULT_BYTES    (1024ull*1024*1024)
+
+typedef struct {
+    NvU64          sizeBytes;      // bytes of the whole dump
+    NvLength       segmentBytes;   // of every segment but the last
+    unsigned int   count;
+    unsigned int   targets;        // directories the segments rotate over
+    char         **paths;          // count file names
+    int           *fds;            // count descriptors, -1 when not open
+} SegmentSet;
+
+//
+// Parses a comma separated list of directories into *dirs (free with
+// segmentDirsFree).  Returns the number of directories, or -1 after an
+// error.
+//
+int segmentParseDirs(const char *list, char ***dirs);
+void segmentDirsFree(char **dirs, int count);
+
+//
+// Creates and sizes the segments of a sizeBytes dump, named after the base
+// name of file, refusing to overwrite any.  Returns 0, or -1 after an error.
+//
+int segmentSetCreate(SegmentSet *set, const char *file, char *const *dirs,
+                     unsigned int targets, NvLength segmentBytes,
+                     NvU64 sizeBytes);
+
+// Writes the manifest of set to fd.  Returns 0, or -1 after an error.
+int segmentManifestWrite(const SegmentSet *set, int fd);
+
+//
+// Reads the manifest in fd and opens its segments read-only.  path, if
+// set, is where fd was opened from; segments missing from their recorded
+// paths are then also looked for next to it.  Returns 0, 1 if fd does not
+// hold a segment manifest, or -1 after an error.
+//
+int segmentSetOpenFd(SegmentSet *set, int fd, const char *path);
+
+//
+// Reads len bytes of the dump at offset from the segments of an opened set.
+// Returns 0, or -1 with errno set.
+//
+int segmentRead(const SegmentSet *set, void *buf, NvLength len,
+                NvU64 offset);
+
+// The segment holding the dump's byte at offset, and its offset in there.
+static __inline__ unsigned int segmentLocate(const SegmentSet *set,
+                                             NvU64 offset, NvU64 *inSegment) {
+    *inSegment = offset % set->segmentBytes;
+    return (unsigned int)(offset / set->segmentBytes);
+}
+
+static __inline__ NvLength segmentLength(const SegmentSet *set,
+                                         unsigned int i) {
+    NvU64 start = (NvU64)i * set->segmentBytes;
+    return set->sizeBytes - start < set->segmentBytes ?
+           set->sizeBytes - start : set->segmentBytes;
+}
+
+// fsyncs every segment.  Returns 0, or -1 after an error.
+int segmentSetSync(const SegmentSet *set);
+void segmentSetClose(SegmentSet *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
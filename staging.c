@@ -0,0 +1,230 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "staging.h"
+#include "common-utils.h"
+#include "msg.h"
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+// /proc/self/pagemap entries
+#define PAGEMAP_PRESENT  (1ull << 63)
+#define PAGEMAP_PFN_MASK ((1ull << 55) - 1)
+#define PAGEMAP_BATCH    512
+
+static const char *g_stagingPagesNames[] = {
+    [STAGING_PAGES_4K]      = "4k",
+    [STAGING_PAGES_HUGETLB] = "hugetlb",
+    [STAGING_PAGES_THP]     = "thp",
+    [STAGING_PAGES_AUTO]    = "auto",
+};
+
+int stagingParsePages(const char *name, StagingPages *pages) {
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_LEN(g_stagingPagesNames); i++) {
+        if (!strcasecmp(name, g_stagingPagesNames[i])) {
+            *pages = (StagingPages)i;
+            return 0;
+        }
+    }
+
+    nv_error_msg("Unknown page type '%s'; use 4k, hugetlb, thp or auto.\n",
+                 name);
+    return -1;
+}
+
+const char *stagingPagesName(StagingPages pages) {
+    if ((unsigned int)pages >= ARRAY_LEN(g_stagingPagesNames))
+        return "unknown";
+    return g_stagingPagesNames[pages];
+}
+
+static size_t stagingRoundHuge(size_t bytes) {
+    return (bytes + STAGING_HUGE_PAGE_SIZE - 1) /
+           STAGING_HUGE_PAGE_SIZE * STAGING_HUGE_PAGE_SIZE;
+}
+
+static void *stagingMapHugetlb(size_t mapBytes) {
+    void *ptr = mmap(NULL, mapBytes, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_HUGE_2MB|
+                     MAP_POPULATE, -1, 0);
+
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+//
+// Maps a hugepage aligned region and asks for transparent hugepages before
+// touching it; populating it at mmap time would fault in 4 KB pages.
+//
+static void *stagingMapThp(size_t mapBytes) {
+    const long pageSize = sysconf(_SC_PAGE_SIZE);
+    size_t slack = STAGING_HUGE_PAGE_SIZE;
+    uintptr_t start, aligned;
+    void *ptr;
+    size_t off;
+
+    ptr = mmap(NULL, mapBytes + slack, PROT_READ|PROT_WRITE,
+               MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    start   = (uintptr_t)ptr;
+    aligned = (start + slack - 1) / slack * slack;
+    if (aligned > start)
+        munmap(ptr, aligned - start);
+    if (aligned + mapBytes < start + mapBytes + slack)
+        munmap((void *)(aligned + mapBytes),
+               start + mapBytes + slack - (aligned + mapBytes));
+    ptr = (void *)aligned;
+
+    // Only advice: without THP support this is plain 4 KB pages.
+    madvise(ptr, mapBytes, MADV_HUGEPAGE);
+
+    for (off = 0; off < mapBytes; off += pageSize)
+        ((volatile char *)ptr)[off] = 0;
+
+    return ptr;
+}
+
+RM_STATUS stagingAlloc(size_t bytes, StagingPages pages, StagingBuffer *buf) {
+    memset(buf, 0, sizeof(*buf));
+
+    if (bytes == 0)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    buf->bytes = bytes;
+
+    switch (pages) {
+        case STAGING_PAGES_4K:
+            buf->mapBytes = bytes;
+            buf->ptr = mmap(NULL, bytes, PROT_READ|PROT_WRITE,
+                            MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+            if (buf->ptr == MAP_FAILED)
+                buf->ptr = NULL;
+            break;
+
+        case STAGING_PAGES_HUGETLB:
+        case STAGING_PAGES_AUTO:
+            buf->mapBytes = stagingRoundHuge(bytes);
+            buf->ptr = stagingMapHugetlb(buf->mapBytes);
+            if (buf->ptr) {
+                pages = STAGING_PAGES_HUGETLB;
+                break;
+            }
+            if (pages == STAGING_PAGES_HUGETLB) {
+                nv_error_msg("Not enough free 2 MB hugepages for %llu bytes "
+                             "of staging memory; reserve more in "
+                             "/proc/sys/vm/nr_hugepages (see HugePages_Free "
+                             "in /proc/meminfo).\n",
+                             (unsigned long long)buf->mapBytes);
+                return RM_ERR_NO_MEMORY;
+            }
+            // fall through
+
+        case STAGING_PAGES_THP:
+            buf->mapBytes = stagingRoundHuge(bytes);
+            buf->ptr = stagingMapThp(buf->mapBytes);
+            pages = STAGING_PAGES_THP;
+            break;
+
+        default:
+            return RM_ERR_INVALID_ARGUMENT;
+    }
+
+    if (!buf->ptr) {
+        nv_error_msg("Failed to allocate %llu bytes of staging memory.\n",
+                     (unsigned long long)buf->mapBytes);
+        return RM_ERR_NO_MEMORY;
+    }
+
+    buf->pages = pages;
+    return RM_OK;
+}
+
+void stagingFree(StagingBuffer *buf) {
+    if (buf->ptr)
+        munmap(buf->ptr, buf->mapBytes);
+    buf->ptr = NULL;
+}
+
+NvU64 stagingPhysRuns(const void *ptr, size_t bytes, size_t maxRunBytes) {
+    const long pageSize = sysconf(_SC_PAGE_SIZE);
+    uintptr_t start = (uintptr_t)ptr / pageSize;
+    uintptr_t end = ((uintptr_t)ptr + bytes + pageSize - 1) / pageSize;
+    size_t pagesPerRun = maxRunBytes ? NV_MAX(maxRunBytes / pageSize, 1) : 0;
+    NvU64 entries[PAGEMAP_BATCH];
+    NvU64 runs = 0, prevPfn = 0;
+    uintptr_t page;
+    int fd, prevPresent = 0;
+
+    if (bytes == 0)
+        return 0;
+
+    fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    for (page = start; page < end; ) {
+        size_t count = NV_MIN(end - page, PAGEMAP_BATCH), i;
+        ssize_t got = pread(fd, entries, count * sizeof(NvU64),
+                            (off_t)page * sizeof(NvU64));
+
+        if (got != (ssize_t)(count * sizeof(NvU64))) {
+            runs = 0;
+            break;
+        }
+
+        for (i = 0; i < count; i++, page++) {
+            NvU64 pfn = entries[i] & PAGEMAP_PFN_MASK;
+            int present = !!(entries[i] & PAGEMAP_PRESENT);
+
+            // Present pages without a PFN: not allowed to see them
+            if (present && pfn == 0) {
+                close(fd);
+                return 0;
+            }
+
+            if (!present || !prevPresent || pfn != prevPfn + 1 ||
+                (pagesPerRun && (page - start) % pagesPerRun == 0))
+                runs++;
+            prevPfn = pfn;
+            prevPresent = present;
+        }
+    }
+
+    close(fd);
+    return runs;
+}
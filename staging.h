@@ -0,0 +1,91 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _STAGING_H_
+#define _STAGING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+#include <stddef.h>
+
+/*******************************************************************************
+    Staging buffers
+
+    The driver pins a dump's output buffer with get_user_pages and issues one
+    copy for every run of physically contiguous pages.  Buffers built from
+    4 KB pages usually resolve to one run per page; buffers backed by 2 MB
+    hugepages resolve to a run per hugepage (or per driver block, whichever
+    is smaller), so the copy engine gets far fewer, larger copies.
+
+    STAGING_PAGES_HUGETLB takes the hugepages from the hugetlbfs pool
+    (/proc/sys/vm/nr_hugepages) and fails if the pool cannot cover the
+    buffer.  STAGING_PAGES_THP asks for transparent hugepages, which the
+    kernel may or may not provide.  STAGING_PAGES_AUTO tries the pool first
+    and falls back to transparent hugepages.  Every buffer is populated up
+    front, so a dump never takes a page fault on it.
+*/
+
+#define STAGING_HUGE_PAGE_SIZE (2*1024*1024)
+
+typedef enum {
+    STAGING_PAGES_4K = 0,
+    STAGING_PAGES_HUGETLB,
+    STAGING_PAGES_THP,
+    STAGING_PAGES_AUTO,
+} StagingPages;
+
+typedef struct {
+    void        *ptr;
+    size_t       bytes;     // as requested
+    size_t       mapBytes;  // as mapped, rounded up for hugepages
+    StagingPages pages;     // what the buffer actually got, never AUTO
+} StagingBuffer;
+
+// Parses "4k", "hugetlb", "thp" or "auto".  Returns 0, or -1 after an error.
+int stagingParsePages(const char *name, StagingPages *pages);
+const char *stagingPagesName(StagingPages pages);
+
+//
+// Allocates and populates bytes of staging memory.  Returns RM_OK,
+// RM_ERR_NO_MEMORY (with an error printed; for STAGING_PAGES_HUGETLB that
+// explains the pool is short) or RM_ERR_INVALID_ARGUMENT.
+//
+RM_STATUS stagingAlloc(size_t bytes, StagingPages pages, StagingBuffer *buf);
+void stagingFree(StagingBuffer *buf);
+
+//
+// Counts the runs of physically contiguous pages [ptr, ptr+bytes) resolves
+// to, as the driver's coalescing would see them.  With maxRunBytes set a run
+// also ends every maxRunBytes from ptr, like at the driver's block
+// boundaries.  Returns 0 when the physical addresses are unknown, which
+// without CAP_SYS_ADMIN they are.
+//
+NvU64 stagingPhysRuns(const void *ptr, size_t bytes, size_t maxRunBytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "throttle.h"
+#include "common-utils.h"
+
+#define NS_PER_SEC 1000000000ull
+
+void tokenBucketInit(TokenBucket *bucket, NvU64 bytesPerSec, NvU64 burstBytes,
+                     NvU64 nowNs) {
+    bucket->bytesPerSec = bytesPerSec;
+    bucket->burstBytes  = burstBytes;
+    bucket->tokens      = burstBytes;
+    bucket->remainder   = 0;
+    bucket->lastNs      = nowNs;
+}
+
+static void tokenBucketRefill(TokenBucket *bucket, NvU64 nowNs) {
+    unsigned __int128 credit, add;
+    NvU64 room = (NvU64)((long long)bucket->burstBytes - bucket->tokens);
+
+    if (nowNs <= bucket->lastNs)
+        return;
+
+    credit = (unsigned __int128)(nowNs - bucket->lastNs) *
+             bucket->bytesPerSec + bucket->remainder;
+    bucket->lastNs = nowNs;
+
+    add = credit / NS_PER_SEC;
+    if (add >= room) {
+        bucket->tokens    = bucket->burstBytes;
+        bucket->remainder = 0;
+    } else {
+        bucket->tokens   += (long long)add;
+        bucket->remainder = (NvU64)(credit % NS_PER_SEC);
+    }
+}
+
+NvU64 tokenBucketTake(TokenBucket *bucket, NvU64 bytes, NvU64 nowNs) {
+    unsigned __int128 owedNs;
+
+    if (bucket->bytesPerSec == 0)
+        return nowNs;
+
+    tokenBucketRefill(bucket, nowNs);
+    bucket->tokens -= (long long)bytes;
+    if (bucket->tokens >= 0)
+        return nowNs;
+
+    // Until the refill covers the debt, net of the fraction already earned
+    owedNs = (unsigned __int128)(-bucket->tokens) * NS_PER_SEC -
+             bucket->remainder;
+    return nowNs + (NvU64)((owedNs + bucket->bytesPerSec - 1) /
+                           bucket->bytesPerSec);
+}
+
+void callSizerInit(CallSizer *sizer, NvU64 budgetNs, NvLength minBytes,
+                   NvLength maxBytes) {
+    sizer->budgetNs  = budgetNs;
+    sizer->minBytes  = minBytes;
+    sizer->maxBytes  = NV_MAX(maxBytes / minBytes * minBytes, minBytes);
+    sizer->callBytes = budgetNs ? sizer->minBytes : sizer->maxBytes;
+}
+
+void callSizerUpdate(CallSizer *sizer, NvLength bytes, NvU64 ns) {
+    unsigned __int128 target;
+    NvLength next;
+
+    if (sizer->budgetNs == 0 || bytes == 0)
+        return;
+
+    // 90% of the budget at the rate this call achieved
+    if (ns == 0)
+        target = (unsigned __int128)sizer->maxBytes;
+    else
+        target = (unsigned __int128)bytes * sizer->budgetNs * 9 / (10 * ns);
+
+    next = target > (unsigned __int128)sizer->callBytes * 2 ?
+           sizer->callBytes * 2 : (NvLength)target;
+    next = next / sizer->minBytes * sizer->minBytes;
+    sizer->callBytes = NV_MIN(NV_MAX(next, sizer->minBytes), sizer->maxBytes);
+}
@@ -0,0 +1,85 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _THROTTLE_H_
+#define _THROTTLE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+
+/*******************************************************************************
+    Pacing of dumps
+
+    A dump of a GPU that is busy with other work competes with it for the
+    copy engine and PCIe.  TokenBucket caps the average rate at which bytes
+    are submitted, and CallSizer picks the size of each driver call so that
+    a single call occupies the copy engine for at most a latency budget,
+    leaving gaps the workload can use.
+
+    Neither reads a clock: every call is given the current time, so the
+    pacing is deterministic and can be tested with a fake clock.
+*/
+
+typedef struct {
+    NvU64     bytesPerSec;  // 0 = unlimited
+    NvU64     burstBytes;   // most tokens the bucket holds
+    long long tokens;       // negative while callers wait for their bytes
+    NvU64     remainder;    // fraction of a token, in byte-nanoseconds
+    NvU64     lastNs;
+} TokenBucket;
+
+// Starts with a full bucket at nowNs.
+void tokenBucketInit(TokenBucket *bucket, NvU64 bytesPerSec, NvU64 burstBytes,
+                     NvU64 nowNs);
+
+//
+// Takes bytes from the bucket and returns when the caller may send them:
+// nowNs if the bucket held enough, else the time it will have refilled the
+// shortfall.  Bytes taken early are owed, so later callers wait for them.
+//
+NvU64 tokenBucketTake(TokenBucket *bucket, NvU64 bytes, NvU64 nowNs);
+
+typedef struct {
+    NvU64    budgetNs;   // 0 = every call is maxBytes
+    NvLength minBytes;   // also the alignment of every size
+    NvLength maxBytes;
+    NvLength callBytes;  // size of the next call
+} CallSizer;
+
+// Starts at minBytes, so the first call stays within any sane budget.
+void callSizerInit(CallSizer *sizer, NvU64 budgetNs, NvLength minBytes,
+                   NvLength maxBytes);
+
+//
+// Feeds back that a call of bytes took ns.  The next size aims at 90% of
+// the budget at the observed rate, growing at most twofold per call.
+//
+void callSizerUpdate(CallSizer *sizer, NvLength bytes, NvU64 ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
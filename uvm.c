@@ -35,6 +35,7 @@
 #include <pthread.h>
 
 #include "uvm.h"
+#include "uvm_backend.h"
 #include "uvm_ioctl.h"
 #include "uvm_linux_ioctl.h"
 //#include "user_counters.h"
@@ -56,16 +57,189 @@ static inline size_t getCountersLength(void)
 }
 RM_STATUS UvmErrnoToRmStatus(int errnoCode);
 
+static RM_STATUS uvmIoctlInitialize(void);
+static RM_STATUS uvmIoctlDeinitialize(void);
+static RM_STATUS uvmIoctlDumpGpuMemory(UvmGpuUuid *pGpuUuidStruct,
+                                       void* pOutput,
+                                       unsigned long long baseAddress,
+                                       NvLength sizeBytes,
+                                       NvLength blockSizeHint,
+                                       NvU32 flags);
+static RM_STATUS uvmIoctlDumpGpuMemoryV(UvmGpuUuid *pGpuUuidStruct,
+                                        const UvmDumpRange *pRanges,
+                                        unsigned int rangeCount,
+                                        NvLength blockSizeHint,
+                                        NvU32 flags);
+static RM_STATUS uvmIoctlDumpGpuMemoryToFd(UvmGpuUuid *pGpuUuidStruct,
+                                           int fd,
+                                           unsigned long long fileOffset,
+                                           unsigned long long baseAddress,
+                                           NvLength sizeBytes,
+                                           NvLength blockSizeHint,
+                                           NvU32 flags,
+                                           NvLength *pBytesWritten);
+
+static const UvmBackend g_uvmIoctlBackend =
+{
+    "ioctl",
+    uvmIoctlInitialize,
+    uvmIoctlDeinitialize,
+    uvmIoctlDumpGpuMemory,
+    uvmIoctlDumpGpuMemoryV,
+    NULL,   // blocking ioctls, run on UvmDumpQueue workers
+    uvmIoctlDumpGpuMemoryToFd,
+};
+
+// Backend all the public entry points are routed through:
+static const UvmBackend *g_uvmBackend = &g_uvmIoctlBackend;
+
+//
+// UvmSetBackend
+//
+void UvmSetBackend(const UvmBackend *backend)
+{
+    pthread_mutex_lock(&g_uvmInitMutex);
+    g_uvmBackend = backend ? backend : &g_uvmIoctlBackend;
+    pthread_mutex_unlock(&g_uvmInitMutex);
+}
 
+//
+// UvmGetBackend
+//
+const UvmBackend *UvmGetBackend(void)
+{
+    return g_uvmBackend;
+}
 
 //
 // UvmInitialize
 //
 RM_STATUS UvmInitialize(void)
 {
-    RM_STATUS status = RM_OK;
+    RM_STATUS status;
 
     pthread_mutex_lock(&g_uvmInitMutex);
+    status = g_uvmBackend->initialize();
+    pthread_mutex_unlock(&g_uvmInitMutex);
+
+    return status;
+}
+
+//
+// UvmDeinitialize
+//
+RM_STATUS UvmDeinitialize(void)
+{
+    RM_STATUS status;
+
+    pthread_mutex_lock(&g_uvmInitMutex);
+    status = g_uvmBackend->deinitialize();
+    pthread_mutex_unlock(&g_uvmInitMutex);
+
+    return status;
+}
+
+//
+// UvmDumpGpuMemory
+//
+RM_STATUS UvmDumpGpuMemory(UvmGpuUuid *pGpuUuidStruct,
+                           void* pOutput,
+                           unsigned long long baseAddress,
+                           NvLength sizeBytes)
+{
+    return g_uvmBackend->dumpGpuMemory(pGpuUuidStruct, pOutput,
+                                       baseAddress, sizeBytes, 0, 0);
+}
+
+//
+// UvmDumpGpuMemoryEx
+//
+RM_STATUS UvmDumpGpuMemoryEx(UvmGpuUuid *pGpuUuidStruct,
+                             void* pOutput,
+                             unsigned long long baseAddress,
+                             NvLength sizeBytes,
+                             NvLength blockSizeHint,
+                             NvU32 flags)
+{
+    return g_uvmBackend->dumpGpuMemory(pGpuUuidStruct, pOutput,
+                                       baseAddress, sizeBytes,
+                                       blockSizeHint, flags);
+}
+
+//
+// UvmDumpGpuMemoryV
+//
+RM_STATUS UvmDumpGpuMemoryV(UvmGpuUuid *pGpuUuidStruct,
+                            const UvmDumpRange *pRanges,
+                            unsigned int rangeCount,
+                            NvLength blockSizeHint,
+                            NvU32 flags)
+{
+    const UvmBackend *backend = g_uvmBackend;
+    RM_STATUS status = RM_OK;
+    unsigned int i, count;
+
+    for (i = 0; i < rangeCount && status == RM_OK; i += count)
+    {
+        count = rangeCount - i;
+        if (count > UVM_DUMP_MAX_RANGES)
+            count = UVM_DUMP_MAX_RANGES;
+
+        if (backend->dumpGpuMemoryV)
+        {
+            status = backend->dumpGpuMemoryV(pGpuUuidStruct, pRanges + i,
+                                             count, blockSizeHint, flags);
+        }
+        else
+        {
+            unsigned int r;
+
+            for (r = i; r < i + count && status == RM_OK; r++)
+                status = backend->dumpGpuMemory(pGpuUuidStruct,
+                                                pRanges[r].pBuffer,
+                                                pRanges[r].gpuOffset,
+                                                pRanges[r].length,
+                                                blockSizeHint, flags);
+        }
+    }
+
+    return status;
+}
+
+//
+// UvmDumpGpuMemoryToFd
+//
+RM_STATUS UvmDumpGpuMemoryToFd(UvmGpuUuid *pGpuUuidStruct,
+                               int fd,
+                               unsigned long long fileOffset,
+                               unsigned long long baseAddress,
+                               NvLength sizeBytes,
+                               NvLength blockSizeHint,
+                               NvU32 flags,
+                               NvLength *pBytesWritten)
+{
+    const UvmBackend *backend = g_uvmBackend;
+    NvLength written = 0;
+    RM_STATUS status = RM_ERR_NOT_SUPPORTED;
+
+    if (backend->dumpGpuMemoryToFd)
+        status = backend->dumpGpuMemoryToFd(pGpuUuidStruct, fd, fileOffset,
+                                            baseAddress, sizeBytes,
+                                            blockSizeHint, flags, &written);
+
+    if (pBytesWritten)
+        *pBytesWritten = written;
+
+    return status;
+}
+
+//
+// ioctl backend: talks to the patched driver through /dev/nvidia-uvm.  The
+// public wrappers above hold g_uvmInitMutex around initialize/deinitialize.
+//
+static RM_STATUS uvmIoctlInitialize(void)
+{
+    RM_STATUS status = RM_OK;
 
     if (nvidia_uvm_modprobe(NV_TRUE) == 0)
     {
@@ -98,24 +272,22 @@ RM_STATUS UvmInitialize(void)
     }
 
 done:
-    pthread_mutex_unlock(&g_uvmInitMutex);
-
     return status;
 }
 
-//
-// UvmDeinitialize
-//
-RM_STATUS UvmDeinitialize(void)
+static RM_STATUS uvmIoctlDeinitialize(void)
 {
     RM_STATUS status = RM_OK;
-
-    pthread_mutex_lock(&g_uvmInitMutex);
+    UVM_DUMP_RELEASE_PARAMS releaseParams;
 
     if (-1 == g_devUvmFd)
         // Already deinitialized
         goto done;
 
+    // Drivers without dump channel caching reject this, which is fine
+    memset(&releaseParams, 0, sizeof(releaseParams));
+    ioctl(g_devUvmFd, UVM_DUMP_RELEASE, &releaseParams);
+
     if (-1 == ioctl(g_devUvmFd, UVM_DEINITIALIZE, 0))
     {
         status = RM_ERROR;
@@ -129,17 +301,40 @@ RM_STATUS UvmDeinitialize(void)
     g_devUvmFd = -1;
 
 done:
-    pthread_mutex_unlock(&g_uvmInitMutex);
-
     return status;
 }
 
-RM_STATUS UvmDumpGpuMemory(UvmGpuUuid *pGpuUuidStruct, 
-                           void* pOutput, 
-                           unsigned long long baseAddress, 
-                           NvLength sizeBytes)
+static RM_STATUS uvmIoctlDumpGpuMemory(UvmGpuUuid *pGpuUuidStruct,
+                                       void* pOutput,
+                                       unsigned long long baseAddress,
+                                       NvLength sizeBytes,
+                                       NvLength blockSizeHint,
+                                       NvU32 flags)
 {
     UVM_DUMP_GPU_MEMORY_PARAMS params;
+
+    if (blockSizeHint || flags)
+    {
+        UVM_DUMP_GPU_MEMORY_EX_PARAMS exParams;
+        memset(&exParams, 0, sizeof(exParams));
+        memcpy(&(exParams.gpuUuid), (pGpuUuidStruct), sizeof(exParams.gpuUuid));
+        exParams.version       = UVM_DUMP_PARAMS_VERSION;
+        exParams.flags         = flags;
+        exParams.baseAddress   = baseAddress;
+        exParams.sizeBytes     = sizeBytes;
+        exParams.blockSizeHint = blockSizeHint;
+        exParams.pOutput       = NV_PTR_TO_NvP64(pOutput);
+
+        if (0 == ioctl(g_devUvmFd, UVM_DUMP_GPU_MEMORY_EX, &exParams))
+            return exParams.rmStatus;
+
+        // Older drivers reject the command; the block size is only a hint
+        if (errno != EINVAL)
+            return UvmErrnoToRmStatus(errno);
+        if (flags)
+            return RM_ERR_NOT_SUPPORTED;
+    }
+
     memset(&params, 0, sizeof(params));
     memcpy(&(params.gpuUuid), (pGpuUuidStruct), sizeof(params.gpuUuid));
     params.baseAddress = baseAddress;
@@ -148,9 +343,85 @@ RM_STATUS UvmDumpGpuMemory(UvmGpuUuid *pGpuUuidStruct,
 
     if (-1 == ioctl(g_devUvmFd, UVM_DUMP_GPU_MEMORY, &params))
     {
-        UvmErrnoToRmStatus(errno);
+        return UvmErrnoToRmStatus(errno);
+    }
+
+    return params.rmStatus;
+}
+
+static RM_STATUS uvmIoctlDumpGpuMemoryV(UvmGpuUuid *pGpuUuidStruct,
+                                        const UvmDumpRange *pRanges,
+                                        unsigned int rangeCount,
+                                        NvLength blockSizeHint,
+                                        NvU32 flags)
+{
+    UVM_DUMP_GPU_MEMORY_V_PARAMS params;
+    UVM_DUMP_RANGE ranges[UVM_DUMP_MAX_RANGES];
+    RM_STATUS status = RM_OK;
+    unsigned int i;
+
+    memset(&params, 0, sizeof(params));
+    memset(ranges, 0, rangeCount * sizeof(ranges[0]));
+    for (i = 0; i < rangeCount; i++)
+    {
+        ranges[i].gpuOffset = pRanges[i].gpuOffset;
+        ranges[i].pBuffer   = NV_PTR_TO_NvP64(pRanges[i].pBuffer);
+        ranges[i].length    = pRanges[i].length;
+    }
+
+    memcpy(&(params.gpuUuid), (pGpuUuidStruct), sizeof(params.gpuUuid));
+    params.version       = UVM_DUMP_PARAMS_VERSION;
+    params.flags         = flags;
+    params.pRanges       = NV_PTR_TO_NvP64(ranges);
+    params.rangeCount    = rangeCount;
+    params.blockSizeHint = blockSizeHint;
+
+    if (0 == ioctl(g_devUvmFd, UVM_DUMP_GPU_MEMORY_V, &params))
+        return params.rmStatus;
+
+    if (errno != EINVAL)
+        return UvmErrnoToRmStatus(errno);
+
+    // Older drivers: one call per range
+    for (i = 0; i < rangeCount && status == RM_OK; i++)
+        status = uvmIoctlDumpGpuMemory(pGpuUuidStruct, pRanges[i].pBuffer,
+                                       pRanges[i].gpuOffset,
+                                       pRanges[i].length,
+                                       blockSizeHint, flags);
+
+    return status;
+}
+
+static RM_STATUS uvmIoctlDumpGpuMemoryToFd(UvmGpuUuid *pGpuUuidStruct,
+                                           int fd,
+                                           unsigned long long fileOffset,
+                                           unsigned long long baseAddress,
+                                           NvLength sizeBytes,
+                                           NvLength blockSizeHint,
+                                           NvU32 flags,
+                                           NvLength *pBytesWritten)
+{
+    UVM_DUMP_GPU_MEMORY_TO_FD_PARAMS params;
+
+    memset(&params, 0, sizeof(params));
+    memcpy(&(params.gpuUuid), (pGpuUuidStruct), sizeof(params.gpuUuid));
+    params.version       = UVM_DUMP_PARAMS_VERSION;
+    params.flags         = flags;
+    params.fd            = fd;
+    params.fileOffset    = fileOffset;
+    params.baseAddress   = baseAddress;
+    params.sizeBytes     = sizeBytes;
+    params.blockSizeHint = blockSizeHint;
+
+    if (-1 == ioctl(g_devUvmFd, UVM_DUMP_GPU_MEMORY_TO_FD, &params))
+    {
+        // Older drivers don't know the command
+        if (errno == EINVAL)
+            return RM_ERR_NOT_SUPPORTED;
+        return UvmErrnoToRmStatus(errno);
     }
 
+    *pBytesWritten = params.bytesWritten;
     return params.rmStatus;
 }
 
@@ -0,0 +1,365 @@
+/*******************************************************************************
+    Copyright (c) 2013 NVidia Corporation
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to
+    deal in the Software without restriction, including without limitation the
+    rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+    sell copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+        The above copyright notice and this permission notice shall be
+        included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*******************************************************************************/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "uvm.h"
+#include "uvm_async.h"
+#include "uvm_backend.h"
+
+typedef struct UvmDumpRequest_tag
+{
+    struct UvmDumpRequest_tag *next;
+    UvmDumpQueue      *queue;
+    const UvmBackend  *backend;
+    UvmDumpTicket      ticket;
+    RM_STATUS          status;
+    void              *userData;
+
+    UvmGpuUuid         gpuUuid;
+    void              *pOutput;
+    unsigned long long baseAddress;
+    NvLength           sizeBytes;
+    NvLength           blockSizeHint;
+    NvU32              flags;
+} UvmDumpRequest;
+
+struct UvmDumpQueue_tag
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  doneCond;      // a request completed
+    int             eventFd;       // readable while completed is non-empty
+    unsigned int    maxInFlight;
+    unsigned int    outstanding;   // submitted and not reaped
+    unsigned int    running;       // submitted and not completed
+    UvmDumpTicket   nextTicket;
+
+    UvmDumpRequest *completedHead;
+    UvmDumpRequest *completedTail;
+
+    // Workers running synchronous dumps for backends without async support
+    pthread_cond_t  workCond;
+    UvmDumpRequest *workHead;
+    UvmDumpRequest *workTail;
+    pthread_t       workers[UVM_DUMP_QUEUE_MAX_IN_FLIGHT];
+    unsigned int    numWorkers;
+    unsigned int    idleWorkers;
+    int             stopping;
+};
+
+static void uvmDumpQueueSignal(UvmDumpQueue *queue)
+{
+    NvU64 one = 1;
+
+    while (write(queue->eventFd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+static void uvmDumpQueueClearSignal(UvmDumpQueue *queue)
+{
+    NvU64 count;
+
+    while (read(queue->eventFd, &count, sizeof(count)) < 0 && errno == EINTR)
+        ;
+}
+
+// UvmDumpDoneFunc of every request; moves it to the completed list.
+static void uvmDumpRequestDone(void *ctx, RM_STATUS status)
+{
+    UvmDumpRequest *req = ctx;
+    UvmDumpQueue *queue = req->queue;
+
+    req->status = status;
+    req->next = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->completedTail)
+    {
+        queue->completedTail->next = req;
+    }
+    else
+    {
+        queue->completedHead = req;
+        uvmDumpQueueSignal(queue);
+    }
+    queue->completedTail = req;
+    queue->running--;
+    pthread_cond_broadcast(&queue->doneCond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void *uvmDumpWorker(void *arg)
+{
+    UvmDumpQueue *queue = arg;
+    UvmDumpRequest *req;
+    RM_STATUS status;
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;)
+    {
+        while (!queue->workHead && !queue->stopping)
+        {
+            queue->idleWorkers++;
+            pthread_cond_wait(&queue->workCond, &queue->lock);
+            queue->idleWorkers--;
+        }
+
+        req = queue->workHead;
+        if (!req)
+            break;
+
+        queue->workHead = req->next;
+        if (!queue->workHead)
+            queue->workTail = NULL;
+        pthread_mutex_unlock(&queue->lock);
+
+        status = req->backend->dumpGpuMemory(&req->gpuUuid, req->pOutput,
+                                             req->baseAddress, req->sizeBytes,
+                                             req->blockSizeHint, req->flags);
+        uvmDumpRequestDone(req, status);
+
+        pthread_mutex_lock(&queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+//
+// Hands req to a worker, starting one if none is idle.  Called with the
+// queue lock held.
+//
+static RM_STATUS uvmDumpQueueWorkLocked(UvmDumpQueue *queue,
+                                        UvmDumpRequest *req)
+{
+    if (queue->idleWorkers == 0 && queue->numWorkers < queue->maxInFlight)
+    {
+        if (pthread_create(&queue->workers[queue->numWorkers], NULL,
+                           uvmDumpWorker, queue) == 0)
+            queue->numWorkers++;
+        else if (queue->numWorkers == 0)
+            return RM_ERROR;
+    }
+
+    req->next = NULL;
+    if (queue->workTail)
+        queue->workTail->next = req;
+    else
+        queue->workHead = req;
+    queue->workTail = req;
+    pthread_cond_signal(&queue->workCond);
+
+    return RM_OK;
+}
+
+RM_STATUS UvmDumpQueueCreate(unsigned int maxInFlight, UvmDumpQueue **ppQueue)
+{
+    UvmDumpQueue *queue;
+
+    if (maxInFlight == 0 || maxInFlight > UVM_DUMP_QUEUE_MAX_IN_FLIGHT ||
+        !ppQueue)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    queue = calloc(1, sizeof(*queue));
+    if (!queue)
+        return RM_ERR_NO_MEMORY;
+
+    queue->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (queue->eventFd < 0)
+    {
+        free(queue);
+        return RM_ERR_INSUFFICIENT_RESOURCES;
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->doneCond, NULL);
+    pthread_cond_init(&queue->workCond, NULL);
+    queue->maxInFlight = maxInFlight;
+    queue->nextTicket = 1;
+
+    *ppQueue = queue;
+    return RM_OK;
+}
+
+void UvmDumpQueueDestroy(UvmDumpQueue *queue)
+{
+    UvmDumpRequest *req;
+    unsigned int i;
+
+    if (!queue)
+        return;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->running)
+        pthread_cond_wait(&queue->doneCond, &queue->lock);
+    queue->stopping = 1;
+    pthread_cond_broadcast(&queue->workCond);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (i = 0; i < queue->numWorkers; i++)
+        pthread_join(queue->workers[i], NULL);
+
+    while ((req = queue->completedHead))
+    {
+        queue->completedHead = req->next;
+        free(req);
+    }
+
+    close(queue->eventFd);
+    pthread_cond_destroy(&queue->workCond);
+    pthread_cond_destroy(&queue->doneCond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+int UvmDumpQueueGetEventFd(const UvmDumpQueue *queue)
+{
+    return queue->eventFd;
+}
+
+RM_STATUS UvmDumpSubmit(UvmDumpQueue *queue,
+                        UvmGpuUuid *pGpuUuidStruct,
+                        void* pOutput,
+                        unsigned long long baseAddress,
+                        NvLength sizeBytes,
+                        NvLength blockSizeHint,
+                        NvU32 flags,
+                        void *userData,
+                        UvmDumpTicket *pTicket)
+{
+    const UvmBackend *backend = UvmGetBackend();
+    UvmDumpRequest *req;
+    RM_STATUS status = RM_OK;
+
+    if (!pGpuUuidStruct || !pTicket)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    req = calloc(1, sizeof(*req));
+    if (!req)
+        return RM_ERR_NO_MEMORY;
+
+    req->queue = queue;
+    req->backend = backend;
+    req->userData = userData;
+    req->gpuUuid = *pGpuUuidStruct;
+    req->pOutput = pOutput;
+    req->baseAddress = baseAddress;
+    req->sizeBytes = sizeBytes;
+    req->blockSizeHint = blockSizeHint;
+    req->flags = flags;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->outstanding >= queue->maxInFlight)
+    {
+        pthread_mutex_unlock(&queue->lock);
+        free(req);
+        return RM_ERR_BUSY_RETRY;
+    }
+
+    req->ticket = queue->nextTicket++;
+    *pTicket = req->ticket;
+    queue->outstanding++;
+    queue->running++;
+
+    if (!backend->dumpGpuMemoryAsync)
+        status = uvmDumpQueueWorkLocked(queue, req);
+    pthread_mutex_unlock(&queue->lock);
+
+    // The backend may complete the request before this returns.
+    if (status == RM_OK && backend->dumpGpuMemoryAsync)
+        status = backend->dumpGpuMemoryAsync(&req->gpuUuid, pOutput,
+                                             baseAddress, sizeBytes,
+                                             blockSizeHint, flags,
+                                             uvmDumpRequestDone, req);
+
+    if (status != RM_OK)
+    {
+        pthread_mutex_lock(&queue->lock);
+        queue->outstanding--;
+        queue->running--;
+        pthread_cond_broadcast(&queue->doneCond);
+        pthread_mutex_unlock(&queue->lock);
+        free(req);
+    }
+
+    return status;
+}
+
+unsigned int UvmDumpReap(UvmDumpQueue *queue, UvmDumpCompletion *completions,
+                         unsigned int max, int wait)
+{
+    UvmDumpRequest *reaped = NULL, *req;
+    unsigned int count = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    while (wait && max && !queue->completedHead && queue->running)
+        pthread_cond_wait(&queue->doneCond, &queue->lock);
+
+    while (count < max && queue->completedHead)
+    {
+        req = queue->completedHead;
+        queue->completedHead = req->next;
+
+        completions[count].ticket   = req->ticket;
+        completions[count].status   = req->status;
+        completions[count].userData = req->userData;
+        count++;
+
+        req->next = reaped;
+        reaped = req;
+    }
+
+    if (!queue->completedHead)
+    {
+        queue->completedTail = NULL;
+        if (count)
+            uvmDumpQueueClearSignal(queue);
+    }
+    queue->outstanding -= count;
+    pthread_mutex_unlock(&queue->lock);
+
+    while ((req = reaped))
+    {
+        reaped = req->next;
+        free(req);
+    }
+
+    return count;
+}
+
+unsigned int UvmDumpQueueOutstanding(UvmDumpQueue *queue)
+{
+    unsigned int outstanding;
+
+    pthread_mutex_lock(&queue->lock);
+    outstanding = queue->outstanding;
+    pthread_mutex_unlock(&queue->lock);
+
+    return outstanding;
+}
@@ -0,0 +1,109 @@
+/*******************************************************************************
+    Copyright (c) 2013 NVidia Corporation
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to
+    deal in the Software without restriction, including without limitation the
+    rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+    sell copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+        The above copyright notice and this permission notice shall be
+        included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef _UVM_ASYNC_H_
+#define _UVM_ASYNC_H_
+
+#include "uvmtypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*******************************************************************************
+    Asynchronous dumps
+
+    A UvmDumpQueue lets a caller queue dumps and go on with other work while
+    the copy engine runs them.  UvmDumpSubmit returns a ticket as soon as the
+    request is queued; when it finishes its completion (ticket, status and the
+    caller's userData) is kept until UvmDumpReap hands it out.  The queue's
+    eventfd is readable exactly while completions are waiting, so it can be
+    watched with poll or epoll.
+
+    At most maxInFlight requests may be submitted and not yet reaped; beyond
+    that UvmDumpSubmit returns RM_ERR_BUSY_RETRY.  The output buffer of a
+    request must not be touched until its completion has been reaped.
+
+    Backends with a dumpGpuMemoryAsync hook (the simulator) run the requests
+    themselves.  For the others, such as the ioctl backend, the queue runs the
+    synchronous dump on a worker thread per request in flight.
+*/
+
+typedef NvU64 UvmDumpTicket;
+
+typedef struct
+{
+    UvmDumpTicket ticket;
+    RM_STATUS     status;
+    void         *userData;
+} UvmDumpCompletion;
+
+typedef struct UvmDumpQueue_tag UvmDumpQueue;
+
+#define UVM_DUMP_QUEUE_MAX_IN_FLIGHT 64
+
+//
+// Creates a queue for up to maxInFlight (1..UVM_DUMP_QUEUE_MAX_IN_FLIGHT)
+// outstanding requests.
+//
+RM_STATUS UvmDumpQueueCreate(unsigned int maxInFlight, UvmDumpQueue **ppQueue);
+
+//
+// Waits for the requests still running, drops unreaped completions and frees
+// the queue.
+//
+void UvmDumpQueueDestroy(UvmDumpQueue *queue);
+
+int UvmDumpQueueGetEventFd(const UvmDumpQueue *queue);
+
+//
+// Queues a dump with the arguments of UvmDumpGpuMemoryEx.  On RM_OK *pTicket
+// identifies it; any other status means it was not queued (argument errors
+// may instead be reported in the completion).
+//
+RM_STATUS UvmDumpSubmit(UvmDumpQueue *queue,
+                        UvmGpuUuid *pGpuUuidStruct,
+                        void* pOutput,
+                        unsigned long long baseAddress,
+                        NvLength sizeBytes,
+                        NvLength blockSizeHint,
+                        NvU32 flags,
+                        void *userData,
+                        UvmDumpTicket *pTicket);
+
+//
+// Moves up to max completions, oldest first, into completions and returns
+// how many.  With wait set and nothing to reap, blocks until a request
+// completes, unless none is running.
+//
+unsigned int UvmDumpReap(UvmDumpQueue *queue, UvmDumpCompletion *completions,
+                         unsigned int max, int wait);
+
+// Requests submitted and not yet reaped
+unsigned int UvmDumpQueueOutstanding(UvmDumpQueue *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
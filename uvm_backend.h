@@ -0,0 +1,110 @@
+/*******************************************************************************
+    Copyright (c) 2013 NVidia Corporation
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to
+    deal in the Software without restriction, including without limitation the
+    rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+    sell copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+        The above copyright notice and this permission notice shall be
+        included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef _UVM_BACKEND_H_
+#define _UVM_BACKEND_H_
+
+#include "uvmtypes.h"
+#include "uvm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*******************************************************************************
+    UvmBackend
+
+    UvmInitialize, UvmDeinitialize and the UvmDump* calls are routed through a
+    backend.  By default this is the ioctl backend, which talks to the patched
+    driver through /dev/nvidia-uvm.  Other backends (see uvm_sim.h) let the
+    rest of the tools run without a GPU.
+
+    initialize and deinitialize are called with the UVM init lock held.
+    dumpGpuMemory must be safe to call from several threads at once.  It gets
+    the blockSizeHint and flags of UvmDumpGpuMemoryEx, both 0 for
+    UvmDumpGpuMemory.
+
+    dumpGpuMemoryV gets at most UVM_DUMP_MAX_RANGES ranges per call;
+    UvmDumpGpuMemoryV splits longer lists.  A backend without it has each
+    range passed to dumpGpuMemory instead.
+
+    dumpGpuMemoryAsync, used by UvmDumpSubmit (uvm_async.h), starts a dump
+    and returns without waiting for it.  If it returns RM_OK, done is called
+    exactly once with the dump's status, possibly from another thread, after
+    the output buffer has been filled.  A backend without it has the
+    synchronous call run on a worker thread instead.
+
+    dumpGpuMemoryToFd implements UvmDumpGpuMemoryToFd.  A backend without it
+    makes that return RM_ERR_NOT_SUPPORTED so callers can fall back to
+    dumping into their own buffer.
+*/
+typedef void (*UvmDumpDoneFunc)(void *ctx, RM_STATUS status);
+
+typedef struct
+{
+    const char *name;
+
+    RM_STATUS (*initialize)(void);
+    RM_STATUS (*deinitialize)(void);
+    RM_STATUS (*dumpGpuMemory)(UvmGpuUuid *pGpuUuidStruct,
+                               void* pOutput,
+                               unsigned long long baseAddress,
+                               NvLength sizeBytes,
+                               NvLength blockSizeHint,
+                               NvU32 flags);
+    RM_STATUS (*dumpGpuMemoryV)(UvmGpuUuid *pGpuUuidStruct,
+                                const UvmDumpRange *pRanges,
+                                unsigned int rangeCount,
+                                NvLength blockSizeHint,
+                                NvU32 flags);
+    RM_STATUS (*dumpGpuMemoryAsync)(UvmGpuUuid *pGpuUuidStruct,
+                                    void* pOutput,
+                                    unsigned long long baseAddress,
+                                    NvLength sizeBytes,
+                                    NvLength blockSizeHint,
+                                    NvU32 flags,
+                                    UvmDumpDoneFunc done,
+                                    void *ctx);
+    RM_STATUS (*dumpGpuMemoryToFd)(UvmGpuUuid *pGpuUuidStruct,
+                                   int fd,
+                                   unsigned long long fileOffset,
+                                   unsigned long long baseAddress,
+                                   NvLength sizeBytes,
+                                   NvLength blockSizeHint,
+                                   NvU32 flags,
+                                   NvLength *pBytesWritten);
+} UvmBackend;
+
+//
+// Selects the backend used by the Uvm* entry points.  NULL restores the ioctl
+// backend.  Must not be called while a backend is initialized.
+//
+void UvmSetBackend(const UvmBackend *backend);
+
+const UvmBackend *UvmGetBackend(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,918 @@
+/*******************************************************************************
+    Copyright (c) 2013 NVidia Corporation
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to
+    deal in the Software without restriction, including without limitation the
+    rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+    sell copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+        The above copyright notice and this permission notice shall be
+        included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*******************************************************************************/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "uvm_sim.h"
+#include "uvm_ioctl.h"
+#include "staging.h"
+#include "common-utils.h"
+
+// A request submitted through dumpGpuMemoryAsync, waiting for its end time
+typedef struct UvmSimAsync_tag
+{
+    struct UvmSimAsync_tag *next;
+    int              gpuIndex;
+    UvmDumpRange     range;
+    NvU64            endNs;
+    RM_STATUS        status;
+    UvmDumpDoneFunc  done;
+    void            *ctx;
+} UvmSimAsync;
+
+typedef struct
+{
+    UvmSimConfig    config;
+    char           *imageFile;
+    int             imageFd;
+    int             initialized;
+
+    pthread_mutex_t lock;
+    NvU64           busyUntilNs[UVM_SIM_MAX_GPUS];
+    int             channelReady[UVM_SIM_MAX_GPUS];
+    UvmSimStats     stats;
+
+    // Async completions, sorted by endNs, served by asyncThread
+    UvmSimAsync    *asyncPending;
+    pthread_cond_t  asyncCond;
+    pthread_t       asyncThread;
+    int             asyncCondReady;
+    int             asyncRunning;
+    int             asyncStop;
+} UvmSimState;
+
+static UvmSimState g_uvmSim =
+{
+    .imageFd = -1,
+    .lock    = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static RM_STATUS uvmSimInitialize(void);
+static RM_STATUS uvmSimDeinitialize(void);
+static RM_STATUS uvmSimDumpGpuMemory(UvmGpuUuid *pGpuUuidStruct,
+                                     void* pOutput,
+                                     unsigned long long baseAddress,
+                                     NvLength sizeBytes,
+                                     NvLength blockSizeHint,
+                                     NvU32 flags);
+static RM_STATUS uvmSimDumpGpuMemoryV(UvmGpuUuid *pGpuUuidStruct,
+                                      const UvmDumpRange *pRanges,
+                                      unsigned int rangeCount,
+                                      NvLength blockSizeHint,
+                                      NvU32 flags);
+static RM_STATUS uvmSimDumpGpuMemoryAsync(UvmGpuUuid *pGpuUuidStruct,
+                                          void* pOutput,
+                                          unsigned long long baseAddress,
+                                          NvLength sizeBytes,
+                                          NvLength blockSizeHint,
+                                          NvU32 flags,
+                                          UvmDumpDoneFunc done,
+                                          void *ctx);
+static RM_STATUS uvmSimDumpGpuMemoryToFd(UvmGpuUuid *pGpuUuidStruct,
+                                         int fd,
+                                         unsigned long long fileOffset,
+                                         unsigned long long baseAddress,
+                                         NvLength sizeBytes,
+                                         NvLength blockSizeHint,
+                                         NvU32 flags,
+                                         NvLength *pBytesWritten);
+
+static const UvmBackend g_uvmSimBackend =
+{
+    "sim",
+    uvmSimInitialize,
+    uvmSimDeinitialize,
+    uvmSimDumpGpuMemory,
+    uvmSimDumpGpuMemoryV,
+    uvmSimDumpGpuMemoryAsync,
+    uvmSimDumpGpuMemoryToFd,
+};
+
+static NvU64 simNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (NvU64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void simSleepUntilNs(NvU64 deadline)
+{
+    struct timespec ts;
+    ts.tv_sec  = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+// splitmix64 finalizer
+static NvU64 simMix(NvU64 x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+void UvmSimConfigInit(UvmSimConfig *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->numGpus      = 1;
+    config->fbSize       = 256ull * 1024 * 1024;
+    config->seed         = 1;
+    config->zeroPercent  = 60;
+    config->constPercent = 20;
+    config->failStatus   = RM_ERR_ECC_ERROR;
+    config->cacheChannels = 1;
+}
+
+static int simParseSize(const char *str, NvU64 *value)
+{
+    char *end;
+    NvU64 v = strtoull(str, &end, 0);
+
+    switch (*end)
+    {
+        case 'k': case 'K': v <<= 10; end++; break;
+        case 'm': case 'M': v <<= 20; end++; break;
+        case 'g': case 'G': v <<= 30; end++; break;
+        case 't': case 'T': v <<= 40; end++; break;
+        default: break;
+    }
+
+    if (end == str || *end != '\0')
+        return -1;
+
+    *value = v;
+    return 0;
+}
+
+static int simParseStatus(const char *str, RM_STATUS *status)
+{
+    NvU64 v;
+
+    if (!strcasecmp(str, "ecc"))
+        *status = RM_ERR_ECC_ERROR;
+    else if (!strcasecmp(str, "invalid-address"))
+        *status = RM_ERR_INVALID_ADDRESS;
+    else if (!strcasecmp(str, "busy"))
+        *status = RM_ERR_BUSY_RETRY;
+    else if (!strcasecmp(str, "error"))
+        *status = RM_ERROR;
+    else if (simParseSize(str, &v) == 0)
+        *status = (RM_STATUS)v;
+    else
+        return -1;
+
+    return 0;
+}
+
+int UvmSimParseSpec(const char *spec, UvmSimConfig *config)
+{
+    char *copy = nvstrdup(spec);
+    char *save = NULL;
+    char *item;
+    int ret = 0;
+
+    for (item = strtok_r(copy, ",", &save); item;
+         item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+        NvU64 v = 0;
+        int bad = 0;
+
+        if (!value)
+        {
+            nv_error_msg("Simulator option '%s' needs a value.\n", item);
+            ret = -1;
+            break;
+        }
+        *value++ = '\0';
+
+        if (!strcmp(item, "file"))
+            config->imageFile = nvstrdup(value);
+        else if (!strcmp(item, "fail-status"))
+            bad = simParseStatus(value, &config->failStatus);
+        else if (simParseSize(value, &v))
+            bad = 1;
+        else if (!strcmp(item, "gpus"))
+            config->numGpus = v;
+        else if (!strcmp(item, "size"))
+            config->fbSize = v;
+        else if (!strcmp(item, "seed"))
+            config->seed = v;
+        else if (!strcmp(item, "zero"))
+            config->zeroPercent = v;
+        else if (!strcmp(item, "const"))
+            config->constPercent = v;
+        else if (!strcmp(item, "region"))
+            config->regionSize = v;
+        else if (!strcmp(item, "latency-us"))
+            config->latencyNs = v * 1000;
+        else if (!strcmp(item, "block-us"))
+            config->blockNs = v * 1000;
+        else if (!strcmp(item, "run-us"))
+            config->runNs = v * 1000;
+        else if (!strcmp(item, "setup-us"))
+            config->setupNs = v * 1000;
+        else if (!strcmp(item, "cache"))
+            config->cacheChannels = v != 0;
+        else if (!strcmp(item, "bandwidth"))
+            config->bytesPerSec = v;
+        else if (!strcmp(item, "fail-every"))
+            config->failEvery = v;
+        else if (!strcmp(item, "fail-at"))
+            config->failAddress = v;
+        else if (!strcmp(item, "fail-len"))
+            config->failLength = v;
+        else
+        {
+            nv_error_msg("Unknown simulator option '%s'.\n", item);
+            ret = -1;
+            break;
+        }
+
+        if (bad)
+        {
+            nv_error_msg("Invalid value '%s' for simulator option '%s'.\n",
+                         value, item);
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ret == 0 &&
+        (config->numGpus == 0 || config->numGpus > UVM_SIM_MAX_GPUS ||
+         config->zeroPercent + config->constPercent > 100))
+    {
+        nv_error_msg("Invalid simulator configuration.\n");
+        ret = -1;
+    }
+
+    nvfree(copy);
+    return ret;
+}
+
+void UvmSimEnable(const UvmSimConfig *config)
+{
+    pthread_mutex_lock(&g_uvmSim.lock);
+    nvfree(g_uvmSim.imageFile);
+    g_uvmSim.config    = *config;
+    g_uvmSim.imageFile = config->imageFile ? nvstrdup(config->imageFile) : NULL;
+    g_uvmSim.config.imageFile = g_uvmSim.imageFile;
+    memset(g_uvmSim.busyUntilNs, 0, sizeof(g_uvmSim.busyUntilNs));
+    memset(g_uvmSim.channelReady, 0, sizeof(g_uvmSim.channelReady));
+    memset(&g_uvmSim.stats, 0, sizeof(g_uvmSim.stats));
+    pthread_mutex_unlock(&g_uvmSim.lock);
+
+    UvmSetBackend(&g_uvmSimBackend);
+}
+
+void UvmSimDisable(void)
+{
+    UvmSetBackend(NULL);
+}
+
+int UvmSimIsEnabled(void)
+{
+    return UvmGetBackend() == &g_uvmSimBackend;
+}
+
+const UvmSimConfig *UvmSimGetConfig(void)
+{
+    return &g_uvmSim.config;
+}
+
+void UvmSimGetStats(UvmSimStats *stats)
+{
+    pthread_mutex_lock(&g_uvmSim.lock);
+    *stats = g_uvmSim.stats;
+    pthread_mutex_unlock(&g_uvmSim.lock);
+}
+
+static const NvU8 g_simUuidPrefix[] = { 'S', 'I', 'M', 'G', 'P', 'U' };
+
+void UvmSimGetGpuUuid(unsigned int index, UvmGpuUuid *uuid)
+{
+    memset(uuid, 0, sizeof(*uuid));
+    memcpy(uuid->uuid, g_simUuidPrefix, sizeof(g_simUuidPrefix));
+    uuid->uuid[15] = index;
+}
+
+void UvmSimGetGpuUuidString(unsigned int index, char *buf, size_t bufSize)
+{
+    UvmGpuUuid uuid;
+    const NvU8 *u = uuid.uuid;
+
+    UvmSimGetGpuUuid(index, &uuid);
+    snprintf(buf, bufSize,
+             "GPU-%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
+             "%02x%02x%02x%02x%02x%02x",
+             u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7],
+             u[8], u[9], u[10], u[11], u[12], u[13], u[14], u[15]);
+}
+
+int UvmSimGpuIndex(const UvmGpuUuid *uuid)
+{
+    UvmGpuUuid expected;
+
+    if (!uuid || uuid->uuid[15] >= g_uvmSim.config.numGpus)
+        return -1;
+
+    UvmSimGetGpuUuid(uuid->uuid[15], &expected);
+    if (memcmp(&expected, uuid, sizeof(expected)))
+        return -1;
+
+    return uuid->uuid[15];
+}
+
+static void simFillSyntheticPage(unsigned int gpuIndex, NvU64 pageAddress,
+                                 NvU64 *words)
+{
+    const NvU64 key = g_uvmSim.config.seed ^ ((NvU64)gpuIndex << 56);
+    const NvLength region = g_uvmSim.config.regionSize;
+    const NvU64 h = simMix(key ^ (region > UVM_SIM_PAGE_SIZE ?
+                                  pageAddress - pageAddress % region :
+                                  pageAddress));
+    const unsigned int kind = h % 100;
+    unsigned int i;
+
+    if (kind < g_uvmSim.config.zeroPercent)
+    {
+        memset(words, 0, UVM_SIM_PAGE_SIZE);
+    }
+    else if (kind < g_uvmSim.config.zeroPercent + g_uvmSim.config.constPercent)
+    {
+        NvU64 value = (h >> 32) | ((h >> 32) << 32);
+        for (i = 0; i < UVM_SIM_PAGE_SIZE / sizeof(NvU64); i++)
+            words[i] = value;
+    }
+    else
+    {
+        for (i = 0; i < UVM_SIM_PAGE_SIZE / sizeof(NvU64); i++)
+            words[i] = simMix(key ^ (pageAddress + i * sizeof(NvU64)) ^ h);
+    }
+}
+
+static void simFillFromImage(int fd, unsigned long long gpuAddress,
+                             char *buf, NvLength sizeBytes)
+{
+    while (sizeBytes)
+    {
+        ssize_t ret = pread(fd, buf, sizeBytes, gpuAddress);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+        {
+            // Past the end of the image reads as zero.
+            memset(buf, 0, sizeBytes);
+            return;
+        }
+        buf        += ret;
+        gpuAddress += ret;
+        sizeBytes  -= ret;
+    }
+}
+
+void UvmSimFill(unsigned int gpuIndex, unsigned long long gpuAddress,
+                void *buf, NvLength sizeBytes)
+{
+    char *out = buf;
+
+    if (g_uvmSim.imageFile)
+    {
+        int fd = g_uvmSim.imageFd;
+
+        if (fd < 0)
+            fd = open(g_uvmSim.imageFile, O_RDONLY);
+        if (fd < 0)
+            memset(buf, 0, sizeBytes);
+        else
+            simFillFromImage(fd, gpuAddress, buf, sizeBytes);
+        if (fd >= 0 && fd != g_uvmSim.imageFd)
+            close(fd);
+        return;
+    }
+
+    while (sizeBytes)
+    {
+        NvU64 pageAddress = gpuAddress & ~(NvU64)(UVM_SIM_PAGE_SIZE - 1);
+        NvLength pageOffset = gpuAddress - pageAddress;
+        NvLength len = NV_MIN(UVM_SIM_PAGE_SIZE - pageOffset, sizeBytes);
+
+        if (pageOffset == 0 && len == UVM_SIM_PAGE_SIZE &&
+            ((uintptr_t)out % sizeof(NvU64)) == 0)
+        {
+            simFillSyntheticPage(gpuIndex, pageAddress, (NvU64 *)out);
+        }
+        else
+        {
+            NvU64 page[UVM_SIM_PAGE_SIZE / sizeof(NvU64)];
+            simFillSyntheticPage(gpuIndex, pageAddress, page);
+            memcpy(out, (char *)page + pageOffset, len);
+        }
+
+        out        += len;
+        gpuAddress += len;
+        sizeBytes  -= len;
+    }
+}
+
+static RM_STATUS uvmSimInitialize(void)
+{
+    if (g_uvmSim.initialized)
+        return RM_OK;
+
+    if (g_uvmSim.imageFile)
+    {
+        struct stat st;
+
+        g_uvmSim.imageFd = open(g_uvmSim.imageFile, O_RDONLY);
+        if (g_uvmSim.imageFd < 0)
+            return RM_ERR_INVALID_PATH;
+
+        // Without an explicit size the image defines the framebuffer.
+        if (g_uvmSim.config.fbSize == 0 && fstat(g_uvmSim.imageFd, &st) == 0)
+            g_uvmSim.config.fbSize = st.st_size;
+    }
+
+    g_uvmSim.initialized = 1;
+    return RM_OK;
+}
+
+static void simAsyncStop(void);
+
+static RM_STATUS uvmSimDeinitialize(void)
+{
+    // Outstanding async requests still read the image
+    simAsyncStop();
+
+    if (g_uvmSim.imageFd >= 0)
+        close(g_uvmSim.imageFd);
+    g_uvmSim.imageFd = -1;
+    g_uvmSim.initialized = 0;
+
+    // UVM_DUMP_RELEASE drops the cached channel managers
+    pthread_mutex_lock(&g_uvmSim.lock);
+    memset(g_uvmSim.channelReady, 0, sizeof(g_uvmSim.channelReady));
+    pthread_mutex_unlock(&g_uvmSim.lock);
+
+    return RM_OK;
+}
+
+// Stands in for the driver's own bounce pages in UvmDumpGpuMemoryToFd ranges
+static NvU8 g_simDriverBuffer;
+#define SIM_DRIVER_BUFFER ((void *)&g_simDriverBuffer)
+
+//
+// Applies the same argument checks as uvm_api_dump_gpu_memory, plus the
+// bounds check against the framebuffer size that the kernel cannot do.
+//
+static RM_STATUS simValidate(int gpuIndex, void *pOutput,
+                             unsigned long long baseAddress,
+                             NvLength sizeBytes)
+{
+    uintptr_t cpuAddress = (uintptr_t)pOutput;
+
+    if (!g_uvmSim.initialized || gpuIndex < 0)
+        return RM_ERROR;
+
+    if (pOutput == SIM_DRIVER_BUFFER)
+        cpuAddress = 0;
+
+    if (cpuAddress % UVM_SIM_PAGE_SIZE || baseAddress % UVM_SIM_PAGE_SIZE)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    if (cpuAddress + sizeBytes < cpuAddress)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    if (sizeBytes == 0)
+        return RM_OK;
+
+    // madvise fails with ENOMEM if any part of the range is unmapped.
+    if (pOutput != SIM_DRIVER_BUFFER && madvise(pOutput, sizeBytes, MADV_NORMAL))
+        return RM_ERR_INVALID_ADDRESS;
+
+    if (baseAddress + sizeBytes < baseAddress ||
+        baseAddress + sizeBytes > g_uvmSim.config.fbSize)
+        return RM_ERR_INVALID_ADDRESS;
+
+    return RM_OK;
+}
+
+//
+// Books one driver call covering rangeCount ranges.  Like the driver, all
+// ranges are checked before any is copied, the call pays latencyNs and the
+// channel setup once, and the pages of all ranges are packed into blocks.
+// Returns the argument check result; when that is RM_OK, *pEnd is when the
+// copy engine finishes the call (0 if there is nothing to copy) and *pResult
+// is the status the call completes with.
+//
+static RM_STATUS simBook(int gpuIndex,
+                         const UvmDumpRange *pRanges,
+                         unsigned int rangeCount,
+                         NvLength blockSizeHint,
+                         NvU32 flags,
+                         NvU64 *pEnd,
+                         RM_STATUS *pResult)
+{
+    const UvmSimConfig *config = &g_uvmSim.config;
+    NvLength blockSize = blockSizeHint;
+    NvLength totalBytes = 0;
+    RM_STATUS status = RM_OK;
+    NvU64 callNumber, blocks, pages = 0, runs = 0;
+    NvU64 duration, start, end;
+    unsigned int i;
+
+    *pEnd = 0;
+    *pResult = RM_OK;
+
+    if (flags & ~UVM_DUMP_FLAGS_ALL)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    for (i = 0; i < rangeCount; i++)
+    {
+        status = simValidate(gpuIndex, pRanges[i].pBuffer,
+                             pRanges[i].gpuOffset, pRanges[i].length);
+        if (status != RM_OK)
+            return status;
+
+        totalBytes += pRanges[i].length;
+        pages += (pRanges[i].length + UVM_SIM_PAGE_SIZE - 1) /
+                 UVM_SIM_PAGE_SIZE;
+    }
+
+    if (totalBytes == 0)
+        return RM_OK;
+
+    // Same rounding as _uvm_dump_block_size
+    if (blockSize == 0)
+        blockSize = UVM_SIM_DEFAULT_BLOCK_SIZE;
+    blockSize = NV_MIN(NV_MAX(blockSize, UVM_SIM_PAGE_SIZE),
+                       UVM_SIM_MAX_BLOCK_SIZE);
+    blockSize -= blockSize % UVM_SIM_PAGE_SIZE;
+    blocks = (pages * UVM_SIM_PAGE_SIZE + blockSize - 1) / blockSize;
+
+    // The driver's bounce pages are allocated one by one.
+    for (i = 0; config->runNs && i < rangeCount; i++)
+    {
+        NvU64 rangeRuns = 0;
+
+        if (pRanges[i].pBuffer != SIM_DRIVER_BUFFER &&
+            !(flags & UVM_DUMP_FLAG_NO_COALESCE))
+            rangeRuns = stagingPhysRuns(pRanges[i].pBuffer,
+                                        pRanges[i].length, blockSize);
+        if (rangeRuns == 0)
+            rangeRuns = (pRanges[i].length + UVM_SIM_PAGE_SIZE - 1) /
+                        UVM_SIM_PAGE_SIZE;
+        runs += rangeRuns;
+    }
+
+    duration = config->latencyNs + blocks * config->blockNs +
+               runs * config->runNs;
+    if (config->bytesPerSec)
+        duration += totalBytes * 1000000000ull / config->bytesPerSec;
+
+    pthread_mutex_lock(&g_uvmSim.lock);
+    callNumber = ++g_uvmSim.stats.calls;
+    g_uvmSim.stats.ranges += rangeCount;
+    g_uvmSim.stats.blocks += blocks;
+    g_uvmSim.stats.runs += runs;
+    g_uvmSim.stats.lastBlockSize = blockSize;
+    if (!g_uvmSim.channelReady[gpuIndex])
+    {
+        duration += config->setupNs;
+        g_uvmSim.channelReady[gpuIndex] = config->cacheChannels;
+        g_uvmSim.stats.setups++;
+    }
+    start = NV_MAX(simNowNs(), g_uvmSim.busyUntilNs[gpuIndex]);
+    end = start + duration;
+    g_uvmSim.busyUntilNs[gpuIndex] = end;
+
+    if (config->failEvery && callNumber % config->failEvery == 0)
+        status = config->failStatus;
+
+    for (i = 0; i < rangeCount && status == RM_OK; i++)
+    {
+        if (config->failLength &&
+            pRanges[i].gpuOffset < config->failAddress + config->failLength &&
+            config->failAddress < pRanges[i].gpuOffset + pRanges[i].length)
+            status = config->failStatus;
+    }
+
+    if (status != RM_OK)
+        g_uvmSim.stats.failures++;
+    else
+        g_uvmSim.stats.bytes += totalBytes;
+    pthread_mutex_unlock(&g_uvmSim.lock);
+
+    *pEnd = end;
+    *pResult = status;
+    return RM_OK;
+}
+
+static RM_STATUS simDumpRanges(UvmGpuUuid *pGpuUuidStruct,
+                               const UvmDumpRange *pRanges,
+                               unsigned int rangeCount,
+                               NvLength blockSizeHint,
+                               NvU32 flags)
+{
+    int gpuIndex = UvmSimGpuIndex(pGpuUuidStruct);
+    RM_STATUS status, result;
+    NvU64 end;
+    unsigned int i;
+
+    status = simBook(gpuIndex, pRanges, rangeCount, blockSizeHint, flags,
+                     &end, &result);
+    if (status != RM_OK)
+        return status;
+
+    for (i = 0; i < rangeCount && result == RM_OK; i++)
+        UvmSimFill(gpuIndex, pRanges[i].gpuOffset, pRanges[i].pBuffer,
+                   pRanges[i].length);
+
+    if (end)
+        simSleepUntilNs(end);
+
+    return result;
+}
+
+static RM_STATUS uvmSimDumpGpuMemory(UvmGpuUuid *pGpuUuidStruct,
+                                     void* pOutput,
+                                     unsigned long long baseAddress,
+                                     NvLength sizeBytes,
+                                     NvLength blockSizeHint,
+                                     NvU32 flags)
+{
+    UvmDumpRange range = { baseAddress, pOutput, sizeBytes };
+
+    return simDumpRanges(pGpuUuidStruct, &range, 1, blockSizeHint, flags);
+}
+
+static RM_STATUS uvmSimDumpGpuMemoryV(UvmGpuUuid *pGpuUuidStruct,
+                                      const UvmDumpRange *pRanges,
+                                      unsigned int rangeCount,
+                                      NvLength blockSizeHint,
+                                      NvU32 flags)
+{
+    if (rangeCount > UVM_DUMP_MAX_RANGES)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    return simDumpRanges(pGpuUuidStruct, pRanges, rangeCount,
+                         blockSizeHint, flags);
+}
+
+//
+// Like the driver, bounces the copy through a buffer of its own and writes
+// it to fd with positioned writes.  Only regular files opened for writing
+// are accepted.  Nothing is written if the copy fails.
+//
+static RM_STATUS uvmSimDumpGpuMemoryToFd(UvmGpuUuid *pGpuUuidStruct,
+                                         int fd,
+                                         unsigned long long fileOffset,
+                                         unsigned long long baseAddress,
+                                         NvLength sizeBytes,
+                                         NvLength blockSizeHint,
+                                         NvU32 flags,
+                                         NvLength *pBytesWritten)
+{
+    int gpuIndex = UvmSimGpuIndex(pGpuUuidStruct);
+    UvmDumpRange range = { baseAddress, SIM_DRIVER_BUFFER, sizeBytes };
+    NvLength bounceSize = NV_MIN(sizeBytes, UVM_SIM_MAX_BLOCK_SIZE);
+    NvLength done = 0;
+    void *bounce = NULL;
+    struct stat st;
+    RM_STATUS status, result;
+    NvU64 end;
+    int accMode;
+
+    *pBytesWritten = 0;
+
+    if (fileOffset + sizeBytes < fileOffset ||
+        (off_t)(fileOffset + sizeBytes) < 0)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    accMode = fcntl(fd, F_GETFL);
+    if (accMode == -1 || fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+        (accMode & O_ACCMODE) == O_RDONLY)
+        return RM_ERR_INVALID_ARGUMENT;
+
+    status = simBook(gpuIndex, &range, 1, blockSizeHint, flags, &end, &result);
+    if (status != RM_OK)
+        return status;
+
+    if (result == RM_OK && sizeBytes &&
+        posix_memalign(&bounce, UVM_SIM_PAGE_SIZE, bounceSize))
+        result = RM_ERR_NO_MEMORY;
+
+    while (result == RM_OK && done < sizeBytes)
+    {
+        NvLength chunk = NV_MIN(sizeBytes - done, bounceSize);
+        NvLength off = 0;
+
+        UvmSimFill(gpuIndex, baseAddress + done, bounce, chunk);
+        while (off < chunk)
+        {
+            ssize_t ret = pwrite(fd, (NvU8 *)bounce + off, chunk - off,
+                                 fileOffset + done + off);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+            {
+                result = RM_ERROR;
+                break;
+            }
+            off += ret;
+        }
+        done += off;
+    }
+
+    free(bounce);
+
+    if (end)
+        simSleepUntilNs(end);
+
+    *pBytesWritten = done;
+    return result;
+}
+
+//
+// Completes async requests in order of their end time, filling each buffer
+// once the copy engine would have finished it.  Exits when asked to stop and
+// nothing is left pending.
+//
+static void *simAsyncThread(void *arg)
+{
+    pthread_mutex_lock(&g_uvmSim.lock);
+    for (;;)
+    {
+        UvmSimAsync *req = g_uvmSim.asyncPending;
+        struct timespec ts;
+
+        if (!req)
+        {
+            if (g_uvmSim.asyncStop)
+                break;
+            pthread_cond_wait(&g_uvmSim.asyncCond, &g_uvmSim.lock);
+            continue;
+        }
+
+        if (simNowNs() < req->endNs)
+        {
+            ts.tv_sec  = req->endNs / 1000000000ull;
+            ts.tv_nsec = req->endNs % 1000000000ull;
+            pthread_cond_timedwait(&g_uvmSim.asyncCond, &g_uvmSim.lock, &ts);
+            continue;
+        }
+
+        g_uvmSim.asyncPending = req->next;
+        pthread_mutex_unlock(&g_uvmSim.lock);
+
+        if (req->status == RM_OK)
+            UvmSimFill(req->gpuIndex, req->range.gpuOffset,
+                       req->range.pBuffer, req->range.length);
+        req->done(req->ctx, req->status);
+        free(req);
+
+        pthread_mutex_lock(&g_uvmSim.lock);
+    }
+    pthread_mutex_unlock(&g_uvmSim.lock);
+
+    return NULL;
+}
+
+// Starts the completion thread if needed; called with g_uvmSim.lock held.
+static RM_STATUS simAsyncStartLocked(void)
+{
+    if (!g_uvmSim.asyncCondReady)
+    {
+        pthread_condattr_t attr;
+
+        // Timed waits are against simNowNs()
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&g_uvmSim.asyncCond, &attr);
+        pthread_condattr_destroy(&attr);
+        g_uvmSim.asyncCondReady = 1;
+    }
+
+    if (g_uvmSim.asyncRunning)
+        return RM_OK;
+
+    g_uvmSim.asyncStop = 0;
+    if (pthread_create(&g_uvmSim.asyncThread, NULL, simAsyncThread, NULL))
+        return RM_ERROR;
+
+    g_uvmSim.asyncRunning = 1;
+    return RM_OK;
+}
+
+// Waits for the pending async requests and stops the completion thread.
+static void simAsyncStop(void)
+{
+    int running;
+
+    pthread_mutex_lock(&g_uvmSim.lock);
+    running = g_uvmSim.asyncRunning;
+    if (running)
+    {
+        g_uvmSim.asyncStop = 1;
+        pthread_cond_signal(&g_uvmSim.asyncCond);
+    }
+    pthread_mutex_unlock(&g_uvmSim.lock);
+
+    if (!running)
+        return;
+
+    pthread_join(g_uvmSim.asyncThread, NULL);
+
+    pthread_mutex_lock(&g_uvmSim.lock);
+    g_uvmSim.asyncRunning = 0;
+    g_uvmSim.asyncStop = 0;
+    pthread_mutex_unlock(&g_uvmSim.lock);
+}
+
+static RM_STATUS uvmSimDumpGpuMemoryAsync(UvmGpuUuid *pGpuUuidStruct,
+                                          void* pOutput,
+                                          unsigned long long baseAddress,
+                                          NvLength sizeBytes,
+                                          NvLength blockSizeHint,
+                                          NvU32 flags,
+                                          UvmDumpDoneFunc done,
+                                          void *ctx)
+{
+    UvmSimAsync *req, **link;
+    RM_STATUS status;
+
+    req = calloc(1, sizeof(*req));
+    if (!req)
+        return RM_ERR_NO_MEMORY;
+
+    req->gpuIndex = UvmSimGpuIndex(pGpuUuidStruct);
+    req->range.gpuOffset = baseAddress;
+    req->range.pBuffer = pOutput;
+    req->range.length = sizeBytes;
+    req->done = done;
+    req->ctx = ctx;
+
+    pthread_mutex_lock(&g_uvmSim.lock);
+    status = simAsyncStartLocked();
+    pthread_mutex_unlock(&g_uvmSim.lock);
+    if (status != RM_OK)
+        goto fail;
+
+    status = simBook(req->gpuIndex, &req->range, 1, blockSizeHint, flags,
+                     &req->endNs, &req->status);
+    if (status != RM_OK)
+        goto fail;
+
+    // Keep the list sorted; requests ending at the same time stay in order.
+    pthread_mutex_lock(&g_uvmSim.lock);
+    for (link = &g_uvmSim.asyncPending; *link; link = &(*link)->next)
+    {
+        if ((*link)->endNs > req->endNs)
+            break;
+    }
+    req->next = *link;
+    *link = req;
+    if (g_uvmSim.asyncPending == req)
+        pthread_cond_signal(&g_uvmSim.asyncCond);
+    pthread_mutex_unlock(&g_uvmSim.lock);
+
+    return RM_OK;
+
+fail:
+    free(req);
+    return status;
+}
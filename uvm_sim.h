@@ -0,0 +1,148 @@
+/*******************************************************************************
+    Copyright (c) 2013 NVidia Corporation
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to
+    deal in the Software without restriction, including without limitation the
+    rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+    sell copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+        The above copyright notice and this permission notice shall be
+        included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+*******************************************************************************/
+
+
+#ifndef _UVM_SIM_H_
+#define _UVM_SIM_H_
+
+#include <stddef.h>
+
+#include "uvmtypes.h"
+#include "uvm_backend.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*******************************************************************************
+    Simulated GPU backend
+
+    Serves "framebuffer" contents from an image file or from a deterministic
+    synthetic generator, so that dump_fb and dump_fb_test can run on machines
+    without the patched driver.  Each simulated GPU owns a copy engine that
+    handles one request at a time; a request occupies it for
+    latencyNs + sizeBytes / bytesPerSec, and the calling thread sleeps until
+    its request completes.  The driver pins and copies a request blockSize
+    bytes at a time (the UvmDumpGpuMemoryEx hint, rounded like the driver
+    does), and each block adds blockNs.  runNs is the cost of every copy the
+    driver pushes: one per run of physically contiguous output pages within
+    a block (see staging.h), or one per page with UVM_DUMP_FLAG_NO_COALESCE or
+    when the physical addresses cannot be read.  setupNs models creating the GPU's channel
+    manager: with cacheChannels set it is paid by the first request after
+    UvmInitialize, like the patched driver does, otherwise by every request.
+    A UvmDumpGpuMemoryV batch is a single request covering all its ranges.
+    Requests submitted through a UvmDumpQueue (uvm_async.h) are booked on the
+    copy engine the same way, but the caller does not sleep: a completion
+    thread fills each one's buffer and completes it when its time is up.
+
+    Synthetic contents are built page by page: a page is all zero, filled with
+    a repeated 32-bit value, or filled with pseudo-random words, in the
+    proportions given by zeroPercent and constPercent.  With regionSize set,
+    the kind is chosen once per aligned region of that size instead, which
+    gives the long zero and data runs of a real framebuffer.  The same (seed, GPU,
+    address) always produces the same bytes, see UvmSimFill.
+*/
+
+#define UVM_SIM_MAX_GPUS   16
+#define UVM_SIM_PAGE_SIZE  4096
+
+// Block size limits of the patched driver
+#define UVM_SIM_DEFAULT_BLOCK_SIZE  (128*1024)
+#define UVM_SIM_MAX_BLOCK_SIZE      (16*1024*1024)
+
+typedef struct
+{
+    unsigned int       numGpus;        // simulated GPUs, 1..UVM_SIM_MAX_GPUS
+    NvLength           fbSize;         // bytes of memory per GPU
+    const char        *imageFile;      // serve contents from this file if set
+    NvU64              seed;           // synthetic generator seed
+    unsigned int       zeroPercent;    // share of synthetic pages that are 0
+    unsigned int       constPercent;   // share of constant-filled pages
+    NvLength           regionSize;     // pages of one region share a kind
+
+    NvU64              latencyNs;      // fixed cost of every call
+    NvU64              bytesPerSec;    // copy engine bandwidth, 0 = unlimited
+    NvU64              blockNs;        // per block pin and submit cost
+    NvU64              runNs;          // per physically contiguous copy
+    NvU64              setupNs;        // channel manager creation cost
+    int                cacheChannels;  // keep channel managers between calls
+
+    NvU64              failEvery;      // fail every Nth call, 0 = never
+    unsigned long long failAddress;    // fail calls touching this range...
+    NvLength           failLength;     // ...when failLength != 0
+    RM_STATUS          failStatus;     // status returned by injected failures
+} UvmSimConfig;
+
+typedef struct
+{
+    NvU64    calls;
+    NvU64    failures;
+    NvU64    setups;       // channel managers created
+    NvU64    ranges;       // ranges copied, calls can have several
+    NvU64    blocks;       // blocks copied
+    NvU64    runs;         // copies pushed, counted when runNs is set
+    NvLength lastBlockSize;
+    NvLength bytes;
+} UvmSimStats;
+
+void UvmSimConfigInit(UvmSimConfig *config);
+
+//
+// Parses a comma separated list of key=value pairs into config, e.g.
+// "size=1G,zero=90,bandwidth=4G,latency-us=20,block-us=5,setup-us=500".  Sizes take K/M/G suffixes.
+// Returns 0 on success, -1 (after printing an error) otherwise.
+//
+int UvmSimParseSpec(const char *spec, UvmSimConfig *config);
+
+//
+// Installs the simulated backend with the given configuration.  Call before
+// UvmInitialize; UvmSimDisable restores the ioctl backend.
+//
+void UvmSimEnable(const UvmSimConfig *config);
+void UvmSimDisable(void);
+
+int UvmSimIsEnabled(void);
+
+const UvmSimConfig *UvmSimGetConfig(void);
+
+void UvmSimGetStats(UvmSimStats *stats);
+
+// UUID of simulated GPU index, as raw bytes or in nvml "GPU-..." form.
+void UvmSimGetGpuUuid(unsigned int index, UvmGpuUuid *uuid);
+void UvmSimGetGpuUuidString(unsigned int index, char *buf, size_t bufSize);
+
+// Returns the simulated GPU index for uuid, or -1 if it isn't one.
+int UvmSimGpuIndex(const UvmGpuUuid *uuid);
+
+//
+// Fills buf with the bytes simulated GPU gpuIndex holds at
+// [gpuAddress, gpuAddress+sizeBytes).  Any alignment is accepted; this is what
+// tests compare dumps against.
+//
+void UvmSimFill(unsigned int gpuIndex, unsigned long long gpuAddress,
+                void *buf, NvLength sizeBytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
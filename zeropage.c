@@ -0,0 +1,193 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+
+#include "zeropage.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define ZEROPAGE_HAVE_X86 1
+#endif
+
+//
+// Every scanner looks at 128 bytes per step and returns at the first
+// non-zero step, so pages with data are usually rejected after a few
+// cache lines and only zero pages are read in full.
+//
+static int isZeroScalar(const void *buf, NvLength len) {
+    const NvU64 *p = buf;
+    const NvU64 *end = p + len / sizeof(NvU64);
+
+    for (; p < end; p += 16) {
+        if (p[0] | p[1] | p[2]  | p[3]  | p[4]  | p[5]  | p[6]  | p[7] |
+            p[8] | p[9] | p[10] | p[11] | p[12] | p[13] | p[14] | p[15])
+            return 0;
+    }
+
+    return 1;
+}
+
+#ifdef ZEROPAGE_HAVE_X86
+
+__attribute__((target("sse2")))
+static int isZeroSse2(const void *buf, NvLength len) {
+    const __m128i *p = buf;
+    const __m128i *end = p + len / sizeof(__m128i);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; p < end; p += 8) {
+        __m128i x = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p),
+                                      _mm_loadu_si128(p + 1)),
+                         _mm_or_si128(_mm_loadu_si128(p + 2),
+                                      _mm_loadu_si128(p + 3))),
+            _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p + 4),
+                                      _mm_loadu_si128(p + 5)),
+                         _mm_or_si128(_mm_loadu_si128(p + 6),
+                                      _mm_loadu_si128(p + 7))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xFFFF)
+            return 0;
+    }
+
+    return 1;
+}
+
+__attribute__((target("avx2")))
+static int isZeroAvx2(const void *buf, NvLength len) {
+    const __m256i *p = buf;
+    const __m256i *end = p + len / sizeof(__m256i);
+
+    for (; p < end; p += 4) {
+        __m256i x = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)),
+            _mm256_or_si256(_mm256_loadu_si256(p + 2),
+                            _mm256_loadu_si256(p + 3)));
+        if (!_mm256_testz_si256(x, x))
+            return 0;
+    }
+
+    return 1;
+}
+
+static int cpuHasAvx2(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    // AVX2 also needs the OS to save the YMM registers.
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+        !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return 0;
+
+    __asm__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    if ((eax & 6) != 6)
+        return 0;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return 0;
+
+    return (ebx & bit_AVX2) != 0;
+}
+
+#endif
+
+typedef int (*IsZeroFunc)(const void *buf, NvLength len);
+
+static IsZeroFunc isZero;
+
+static IsZeroFunc getIsZero(void) {
+    IsZeroFunc func = __atomic_load_n(&isZero, __ATOMIC_RELAXED);
+
+    if (!func) {
+        func = isZeroScalar;
+#ifdef ZEROPAGE_HAVE_X86
+        func = cpuHasAvx2() ? isZeroAvx2 : isZeroSse2;
+#endif
+        __atomic_store_n(&isZero, func, __ATOMIC_RELAXED);
+    }
+
+    return func;
+}
+
+int zeroPageSetImplementation(ZeroScanImpl impl) {
+    IsZeroFunc func = NULL;
+
+    switch (impl) {
+        case ZERO_SCAN_AUTO:
+            break;
+        case ZERO_SCAN_SCALAR:
+            func = isZeroScalar;
+            break;
+#ifdef ZEROPAGE_HAVE_X86
+        case ZERO_SCAN_SSE2:
+            func = isZeroSse2;
+            break;
+        case ZERO_SCAN_AVX2:
+            if (!cpuHasAvx2())
+                return -1;
+            func = isZeroAvx2;
+            break;
+#endif
+        default:
+            return -1;
+    }
+
+    __atomic_store_n(&isZero, func, __ATOMIC_RELAXED);
+    return 0;
+}
+
+const char *zeroPageImplementation(void) {
+    IsZeroFunc func = getIsZero();
+
+#ifdef ZEROPAGE_HAVE_X86
+    if (func == isZeroAvx2)
+        return "avx2";
+    if (func == isZeroSse2)
+        return "sse2";
+#endif
+    return func == isZeroScalar ? "scalar" : "unknown";
+}
+
+int zeroPageIsZero(const void *buf, NvLength len) {
+    return getIsZero()(buf, len);
+}
+
+NvU64 zeroPageScan(const void *buf, NvLength len, NvLength pageSize,
+                   NvU64 *bitmap, NvU64 firstBit) {
+    IsZeroFunc func = getIsZero();
+    const char *p = buf;
+    NvU64 pages = len / pageSize, zero = 0, i;
+
+    for (i = 0; i < pages; i++) {
+        NvU64 bit = firstBit + i;
+        int z = func(p + i * pageSize, pageSize);
+
+        zero += z;
+        if (!bitmap)
+            continue;
+        if (z)
+            bitmap[bit / 64] |= 1ull << (bit % 64);
+        else
+            bitmap[bit / 64] &= ~(1ull << (bit % 64));
+    }
+
+    return zero;
+}
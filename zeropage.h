@@ -0,0 +1,66 @@
+/////////////////////////////////////////////////////////////////////////////////
+//   Copyright (c) 2014 NVidia Corporation
+//
+//   Permission is hereby granted, free of charge, to any person obtaining a copy
+//   of this software and associated documentation files (the "Software"), to
+//   deal in the Software without restriction, including without limitation the
+//   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//   sell copies of the Software, and to permit persons to whom the Software is
+//   furnished to do so, subject to the following conditions:
+//
+//       The above copyright notice and this permission notice shall be
+//       included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//   DEALINGS IN THE SOFTWARE.
+//
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _ZEROPAGE_H_
+#define _ZEROPAGE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uvmtypes.h"
+
+typedef enum {
+    ZERO_SCAN_AUTO = 0,  // the fastest one the CPU supports
+    ZERO_SCAN_SCALAR,
+    ZERO_SCAN_SSE2,
+    ZERO_SCAN_AVX2,
+} ZeroScanImpl;
+
+//
+// Checks the len/pageSize pages of buf (len must be a multiple of pageSize,
+// and pageSize of 128) and sets bit firstBit+i of bitmap for every page i that
+// is all zero; bits of non-zero pages are cleared.  bitmap may be NULL.
+// Returns the number of zero pages.
+//
+NvU64 zeroPageScan(const void *buf, NvLength len, NvLength pageSize,
+                   NvU64 *bitmap, NvU64 firstBit);
+
+// Returns non-zero if all len bytes of buf (a multiple of 128) are zero.
+int zeroPageIsZero(const void *buf, NvLength len);
+
+//
+// Selects the scanner, for testing and benchmarking.  Returns -1 if the CPU
+// does not support impl.
+//
+int zeroPageSetImplementation(ZeroScanImpl impl);
+const char *zeroPageImplementation(void);
+
+static __inline__ int zeroPageBitmapTest(const NvU64 *bitmap, NvU64 bit) {
+    return (bitmap[bit / 64] >> (bit % 64)) & 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif